@@ -0,0 +1,208 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "ChannelWriter.h"
+#include "FrameScheduler.h"
+#include "LatencyHistogram.h"
+#include "Platform.h"
+
+// Measures how long a control message takes from ChannelWriter::Send until
+// the receiver has read it while a video stream keeps the connection busy,
+// every 60th frame four times the size of the others. With a link rate the
+// receiver reads no faster than that and keeps its receive buffer about one
+// bandwidth-delay product deep, so the stream backs up in the sender like on
+// a saturated network link. The latency then includes the bytes already in
+// that buffer, which nothing on the sender can overtake.
+// Command line is "[seconds] [video Mbit/s] [link Mbit/s, 0 for loopback speed]"
+
+constexpr uint32_t CHANNEL_BENCHMARK_FPS = 60;
+constexpr uint32_t CHANNEL_BENCHMARK_KEYFRAME_INTERVAL = 60;
+constexpr uint32_t CHANNEL_BENCHMARK_KEYFRAME_SCALE = 4;
+constexpr uint32_t CHANNEL_BENCHMARK_CONTROL_INTERVAL_US = 2000;
+constexpr uint32_t CHANNEL_BENCHMARK_RECEIVE_BUFFER = 16u * 1024u;
+// Latency the control channel is meant to stay under
+constexpr uint64_t CHANNEL_BENCHMARK_TARGET_NS = 1000000;
+
+struct Receiver {
+	SocketHandle socket;
+	// 0 to read as fast as the loopback interface delivers
+	uint64_t link_bps;
+	// Written by the receiving thread
+	LatencyHistogram control_latency;
+	std::atomic<uint64_t> video_bytes;
+	std::atomic<uint64_t> video_messages;
+	std::atomic<bool> failed;
+};
+
+// Reads chunks no faster than the link rate and records the latency of every
+// control message, which carries the time it was handed to the writer
+static void ReceiveLoop(Receiver *receiver) {
+	static uint8_t payload[MAX_CHUNK_PAYLOAD];
+	uint8_t control_message[MAX_CONTROL_MESSAGE_SIZE];
+	uint32_t control_size = 0;
+	uint64_t start_ns = PlatformTimestampNs();
+	uint64_t received_bytes = 0;
+	while(true) {
+		ChunkHeader header;
+		if(!NetRecvAll(receiver->socket, &header, sizeof(header)) ||
+		   !NetRecvAll(receiver->socket, payload, header.size)) {
+			break;
+		}
+		uint64_t now_ns = PlatformTimestampNs();
+
+		if(header.channel == Channel::Control) {
+			if(control_size + header.size > MAX_CONTROL_MESSAGE_SIZE) {
+				receiver->failed.store(true, std::memory_order_relaxed);
+				break;
+			}
+			memcpy(control_message + control_size, payload, header.size);
+			control_size += header.size;
+			if(header.flags & CHUNK_FLAG_END) {
+				uint64_t sent_ns;
+				memcpy(&sent_ns, control_message, sizeof(sent_ns));
+				receiver->control_latency.Record(now_ns - sent_ns);
+				control_size = 0;
+			}
+		}
+		else {
+			receiver->video_bytes.fetch_add(header.size, std::memory_order_relaxed);
+			if(header.flags & CHUNK_FLAG_END) {
+				receiver->video_messages.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		// Hold back until the link would have carried what was read so far
+		received_bytes += sizeof(header) + header.size;
+		if(receiver->link_bps != 0) {
+			uint64_t due_ns = start_ns + received_bytes * 8 * 1000000000 / receiver->link_bps;
+			while(PlatformTimestampNs() < due_ns) {
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t seconds = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 5;
+	uint64_t video_bps = (argc > 2 ? strtoull(argv[2], nullptr, 10) : 50) * 1000000;
+	uint64_t link_bps = (argc > 3 ? strtoull(argv[3], nullptr, 10) : 0) * 1000000;
+	if(video_bps == 0) {
+		printf("Usage: %s [seconds] [video Mbit/s] [link Mbit/s, 0 for loopback speed]\n", argv[0]);
+		return 1;
+	}
+
+	bool startup_result = NetStartup();
+	if(!startup_result) {
+		printf("Failed to initialize networking\n");
+		return 1;
+	}
+	SocketHandle listen_socket = NetListen("0");
+	char port[8];
+	snprintf(port, sizeof(port), "%u", NetLocalPort(listen_socket));
+	SocketHandle receive_socket = NetConnect("127.0.0.1", port);
+	if(link_bps != 0) {
+		NetSetReceiveBufferSize(receive_socket, CHANNEL_BENCHMARK_RECEIVE_BUFFER);
+	}
+	char address[NET_ADDRESS_SIZE];
+	SocketHandle send_socket = NetAccept(listen_socket, address, sizeof(address));
+	NetClose(listen_socket);
+	NetSetNoDelay(send_socket, true);
+
+	ChannelWriter writer {};
+	writer.Initialize(send_socket);
+	Receiver receiver {};
+	receiver.socket = receive_socket;
+	receiver.link_bps = link_bps;
+	std::thread receive_thread(ReceiveLoop, &receiver);
+
+	// Average frame size matches the video bitrate, keyframes included
+	uint32_t frames_per_interval = CHANNEL_BENCHMARK_KEYFRAME_INTERVAL - 1 + CHANNEL_BENCHMARK_KEYFRAME_SCALE;
+	uint32_t frame_size = static_cast<uint32_t>(video_bps / 8 * CHANNEL_BENCHMARK_KEYFRAME_INTERVAL /
+												CHANNEL_BENCHMARK_FPS / frames_per_interval);
+	uint32_t keyframe_size = frame_size * CHANNEL_BENCHMARK_KEYFRAME_SCALE;
+	uint8_t *frame = static_cast<uint8_t *>(PlatformAllocate(keyframe_size));
+	memset(frame, 0xAB, keyframe_size);
+
+	std::atomic<bool> running { true };
+	std::thread video_thread([&] {
+		FrameScheduler scheduler {};
+		scheduler.Initialize(CHANNEL_BENCHMARK_FPS);
+		for(uint32_t i = 0; running.load(std::memory_order_relaxed); ++i) {
+			scheduler.WaitForNextFrame();
+			NetBuffer buffer {
+				.ptr = frame,
+				.size = i % CHANNEL_BENCHMARK_KEYFRAME_INTERVAL == 0 ? keyframe_size : frame_size
+			};
+			if(!writer.Send(Channel::Video, &buffer, 1)) {
+				break;
+			}
+		}
+		scheduler.Shutdown();
+	});
+
+	LatencyReport report {};
+	report.Initialize(nullptr);
+	report.Add("control", &receiver.control_latency);
+
+	printf("Control messages every %u us over %llu Mbit/s of video, %u byte frames and %u byte keyframes\n",
+		   CHANNEL_BENCHMARK_CONTROL_INTERVAL_US, static_cast<unsigned long long>(video_bps / 1000000), frame_size,
+		   keyframe_size);
+	if(link_bps != 0) {
+		printf("Link emulated at %llu Mbit/s\n", static_cast<unsigned long long>(link_bps / 1000000));
+	}
+	uint64_t start = PlatformTimestamp();
+	uint64_t report_timestamp = start;
+	uint64_t report_bytes = 0;
+	uint64_t max_p99_ns = 0;
+	// The first second has the connection warming up
+	bool warm = false;
+	while(PlatformTimestamp() - start < seconds * 1000000ull) {
+		std::this_thread::sleep_for(std::chrono::microseconds(CHANNEL_BENCHMARK_CONTROL_INTERVAL_US));
+		uint64_t sent_ns = PlatformTimestampNs();
+		NetBuffer buffer { .ptr = &sent_ns, .size = sizeof(sent_ns) };
+		if(!writer.Send(Channel::Control, &buffer, 1)) {
+			break;
+		}
+
+		uint64_t now = PlatformTimestamp();
+		if(now - report_timestamp >= 1000000) {
+			uint64_t bytes = receiver.video_bytes.load(std::memory_order_relaxed);
+			LatencySummary latency = report.Summarize(0);
+			printf("Video %.1f Mbit/s, control latency n %llu, p50 %.1f us, p99 %.1f us, max %.1f us, "
+				   "%llu preemptions\n", (bytes - report_bytes) * 8.0 / (now - report_timestamp),
+				   static_cast<unsigned long long>(latency.count), latency.p50_ns / 1000.0,
+				   latency.p99_ns / 1000.0, latency.max_ns / 1000.0,
+				   static_cast<unsigned long long>(writer.stats.preemptions.exchange(0, std::memory_order_relaxed)));
+			if(warm) {
+				max_p99_ns = latency.p99_ns > max_p99_ns ? latency.p99_ns : max_p99_ns;
+			}
+			warm = true;
+			report_timestamp = now;
+			report_bytes = bytes;
+		}
+	}
+
+	running.store(false, std::memory_order_relaxed);
+	video_thread.join();
+	NetDisconnect(send_socket);
+	receive_thread.join();
+	NetClose(send_socket);
+	NetClose(receive_socket);
+	report.Shutdown();
+	PlatformFree(frame, keyframe_size);
+
+	bool failed = receiver.failed.load(std::memory_order_relaxed);
+	if(failed) {
+		printf("Received a control message larger than %u bytes\n", MAX_CONTROL_MESSAGE_SIZE);
+	}
+	if(max_p99_ns >= CHANNEL_BENCHMARK_TARGET_NS) {
+		printf("Control latency p99 reached %.1f us, above the %.1f us target\n", max_p99_ns / 1000.0,
+			   CHANNEL_BENCHMARK_TARGET_NS / 1000.0);
+		failed = true;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "ColorConvert.h"
+#include "WorkerPool.h"
+
+// Time per frame of BGRA to NV12, BGRA to I420 and NV12 to BGRA at 1080p and
+// 4K with every kernel the CPU supports, on the calling thread alone and on a
+// pool of every hardware thread
+
+constexpr ColorKernel COLOR_KERNELS[] = { ColorKernel::Scalar, ColorKernel::Sse41, ColorKernel::Avx2,
+										  ColorKernel::Neon };
+constexpr uint32_t COLOR_RESOLUTIONS[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+// Frames converted per measurement at 1080p, fewer at 4K
+constexpr uint32_t COLOR_ITERATIONS = 60;
+
+static double Seconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main() {
+	ColorInitialize();
+	WorkerPool pool {};
+	pool.Initialize(0);
+	printf("Default kernel %s, pool of %u threads\n", ColorKernelName(ColorSelectedKernel()), pool.thread_count + 1);
+
+	std::mt19937 rng(1);
+	for(const uint32_t *resolution : COLOR_RESOLUTIONS) {
+		uint32_t width = resolution[0];
+		uint32_t height = resolution[1];
+		uint32_t iterations = COLOR_ITERATIONS * 1920 / width;
+		std::vector<uint32_t> bgra(width * height);
+		for(uint32_t &pixel : bgra) {
+			pixel = rng();
+		}
+		// U is big enough for the interleaved UV plane of NV12
+		std::vector<uint8_t> y(width * height), u(width * height / 2), v(width * height / 4);
+		for(bool nv12 : { true, false }) {
+			printf("%ux%u to %s\n", width, height, nv12 ? "NV12" : "I420");
+			for(ColorKernel kernel : COLOR_KERNELS) {
+				if(!ColorSelectKernel(kernel)) {
+					continue;
+				}
+				printf("  %-7s", ColorKernelName(kernel));
+				for(WorkerPool *threads : { static_cast<WorkerPool *>(nullptr), &pool }) {
+					double start = Seconds();
+					for(uint32_t i = 0; i < iterations; ++i) {
+						if(nv12) {
+							ConvertBgraToNv12(bgra.data(), width, width, height, ColorMatrix::Bt709, ColorRange::Limited,
+											  y.data(), width, u.data(), width, threads);
+						}
+						else {
+							ConvertBgraToI420(bgra.data(), width, width, height, ColorMatrix::Bt709, ColorRange::Limited,
+											  y.data(), width, u.data(), width / 2, v.data(), width / 2, threads);
+						}
+					}
+					double ms = (Seconds() - start) * 1e3 / iterations;
+					printf("  %s %6.2f ms (%5.0f MB/s of BGRA)", threads ? "pool" : "inline", ms,
+						   width * height * 4.0 / ms / 1e3);
+				}
+				printf("\n");
+			}
+		}
+
+		// The way back, from the NV12 just converted
+		ConvertBgraToNv12(bgra.data(), width, width, height, ColorMatrix::Bt709, ColorRange::Limited, y.data(), width,
+						  u.data(), width, nullptr);
+		printf("%ux%u NV12 to BGRA\n", width, height);
+		for(ColorKernel kernel : COLOR_KERNELS) {
+			if(!ColorSelectKernel(kernel)) {
+				continue;
+			}
+			printf("  %-7s", ColorKernelName(kernel));
+			for(WorkerPool *threads : { static_cast<WorkerPool *>(nullptr), &pool }) {
+				double start = Seconds();
+				for(uint32_t i = 0; i < iterations; ++i) {
+					ConvertNv12ToBgra(y.data(), width, u.data(), width, width, height, ColorMatrix::Bt709,
+									  ColorRange::Limited, bgra.data(), width, threads);
+				}
+				double ms = (Seconds() - start) * 1e3 / iterations;
+				printf("  %s %6.2f ms (%5.0f MB/s of BGRA)", threads ? "pool" : "inline", ms,
+					   width * height * 4.0 / ms / 1e3);
+			}
+			printf("\n");
+		}
+	}
+	pool.Shutdown();
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "CursorBlend.h"
+#include "CursorShape.h"
+
+// Time per cursor blend with every kernel the CPU supports, and for hashing,
+// compressing and decompressing a shape, at cursor sizes from 32x32 up to
+// MAX_CURSOR_DIMENSION
+
+constexpr BlendKernel BLEND_KERNELS[] = { BlendKernel::Scalar, BlendKernel::Sse2, BlendKernel::Avx2 };
+constexpr uint32_t CURSOR_SIZES[] = { 32, 64, 128, 256 };
+
+static double Seconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void BenchmarkBlend(const char *name, const std::vector<uint32_t> &src, std::vector<uint32_t> *dst,
+						   uint32_t size) {
+	printf("%-16s", name);
+	uint32_t iterations = 40000000 / (size * size) + 10;
+	for(BlendKernel kernel : BLEND_KERNELS) {
+		if(!BlendSelectKernel(kernel)) {
+			continue;
+		}
+		double start = Seconds();
+		for(uint32_t i = 0; i < iterations; ++i) {
+			BlendImage(dst->data(), size, src.data(), size, size, size);
+		}
+		double ns = (Seconds() - start) * 1e9 / iterations;
+		printf("  %s %8.0f ns (%.2f px/ns)", BlendKernelName(kernel), ns, size * size / ns);
+	}
+	printf("\n");
+}
+
+int main() {
+	BlendInitialize();
+	printf("Blend, default kernel %s\n", BlendKernelName(BlendSelectedKernel()));
+	for(uint32_t size : CURSOR_SIZES) {
+		// A typical shape: mostly transparent, a solid body and an antialiased edge
+		std::vector<uint32_t> src(size * size), dst(size * size);
+		uint32_t state = 1;
+		for(uint32_t y = 0; y < size; ++y) {
+			for(uint32_t x = 0; x < size; ++x) {
+				float dx = x - size / 2.0f;
+				float dy = y - size / 2.0f;
+				float coverage = size / 3.0f - sqrtf(dx * dx + dy * dy);
+				coverage = coverage < 0.0f ? 0.0f : coverage > 1.0f ? 1.0f : coverage;
+				src[y * size + x] = static_cast<uint32_t>(coverage * 255) << 24 | 0x204080;
+				state = state * 1664525u + 1013904223u;
+				dst[y * size + x] = state | 0xFF000000;
+			}
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "%ux%u", size, size);
+		BenchmarkBlend(name, src, &dst, size);
+	}
+	// Nothing transparent to skip
+	std::vector<uint32_t> src(256 * 256, 0x80204080), dst(256 * 256, 0xFF112233);
+	BenchmarkBlend("256x256 alpha/2", src, &dst, 256);
+
+	printf("\nShape hash, compress and decompress\n");
+	for(uint32_t size : CURSOR_SIZES) {
+		// An arrow, black outline around white
+		std::vector<uint32_t> shape(size * size), decoded(size * size);
+		for(uint32_t y = 0; y < size; ++y) {
+			for(uint32_t x = 0; x < size; ++x) {
+				uint32_t edge = y / 2 + 1;
+				uint32_t pixel = 0;
+				if(x <= edge && y < size * 3 / 4) {
+					pixel = x == 0 || x == edge ? 0xFF000000 : 0xFFFFFFFF;
+				}
+				shape[y * size + x] = pixel;
+			}
+		}
+		std::vector<uint8_t> data(CursorCompressBound(size * size));
+		uint32_t iterations = 2000000 / (size * size) + 10;
+
+		double start = Seconds();
+		uint64_t hash = 0;
+		for(uint32_t i = 0; i < iterations; ++i) {
+			hash += CursorShapeHash(shape.data(), size, size, 0, 0);
+		}
+		double hashed = Seconds();
+		uint32_t bytes = 0;
+		for(uint32_t i = 0; i < iterations; ++i) {
+			bytes = CursorCompress(shape.data(), size * size, data.data());
+		}
+		double compressed = Seconds();
+		bool decoded_all = true;
+		for(uint32_t i = 0; i < iterations; ++i) {
+			decoded_all &= CursorDecompress(data.data(), bytes, decoded.data(), size * size);
+		}
+		double decompressed = Seconds();
+
+		printf("%3ux%-3u %6u -> %5u bytes (%.1fx), hash %.1f us, compress %.1f us, decompress %.1f us%s\n", size,
+			   size, size * size * 4, bytes, size * size * 4.0 / bytes, (hashed - start) * 1e6 / iterations,
+			   (compressed - hashed) * 1e6 / iterations, (decompressed - compressed) * 1e6 / iterations,
+			   decoded_all && hash != 0 ? "" : ", failed to decode");
+	}
+	return 0;
+}
@@ -0,0 +1,179 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "DamageTracker.h"
+
+// Feeds the damage tracker rect traces of typical desktop activity at
+// 1920x1080 and reports the time per frame, how many rects it merges the
+// damage into and how much area the merging adds over the exact union
+
+constexpr uint32_t DAMAGE_WIDTH = 1920;
+constexpr uint32_t DAMAGE_HEIGHT = 1080;
+constexpr uint32_t DAMAGE_TRACE_FRAMES = 3000;
+constexpr uint32_t DAMAGE_REPETITIONS = 3;
+
+struct TraceMove {
+	DamageRect destination;
+	int32_t source_x;
+	int32_t source_y;
+};
+
+struct TraceFrame {
+	std::vector<DamageRect> dirty;
+	std::vector<TraceMove> moves;
+};
+
+constexpr const char *TRACE_NAMES[] = { "clock", "typing", "scroll", "video", "terminal", "scattered", "full" };
+
+static std::vector<TraceFrame> Trace(const char *name, std::mt19937 *rng) {
+	auto random = [rng](int32_t low, int32_t high) { return std::uniform_int_distribution<int32_t>(low, high)(*rng); };
+	std::vector<TraceFrame> trace(DAMAGE_TRACE_FRAMES);
+	for(uint32_t i = 0; i < DAMAGE_TRACE_FRAMES; ++i) {
+		TraceFrame &frame = trace[i];
+		if(strcmp(name, "clock") == 0) {
+			// A tray clock ticking once a second
+			if(i % 60 == 0) {
+				frame.dirty.push_back({ 1800, 1050, 1870, 1075 });
+			}
+		}
+		else if(strcmp(name, "typing") == 0) {
+			// One glyph per frame, a blinking caret in the menu bar and the clock
+			int32_t x = 200 + static_cast<int32_t>(i % 80) * 9;
+			int32_t y = 300 + static_cast<int32_t>(i / 80) * 18;
+			frame.dirty.push_back({ x, y, x + 9, y + 18 });
+			if(i % 30 == 0) {
+				frame.dirty.push_back({ 1800, 1050, 1870, 1075 });
+			}
+			if(i % 2 == 0) {
+				frame.dirty.push_back({ 0, 0, 1920, 24 });
+			}
+		}
+		else if(strcmp(name, "scroll") == 0) {
+			// A document scrolled by 30 lines a frame and its scroll bar
+			frame.moves.push_back({ { 300, 100, 1600, 970 }, 300, 130 });
+			frame.dirty.push_back({ 300, 970, 1600, 1000 });
+			frame.dirty.push_back({ 1880, 100, 1900, 1000 });
+		}
+		else if(strcmp(name, "video") == 0) {
+			// A 1280x720 player with its controls fading in and out
+			frame.dirty.push_back({ 320, 180, 1600, 900 });
+			if(i % 4 == 0) {
+				frame.dirty.push_back({ 320, 900, 1600, 940 });
+			}
+		}
+		else if(strcmp(name, "terminal") == 0) {
+			// Build output, glyphs all over an 8x16 grid
+			int32_t count = random(50, 300);
+			for(int32_t j = 0; j < count; ++j) {
+				int32_t x = random(0, 239) * 8;
+				int32_t y = random(0, 66) * 16;
+				frame.dirty.push_back({ x, y, x + 8, y + 16 });
+			}
+		}
+		else if(strcmp(name, "scattered") == 0) {
+			int32_t count = random(2, 40);
+			for(int32_t j = 0; j < count; ++j) {
+				int32_t x = random(0, 1900);
+				int32_t y = random(0, 1060);
+				frame.dirty.push_back({ x, y, x + random(1, 200), y + random(1, 120) });
+			}
+		}
+		else {
+			frame.dirty.push_back({ 0, 0, DAMAGE_WIDTH, DAMAGE_HEIGHT });
+		}
+	}
+	return trace;
+}
+
+// Marks the blocks rect touches
+static void Paint(std::vector<uint8_t> *blocks, uint32_t block_size, DamageRect rect) {
+	uint32_t columns = (DAMAGE_WIDTH + block_size - 1) / block_size;
+	rect.left = rect.left < 0 ? 0 : rect.left;
+	rect.top = rect.top < 0 ? 0 : rect.top;
+	rect.right = rect.right > static_cast<int32_t>(DAMAGE_WIDTH) ? DAMAGE_WIDTH : rect.right;
+	rect.bottom = rect.bottom > static_cast<int32_t>(DAMAGE_HEIGHT) ? DAMAGE_HEIGHT : rect.bottom;
+	if(rect.left >= rect.right || rect.top >= rect.bottom) {
+		return;
+	}
+	for(uint32_t y = rect.top / block_size; y < (rect.bottom + block_size - 1) / block_size; ++y) {
+		for(uint32_t x = rect.left / block_size; x < (rect.right + block_size - 1) / block_size; ++x) {
+			(*blocks)[y * columns + x] = 1;
+		}
+	}
+}
+
+int main() {
+	std::mt19937 rng(1);
+	for(const char *name : TRACE_NAMES) {
+		std::vector<TraceFrame> trace = Trace(name, &rng);
+		for(uint32_t block_size : { 16u, 32u }) {
+			for(bool keep_moves : { false, true }) {
+				DamageTracker tracker {};
+				tracker.Initialize(DAMAGE_WIDTH, DAMAGE_HEIGHT, block_size, keep_moves);
+				DamageRegion region;
+				DamageMoves moves;
+				tracker.Collect(tracker.Commit(), &region, &moves);
+
+				std::vector<int8_t> map(tracker.BlockCount());
+				std::vector<uint8_t> exact(tracker.BlockCount());
+				std::vector<uint8_t> merged(tracker.BlockCount());
+				uint64_t rects_in = 0, rects_out = 0, moves_out = 0, unchanged = 0;
+				uint64_t exact_blocks = 0, merged_blocks = 0;
+				double ns = 0.0;
+				for(uint32_t repetition = 0; repetition < DAMAGE_REPETITIONS; ++repetition) {
+					for(const TraceFrame &frame : trace) {
+						auto start = std::chrono::steady_clock::now();
+						for(const TraceMove &move : frame.moves) {
+							tracker.AddMove(move.destination, move.source_x, move.source_y);
+						}
+						for(const DamageRect &rect : frame.dirty) {
+							tracker.AddDirty(rect);
+						}
+						bool changed = tracker.Collect(tracker.Commit(), &region, &moves);
+						if(changed && !region.Covers(DAMAGE_WIDTH, DAMAGE_HEIGHT)) {
+							tracker.FillBlockMap(region, 2, 0, map.data());
+						}
+						ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+						if(repetition != 0) {
+							continue;
+						}
+
+						// Area is counted once, on the first pass
+						rects_in += frame.dirty.size() + frame.moves.size();
+						rects_out += region.count;
+						moves_out += moves.count;
+						unchanged += changed ? 0 : 1;
+						std::fill(exact.begin(), exact.end(), 0);
+						std::fill(merged.begin(), merged.end(), 0);
+						for(const DamageRect &rect : frame.dirty) {
+							Paint(&exact, block_size, rect);
+						}
+						for(const TraceMove &move : frame.moves) {
+							if(!keep_moves) {
+								Paint(&exact, block_size, move.destination);
+							}
+						}
+						for(uint32_t i = 0; i < region.count; ++i) {
+							Paint(&merged, block_size, region.rects[i]);
+						}
+						for(uint32_t i = 0; i < tracker.BlockCount(); ++i) {
+							exact_blocks += exact[i];
+							merged_blocks += merged[i];
+						}
+					}
+				}
+				printf("%-10s %2u px blocks%s: %6.2f us per frame, %5.1f rects in, %4.1f out, %3.1f moves, "
+					   "%5.1f%% unchanged, %5.2f%% of the frame damaged, %.2fx the exact area\n", name, block_size,
+					   keep_moves ? ", moves kept" : "             ", ns / DAMAGE_REPETITIONS / trace.size() / 1000.0,
+					   static_cast<double>(rects_in) / trace.size(), static_cast<double>(rects_out) / trace.size(),
+					   static_cast<double>(moves_out) / trace.size(), 100.0 * unchanged / trace.size(),
+					   100.0 * merged_blocks / trace.size() / tracker.BlockCount(),
+					   exact_blocks ? static_cast<double>(merged_blocks) / exact_blocks : 0.0);
+			}
+		}
+	}
+	return 0;
+}
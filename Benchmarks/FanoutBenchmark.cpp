@@ -0,0 +1,220 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <semaphore>
+#include <thread>
+
+#include "Client.h"
+#include "FrameScheduler.h"
+#include "LatencyHistogram.h"
+#include "Platform.h"
+#include "Server.h"
+
+// Fans synthetic frames out from a Server to up to 16 Clients in the same
+// process over TCP on the loopback interface. With "stall" the last viewer is
+// a connection that is never read from, which has to skip frames without
+// holding back the others. Prints how long SendData takes and, for every
+// viewer, the frames it received or skipped and the latency from SendData
+// until the client had the frame. Fails if a viewer that reads misses more
+// than a tenth of the frames, or a stalled one skips none.
+// Command line is "[viewers] [seconds] [frame bytes] [stall]"
+
+constexpr uint32_t FANOUT_WIDTH = 1920;
+constexpr uint32_t FANOUT_HEIGHT = 1080;
+constexpr uint32_t FANOUT_FPS = 120;
+// A viewer that has not received a keyframe by then is taken as failed
+constexpr uint64_t FANOUT_JOIN_TIMEOUT_US = 10000000;
+constexpr uint32_t FANOUT_MAX_MISSED_PERCENT = 10;
+
+struct Receiver {
+	Client *client;
+	std::counting_semaphore<FRAME_QUEUE_SIZE * 2> wake { 0 };
+	std::atomic<bool> running;
+	// Written by the receiving thread
+	LatencyHistogram latency;
+	std::atomic<uint64_t> frames;
+	std::atomic<uint64_t> reordered;
+	uint64_t last_counter;
+};
+
+static void WakeReceiver(void *user_data) {
+	static_cast<Receiver *>(user_data)->wake.release();
+}
+
+static void ReceiveLoop(Receiver *receiver) {
+	EncodedData frames[FRAME_QUEUE_SIZE];
+	while(receiver->running.load(std::memory_order_relaxed)) {
+		receiver->wake.try_acquire_for(std::chrono::milliseconds(10));
+		uint32_t frame_count = receiver->client->PollData(frames, FRAME_QUEUE_SIZE);
+		uint64_t now = PlatformTimestamp();
+		for(uint32_t i = 0; i < frame_count; ++i) {
+			if(frames[i].result == EncodedDataResult::Abort) {
+				receiver->running.store(false, std::memory_order_relaxed);
+				break;
+			}
+			receiver->latency.Record((now - frames[i].capture_timestamp) * 1000);
+
+			uint64_t counter;
+			memcpy(&counter, frames[i].ptr, sizeof(counter));
+			if(counter <= receiver->last_counter && receiver->frames.load(std::memory_order_relaxed) != 0) {
+				receiver->reordered.fetch_add(1, std::memory_order_relaxed);
+			}
+			receiver->last_counter = counter;
+			receiver->frames.fetch_add(1, std::memory_order_relaxed);
+			receiver->client->ReleaseData(frames[i]);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t viewer_count = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : MAX_VIEWERS;
+	uint32_t seconds = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 5;
+	uint32_t frame_size = argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 100u * 1024u;
+	bool stall = argc > 4 && strcmp(argv[4], "stall") == 0;
+	viewer_count = viewer_count < 1 ? 1 : viewer_count;
+	viewer_count = viewer_count > MAX_VIEWERS ? MAX_VIEWERS : viewer_count;
+	frame_size = frame_size < sizeof(uint64_t) ? static_cast<uint32_t>(sizeof(uint64_t)) : frame_size;
+	// The stalled viewer is the last one, the others read
+	uint32_t reader_count = stall && viewer_count > 1 ? viewer_count - 1 : viewer_count;
+	stall = reader_count < viewer_count;
+
+	uint8_t *payload = static_cast<uint8_t *>(PlatformAllocate(frame_size));
+	memset(payload, 0xAB, frame_size);
+
+	ServerOptions options {};
+	options.transport = Transport::Tcp;
+	options.adaptive_bitrate = false;
+	options.max_viewers = viewer_count;
+	Server server {};
+	server.Initialize(FANOUT_WIDTH, FANOUT_HEIGHT, 0, Codec::Hevc, options);
+
+	// One at a time, so client i is the server's viewer i
+	Client *clients = new Client[reader_count] {};
+	Receiver *receivers = new Receiver[reader_count] {};
+	std::thread receive_threads[MAX_VIEWERS];
+	for(uint32_t i = 0; i < reader_count; ++i) {
+		receivers[i].client = &clients[i];
+		clients[i].Initialize("127.0.0.1");
+		receivers[i].running.store(true, std::memory_order_relaxed);
+		clients[i].Start(WakeReceiver, &receivers[i]);
+		receive_threads[i] = std::thread(ReceiveLoop, &receivers[i]);
+	}
+	// Over TCP a viewer streams once it has sent the InitMessage, which is
+	// all the stalled one reads
+	SocketHandle stalled_socket = INVALID_SOCKET_HANDLE;
+	if(stall) {
+		stalled_socket = NetConnect("127.0.0.1", PORT);
+		InitMessage init_message {};
+		NetRecvAll(stalled_socket, &init_message, sizeof(init_message));
+	}
+
+	LatencyHistogram send_latency {};
+	LatencyReport send_report {};
+	send_report.Initialize(nullptr);
+	send_report.Add("fanout", &send_latency);
+	LatencyReport *reports = new LatencyReport[reader_count] {};
+	for(uint32_t i = 0; i < reader_count; ++i) {
+		reports[i].Initialize(nullptr);
+		reports[i].Add("delivery", &receivers[i].latency);
+	}
+
+	printf("%u viewers over TCP%s, %u byte frames at %u fps for %u s\n", viewer_count,
+		   stall ? ", the last one stalled" : "", frame_size, FANOUT_FPS, seconds);
+	FrameScheduler scheduler {};
+	scheduler.Initialize(FANOUT_FPS);
+	uint64_t counter = 0;
+	bool failed = false;
+
+	// Keyframes until every viewer has one queued and every reader has one
+	uint64_t join_start = PlatformTimestamp();
+	for(uint32_t joined = 0; joined < viewer_count;) {
+		if(PlatformTimestamp() - join_start > FANOUT_JOIN_TIMEOUT_US) {
+			printf("Only %u viewers had a frame within %llu ms\n", joined,
+				   static_cast<unsigned long long>(FANOUT_JOIN_TIMEOUT_US / 1000));
+			failed = true;
+			break;
+		}
+		scheduler.WaitForNextFrame();
+		memcpy(payload, &++counter, sizeof(counter));
+		server.SendData(payload, frame_size, true, nullptr, 0, PlatformTimestamp());
+		joined = 0;
+		for(uint32_t i = 0; i < viewer_count; ++i) {
+			bool has_frame = i < reader_count ? receivers[i].frames.load(std::memory_order_relaxed) != 0 :
+												server.viewers[i].joined;
+			joined += has_frame ? 1 : 0;
+		}
+	}
+
+	uint64_t sent = 0;
+	uint64_t frames_before[MAX_VIEWERS] = {};
+	uint64_t skipped_before[MAX_VIEWERS] = {};
+	if(!failed) {
+		// Keyframes still in flight from joining
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		send_report.Summarize(0);
+		for(uint32_t i = 0; i < viewer_count; ++i) {
+			if(i < reader_count) {
+				reports[i].Summarize(0);
+				frames_before[i] = receivers[i].frames.load(std::memory_order_relaxed);
+			}
+			skipped_before[i] = server.viewers[i].stats.frames_skipped.load(std::memory_order_relaxed);
+		}
+
+		for(uint32_t i = 0; i < FANOUT_FPS * seconds; ++i) {
+			scheduler.WaitForNextFrame();
+			memcpy(payload, &++counter, sizeof(counter));
+			bool keyframe = server.keyframe_requests.Due(PlatformTimestamp());
+			uint64_t start_ns = PlatformTimestampNs();
+			server.SendData(payload, frame_size, keyframe, nullptr, 0, PlatformTimestamp());
+			send_latency.Record(PlatformTimestampNs() - start_ns);
+			++sent;
+		}
+		// Frames still in flight
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+		LatencySummary send = send_report.Summarize(0);
+		printf("SendData: p50 %.1f us, p99 %.1f us, max %.1f us, %llu frames dropped\n", send.p50_ns / 1000.0,
+			   send.p99_ns / 1000.0, send.max_ns / 1000.0,
+			   static_cast<unsigned long long>(server.stats.frames_dropped.load(std::memory_order_relaxed)));
+		for(uint32_t i = 0; i < viewer_count; ++i) {
+			uint64_t skipped = server.viewers[i].stats.frames_skipped.load(std::memory_order_relaxed) -
+							   skipped_before[i];
+			if(i >= reader_count) {
+				printf("Viewer %2u: stalled, skipped %llu\n", i, static_cast<unsigned long long>(skipped));
+				failed |= skipped == 0;
+				continue;
+			}
+			uint64_t received = receivers[i].frames.load(std::memory_order_relaxed) - frames_before[i];
+			LatencySummary latency = reports[i].Summarize(0);
+			printf("Viewer %2u: received %llu of %llu, skipped %llu, latency p50 %.1f us, p99 %.1f us\n", i,
+				   static_cast<unsigned long long>(received), static_cast<unsigned long long>(sent),
+				   static_cast<unsigned long long>(skipped), latency.p50_ns / 1000.0, latency.p99_ns / 1000.0);
+			failed |= (sent - received) * 100 > sent * FANOUT_MAX_MISSED_PERCENT;
+			if(receivers[i].reordered.load(std::memory_order_relaxed) != 0) {
+				printf("Viewer %2u: %llu frames arrived out of order\n", i,
+					   static_cast<unsigned long long>(receivers[i].reordered.load(std::memory_order_relaxed)));
+				failed = true;
+			}
+		}
+	}
+	scheduler.Shutdown();
+
+	for(uint32_t i = 0; i < reader_count; ++i) {
+		receivers[i].running.store(false, std::memory_order_relaxed);
+		receive_threads[i].join();
+		clients[i].Shutdown();
+		reports[i].Shutdown();
+	}
+	if(stalled_socket != INVALID_SOCKET_HANDLE) {
+		NetClose(stalled_socket);
+	}
+	server.Shutdown();
+	send_report.Shutdown();
+	delete[] reports;
+	delete[] receivers;
+	delete[] clients;
+	PlatformFree(payload, frame_size);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "GaloisField.h"
+#include "Protocol.h"
+#include "ReedSolomon.h"
+
+// Reed-Solomon encode and reconstruct throughput of every GF(2^8) kernel the
+// CPU supports for blocks of UDP packet payloads, reconstructing as many data
+// shards as there are parity shards. Then the share of frames that arrive
+// whole under bursty loss with and without parity, the packets of each frame
+// dealt out to blocks and sent in the order the server sends them. Loss
+// follows the Gilbert-Elliott model of the link emulator
+
+constexpr GfKernel FEC_KERNELS[] = { GfKernel::Scalar, GfKernel::Ssse3, GfKernel::Avx2 };
+// Data and parity shards per block, the default --fec-block with 12.5% and a full size block
+constexpr uint32_t FEC_BLOCKS[][2] = { { 32, 4 }, { 128, 16 } };
+// Each measurement repeats for at least this long
+constexpr double FEC_MEASURE_SECONDS = 0.25;
+
+// Loss percent and average burst length
+constexpr float FEC_LINKS[][2] = { { 1.0f, 1.0f }, { 1.0f, 4.0f }, { 2.0f, 2.0f }, { 5.0f, 1.0f }, { 5.0f, 4.0f } };
+// Parity packets per block of FEC_RECOVERY_BLOCK_SIZE, the first without FEC
+constexpr uint32_t FEC_RECOVERY_PARITY[] = { 0, 2, 4, 8 };
+constexpr uint32_t FEC_RECOVERY_BLOCK_SIZE = 32;
+constexpr uint32_t FEC_RECOVERY_FRAME_BYTES = 100 * 1024;
+constexpr uint32_t FEC_RECOVERY_FRAMES = 20000;
+
+static double Seconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct LossModel {
+	std::mt19937 rng;
+	std::uniform_real_distribution<float> uniform;
+	float enter_loss;
+	float leave_loss;
+	bool losing;
+
+	void Initialize(float loss_percent, float burst_length) {
+		rng.seed(1);
+		uniform = std::uniform_real_distribution<float>(0.0f, 1.0f);
+		float loss = loss_percent / 100.0f;
+		loss = loss > 0.99f ? 0.99f : loss;
+		leave_loss = burst_length > 1.0f ? 1.0f / burst_length : 1.0f;
+		enter_loss = loss * leave_loss / (1.0f - loss);
+		losing = false;
+	}
+
+	bool Lost() {
+		losing = losing ? uniform(rng) >= leave_loss : uniform(rng) < enter_loss;
+		return losing;
+	}
+};
+
+static void MeasureThroughput() {
+	std::mt19937 rng(1);
+	for(const uint32_t *counts : FEC_BLOCKS) {
+		uint32_t data_count = counts[0];
+		uint32_t parity_count = counts[1];
+		std::vector<std::vector<uint8_t>> shards(data_count + parity_count, std::vector<uint8_t>(MAX_PACKET_PAYLOAD));
+		std::vector<uint8_t *> pointers;
+		for(std::vector<uint8_t> &shard : shards) {
+			for(uint8_t &byte : shard) {
+				byte = static_cast<uint8_t>(rng());
+			}
+			pointers.push_back(shard.data());
+		}
+		// The first parity_count data shards are missing, the most work a block can take
+		bool present[MAX_FEC_DATA_SHARDS + MAX_FEC_PARITY_SHARDS];
+		for(uint32_t i = 0; i < data_count + parity_count; ++i) {
+			present[i] = i >= parity_count;
+		}
+		double block_bytes = static_cast<double>(data_count) * MAX_PACKET_PAYLOAD;
+
+		printf("%u + %u shards of %u bytes\n", data_count, parity_count, MAX_PACKET_PAYLOAD);
+		for(GfKernel kernel : FEC_KERNELS) {
+			if(!GfSelectKernel(kernel)) {
+				continue;
+			}
+			uint32_t encoded = 0;
+			double start = Seconds();
+			double elapsed = 0.0;
+			for(; elapsed < FEC_MEASURE_SECONDS; elapsed = Seconds() - start) {
+				ReedSolomonEncode(pointers.data(), data_count, pointers.data() + data_count, parity_count,
+								  MAX_PACKET_PAYLOAD);
+				++encoded;
+			}
+			double encode_rate = encoded * block_bytes / elapsed;
+
+			uint32_t reconstructed = 0;
+			start = Seconds();
+			elapsed = 0.0;
+			for(; elapsed < FEC_MEASURE_SECONDS; elapsed = Seconds() - start) {
+				ReedSolomonReconstruct(pointers.data(), present, data_count, parity_count, MAX_PACKET_PAYLOAD);
+				++reconstructed;
+			}
+			double reconstruct_rate = reconstructed * block_bytes / elapsed;
+			printf("  %-7s encode %6.2f GB/s, reconstruct %6.2f GB/s of data (%.1f us per block)\n",
+				   GfKernelName(kernel), encode_rate / 1e9, reconstruct_rate / 1e9, elapsed * 1e6 / reconstructed);
+		}
+	}
+	GfInitialize();
+}
+
+// Frames of FEC_RECOVERY_FRAMES that arrive whole or are rebuilt from parity,
+// out of a stream of packets through one lossy link
+static uint32_t RecoveredFrames(const float *link, uint32_t parity_count) {
+	uint32_t packet_count = (FEC_RECOVERY_FRAME_BYTES + MAX_PACKET_PAYLOAD - 1) / MAX_PACKET_PAYLOAD;
+	uint32_t block_count = FecBlockCount(packet_count, FEC_RECOVERY_BLOCK_SIZE);
+	LossModel model {};
+	model.Initialize(link[0], link[1]);
+	uint32_t recovered = 0;
+	for(uint32_t frame = 0; frame < FEC_RECOVERY_FRAMES; ++frame) {
+		// Packet i is in block i % block_count
+		uint32_t lost[MAX_FEC_DATA_SHARDS] = {};
+		uint32_t lost_total = 0;
+		for(uint32_t i = 0; i < packet_count; ++i) {
+			if(model.Lost()) {
+				++lost[i % block_count];
+				++lost_total;
+			}
+		}
+		// Parity goes out round robin over the blocks, lost parity does not
+		// count against the block but cannot rebuild anything
+		uint32_t parity_counts[MAX_FEC_DATA_SHARDS];
+		uint32_t parity_received[MAX_FEC_DATA_SHARDS] = {};
+		for(uint32_t block = 0; block < block_count; ++block) {
+			uint32_t data_count = FecBlockDataCount(packet_count, block_count, block);
+			parity_counts[block] = parity_count == 0 ? 0 :
+													   FecParityCount(data_count, FEC_RECOVERY_BLOCK_SIZE, parity_count);
+		}
+		for(uint32_t j = 0; j < parity_count; ++j) {
+			for(uint32_t block = 0; block < block_count; ++block) {
+				if(j < parity_counts[block] && !model.Lost()) {
+					++parity_received[block];
+				}
+			}
+		}
+		bool whole = true;
+		for(uint32_t block = 0; block < block_count; ++block) {
+			whole &= lost[block] <= parity_received[block];
+		}
+		recovered += lost_total == 0 || whole ? 1 : 0;
+	}
+	return recovered;
+}
+
+static void MeasureRecovery() {
+	uint32_t packet_count = (FEC_RECOVERY_FRAME_BYTES + MAX_PACKET_PAYLOAD - 1) / MAX_PACKET_PAYLOAD;
+	printf("\n%u frames of %u packets in blocks of %u, frames arriving whole with parity per block of\n",
+		   FEC_RECOVERY_FRAMES, packet_count, FEC_RECOVERY_BLOCK_SIZE);
+	printf("  loss  burst");
+	for(uint32_t parity_count : FEC_RECOVERY_PARITY) {
+		printf("  %8u", parity_count);
+	}
+	printf("\n");
+	for(const float *link : FEC_LINKS) {
+		printf("  %3.0f%%  %5.1f", link[0], link[1]);
+		for(uint32_t parity_count : FEC_RECOVERY_PARITY) {
+			printf("  %7.2f%%", 100.0 * RecoveredFrames(link, parity_count) / FEC_RECOVERY_FRAMES);
+		}
+		printf("\n");
+	}
+}
+
+int main() {
+	GfInitialize();
+	printf("Default kernel %s\n", GfKernelName(GfSelectedKernel()));
+	MeasureThroughput();
+	MeasureRecovery();
+	return 0;
+}
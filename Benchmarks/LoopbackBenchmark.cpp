@@ -0,0 +1,293 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <semaphore>
+#include <thread>
+
+#include "Client.h"
+#include "FrameScheduler.h"
+#include "LatencyHistogram.h"
+#include "LinkEmulator.h"
+#include "Platform.h"
+#include "Server.h"
+
+// Streams synthetic frames from a Server to a Client in the same process over
+// the loopback interface at 60, 120 and 240 fps and reports the throughput
+// and the latency from handing a frame to the server until the client has
+// all of it. With a loss rate the link is emulated: over UDP the server's
+// link emulator drops datagrams, over TCP the stream goes through a relay
+// whose emulator delivers lost segments a round trip late instead, with every
+// later byte waiting behind them. "both" runs TCP and then UDP.
+// Command line is "[frame bytes] [seconds per rate] [tcp|udp|both] [loss percent] [burst length] [delay ms]
+// [fec percent]"
+
+constexpr uint32_t LOOPBACK_WIDTH = 1920;
+constexpr uint32_t LOOPBACK_HEIGHT = 1080;
+constexpr uint32_t LOOPBACK_RATES[] = { 60, 120, 240 };
+// A viewer that has not received a keyframe by then is taken as failed
+constexpr uint64_t LOOPBACK_JOIN_TIMEOUT_US = 5000000;
+// The server listens here when the relay takes PORT
+constexpr const char *LOOPBACK_SERVER_PORT = "4647";
+// A lost TCP segment is sent again once duplicate ACKs reached the sender, a
+// round trip and a bit after it went out. That is the best case, a
+// retransmission timeout takes at least 200 ms
+constexpr uint32_t LOOPBACK_RETRANSMIT_MARGIN_US = 2000;
+
+struct Receiver {
+	Client *client;
+	std::counting_semaphore<FRAME_QUEUE_SIZE * 2> wake { 0 };
+	std::atomic<bool> running;
+	// Written by the receiving thread
+	LatencyHistogram latency;
+	std::atomic<uint64_t> frames;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> reordered;
+	uint64_t last_counter;
+};
+
+// Forwards one TCP connection from PORT to the server, the server's bytes
+// through a link emulator and the client's as they are
+struct Relay {
+	SocketHandle listen_socket;
+	SocketHandle client_socket;
+	SocketHandle server_socket;
+	LinkEmulatorOptions link;
+	LinkEmulator emulator;
+	std::thread accept_thread;
+	std::thread upstream_thread;
+};
+
+static void WakeReceiver(void *user_data) {
+	static_cast<Receiver *>(user_data)->wake.release();
+}
+
+static void ReceiveLoop(Receiver *receiver) {
+	EncodedData frames[FRAME_QUEUE_SIZE];
+	while(receiver->running.load(std::memory_order_relaxed)) {
+		receiver->wake.try_acquire_for(std::chrono::milliseconds(10));
+		uint32_t frame_count = receiver->client->PollData(frames, FRAME_QUEUE_SIZE);
+		uint64_t now = PlatformTimestamp();
+		for(uint32_t i = 0; i < frame_count; ++i) {
+			if(frames[i].result == EncodedDataResult::Abort) {
+				receiver->running.store(false, std::memory_order_relaxed);
+				break;
+			}
+			// Both ends run on the same clock, no synchronization needed
+			receiver->latency.Record((now - frames[i].capture_timestamp) * 1000);
+
+			uint64_t counter;
+			memcpy(&counter, frames[i].ptr, sizeof(counter));
+			if(counter <= receiver->last_counter && receiver->frames.load(std::memory_order_relaxed) != 0) {
+				receiver->reordered.fetch_add(1, std::memory_order_relaxed);
+			}
+			receiver->last_counter = counter;
+			receiver->frames.fetch_add(1, std::memory_order_relaxed);
+			receiver->bytes.fetch_add(frames[i].size, std::memory_order_relaxed);
+			receiver->client->ReleaseData(frames[i]);
+		}
+	}
+}
+
+static void RelayUpstream(Relay *relay) {
+	uint8_t buffer[MAX_DATAGRAM_SIZE];
+	for(;;) {
+		int64_t received = NetRecv(relay->client_socket, buffer, sizeof(buffer));
+		if(received <= 0 || !NetSendAll(relay->server_socket, buffer, static_cast<uint32_t>(received))) {
+			break;
+		}
+	}
+	NetDisconnect(relay->server_socket);
+}
+
+// Runs the downstream half on the accepting thread, segments of at most a
+// datagram go through the emulator
+static void RelayLoop(Relay *relay) {
+	relay->client_socket = NetAccept(relay->listen_socket, nullptr, 0);
+	if(relay->client_socket == INVALID_SOCKET_HANDLE) {
+		return;
+	}
+	relay->server_socket = NetConnect("127.0.0.1", LOOPBACK_SERVER_PORT);
+	if(relay->server_socket == INVALID_SOCKET_HANDLE) {
+		NetDisconnect(relay->client_socket);
+		return;
+	}
+	NetSetNoDelay(relay->client_socket, true);
+	NetSetNoDelay(relay->server_socket, true);
+	relay->emulator.Initialize(relay->client_socket, relay->link);
+	relay->upstream_thread = std::thread(RelayUpstream, relay);
+
+	uint8_t buffer[MAX_DATAGRAM_SIZE];
+	for(;;) {
+		int64_t received = NetRecv(relay->server_socket, buffer, sizeof(buffer));
+		NetBuffer segment {
+			.ptr = buffer,
+			.size = static_cast<uint32_t>(received)
+		};
+		if(received <= 0 || !relay->emulator.Send(&segment, 1)) {
+			break;
+		}
+	}
+	// Flushes what the emulator still holds before the client sees the end
+	relay->emulator.Shutdown();
+	NetDisconnect(relay->client_socket);
+	relay->upstream_thread.join();
+}
+
+// Streams at every rate of LOOPBACK_RATES, false if the viewer never joined
+// or frames arrived out of order
+static bool Run(Transport transport, const LinkEmulatorOptions &link, float fec_percent, uint32_t frame_size,
+				uint32_t seconds, uint8_t *payload) {
+	bool relayed = transport == Transport::Tcp && link.loss_percent > 0.0f;
+	ServerOptions options {};
+	options.transport = transport;
+	options.adaptive_bitrate = false;
+	options.max_viewers = 1;
+	options.port = relayed ? LOOPBACK_SERVER_PORT : PORT;
+	if(transport == Transport::Udp) {
+		options.emulator = link;
+		options.fec_percent = fec_percent;
+	}
+	Server server {};
+	server.Initialize(LOOPBACK_WIDTH, LOOPBACK_HEIGHT, 0, Codec::Hevc, options);
+
+	Relay relay {};
+	if(relayed) {
+		relay.client_socket = INVALID_SOCKET_HANDLE;
+		relay.server_socket = INVALID_SOCKET_HANDLE;
+		relay.link = link;
+		relay.link.retransmit_us = 2 * link.delay_us + LOOPBACK_RETRANSMIT_MARGIN_US;
+		relay.listen_socket = NetListen(PORT);
+		relay.accept_thread = std::thread(RelayLoop, &relay);
+	}
+
+	Client client {};
+	Receiver receiver {};
+	receiver.client = &client;
+	client.Initialize("127.0.0.1");
+	receiver.running.store(true, std::memory_order_relaxed);
+	client.Start(WakeReceiver, &receiver);
+	std::thread receive_thread(ReceiveLoop, &receiver);
+
+	LatencyReport report {};
+	report.Initialize(nullptr);
+	report.Add("loopback", &receiver.latency);
+
+	printf("Loopback over %s, %u byte frames, %u s per rate", transport == Transport::Udp ? "UDP" : "TCP",
+		   frame_size, seconds);
+	if(link.loss_percent > 0.0f) {
+		printf(", %.1f%% loss in bursts of %.1f, %.1f ms delay", link.loss_percent, link.burst_length,
+			   link.delay_us / 1000.0);
+		if(transport == Transport::Udp) {
+			printf(", %.1f%% FEC", fec_percent);
+		}
+	}
+	printf("\n");
+	uint64_t counter = 0;
+	bool failed = false;
+	for(uint32_t fps : LOOPBACK_RATES) {
+		FrameScheduler scheduler {};
+		scheduler.Initialize(fps);
+
+		// Keyframes until the viewer has joined, the viewer skips everything before
+		uint64_t join_start = PlatformTimestamp();
+		while(receiver.frames.load(std::memory_order_relaxed) == 0) {
+			if(PlatformTimestamp() - join_start > LOOPBACK_JOIN_TIMEOUT_US) {
+				printf("No frame arrived within %llu ms\n",
+					   static_cast<unsigned long long>(LOOPBACK_JOIN_TIMEOUT_US / 1000));
+				failed = true;
+				break;
+			}
+			scheduler.WaitForNextFrame();
+			memcpy(payload, &++counter, sizeof(counter));
+			server.SendData(payload, frame_size, true, nullptr, 0, PlatformTimestamp());
+		}
+		if(failed) {
+			scheduler.Shutdown();
+			break;
+		}
+
+		// Keyframes still in flight from joining
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		report.Summarize(0);
+		uint64_t frames_before = receiver.frames.load(std::memory_order_relaxed);
+		uint64_t bytes_before = receiver.bytes.load(std::memory_order_relaxed);
+		uint64_t start = PlatformTimestamp();
+		uint64_t sent = 0;
+		for(uint32_t i = 0; i < fps * seconds; ++i) {
+			scheduler.WaitForNextFrame();
+			memcpy(payload, &++counter, sizeof(counter));
+			bool keyframe = server.keyframe_requests.Due(PlatformTimestamp());
+			server.SendData(payload, frame_size, keyframe, nullptr, 0, PlatformTimestamp());
+			++sent;
+		}
+		// Frames still in flight
+		std::this_thread::sleep_for(std::chrono::milliseconds(100 + 2 * link.delay_us / 1000));
+		double elapsed = (PlatformTimestamp() - start) / 1000000.0;
+		scheduler.Shutdown();
+
+		uint64_t received = receiver.frames.load(std::memory_order_relaxed) - frames_before;
+		uint64_t bytes = receiver.bytes.load(std::memory_order_relaxed) - bytes_before;
+		LatencySummary latency = report.Summarize(0);
+		printf("%3u fps: sent %llu, received %llu, %.1f Mbit/s, latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+			   "max %.1f us\n", fps, static_cast<unsigned long long>(sent), static_cast<unsigned long long>(received),
+			   bytes * 8 / elapsed / 1000000.0, latency.p50_ns / 1000.0, latency.p99_ns / 1000.0,
+			   latency.p999_ns / 1000.0, latency.max_ns / 1000.0);
+	}
+	if(receiver.reordered.load(std::memory_order_relaxed) != 0) {
+		printf("%llu frames arrived out of order\n",
+			   static_cast<unsigned long long>(receiver.reordered.load(std::memory_order_relaxed)));
+		failed = true;
+	}
+	if(relayed) {
+		printf("Relay: %llu segments, %llu sent again\n",
+			   static_cast<unsigned long long>(relay.emulator.stats.sent.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(relay.emulator.stats.retransmitted.load(std::memory_order_relaxed)));
+	}
+
+	receiver.running.store(false, std::memory_order_relaxed);
+	receive_thread.join();
+	client.Shutdown();
+	server.Shutdown();
+	if(relayed) {
+		// Unblocks the accept if the client never came through
+		NetDisconnect(relay.listen_socket);
+		relay.accept_thread.join();
+		NetClose(relay.listen_socket);
+		if(relay.client_socket != INVALID_SOCKET_HANDLE) {
+			NetClose(relay.client_socket);
+		}
+		if(relay.server_socket != INVALID_SOCKET_HANDLE) {
+			NetClose(relay.server_socket);
+		}
+	}
+	report.Shutdown();
+	return !failed;
+}
+
+int main(int argc, char **argv) {
+	uint32_t frame_size = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 64u * 1024u;
+	uint32_t seconds = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 3;
+	const char *mode = argc > 3 ? argv[3] : "tcp";
+	LinkEmulatorOptions link {};
+	link.loss_percent = argc > 4 ? static_cast<float>(atof(argv[4])) : 0.0f;
+	link.burst_length = argc > 5 ? static_cast<float>(atof(argv[5])) : 1.0f;
+	link.delay_us = argc > 6 ? static_cast<uint32_t>(atof(argv[6]) * 1000.0) : 0;
+	float fec_percent = argc > 7 ? static_cast<float>(atof(argv[7])) : 0.0f;
+	frame_size = frame_size < sizeof(uint64_t) ? static_cast<uint32_t>(sizeof(uint64_t)) : frame_size;
+	bool tcp = strcmp(mode, "udp") != 0;
+	bool udp = strcmp(mode, "udp") == 0 || strcmp(mode, "both") == 0;
+
+	uint8_t *payload = static_cast<uint8_t *>(PlatformAllocate(frame_size));
+	memset(payload, 0xAB, frame_size);
+	bool succeeded = true;
+	if(tcp) {
+		succeeded &= Run(Transport::Tcp, link, fec_percent, frame_size, seconds, payload);
+	}
+	if(udp) {
+		succeeded &= Run(Transport::Udp, link, fec_percent, frame_size, seconds, payload);
+	}
+	PlatformFree(payload, frame_size);
+	return succeeded ? 0 : 1;
+}
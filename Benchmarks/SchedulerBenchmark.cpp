@@ -0,0 +1,38 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "FrameScheduler.h"
+#include "Platform.h"
+
+// Paces an empty loop with the frame scheduler at 60, 120 and 240 fps and
+// prints the share of a core the waiting thread uses, the spin threshold the
+// scheduler calibrated and the wakeup jitter. Sleeping the interval out
+// costs next to nothing, so the share is almost all spinning.
+// Command line is "[seconds per rate]"
+
+constexpr uint32_t SCHEDULER_BENCHMARK_RATES[] = { 60, 120, 240 };
+
+int main(int argc, char **argv) {
+	uint32_t seconds = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 5;
+	seconds = seconds == 0 ? 1 : seconds;
+
+	for(uint32_t fps : SCHEDULER_BENCHMARK_RATES) {
+		FrameScheduler scheduler {};
+		scheduler.Initialize(fps);
+		uint64_t start_ns = scheduler.Now();
+		uint64_t start_cpu_ns = PlatformThreadCpuTimeNs();
+		for(uint64_t i = 0; i < static_cast<uint64_t>(seconds) * fps; ++i) {
+			scheduler.WaitForNextFrame();
+		}
+		uint64_t cpu_ns = PlatformThreadCpuTimeNs() - start_cpu_ns;
+		uint64_t elapsed_ns = scheduler.Now() - start_ns;
+
+		printf("%3u fps: %.2f%% of a core, %.1f us per frame, spin threshold %llu us\n", fps,
+			   100.0 * static_cast<double>(cpu_ns) / static_cast<double>(elapsed_ns),
+			   static_cast<double>(cpu_ns) / 1000.0 / (static_cast<double>(seconds) * fps),
+			   static_cast<unsigned long long>(scheduler.spin_threshold_ns / 1000));
+		scheduler.PrintStats();
+		scheduler.Shutdown();
+	}
+	return 0;
+}
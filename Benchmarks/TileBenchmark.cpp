@@ -0,0 +1,263 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "TileCodec.h"
+#include "TileDecoder.h"
+#include "TileEncoder.h"
+
+// Hash throughput of every kernel the CPU supports, then synthetic office
+// sequences at 1920x1080 through the tile encoder and decoder. Reports the
+// encode rate over the whole frame, the time per frame on both sides and the
+// bytes sent, with changed tiles found by hashing alone and with a damage mask.
+// Every decoded frame is compared against the desktop
+
+constexpr uint32_t DESKTOP_WIDTH = 1920;
+constexpr uint32_t DESKTOP_HEIGHT = 1080;
+constexpr uint32_t SEQUENCE_FRAMES = 120;
+
+constexpr TileKernel TILE_KERNELS[] = { TileKernel::Scalar, TileKernel::Sse41, TileKernel::Avx2, TileKernel::Neon };
+
+static double Seconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// An office desktop and the tiles each change touched
+struct Desktop {
+	std::vector<uint32_t> pixels;
+	std::vector<int8_t> mask;
+	std::mt19937 rng;
+
+	void Fill(int32_t x, int32_t y, int32_t width, int32_t height, uint32_t color) {
+		for(int32_t row = y < 0 ? 0 : y; row < y + height && row < static_cast<int32_t>(DESKTOP_HEIGHT); ++row) {
+			for(int32_t column = x < 0 ? 0 : x; column < x + width && column < static_cast<int32_t>(DESKTOP_WIDTH);
+				++column) {
+				pixels[row * DESKTOP_WIDTH + column] = color | 0xFF000000;
+			}
+		}
+	}
+
+	void Damage(int32_t x, int32_t y, int32_t width, int32_t height) {
+		uint32_t columns = (DESKTOP_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+		uint32_t rows = (DESKTOP_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+		for(uint32_t row = y / TILE_SIZE; row <= (y + height - 1) / TILE_SIZE && row < rows; ++row) {
+			for(uint32_t column = x / TILE_SIZE; column <= (x + width - 1) / TILE_SIZE && column < columns; ++column) {
+				mask[row * columns + column] = 1;
+			}
+		}
+	}
+
+	// Antialiased, black on white with a few levels of grey
+	void Glyph(int32_t x, int32_t y, uint32_t seed) {
+		constexpr uint32_t GREYS[] = { 0xFFFFFF, 0xC0C0C0, 0x808080, 0x202020 };
+		std::mt19937 glyph(seed);
+		for(int32_t row = 0; row < 14; ++row) {
+			for(int32_t column = 0; column < 8; ++column) {
+				uint32_t level = (glyph() >> 7) % 4;
+				Fill(x + column, y + row, 1, 1, GREYS[(glyph() >> 3) % 3 == 0 ? level : 0]);
+			}
+		}
+	}
+
+	void TextLine(int32_t x, int32_t y, int32_t characters, uint32_t seed) {
+		for(int32_t i = 0; i < characters; ++i) {
+			if((seed + i) % 7 != 0) {
+				Glyph(x + i * 9, y, seed * 131 + i);
+			}
+		}
+	}
+
+	// Smooth gradients with noise, nothing for a palette
+	void Photo(int32_t x, int32_t y, int32_t width, int32_t height, uint32_t seed) {
+		std::mt19937 noise(seed);
+		for(int32_t row = 0; row < height; ++row) {
+			for(int32_t column = 0; column < width; ++column) {
+				uint32_t red = ((column + row) * 3 + (noise() & 15)) & 255;
+				uint32_t green = (column * 2 + (noise() & 15)) & 255;
+				uint32_t blue = (row * 2 + (noise() & 15)) & 255;
+				Fill(x + column, y + row, 1, 1, red << 16 | green << 8 | blue);
+			}
+		}
+	}
+
+	// A page of text scrolled down by scroll pixels
+	void Document(int32_t scroll) {
+		Fill(200, 80, 1400, 960, 0xFFFFFF);
+		for(int32_t line = 0; line < 50; ++line) {
+			int32_t y = 100 + line * 20 - scroll % 20;
+			int32_t index = line + scroll / 20;
+			if(y >= 90 && y < 1020) {
+				TextLine(240, y, 100 + index % 40, index + 1);
+			}
+		}
+	}
+
+	void Initialize() {
+		pixels.assign(DESKTOP_WIDTH * DESKTOP_HEIGHT, 0);
+		mask.assign(((DESKTOP_WIDTH + TILE_SIZE - 1) / TILE_SIZE) * ((DESKTOP_HEIGHT + TILE_SIZE - 1) / TILE_SIZE), 0);
+		rng.seed(1234);
+		// Wallpaper, a title bar gradient, the taskbar with its icons, the
+		// document and a picture in a side panel
+		Fill(0, 0, DESKTOP_WIDTH, DESKTOP_HEIGHT, 0x3A6EA5);
+		for(int32_t row = 0; row < 40; ++row) {
+			Fill(0, row, DESKTOP_WIDTH, 1, 0x203040 + row * 0x010101);
+		}
+		Fill(0, 1040, DESKTOP_WIDTH, 40, 0x202020);
+		for(int32_t i = 0; i < 12; ++i) {
+			Photo(10 + i * 50, 1044, 32, 32, i);
+		}
+		Document(0);
+		Photo(1620, 100, 280, 400, 99);
+	}
+};
+
+constexpr const char *SEQUENCE_NAMES[] = { "typing", "scrolling", "window switch", "spreadsheet", "idle" };
+
+// Advances the desktop by one frame of the sequence
+static void Step(Desktop *desktop, const char *name, uint32_t frame) {
+	std::fill(desktop->mask.begin(), desktop->mask.end(), 0);
+	if(strcmp(name, "typing") == 0) {
+		// A glyph every other frame and a blinking caret
+		if(frame % 2 == 0) {
+			int32_t x = 240 + (frame / 2 % 140) * 9;
+			int32_t y = 700 + (frame / 2 / 140) * 20;
+			desktop->Glyph(x, y, 7777 + frame);
+			desktop->Damage(x, y, 8, 14);
+		}
+		if(frame % 30 == 0) {
+			desktop->Fill(1500, 700, 2, 14, frame / 30 % 2 ? 0xFFFFFF : 0);
+			desktop->Damage(1500, 700, 2, 14);
+		}
+	}
+	else if(strcmp(name, "scrolling") == 0) {
+		// Three lines a frame
+		desktop->Document(frame * 60);
+		desktop->Damage(200, 80, 1400, 960);
+	}
+	else if(strcmp(name, "window switch") == 0) {
+		// Between the document and a photo viewer every 20 frames, idle in between
+		if(frame % 20 == 0) {
+			if(frame / 20 % 2) {
+				desktop->Photo(200, 80, 1400, 960, frame);
+			}
+			else {
+				desktop->Document(0);
+			}
+			desktop->Damage(200, 80, 1400, 960);
+		}
+	}
+	else if(strcmp(name, "spreadsheet") == 0) {
+		// A grid of cells, a few of which are recalculated every frame
+		if(frame == 0) {
+			desktop->Fill(200, 80, 1400, 960, 0xFFFFFF);
+			for(int32_t y = 80; y < 1040; y += 22) {
+				desktop->Fill(200, y, 1400, 1, 0xD0D0D0);
+			}
+			for(int32_t x = 200; x < 1600; x += 100) {
+				desktop->Fill(x, 80, 1, 960, 0xD0D0D0);
+			}
+			desktop->Damage(200, 80, 1400, 960);
+		}
+		for(uint32_t i = 0; i < 6; ++i) {
+			int32_t x = 200 + (desktop->rng() % 14) * 100;
+			int32_t y = 80 + (desktop->rng() % 43) * 22;
+			desktop->Fill(x + 1, y + 1, 99, 21, 0xFFFFFF);
+			desktop->TextLine(x + 4, y + 4, 9, desktop->rng());
+			desktop->Damage(x, y, 100, 22);
+		}
+	}
+	else {
+		// A clock ticking once a second
+		if(frame % 60 == 0) {
+			desktop->TextLine(1800, 1050, 5, frame);
+			desktop->Damage(1800, 1050, 45, 14);
+		}
+	}
+}
+
+static void BenchmarkHash(const Desktop &desktop) {
+	constexpr uint32_t REPETITIONS = 20;
+	for(TileKernel kernel : TILE_KERNELS) {
+		if(!TileSelectKernel(kernel)) {
+			continue;
+		}
+		uint64_t sum = 0;
+		double start = Seconds();
+		for(uint32_t i = 0; i < REPETITIONS; ++i) {
+			for(uint32_t y = 0; y < DESKTOP_HEIGHT; y += TILE_SIZE) {
+				for(uint32_t x = 0; x < DESKTOP_WIDTH; x += TILE_SIZE) {
+					uint32_t width = DESKTOP_WIDTH - x < TILE_SIZE ? DESKTOP_WIDTH - x : TILE_SIZE;
+					uint32_t height = DESKTOP_HEIGHT - y < TILE_SIZE ? DESKTOP_HEIGHT - y : TILE_SIZE;
+					sum += TileHash(desktop.pixels.data() + y * DESKTOP_WIDTH + x, DESKTOP_WIDTH, width, height);
+				}
+			}
+		}
+		double seconds = Seconds() - start;
+		// The hashes are printed so the loop is not optimized away
+		printf("Hash %-6s %8.0f MB/s, sum %016llx\n", TileKernelName(kernel),
+			   REPETITIONS * DESKTOP_WIDTH * DESKTOP_HEIGHT * 4.0 / seconds / 1e6, static_cast<unsigned long long>(sum));
+	}
+	TileInitialize();
+}
+
+int main() {
+	TileInitialize();
+	Desktop desktop {};
+	desktop.Initialize();
+	BenchmarkHash(desktop);
+
+	printf("\n%u frames per sequence, %u KB per raw frame, %s hashing\n", SEQUENCE_FRAMES,
+		   DESKTOP_WIDTH * DESKTOP_HEIGHT * 4 / 1024, TileKernelName(TileSelectedKernel()));
+	bool failed = false;
+	for(const char *name : SEQUENCE_NAMES) {
+		for(uint32_t threads : { 1u, 0u }) {
+			for(bool masked : { false, true }) {
+				desktop.Initialize();
+				TileEncoder encoder {};
+				encoder.Initialize(DESKTOP_WIDTH, DESKTOP_HEIGHT, threads);
+				TileDecoder decoder {};
+				decoder.Initialize(DESKTOP_WIDTH, DESKTOP_HEIGHT, threads);
+				// The first frame is coded whole and not counted
+				EncodedData data = encoder.Encode(desktop.pixels.data(), DESKTOP_WIDTH, nullptr, true, 0);
+				decoder.Decode(data.ptr, data.size);
+
+				uint64_t bytes = 0, tiles = 0, sent = 0;
+				uint32_t mismatches = 0;
+				double encode_seconds = 0.0, decode_seconds = 0.0;
+				for(uint32_t frame = 0; frame < SEQUENCE_FRAMES; ++frame) {
+					Step(&desktop, name, frame);
+					double start = Seconds();
+					data = encoder.Encode(desktop.pixels.data(), DESKTOP_WIDTH, masked ? desktop.mask.data() : nullptr,
+										  false, frame % NUM_IO_BUFFERS);
+					double encoded = Seconds();
+					if(data.size != 0) {
+						if(!decoder.Decode(data.ptr, data.size)) {
+							++mismatches;
+						}
+						TileFrame header;
+						memcpy(&header, data.ptr, sizeof(header));
+						tiles += header.tile_count;
+						bytes += data.size;
+						++sent;
+					}
+					decode_seconds += Seconds() - encoded;
+					encode_seconds += encoded - start;
+					mismatches += memcmp(decoder.frame, desktop.pixels.data(), desktop.pixels.size() * 4) != 0 ? 1 : 0;
+				}
+				printf("%-13s %u threads %-4s: encode %7.0f MB/s %6.2f ms, decode %6.2f ms per frame, "
+					   "%3llu frames sent, %6.1f tiles and %8.1f KB per frame%s\n", name, encoder.pool.thread_count + 1,
+					   masked ? "mask" : "hash",
+					   SEQUENCE_FRAMES * DESKTOP_WIDTH * DESKTOP_HEIGHT * 4.0 / encode_seconds / 1e6,
+					   encode_seconds * 1e3 / SEQUENCE_FRAMES, decode_seconds * 1e3 / SEQUENCE_FRAMES,
+					   static_cast<unsigned long long>(sent), static_cast<double>(tiles) / SEQUENCE_FRAMES,
+					   bytes / 1024.0 / SEQUENCE_FRAMES, mismatches != 0 ? ", decoded frames differ" : "");
+				failed |= mismatches != 0;
+				encoder.Shutdown();
+				decoder.Shutdown();
+			}
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,773 @@
+#include "ColorConvert.h"
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include "WorkerPool.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define COLOR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define COLOR_NEON 1
+#include <arm_neon.h>
+#endif
+
+// MSVC accepts any intrinsic without a matching /arch, GCC and Clang have to
+// be told per function
+#if defined(COLOR_X86) && !defined(_MSC_VER)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+// Q15 factors for B, G and R. Luma is their sum over one pixel plus y_bias
+// shifted down by 15, chroma the sum over the four pixels of a block plus
+// CHROMA_BIAS shifted down by 17. The biases hold the offset and rounding
+struct ColorCoefficients {
+	int16_t y[3];
+	int16_t u[3];
+	int16_t v[3];
+	int32_t y_bias;
+};
+
+constexpr int32_t CHROMA_BIAS = (128 << 17) + (1 << 16);
+
+// y0 and y1 receive luma of row0 and row1, y1 may be null for an odd last
+// row. NV12 interleaves chroma into u and leaves v unused
+using RowPairFunction = void (*)(const uint32_t *row0, const uint32_t *row1, uint32_t width,
+								 const ColorCoefficients &c, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v);
+// One row of NV12 to BGRA
+using RowFunction = void (*)(const uint8_t *y, const uint8_t *uv, uint32_t width, const YuvCoefficients &c,
+							 uint32_t *bgra);
+
+struct ColorState {
+	bool initialized;
+	ColorKernel kernel;
+	RowPairFunction nv12_rows;
+	RowPairFunction i420_rows;
+	RowFunction bgra_rows;
+};
+
+static ColorState state;
+
+static ColorCoefficients MakeCoefficients(ColorMatrix matrix, ColorRange range) {
+	double kr = matrix == ColorMatrix::Bt709 ? 0.2126 : 0.299;
+	double kb = matrix == ColorMatrix::Bt709 ? 0.0722 : 0.114;
+	double y_scale = range == ColorRange::Full ? 1.0 : 219.0 / 255.0;
+	double c_scale = range == ColorRange::Full ? 1.0 : 224.0 / 255.0;
+	int32_t y_offset = range == ColorRange::Full ? 0 : 16;
+	auto q15 = [](double value) {
+		return static_cast<int32_t>(std::lround(value * 32768.0));
+	};
+
+	// Green takes what is left, so white and gray come out exact
+	int32_t yr = q15(kr * y_scale);
+	int32_t yb = q15(kb * y_scale);
+	int32_t yg = q15(y_scale) - yr - yb;
+	// U = (B - Y) / (2 - 2Kb) and V = (R - Y) / (2 - 2Kr)
+	int32_t ub = q15(0.5 * c_scale);
+	int32_t ur = q15(-0.5 * c_scale * kr / (1.0 - kb));
+	int32_t ug = -ub - ur;
+	int32_t vr = q15(0.5 * c_scale);
+	int32_t vb = q15(-0.5 * c_scale * kb / (1.0 - kr));
+	int32_t vg = -vr - vb;
+	return ColorCoefficients {
+		.y = { static_cast<int16_t>(yb), static_cast<int16_t>(yg), static_cast<int16_t>(yr) },
+		.u = { static_cast<int16_t>(ub), static_cast<int16_t>(ug), static_cast<int16_t>(ur) },
+		.v = { static_cast<int16_t>(vb), static_cast<int16_t>(vg), static_cast<int16_t>(vr) },
+		.y_bias = (y_offset << 15) + (1 << 14)
+	};
+}
+
+YuvCoefficients ColorYuvCoefficients(ColorMatrix matrix, ColorRange range) {
+	double kr = matrix == ColorMatrix::Bt709 ? 0.2126 : 0.299;
+	double kb = matrix == ColorMatrix::Bt709 ? 0.0722 : 0.114;
+	double kg = 1.0 - kr - kb;
+	double y_scale = range == ColorRange::Full ? 1.0 : 255.0 / 219.0;
+	double c_scale = range == ColorRange::Full ? 1.0 : 255.0 / 224.0;
+	auto q13 = [](double value) {
+		return static_cast<int16_t>(std::lround(value * 8192.0));
+	};
+	// B = Y + (2 - 2Kb) U, R = Y + (2 - 2Kr) V and G follows from Y
+	return YuvCoefficients {
+		.y = q13(y_scale),
+		.y_offset = static_cast<int16_t>(range == ColorRange::Full ? 0 : 16),
+		.bu = q13((2.0 - 2.0 * kb) * c_scale),
+		.gu = q13(-(2.0 - 2.0 * kb) * kb / kg * c_scale),
+		.gv = q13(-(2.0 - 2.0 * kr) * kr / kg * c_scale),
+		.rv = q13((2.0 - 2.0 * kr) * c_scale)
+	};
+}
+
+static inline uint8_t Luma(const ColorCoefficients &c, uint32_t pixel) {
+	int32_t b = pixel & 0xFF;
+	int32_t g = (pixel >> 8) & 0xFF;
+	int32_t r = (pixel >> 16) & 0xFF;
+	return ColorClamp((c.y[0] * b + c.y[1] * g + c.y[2] * r + c.y_bias) >> 15);
+}
+
+// From the even column begin on, the vector kernels leave their tail to it
+template<bool Nv12>
+static void RowPairTail(const uint32_t *row0, const uint32_t *row1, uint32_t begin, uint32_t width,
+						const ColorCoefficients &c, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v) {
+	for(uint32_t x = begin; x < width; x += 2) {
+		uint32_t x1 = x + 1 < width ? x + 1 : x;
+		y0[x] = Luma(c, row0[x]);
+		y0[x1] = Luma(c, row0[x1]);
+		if(y1) {
+			y1[x] = Luma(c, row1[x]);
+			y1[x1] = Luma(c, row1[x1]);
+		}
+
+		int32_t sum_b = 0;
+		int32_t sum_g = 0;
+		int32_t sum_r = 0;
+		for(uint32_t pixel : { row0[x], row0[x1], row1[x], row1[x1] }) {
+			sum_b += pixel & 0xFF;
+			sum_g += (pixel >> 8) & 0xFF;
+			sum_r += (pixel >> 16) & 0xFF;
+		}
+		uint8_t cu = ColorClamp((c.u[0] * sum_b + c.u[1] * sum_g + c.u[2] * sum_r + CHROMA_BIAS) >> 17);
+		uint8_t cv = ColorClamp((c.v[0] * sum_b + c.v[1] * sum_g + c.v[2] * sum_r + CHROMA_BIAS) >> 17);
+		if(Nv12) {
+			u[x] = cu;
+			u[x + 1] = cv;
+		} else {
+			u[x / 2] = cu;
+			v[x / 2] = cv;
+		}
+	}
+}
+
+template<bool Nv12>
+static void RowPairScalar(const uint32_t *row0, const uint32_t *row1, uint32_t width, const ColorCoefficients &c,
+						  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v) {
+	RowPairTail<Nv12>(row0, row1, 0, width, c, y0, y1, u, v);
+}
+
+static void RowTail(const uint8_t *y, const uint8_t *uv, uint32_t begin, uint32_t width, const YuvCoefficients &c,
+					uint32_t *bgra) {
+	for(uint32_t x = begin; x < width; ++x) {
+		bgra[x] = YuvToBgra(c, y[x], uv[x & ~1u], uv[x | 1u]);
+	}
+}
+
+static void RowScalar(const uint8_t *y, const uint8_t *uv, uint32_t width, const YuvCoefficients &c, uint32_t *bgra) {
+	RowTail(y, uv, 0, width, c, bgra);
+}
+
+#ifdef COLOR_X86
+// Two 16-bit values as the 32 bits madd multiplies them from
+static inline int32_t Pair16(int16_t low, int16_t high) {
+	return static_cast<int32_t>(static_cast<uint16_t>(low) | static_cast<uint32_t>(static_cast<uint16_t>(high)) << 16);
+}
+
+// Luma of four pixels from two registers of two pixels in 16-bit components
+TARGET_SSE41 static inline __m128i LumaSse41(__m128i low, __m128i high, __m128i coefficients, __m128i bias) {
+	__m128i sums = _mm_hadd_epi32(_mm_madd_epi16(low, coefficients), _mm_madd_epi16(high, coefficients));
+	return _mm_srai_epi32(_mm_add_epi32(sums, bias), 15);
+}
+
+// Chroma of four blocks from the block sums of two registers
+TARGET_SSE41 static inline __m128i ChromaSse41(__m128i low, __m128i high, __m128i coefficients, __m128i bias) {
+	__m128i sums = _mm_hadd_epi32(_mm_madd_epi16(low, coefficients), _mm_madd_epi16(high, coefficients));
+	return _mm_srai_epi32(_mm_add_epi32(sums, bias), 17);
+}
+
+template<bool Nv12>
+TARGET_SSE41 static void RowPairSse41(const uint32_t *row0, const uint32_t *row1, uint32_t width,
+									  const ColorCoefficients &c, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i y_coefficients = _mm_setr_epi16(c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0);
+	__m128i u_coefficients = _mm_setr_epi16(c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0);
+	__m128i v_coefficients = _mm_setr_epi16(c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0);
+	__m128i y_bias = _mm_set1_epi32(c.y_bias);
+	__m128i chroma_bias = _mm_set1_epi32(CHROMA_BIAS);
+
+	uint32_t x = 0;
+	for(; x + 8 <= width; x += 8) {
+		__m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x));
+		__m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x + 4));
+		__m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x));
+		__m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x + 4));
+		// Pixels 0 and 1, 2 and 3, 4 and 5, 6 and 7 in 16-bit components
+		__m128i a00 = _mm_unpacklo_epi8(a0, zero);
+		__m128i a01 = _mm_unpackhi_epi8(a0, zero);
+		__m128i a10 = _mm_unpacklo_epi8(a1, zero);
+		__m128i a11 = _mm_unpackhi_epi8(a1, zero);
+		__m128i b00 = _mm_unpacklo_epi8(b0, zero);
+		__m128i b01 = _mm_unpackhi_epi8(b0, zero);
+		__m128i b10 = _mm_unpacklo_epi8(b1, zero);
+		__m128i b11 = _mm_unpackhi_epi8(b1, zero);
+
+		__m128i luma0 = _mm_packs_epi32(LumaSse41(a00, a01, y_coefficients, y_bias),
+										LumaSse41(a10, a11, y_coefficients, y_bias));
+		__m128i luma1 = _mm_packs_epi32(LumaSse41(b00, b01, y_coefficients, y_bias),
+										LumaSse41(b10, b11, y_coefficients, y_bias));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(y0 + x), _mm_packus_epi16(luma0, zero));
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(y1 + x), _mm_packus_epi16(luma1, zero));
+
+		// Columns summed first, then the two columns of each block
+		__m128i v00 = _mm_add_epi16(a00, b00);
+		__m128i v01 = _mm_add_epi16(a01, b01);
+		__m128i v10 = _mm_add_epi16(a10, b10);
+		__m128i v11 = _mm_add_epi16(a11, b11);
+		__m128i blocks0 = _mm_add_epi16(_mm_unpacklo_epi64(v00, v01), _mm_unpackhi_epi64(v00, v01));
+		__m128i blocks1 = _mm_add_epi16(_mm_unpacklo_epi64(v10, v11), _mm_unpackhi_epi64(v10, v11));
+		__m128i cu = ChromaSse41(blocks0, blocks1, u_coefficients, chroma_bias);
+		__m128i cv = ChromaSse41(blocks0, blocks1, v_coefficients, chroma_bias);
+		if(Nv12) {
+			__m128i uv = _mm_unpacklo_epi16(_mm_packs_epi32(cu, cu), _mm_packs_epi32(cv, cv));
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(u + x), _mm_packus_epi16(uv, zero));
+		} else {
+			uint32_t u_bytes = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(cu, cu), zero)));
+			uint32_t v_bytes = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(cv, cv), zero)));
+			memcpy(u + x / 2, &u_bytes, sizeof(u_bytes));
+			memcpy(v + x / 2, &v_bytes, sizeof(v_bytes));
+		}
+	}
+	RowPairTail<Nv12>(row0, row1, x, width, c, y0, y1, u, v);
+}
+
+// One component of eight pixels in 16 bits, terms holds those of four
+// chroma samples which cover two pixels each
+TARGET_SSE41 static inline __m128i ComponentSse41(__m128i luma_low, __m128i luma_high, __m128i terms) {
+	__m128i low = _mm_srai_epi32(_mm_add_epi32(luma_low, _mm_unpacklo_epi32(terms, terms)), 13);
+	__m128i high = _mm_srai_epi32(_mm_add_epi32(luma_high, _mm_unpackhi_epi32(terms, terms)), 13);
+	return _mm_packs_epi32(low, high);
+}
+
+TARGET_SSE41 static void RowSse41(const uint8_t *y, const uint8_t *uv, uint32_t width, const YuvCoefficients &c,
+								  uint32_t *bgra) {
+	__m128i y_offset = _mm_set1_epi16(c.y_offset);
+	__m128i chroma_offset = _mm_set1_epi16(128);
+	__m128i ones = _mm_set1_epi16(1);
+	__m128i alpha = _mm_set1_epi16(0xFF);
+	// Luma is paired with 1 so that the same multiply adds the rounding
+	__m128i y_coefficients = _mm_set1_epi32(Pair16(c.y, 1 << 12));
+	__m128i b_coefficients = _mm_set1_epi32(Pair16(c.bu, 0));
+	__m128i g_coefficients = _mm_set1_epi32(Pair16(c.gu, c.gv));
+	__m128i r_coefficients = _mm_set1_epi32(Pair16(0, c.rv));
+
+	uint32_t x = 0;
+	for(; x + 8 <= width; x += 8) {
+		__m128i luma = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(y + x))),
+									 y_offset);
+		__m128i luma_low = _mm_madd_epi16(_mm_unpacklo_epi16(luma, ones), y_coefficients);
+		__m128i luma_high = _mm_madd_epi16(_mm_unpackhi_epi16(luma, ones), y_coefficients);
+		__m128i chroma = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(uv + x))),
+									   chroma_offset);
+		__m128i b = ComponentSse41(luma_low, luma_high, _mm_madd_epi16(chroma, b_coefficients));
+		__m128i g = ComponentSse41(luma_low, luma_high, _mm_madd_epi16(chroma, g_coefficients));
+		__m128i r = ComponentSse41(luma_low, luma_high, _mm_madd_epi16(chroma, r_coefficients));
+
+		// Bytes of B and G, R and A, interleaved into pairs and the pairs into pixels
+		__m128i bg = _mm_packus_epi16(b, g);
+		__m128i ra = _mm_packus_epi16(r, alpha);
+		bg = _mm_unpacklo_epi8(bg, _mm_srli_si128(bg, 8));
+		ra = _mm_unpacklo_epi8(ra, _mm_srli_si128(ra, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(bgra + x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(bgra + x + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+	RowTail(y, uv, x, width, c, bgra);
+}
+
+// As the SSE4.1 helpers, within each 128-bit lane
+TARGET_AVX2 static inline __m256i LumaAvx2(__m256i low, __m256i high, __m256i coefficients, __m256i bias) {
+	__m256i sums = _mm256_hadd_epi32(_mm256_madd_epi16(low, coefficients), _mm256_madd_epi16(high, coefficients));
+	return _mm256_srai_epi32(_mm256_add_epi32(sums, bias), 15);
+}
+
+TARGET_AVX2 static inline __m256i ChromaAvx2(__m256i low, __m256i high, __m256i coefficients, __m256i bias) {
+	__m256i sums = _mm256_hadd_epi32(_mm256_madd_epi16(low, coefficients), _mm256_madd_epi16(high, coefficients));
+	return _mm256_srai_epi32(_mm256_add_epi32(sums, bias), 17);
+}
+
+// Luma of 16 pixels as bytes in the low 128 bits
+TARGET_AVX2 static inline __m128i PackLumaAvx2(__m256i low, __m256i high) {
+	// Lanes hold pixels 0-3 and 8-11, then 4-7 and 12-15
+	__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+	__m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm256_castsi256_si128(bytes);
+}
+
+template<bool Nv12>
+TARGET_AVX2 static void RowPairAvx2(const uint32_t *row0, const uint32_t *row1, uint32_t width,
+									const ColorCoefficients &c, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i y_coefficients = _mm256_setr_epi16(c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0,
+											   c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0);
+	__m256i u_coefficients = _mm256_setr_epi16(c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0,
+											   c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0);
+	__m256i v_coefficients = _mm256_setr_epi16(c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0,
+											   c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0);
+	__m256i y_bias = _mm256_set1_epi32(c.y_bias);
+	__m256i chroma_bias = _mm256_set1_epi32(CHROMA_BIAS);
+	// hadd leaves blocks 0, 1, 4, 5 in the low lane and 2, 3, 6, 7 in the high one
+	__m256i block_order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+
+	uint32_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		__m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + x));
+		__m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + x + 8));
+		__m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + x));
+		__m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + x + 8));
+		// Pixels 0, 1 | 4, 5 and 2, 3 | 6, 7 of each register in 16-bit components
+		__m256i a00 = _mm256_unpacklo_epi8(a0, zero);
+		__m256i a01 = _mm256_unpackhi_epi8(a0, zero);
+		__m256i a10 = _mm256_unpacklo_epi8(a1, zero);
+		__m256i a11 = _mm256_unpackhi_epi8(a1, zero);
+		__m256i b00 = _mm256_unpacklo_epi8(b0, zero);
+		__m256i b01 = _mm256_unpackhi_epi8(b0, zero);
+		__m256i b10 = _mm256_unpacklo_epi8(b1, zero);
+		__m256i b11 = _mm256_unpackhi_epi8(b1, zero);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(y0 + x),
+						 PackLumaAvx2(LumaAvx2(a00, a01, y_coefficients, y_bias),
+									  LumaAvx2(a10, a11, y_coefficients, y_bias)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(y1 + x),
+						 PackLumaAvx2(LumaAvx2(b00, b01, y_coefficients, y_bias),
+									  LumaAvx2(b10, b11, y_coefficients, y_bias)));
+
+		__m256i v00 = _mm256_add_epi16(a00, b00);
+		__m256i v01 = _mm256_add_epi16(a01, b01);
+		__m256i v10 = _mm256_add_epi16(a10, b10);
+		__m256i v11 = _mm256_add_epi16(a11, b11);
+		__m256i blocks0 = _mm256_add_epi16(_mm256_unpacklo_epi64(v00, v01), _mm256_unpackhi_epi64(v00, v01));
+		__m256i blocks1 = _mm256_add_epi16(_mm256_unpacklo_epi64(v10, v11), _mm256_unpackhi_epi64(v10, v11));
+		__m256i cu = _mm256_permutevar8x32_epi32(ChromaAvx2(blocks0, blocks1, u_coefficients, chroma_bias), block_order);
+		__m256i cv = _mm256_permutevar8x32_epi32(ChromaAvx2(blocks0, blocks1, v_coefficients, chroma_bias), block_order);
+		if(Nv12) {
+			// Interleaving within lanes keeps blocks 0-3 low and 4-7 high
+			__m256i uv = _mm256_packs_epi32(_mm256_unpacklo_epi32(cu, cv), _mm256_unpackhi_epi32(cu, cv));
+			__m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(uv, uv), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(u + x), _mm256_castsi256_si128(bytes));
+		} else {
+			__m128i u_words = _mm256_castsi256_si128(
+				_mm256_permute4x64_epi64(_mm256_packs_epi32(cu, cu), _MM_SHUFFLE(3, 1, 2, 0)));
+			__m128i v_words = _mm256_castsi256_si128(
+				_mm256_permute4x64_epi64(_mm256_packs_epi32(cv, cv), _MM_SHUFFLE(3, 1, 2, 0)));
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), _mm_packus_epi16(u_words, u_words));
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), _mm_packus_epi16(v_words, v_words));
+		}
+	}
+	RowPairTail<Nv12>(row0, row1, x, width, c, y0, y1, u, v);
+}
+
+// Lanes hold pixels 0-3 and 8-11 in luma_low, 4-7 and 12-15 in luma_high
+TARGET_AVX2 static inline __m256i ComponentAvx2(__m256i luma_low, __m256i luma_high, __m256i terms) {
+	__m256i low = _mm256_srai_epi32(_mm256_add_epi32(luma_low, _mm256_unpacklo_epi32(terms, terms)), 13);
+	__m256i high = _mm256_srai_epi32(_mm256_add_epi32(luma_high, _mm256_unpackhi_epi32(terms, terms)), 13);
+	return _mm256_packs_epi32(low, high);
+}
+
+TARGET_AVX2 static void RowAvx2(const uint8_t *y, const uint8_t *uv, uint32_t width, const YuvCoefficients &c,
+								uint32_t *bgra) {
+	__m256i y_offset = _mm256_set1_epi16(c.y_offset);
+	__m256i chroma_offset = _mm256_set1_epi16(128);
+	__m256i ones = _mm256_set1_epi16(1);
+	__m256i alpha = _mm256_set1_epi16(0xFF);
+	__m256i y_coefficients = _mm256_set1_epi32(Pair16(c.y, 1 << 12));
+	__m256i b_coefficients = _mm256_set1_epi32(Pair16(c.bu, 0));
+	__m256i g_coefficients = _mm256_set1_epi32(Pair16(c.gu, c.gv));
+	__m256i r_coefficients = _mm256_set1_epi32(Pair16(0, c.rv));
+
+	uint32_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		__m256i luma = _mm256_sub_epi16(
+			_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x))), y_offset);
+		__m256i luma_low = _mm256_madd_epi16(_mm256_unpacklo_epi16(luma, ones), y_coefficients);
+		__m256i luma_high = _mm256_madd_epi16(_mm256_unpackhi_epi16(luma, ones), y_coefficients);
+		__m256i chroma = _mm256_sub_epi16(
+			_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(uv + x))), chroma_offset);
+		__m256i b = ComponentAvx2(luma_low, luma_high, _mm256_madd_epi16(chroma, b_coefficients));
+		__m256i g = ComponentAvx2(luma_low, luma_high, _mm256_madd_epi16(chroma, g_coefficients));
+		__m256i r = ComponentAvx2(luma_low, luma_high, _mm256_madd_epi16(chroma, r_coefficients));
+
+		__m256i bg = _mm256_packus_epi16(b, g);
+		__m256i ra = _mm256_packus_epi16(r, alpha);
+		bg = _mm256_unpacklo_epi8(bg, _mm256_srli_si256(bg, 8));
+		ra = _mm256_unpacklo_epi8(ra, _mm256_srli_si256(ra, 8));
+		// Pixels 0-3 and 8-11, then 4-7 and 12-15
+		__m256i low = _mm256_unpacklo_epi16(bg, ra);
+		__m256i high = _mm256_unpackhi_epi16(bg, ra);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(bgra + x), _mm256_permute2x128_si256(low, high, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(bgra + x + 8), _mm256_permute2x128_si256(low, high, 0x31));
+	}
+	RowTail(y, uv, x, width, c, bgra);
+}
+#endif
+
+#ifdef COLOR_NEON
+static inline int16x4_t LumaNeon(int16x4_t b, int16x4_t g, int16x4_t r, const ColorCoefficients &c) {
+	int32x4_t sums = vmull_n_s16(b, c.y[0]);
+	sums = vmlal_n_s16(sums, g, c.y[1]);
+	sums = vmlal_n_s16(sums, r, c.y[2]);
+	return vmovn_s32(vshrq_n_s32(vaddq_s32(sums, vdupq_n_s32(c.y_bias)), 15));
+}
+
+static inline uint8x16_t LumaRowNeon(const uint8x16x4_t &pixels, const ColorCoefficients &c) {
+	int16x8_t b_low = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(pixels.val[0])));
+	int16x8_t g_low = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(pixels.val[1])));
+	int16x8_t r_low = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(pixels.val[2])));
+	int16x8_t b_high = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(pixels.val[0])));
+	int16x8_t g_high = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(pixels.val[1])));
+	int16x8_t r_high = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(pixels.val[2])));
+	int16x8_t low = vcombine_s16(LumaNeon(vget_low_s16(b_low), vget_low_s16(g_low), vget_low_s16(r_low), c),
+								 LumaNeon(vget_high_s16(b_low), vget_high_s16(g_low), vget_high_s16(r_low), c));
+	int16x8_t high = vcombine_s16(LumaNeon(vget_low_s16(b_high), vget_low_s16(g_high), vget_low_s16(r_high), c),
+								  LumaNeon(vget_high_s16(b_high), vget_high_s16(g_high), vget_high_s16(r_high), c));
+	return vcombine_u8(vqmovun_s16(low), vqmovun_s16(high));
+}
+
+// Chroma of eight blocks from their sums of each component
+static inline uint8x8_t ChromaNeon(int16x8_t b, int16x8_t g, int16x8_t r, const int16_t *coefficients) {
+	int32x4_t bias = vdupq_n_s32(CHROMA_BIAS);
+	int32x4_t low = vmull_n_s16(vget_low_s16(b), coefficients[0]);
+	low = vmlal_n_s16(low, vget_low_s16(g), coefficients[1]);
+	low = vmlal_n_s16(low, vget_low_s16(r), coefficients[2]);
+	int32x4_t high = vmull_n_s16(vget_high_s16(b), coefficients[0]);
+	high = vmlal_n_s16(high, vget_high_s16(g), coefficients[1]);
+	high = vmlal_n_s16(high, vget_high_s16(r), coefficients[2]);
+	int16x8_t words = vcombine_s16(vmovn_s32(vshrq_n_s32(vaddq_s32(low, bias), 17)),
+								   vmovn_s32(vshrq_n_s32(vaddq_s32(high, bias), 17)));
+	return vqmovun_s16(words);
+}
+
+template<bool Nv12>
+static void RowPairNeon(const uint32_t *row0, const uint32_t *row1, uint32_t width, const ColorCoefficients &c,
+						uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v) {
+	uint32_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		// Loads deinterleave into B, G, R and A
+		uint8x16x4_t a = vld4q_u8(reinterpret_cast<const uint8_t *>(row0 + x));
+		uint8x16x4_t b = vld4q_u8(reinterpret_cast<const uint8_t *>(row1 + x));
+		vst1q_u8(y0 + x, LumaRowNeon(a, c));
+		vst1q_u8(y1 + x, LumaRowNeon(b, c));
+
+		int16x8_t sum_b = vreinterpretq_s16_u16(vaddq_u16(vpaddlq_u8(a.val[0]), vpaddlq_u8(b.val[0])));
+		int16x8_t sum_g = vreinterpretq_s16_u16(vaddq_u16(vpaddlq_u8(a.val[1]), vpaddlq_u8(b.val[1])));
+		int16x8_t sum_r = vreinterpretq_s16_u16(vaddq_u16(vpaddlq_u8(a.val[2]), vpaddlq_u8(b.val[2])));
+		uint8x8_t cu = ChromaNeon(sum_b, sum_g, sum_r, c.u);
+		uint8x8_t cv = ChromaNeon(sum_b, sum_g, sum_r, c.v);
+		if(Nv12) {
+			uint8x8x2_t uv = { { cu, cv } };
+			vst2_u8(u + x, uv);
+		} else {
+			vst1_u8(u + x / 2, cu);
+			vst1_u8(v + x / 2, cv);
+		}
+	}
+	RowPairTail<Nv12>(row0, row1, x, width, c, y0, y1, u, v);
+}
+
+// One component of 16 pixels, the terms of chroma samples 0-3 and 4-7 cover two pixels each
+static inline uint8x16_t ComponentNeon(const int32x4_t *luma, int32x4_t terms_low, int32x4_t terms_high) {
+	int32x4_t pixels0 = vshrq_n_s32(vaddq_s32(luma[0], vzip1q_s32(terms_low, terms_low)), 13);
+	int32x4_t pixels1 = vshrq_n_s32(vaddq_s32(luma[1], vzip2q_s32(terms_low, terms_low)), 13);
+	int32x4_t pixels2 = vshrq_n_s32(vaddq_s32(luma[2], vzip1q_s32(terms_high, terms_high)), 13);
+	int32x4_t pixels3 = vshrq_n_s32(vaddq_s32(luma[3], vzip2q_s32(terms_high, terms_high)), 13);
+	return vcombine_u8(vqmovun_s16(vcombine_s16(vmovn_s32(pixels0), vmovn_s32(pixels1))),
+					   vqmovun_s16(vcombine_s16(vmovn_s32(pixels2), vmovn_s32(pixels3))));
+}
+
+static void RowNeon(const uint8_t *y, const uint8_t *uv, uint32_t width, const YuvCoefficients &c, uint32_t *bgra) {
+	uint8x8_t y_offset = vdup_n_u8(static_cast<uint8_t>(c.y_offset));
+	uint8x8_t chroma_offset = vdup_n_u8(128);
+	int32x4_t rounding = vdupq_n_s32(1 << 12);
+
+	uint32_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		// Differences wrap in 16 bits, which reads back as signed
+		uint8x16_t y_bytes = vld1q_u8(y + x);
+		int16x8_t luma_low = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(y_bytes), y_offset));
+		int16x8_t luma_high = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(y_bytes), y_offset));
+		int32x4_t luma[4] = {
+			vmlal_n_s16(rounding, vget_low_s16(luma_low), c.y),
+			vmlal_n_s16(rounding, vget_high_s16(luma_low), c.y),
+			vmlal_n_s16(rounding, vget_low_s16(luma_high), c.y),
+			vmlal_n_s16(rounding, vget_high_s16(luma_high), c.y)
+		};
+		// Loads deinterleave into U and V
+		uint8x8x2_t uv_bytes = vld2_u8(uv + x);
+		int16x8_t cu = vreinterpretq_s16_u16(vsubl_u8(uv_bytes.val[0], chroma_offset));
+		int16x8_t cv = vreinterpretq_s16_u16(vsubl_u8(uv_bytes.val[1], chroma_offset));
+
+		uint8x16x4_t pixels;
+		pixels.val[0] = ComponentNeon(luma, vmull_n_s16(vget_low_s16(cu), c.bu), vmull_n_s16(vget_high_s16(cu), c.bu));
+		pixels.val[1] = ComponentNeon(luma, vmlal_n_s16(vmull_n_s16(vget_low_s16(cu), c.gu), vget_low_s16(cv), c.gv),
+									  vmlal_n_s16(vmull_n_s16(vget_high_s16(cu), c.gu), vget_high_s16(cv), c.gv));
+		pixels.val[2] = ComponentNeon(luma, vmull_n_s16(vget_low_s16(cv), c.rv), vmull_n_s16(vget_high_s16(cv), c.rv));
+		pixels.val[3] = vdupq_n_u8(0xFF);
+		vst4q_u8(reinterpret_cast<uint8_t *>(bgra + x), pixels);
+	}
+	RowTail(y, uv, x, width, c, bgra);
+}
+#endif
+
+static bool CpuSupports(ColorKernel kernel) {
+	if(kernel == ColorKernel::Scalar) {
+		return true;
+	}
+#if defined(COLOR_X86)
+	if(kernel == ColorKernel::Neon) {
+		return false;
+	}
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	if(kernel == ColorKernel::Sse41) {
+		return (info[2] & (1 << 19)) != 0;
+	}
+	// AVX state has to be enabled by the OS as well
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	return avx && (info[1] & (1 << 5)) != 0;
+#else
+	if(kernel == ColorKernel::Sse41) {
+		return __builtin_cpu_supports("sse4.1");
+	}
+	return __builtin_cpu_supports("avx2");
+#endif
+#elif defined(COLOR_NEON)
+	// NEON is part of AArch64
+	return kernel == ColorKernel::Neon;
+#else
+	return false;
+#endif
+}
+
+void ColorInitialize() {
+	if(state.initialized) {
+		return;
+	}
+	if(!ColorSelectKernel(ColorKernel::Avx2) && !ColorSelectKernel(ColorKernel::Sse41) &&
+	   !ColorSelectKernel(ColorKernel::Neon)) {
+		ColorSelectKernel(ColorKernel::Scalar);
+	}
+}
+
+bool ColorSelectKernel(ColorKernel kernel) {
+	if(!CpuSupports(kernel)) {
+		return false;
+	}
+
+	state.initialized = true;
+	state.kernel = kernel;
+	switch(kernel) {
+#ifdef COLOR_X86
+	case ColorKernel::Avx2:
+		state.nv12_rows = RowPairAvx2<true>;
+		state.i420_rows = RowPairAvx2<false>;
+		state.bgra_rows = RowAvx2;
+		break;
+	case ColorKernel::Sse41:
+		state.nv12_rows = RowPairSse41<true>;
+		state.i420_rows = RowPairSse41<false>;
+		state.bgra_rows = RowSse41;
+		break;
+#endif
+#ifdef COLOR_NEON
+	case ColorKernel::Neon:
+		state.nv12_rows = RowPairNeon<true>;
+		state.i420_rows = RowPairNeon<false>;
+		state.bgra_rows = RowNeon;
+		break;
+#endif
+	default:
+		state.nv12_rows = RowPairScalar<true>;
+		state.i420_rows = RowPairScalar<false>;
+		state.bgra_rows = RowScalar;
+		break;
+	}
+	return true;
+}
+
+ColorKernel ColorSelectedKernel() {
+	return state.kernel;
+}
+
+const char *ColorKernelName(ColorKernel kernel) {
+	switch(kernel) {
+	case ColorKernel::Sse41:
+		return "sse4.1";
+	case ColorKernel::Avx2:
+		return "avx2";
+	case ColorKernel::Neon:
+		return "neon";
+	default:
+		return "scalar";
+	}
+}
+
+// Conversions may run before ColorInitialize, the first one selects the
+// kernel. Function statics are initialized once even with several threads
+static void EnsureInitialized() {
+	static const bool initialized = (ColorInitialize(), true);
+	(void)initialized;
+}
+
+// Rows or row pairs per band when converting on a pool, small enough for
+// every thread to get several bands
+constexpr uint32_t MIN_BAND_SIZE = 8;
+constexpr uint32_t BANDS_PER_THREAD = 4;
+
+static uint32_t BandSize(uint32_t count, WorkerPool *pool) {
+	if(!pool) {
+		return count;
+	}
+	uint32_t bands = (pool->thread_count + 1) * BANDS_PER_THREAD;
+	uint32_t band_size = (count + bands - 1) / bands;
+	return band_size < MIN_BAND_SIZE ? MIN_BAND_SIZE : band_size;
+}
+
+static void RunBands(uint32_t count, uint32_t band_size, void (*band_job)(void *, uint32_t), void *user_data,
+					 WorkerPool *pool) {
+	uint32_t band_count = band_size != 0 ? (count + band_size - 1) / band_size : 0;
+	if(pool) {
+		pool->Run(band_count, band_job, user_data);
+	}
+	else {
+		for(uint32_t band = 0; band < band_count; ++band) {
+			band_job(user_data, band);
+		}
+	}
+}
+
+struct ConvertJob {
+	const uint32_t *bgra;
+	uint32_t stride;
+	uint32_t width;
+	uint32_t height;
+	ColorCoefficients coefficients;
+	bool nv12;
+	uint8_t *y;
+	uint32_t y_stride;
+	uint8_t *u;
+	uint32_t u_stride;
+	uint8_t *v;
+	uint32_t v_stride;
+	uint32_t band_row_pairs;
+};
+
+static void ConvertBand(void *user_data, uint32_t band) {
+	const ConvertJob &job = *static_cast<const ConvertJob *>(user_data);
+	uint32_t row_pairs = (job.height + 1) / 2;
+	uint32_t first_pair = band * job.band_row_pairs;
+	uint32_t end_pair = first_pair + job.band_row_pairs < row_pairs ? first_pair + job.band_row_pairs : row_pairs;
+	RowPairFunction rows = job.nv12 ? state.nv12_rows : state.i420_rows;
+	for(uint32_t pair = first_pair; pair < end_pair; ++pair) {
+		uint32_t row = pair * 2;
+		const uint32_t *row0 = job.bgra + static_cast<size_t>(row) * job.stride;
+		uint8_t *y0 = job.y + static_cast<size_t>(row) * job.y_stride;
+		uint8_t *u = job.u + static_cast<size_t>(pair) * job.u_stride;
+		uint8_t *v = job.v ? job.v + static_cast<size_t>(pair) * job.v_stride : nullptr;
+		if(row + 1 < job.height) {
+			rows(row0, row0 + job.stride, job.width, job.coefficients, y0, y0 + job.y_stride, u, v);
+		}
+		// An odd last row is its own second row
+		else if(job.nv12) {
+			RowPairScalar<true>(row0, row0, job.width, job.coefficients, y0, nullptr, u, v);
+		}
+		else {
+			RowPairScalar<false>(row0, row0, job.width, job.coefficients, y0, nullptr, u, v);
+		}
+	}
+}
+
+static void Convert(ConvertJob &job, WorkerPool *pool) {
+	EnsureInitialized();
+	uint32_t row_pairs = (job.height + 1) / 2;
+	job.band_row_pairs = BandSize(row_pairs, pool);
+	RunBands(row_pairs, job.band_row_pairs, ConvertBand, &job, pool);
+}
+
+struct BgraJob {
+	const uint8_t *y;
+	uint32_t y_stride;
+	const uint8_t *uv;
+	uint32_t uv_stride;
+	uint32_t width;
+	uint32_t height;
+	YuvCoefficients coefficients;
+	uint32_t *bgra;
+	uint32_t stride;
+	uint32_t band_rows;
+};
+
+static void BgraBand(void *user_data, uint32_t band) {
+	const BgraJob &job = *static_cast<const BgraJob *>(user_data);
+	uint32_t first_row = band * job.band_rows;
+	uint32_t end_row = first_row + job.band_rows < job.height ? first_row + job.band_rows : job.height;
+	for(uint32_t row = first_row; row < end_row; ++row) {
+		state.bgra_rows(job.y + static_cast<size_t>(row) * job.y_stride,
+						job.uv + static_cast<size_t>(row / 2) * job.uv_stride, job.width, job.coefficients,
+						job.bgra + static_cast<size_t>(row) * job.stride);
+	}
+}
+
+void ConvertBgraToNv12(const uint32_t *bgra, uint32_t stride, uint32_t width, uint32_t height, ColorMatrix matrix,
+					   ColorRange range, uint8_t *y, uint32_t y_stride, uint8_t *uv, uint32_t uv_stride,
+					   WorkerPool *pool) {
+	ConvertJob job = {
+		.bgra = bgra,
+		.stride = stride,
+		.width = width,
+		.height = height,
+		.coefficients = MakeCoefficients(matrix, range),
+		.nv12 = true,
+		.y = y,
+		.y_stride = y_stride,
+		.u = uv,
+		.u_stride = uv_stride,
+		.v = nullptr,
+		.v_stride = 0,
+		.band_row_pairs = 0
+	};
+	Convert(job, pool);
+}
+
+void ConvertBgraToI420(const uint32_t *bgra, uint32_t stride, uint32_t width, uint32_t height, ColorMatrix matrix,
+					   ColorRange range, uint8_t *y, uint32_t y_stride, uint8_t *u, uint32_t u_stride, uint8_t *v,
+					   uint32_t v_stride, WorkerPool *pool) {
+	ConvertJob job = {
+		.bgra = bgra,
+		.stride = stride,
+		.width = width,
+		.height = height,
+		.coefficients = MakeCoefficients(matrix, range),
+		.nv12 = false,
+		.y = y,
+		.y_stride = y_stride,
+		.u = u,
+		.u_stride = u_stride,
+		.v = v,
+		.v_stride = v_stride,
+		.band_row_pairs = 0
+	};
+	Convert(job, pool);
+}
+
+void ConvertNv12ToBgra(const uint8_t *y, uint32_t y_stride, const uint8_t *uv, uint32_t uv_stride, uint32_t width,
+					   uint32_t height, ColorMatrix matrix, ColorRange range, uint32_t *bgra, uint32_t stride,
+					   WorkerPool *pool) {
+	EnsureInitialized();
+	BgraJob job = {
+		.y = y,
+		.y_stride = y_stride,
+		.uv = uv,
+		.uv_stride = uv_stride,
+		.width = width,
+		.height = height,
+		.coefficients = ColorYuvCoefficients(matrix, range),
+		.bgra = bgra,
+		.stride = stride,
+		.band_rows = BandSize(height, pool)
+	};
+	RunBands(height, job.band_rows, BgraBand, &job, pool);
+}
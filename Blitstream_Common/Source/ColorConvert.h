@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+
+// Declared only, this header is also compiled into a CUDA kernel
+struct WorkerPool;
+
+// Conversion of BGRA pixels to 4:2:0 YUV in NV12 or I420 layout and of NV12
+// back to BGRA. Every CPU kernel gives exactly the same bytes. Luma is computed
+// per pixel with Q15 coefficients, chroma from the sum of each 2x2 block, so
+// a block's chroma is that of its average color. An odd last column or row
+// repeats its pixels into the missing half of the block. Alpha is ignored
+// one way and opaque the other
+
+// The per pixel math of the way back is shared with the CUDA kernel
+#ifdef __CUDACC__
+#define COLOR_FUNCTION __host__ __device__ inline
+#else
+#define COLOR_FUNCTION inline
+#endif
+
+enum class ColorMatrix : uint32_t {
+	Bt601,
+	Bt709
+};
+
+enum class ColorRange : uint32_t {
+	// Y from 16 to 235, U and V from 16 to 240
+	Limited,
+	// Every component from 0 to 255
+	Full
+};
+
+enum class ColorKernel : uint32_t {
+	Scalar,
+	// 8 pixels at a time, of two rows when going to YUV
+	Sse41,
+	// 16 pixels at a time, of two rows when going to YUV
+	Avx2,
+	// 16 pixels at a time, of two rows when going to YUV
+	Neon
+};
+
+// Selects the fastest kernel the CPU supports. The first conversion calls it
+// if nothing did before, calling it again or after ColorSelectKernel is harmless
+void ColorInitialize();
+
+// Overrides the kernel for benchmarking, false if the CPU does not support it
+bool ColorSelectKernel(ColorKernel kernel);
+ColorKernel ColorSelectedKernel();
+const char *ColorKernelName(ColorKernel kernel);
+
+// Source stride in pixels, destination strides in bytes. The U and V planes
+// and the interleaved UV plane have (height + 1) / 2 rows. With a pool,
+// bands of rows are converted on its threads
+void ConvertBgraToNv12(const uint32_t *bgra, uint32_t stride, uint32_t width, uint32_t height, ColorMatrix matrix,
+					   ColorRange range, uint8_t *y, uint32_t y_stride, uint8_t *uv, uint32_t uv_stride,
+					   WorkerPool *pool);
+void ConvertBgraToI420(const uint32_t *bgra, uint32_t stride, uint32_t width, uint32_t height, ColorMatrix matrix,
+					   ColorRange range, uint8_t *y, uint32_t y_stride, uint8_t *u, uint32_t u_stride, uint8_t *v,
+					   uint32_t v_stride, WorkerPool *pool);
+
+// Q13 factors of the way back. B, G and R are the luma term plus their
+// chroma terms shifted down by 13, with U and V centered on 0
+struct YuvCoefficients {
+	int16_t y;
+	int16_t y_offset;
+	int16_t bu;
+	int16_t gu;
+	int16_t gv;
+	int16_t rv;
+};
+
+YuvCoefficients ColorYuvCoefficients(ColorMatrix matrix, ColorRange range);
+
+COLOR_FUNCTION uint8_t ColorClamp(int32_t value) {
+	return static_cast<uint8_t>(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+COLOR_FUNCTION uint32_t YuvToBgra(const YuvCoefficients &c, uint8_t y, uint8_t u, uint8_t v) {
+	int32_t luma = c.y * (y - c.y_offset) + (1 << 12);
+	int32_t cu = u - 128;
+	int32_t cv = v - 128;
+	uint32_t b = ColorClamp((luma + c.bu * cu) >> 13);
+	uint32_t g = ColorClamp((luma + c.gu * cu + c.gv * cv) >> 13);
+	uint32_t r = ColorClamp((luma + c.rv * cv) >> 13);
+	return b | (g << 8) | (r << 16) | 0xFF000000;
+}
+
+// Source strides in bytes, destination stride in pixels. The UV plane has
+// (height + 1) / 2 rows of (width + 1) / 2 pairs
+void ConvertNv12ToBgra(const uint8_t *y, uint32_t y_stride, const uint8_t *uv, uint32_t uv_stride, uint32_t width,
+					   uint32_t height, ColorMatrix matrix, ColorRange range, uint32_t *bgra, uint32_t stride,
+					   WorkerPool *pool);
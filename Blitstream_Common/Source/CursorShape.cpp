@@ -0,0 +1,114 @@
+#include "CursorShape.h"
+#include <cstring>
+
+// Longest run or literal a token covers
+static constexpr uint32_t MAX_TOKEN_PIXELS = 128;
+static constexpr uint8_t TOKEN_RUN = 0x80;
+
+uint64_t CursorShapeHash(const uint32_t *pixels, uint32_t width, uint32_t height, uint32_t hot_x, uint32_t hot_y) {
+	// FNV-1a over 32-bit words, shapes change far too rarely for it to matter
+	// that it is not the fastest
+	constexpr uint64_t FNV_PRIME = 0x100000001B3ull;
+	uint64_t hash = 0xCBF29CE484222325ull;
+	uint32_t words[] = { width, height, hot_x, hot_y };
+	for(uint32_t word : words) {
+		hash = (hash ^ word) * FNV_PRIME;
+	}
+	uint32_t count = width * height;
+	for(uint32_t i = 0; i < count; ++i) {
+		hash = (hash ^ pixels[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+uint32_t CursorCompress(const uint32_t *pixels, uint32_t count, uint8_t *data) {
+	uint32_t size = 0;
+	uint32_t i = 0;
+	while(i < count) {
+		uint32_t run = 1;
+		while(i + run < count && run < MAX_TOKEN_PIXELS && pixels[i + run] == pixels[i]) {
+			++run;
+		}
+		if(run > 1) {
+			data[size++] = static_cast<uint8_t>(TOKEN_RUN | (run - 1));
+			memcpy(data + size, pixels + i, 4);
+			size += 4;
+			i += run;
+			continue;
+		}
+
+		// Literals up to where a run of at least two starts
+		uint32_t literal = 1;
+		while(i + literal < count && literal < MAX_TOKEN_PIXELS &&
+			  !(i + literal + 1 < count && pixels[i + literal] == pixels[i + literal + 1])) {
+			++literal;
+		}
+		data[size++] = static_cast<uint8_t>(literal - 1);
+		memcpy(data + size, pixels + i, literal * 4);
+		size += literal * 4;
+		i += literal;
+	}
+	return size;
+}
+
+bool CursorDecompress(const uint8_t *data, uint32_t size, uint32_t *pixels, uint32_t count) {
+	uint32_t position = 0;
+	uint32_t i = 0;
+	while(position < size) {
+		uint8_t token = data[position++];
+		uint32_t length = (token & ~TOKEN_RUN) + 1u;
+		if(length > count - i) {
+			return false;
+		}
+		if(token & TOKEN_RUN) {
+			if(size - position < 4) {
+				return false;
+			}
+			uint32_t pixel;
+			memcpy(&pixel, data + position, 4);
+			position += 4;
+			for(uint32_t j = 0; j < length; ++j) {
+				pixels[i + j] = pixel;
+			}
+		}
+		else {
+			if(size - position < length * 4) {
+				return false;
+			}
+			memcpy(pixels + i, data + position, length * 4);
+			position += length * 4;
+		}
+		i += length;
+	}
+	return i == count;
+}
+
+void CursorCache::Initialize() {
+	for(uint32_t i = 0; i < CURSOR_CACHE_SIZE; ++i) {
+		hashes[i] = 0;
+		last_used[i] = 0;
+	}
+	tick = 0;
+}
+
+uint32_t CursorCache::Find(uint64_t hash) {
+	for(uint32_t i = 0; i < CURSOR_CACHE_SIZE; ++i) {
+		if(last_used[i] != 0 && hashes[i] == hash) {
+			last_used[i] = ++tick;
+			return i;
+		}
+	}
+	return CURSOR_CACHE_MISS;
+}
+
+uint32_t CursorCache::Insert(uint64_t hash) {
+	uint32_t slot = 0;
+	for(uint32_t i = 1; i < CURSOR_CACHE_SIZE; ++i) {
+		if(last_used[i] < last_used[slot]) {
+			slot = i;
+		}
+	}
+	hashes[slot] = hash;
+	last_used[slot] = ++tick;
+	return slot;
+}
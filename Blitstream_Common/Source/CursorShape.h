@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include "Protocol.h"
+
+// Cursor shapes as sent on the cursor channel. Pixels are run length encoded:
+// a token byte with the top bit set repeats the following pixel
+// (token & 0x7F) + 1 times, any other token is followed by token + 1 literal
+// pixels. Most of a cursor is transparent or one solid color, so a 32x32
+// shape typically shrinks from 4 KB to a few hundred bytes
+
+// Returned by CursorCache::Find for a shape the receiver does not have
+constexpr uint32_t CURSOR_CACHE_MISS = UINT32_MAX;
+
+// Identifies a shape by its pixels, size and hot spot
+uint64_t CursorShapeHash(const uint32_t *pixels, uint32_t width, uint32_t height, uint32_t hot_x, uint32_t hot_y);
+
+// Encodes count pixels into data, which must hold CursorCompressBound(count)
+// bytes, and returns the bytes used
+uint32_t CursorCompress(const uint32_t *pixels, uint32_t count, uint8_t *data);
+constexpr uint32_t CursorCompressBound(uint32_t count) {
+	return count * 4 + (count + 127) / 128;
+}
+static_assert(CursorCompressBound(MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION) == MAX_CURSOR_DATA_SIZE,
+			  "MAX_CURSOR_DATA_SIZE does not match the encoding");
+// Returns false unless data decodes to exactly count pixels
+bool CursorDecompress(const uint8_t *data, uint32_t size, uint32_t *pixels, uint32_t count);
+
+// The sender's copy of which shape the receiver holds in which slot. The
+// receiver simply stores every shape in the slot it comes with, so only the
+// sender decides what is evicted
+struct CursorCache {
+	uint64_t hashes[CURSOR_CACHE_SIZE];
+	// Tick of the last use, 0 for an empty slot
+	uint64_t last_used[CURSOR_CACHE_SIZE];
+	uint64_t tick;
+
+	void Initialize();
+
+	// Returns the slot the receiver has the shape in and marks it used,
+	// CURSOR_CACHE_MISS if the shape has to be sent
+	uint32_t Find(uint64_t hash);
+	// Picks the least recently used slot for a shape about to be sent
+	uint32_t Insert(uint64_t hash);
+};
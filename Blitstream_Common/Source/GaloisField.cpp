@@ -0,0 +1,239 @@
+#include "GaloisField.h"
+#include <cassert>
+#include <mutex>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define GF_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts any intrinsic without a matching /arch, GCC and Clang have to
+// be told per function
+#if defined(GF_X86) && !defined(_MSC_VER)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+constexpr uint32_t GF_POLYNOMIAL = 0x11D;
+
+using RegionFunction = void (*)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size);
+
+struct GaloisTables {
+	GfKernel kernel;
+	RegionFunction multiply_region;
+	RegionFunction multiply_add_region;
+
+	// Doubled so exp[log[a] + log[b]] needs no modulo
+	uint8_t exp[512];
+	uint8_t log[256];
+	uint8_t multiply[256][256];
+	// Products of c with 0x0..0xF followed by products with 0x00..0xF0
+	alignas(32) uint8_t nibbles[256][32];
+};
+
+static GaloisTables tables;
+// Every viewer and client with FEC calls GfInitialize from its own thread
+static std::once_flag tables_once;
+
+uint8_t GfMultiply(uint8_t a, uint8_t b) {
+	return tables.multiply[a][b];
+}
+
+uint8_t GfInverse(uint8_t a) {
+	assert(a != 0 && "Zero has no inverse");
+	return tables.exp[255 - tables.log[a]];
+}
+
+static void MultiplyRegionScalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	const uint8_t *row = tables.multiply[c];
+	for(size_t i = 0; i < size; ++i) {
+		dst[i] = row[src[i]];
+	}
+}
+
+static void MultiplyAddRegionScalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	const uint8_t *row = tables.multiply[c];
+	for(size_t i = 0; i < size; ++i) {
+		dst[i] ^= row[src[i]];
+	}
+}
+
+#ifdef GF_X86
+// c * x = c * (x & 0xF) ^ c * (x & 0xF0), each half is a 16 entry table lookup
+TARGET_SSSE3 static inline __m128i MultiplySsse3(__m128i x, __m128i low_table, __m128i high_table, __m128i mask) {
+	__m128i low = _mm_and_si128(x, mask);
+	__m128i high = _mm_and_si128(_mm_srli_epi64(x, 4), mask);
+	return _mm_xor_si128(_mm_shuffle_epi8(low_table, low), _mm_shuffle_epi8(high_table, high));
+}
+
+TARGET_SSSE3 static void MultiplyRegionSsse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	__m128i low_table = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c]));
+	__m128i high_table = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c] + 16));
+	__m128i mask = _mm_set1_epi8(0x0F);
+
+	size_t i = 0;
+	for(; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), MultiplySsse3(x, low_table, high_table, mask));
+	}
+	MultiplyRegionScalar(dst + i, src + i, c, size - i);
+}
+
+TARGET_SSSE3 static void MultiplyAddRegionSsse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	__m128i low_table = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c]));
+	__m128i high_table = _mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c] + 16));
+	__m128i mask = _mm_set1_epi8(0x0F);
+
+	size_t i = 0;
+	for(; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+						 _mm_xor_si128(y, MultiplySsse3(x, low_table, high_table, mask)));
+	}
+	MultiplyAddRegionScalar(dst + i, src + i, c, size - i);
+}
+
+// VPSHUFB looks up within each 128 bit lane, so the tables are repeated in both
+TARGET_AVX2 static inline __m256i MultiplyAvx2(__m256i x, __m256i low_table, __m256i high_table, __m256i mask) {
+	__m256i low = _mm256_and_si256(x, mask);
+	__m256i high = _mm256_and_si256(_mm256_srli_epi64(x, 4), mask);
+	return _mm256_xor_si256(_mm256_shuffle_epi8(low_table, low), _mm256_shuffle_epi8(high_table, high));
+}
+
+TARGET_AVX2 static void MultiplyRegionAvx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	__m256i low_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c])));
+	__m256i high_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c] + 16)));
+	__m256i mask = _mm256_set1_epi8(0x0F);
+
+	size_t i = 0;
+	for(; i + 32 <= size; i += 32) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), MultiplyAvx2(x, low_table, high_table, mask));
+	}
+	MultiplyRegionScalar(dst + i, src + i, c, size - i);
+}
+
+TARGET_AVX2 static void MultiplyAddRegionAvx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	__m256i low_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c])));
+	__m256i high_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(tables.nibbles[c] + 16)));
+	__m256i mask = _mm256_set1_epi8(0x0F);
+
+	size_t i = 0;
+	for(; i + 32 <= size; i += 32) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+		__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+							_mm256_xor_si256(y, MultiplyAvx2(x, low_table, high_table, mask)));
+	}
+	MultiplyAddRegionScalar(dst + i, src + i, c, size - i);
+}
+#endif
+
+static bool CpuSupports(GfKernel kernel) {
+	if(kernel == GfKernel::Scalar) {
+		return true;
+	}
+#ifdef GF_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	// AVX state has to be enabled by the OS as well
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	bool avx2 = avx && (info[1] & (1 << 5)) != 0;
+#else
+	bool ssse3 = __builtin_cpu_supports("ssse3");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	return kernel == GfKernel::Ssse3 ? ssse3 : avx2;
+#else
+	return false;
+#endif
+}
+
+static void BuildTables() {
+	uint32_t value = 1;
+	for(uint32_t i = 0; i < 255; ++i) {
+		tables.exp[i] = static_cast<uint8_t>(value);
+		tables.exp[i + 255] = static_cast<uint8_t>(value);
+		tables.log[value] = static_cast<uint8_t>(i);
+		value <<= 1;
+		value = value & 0x100 ? value ^ GF_POLYNOMIAL : value;
+	}
+	tables.exp[510] = tables.exp[0];
+	tables.exp[511] = tables.exp[1];
+
+	for(uint32_t a = 0; a < 256; ++a) {
+		for(uint32_t b = 0; b < 256; ++b) {
+			tables.multiply[a][b] = a && b ? tables.exp[tables.log[a] + tables.log[b]] : 0;
+		}
+		for(uint32_t x = 0; x < 16; ++x) {
+			tables.nibbles[a][x] = tables.multiply[a][x];
+			tables.nibbles[a][16 + x] = tables.multiply[a][x << 4];
+		}
+	}
+
+	if(!GfSelectKernel(GfKernel::Avx2) && !GfSelectKernel(GfKernel::Ssse3)) {
+		GfSelectKernel(GfKernel::Scalar);
+	}
+}
+
+void GfInitialize() {
+	std::call_once(tables_once, BuildTables);
+}
+
+bool GfSelectKernel(GfKernel kernel) {
+	if(!CpuSupports(kernel)) {
+		return false;
+	}
+
+	tables.kernel = kernel;
+	switch(kernel) {
+#ifdef GF_X86
+	case GfKernel::Avx2:
+		tables.multiply_region = MultiplyRegionAvx2;
+		tables.multiply_add_region = MultiplyAddRegionAvx2;
+		break;
+	case GfKernel::Ssse3:
+		tables.multiply_region = MultiplyRegionSsse3;
+		tables.multiply_add_region = MultiplyAddRegionSsse3;
+		break;
+#endif
+	default:
+		tables.multiply_region = MultiplyRegionScalar;
+		tables.multiply_add_region = MultiplyAddRegionScalar;
+		break;
+	}
+	return true;
+}
+
+GfKernel GfSelectedKernel() {
+	return tables.kernel;
+}
+
+const char *GfKernelName(GfKernel kernel) {
+	switch(kernel) {
+	case GfKernel::Ssse3:
+		return "ssse3";
+	case GfKernel::Avx2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+void GfMultiplyRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	tables.multiply_region(dst, src, c, size);
+}
+
+void GfMultiplyAddRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size) {
+	tables.multiply_add_region(dst, src, c, size);
+}
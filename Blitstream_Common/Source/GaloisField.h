@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1, the
+// field used by the Reed-Solomon code. Addition is XOR, multiplication goes
+// through log and exp tables for single values and through per-constant
+// lookup tables for whole buffers
+
+enum class GfKernel : uint32_t {
+	Scalar,
+	// 16 bytes at a time, PSHUFB on the low and high nibble tables
+	Ssse3,
+	// Same as Ssse3 with 32 bytes at a time
+	Avx2
+};
+
+// Builds the tables and selects the fastest kernel the CPU supports, must be
+// called before anything else in here. Calling it again, from any thread, is
+// harmless
+void GfInitialize();
+
+// Overrides the kernel for benchmarking, false if the CPU does not support it
+bool GfSelectKernel(GfKernel kernel);
+GfKernel GfSelectedKernel();
+const char *GfKernelName(GfKernel kernel);
+
+uint8_t GfMultiply(uint8_t a, uint8_t b);
+// a must not be zero
+uint8_t GfInverse(uint8_t a);
+
+// dst = c * src
+void GfMultiplyRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size);
+// dst ^= c * src
+void GfMultiplyAddRegion(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size);
@@ -0,0 +1,109 @@
+#include "LatencyHistogram.h"
+#include <cassert>
+#include "Platform.h"
+
+static constexpr size_t PREVIOUS_COUNTS_SIZE = MAX_LATENCY_STAGES * LATENCY_BUCKET_COUNT * sizeof(uint64_t);
+
+uint64_t LatencyBucketValue(uint32_t index) {
+	if(index < LATENCY_SUB_BUCKET_COUNT) {
+		return index;
+	}
+	uint32_t shift = (index >> LATENCY_SUB_BUCKET_BITS) - 1;
+	uint64_t lowest = static_cast<uint64_t>(LATENCY_SUB_BUCKET_COUNT + (index & (LATENCY_SUB_BUCKET_COUNT - 1))) << shift;
+	return lowest + (1ull << shift) - 1;
+}
+
+void LatencyReport::Initialize(const char *json_path) {
+	previous_counts = static_cast<uint64_t *>(PlatformAllocate(PREVIOUS_COUNTS_SIZE));
+	stage_count = 0;
+	json_file = nullptr;
+	if(json_path) {
+		json_file = fopen(json_path, "a");
+		if(!json_file) {
+			printf("Failed to open %s for latency output\n", json_path);
+		}
+	}
+}
+
+void LatencyReport::Add(const char *name, const LatencyHistogram *histogram) {
+	assert(stage_count < MAX_LATENCY_STAGES && "Too many latency stages");
+	names[stage_count] = name;
+	histograms[stage_count] = histogram;
+
+	// Start from whatever was recorded before the stage was added
+	uint64_t *previous = previous_counts + stage_count * LATENCY_BUCKET_COUNT;
+	for(uint32_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+		previous[i] = histogram->counts[i].load(std::memory_order_relaxed);
+	}
+	++stage_count;
+}
+
+LatencySummary LatencyReport::Summarize(uint32_t stage) {
+	// Interval counts, the previous snapshot is advanced in the same pass
+	uint64_t *previous = previous_counts + stage * LATENCY_BUCKET_COUNT;
+	uint64_t interval_counts[LATENCY_BUCKET_COUNT];
+	LatencySummary summary {};
+	for(uint32_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+		uint64_t count = histograms[stage]->counts[i].load(std::memory_order_relaxed);
+		interval_counts[i] = count - previous[i];
+		previous[i] = count;
+		summary.count += interval_counts[i];
+	}
+	if(summary.count == 0) {
+		return summary;
+	}
+
+	// Smallest value with at least the given share of samples at or below it
+	uint64_t p50_rank = (summary.count * 500 + 999) / 1000;
+	uint64_t p99_rank = (summary.count * 990 + 999) / 1000;
+	uint64_t p999_rank = (summary.count * 999 + 999) / 1000;
+	uint64_t seen = 0;
+	for(uint32_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+		if(interval_counts[i] == 0) continue;
+
+		uint64_t value = LatencyBucketValue(i);
+		if(seen < p50_rank && seen + interval_counts[i] >= p50_rank) summary.p50_ns = value;
+		if(seen < p99_rank && seen + interval_counts[i] >= p99_rank) summary.p99_ns = value;
+		if(seen < p999_rank && seen + interval_counts[i] >= p999_rank) summary.p999_ns = value;
+		summary.max_ns = value;
+		seen += interval_counts[i];
+	}
+	return summary;
+}
+
+void LatencyReport::Report(uint64_t timestamp_us) {
+	if(json_file) {
+		fprintf(json_file, "{\"timestamp_us\":%llu,\"stages\":{", static_cast<unsigned long long>(timestamp_us));
+	}
+
+	for(uint32_t stage = 0; stage < stage_count; ++stage) {
+		LatencySummary summary = Summarize(stage);
+
+		if(summary.count) {
+			printf("Latency %-8s n %llu, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n", names[stage],
+				   static_cast<unsigned long long>(summary.count), summary.p50_ns / 1000.0, summary.p99_ns / 1000.0,
+				   summary.p999_ns / 1000.0, summary.max_ns / 1000.0);
+		}
+		if(json_file) {
+			fprintf(json_file, "%s\"%s\":{\"count\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+					stage ? "," : "", names[stage], static_cast<unsigned long long>(summary.count),
+					static_cast<unsigned long long>(summary.p50_ns), static_cast<unsigned long long>(summary.p99_ns),
+					static_cast<unsigned long long>(summary.p999_ns), static_cast<unsigned long long>(summary.max_ns));
+		}
+	}
+
+	if(json_file) {
+		fprintf(json_file, "}}\n");
+		fflush(json_file);
+	}
+}
+
+void LatencyReport::Shutdown() {
+	if(json_file) {
+		fclose(json_file);
+		json_file = nullptr;
+	}
+	PlatformFree(previous_counts, PREVIOUS_COUNTS_SIZE);
+	previous_counts = nullptr;
+	stage_count = 0;
+}
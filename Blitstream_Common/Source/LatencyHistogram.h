@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+
+// Log-linear buckets: values below LATENCY_SUB_BUCKET_COUNT get a bucket each
+// and every power of two above is split into LATENCY_SUB_BUCKET_COUNT buckets,
+// so a reported value is within about 3% of the recorded one
+constexpr uint32_t LATENCY_SUB_BUCKET_BITS = 5;
+constexpr uint32_t LATENCY_SUB_BUCKET_COUNT = 1u << LATENCY_SUB_BUCKET_BITS;
+// Durations of 2^36 ns (about 68 s) or longer end up in the last bucket
+constexpr uint32_t LATENCY_MAX_VALUE_BITS = 36;
+constexpr uint32_t LATENCY_BUCKET_COUNT = (LATENCY_MAX_VALUE_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKET_COUNT;
+
+constexpr uint32_t MAX_LATENCY_STAGES = 8;
+
+inline uint32_t LatencyBucketIndex(uint64_t value_ns) {
+	if(value_ns >= 1ull << LATENCY_MAX_VALUE_BITS) {
+		return LATENCY_BUCKET_COUNT - 1;
+	}
+	uint32_t value_bits = static_cast<uint32_t>(std::bit_width(value_ns));
+	if(value_bits <= LATENCY_SUB_BUCKET_BITS) {
+		return static_cast<uint32_t>(value_ns);
+	}
+	uint32_t shift = value_bits - LATENCY_SUB_BUCKET_BITS - 1;
+	uint32_t sub_bucket = static_cast<uint32_t>(value_ns >> shift) - LATENCY_SUB_BUCKET_COUNT;
+	return ((shift + 1) << LATENCY_SUB_BUCKET_BITS) + sub_bucket;
+}
+
+// Largest value that maps to the bucket
+uint64_t LatencyBucketValue(uint32_t index);
+
+// Durations in nanoseconds recorded by a single thread. Counts only ever grow
+// and readers take the difference between two snapshots instead of resetting
+// them, so recording is a plain load and store without read-modify-write
+struct LatencyHistogram {
+	std::atomic<uint64_t> counts[LATENCY_BUCKET_COUNT];
+
+	void Record(uint64_t duration_ns) {
+		std::atomic<uint64_t> &count = counts[LatencyBucketIndex(duration_ns)];
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+};
+
+struct LatencySummary {
+	uint64_t count;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+};
+
+// Summarizes a fixed set of histograms over the interval since the previous
+// report, printed to stdout and optionally appended to a file as one JSON
+// object per line. Only the reporting thread may call into it
+struct LatencyReport {
+	const char *names[MAX_LATENCY_STAGES];
+	const LatencyHistogram *histograms[MAX_LATENCY_STAGES];
+	// Counts at the previous report, one row of LATENCY_BUCKET_COUNT per stage
+	uint64_t *previous_counts;
+	uint32_t stage_count;
+	FILE *json_file;
+
+	// json_path may be null to only print to stdout
+	void Initialize(const char *json_path);
+	void Add(const char *name, const LatencyHistogram *histogram);
+
+	void Report(uint64_t timestamp_us);
+
+	void Shutdown();
+
+	LatencySummary Summarize(uint32_t stage);
+};
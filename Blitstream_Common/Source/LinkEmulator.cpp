@@ -0,0 +1,149 @@
+#include "LinkEmulator.h"
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "Platform.h"
+#include "Protocol.h"
+
+static constexpr size_t SLOTS_SIZE = static_cast<size_t>(EMULATOR_QUEUE_SIZE) * MAX_DATAGRAM_SIZE;
+
+void LinkEmulator::Initialize(SocketHandle datagram_socket, const LinkEmulatorOptions &emulator_options) {
+	socket = datagram_socket;
+	options = emulator_options;
+	enabled = options.loss_percent > 0.0f || options.delay_us > 0 || options.jitter_us > 0 || options.rate_kbps > 0;
+
+	// Stationary loss rate of the bad state is enter / (enter + leave)
+	float loss = options.loss_percent / 100.0f;
+	loss = loss > 0.99f ? 0.99f : loss;
+	leave_loss = options.burst_length > 1.0f ? 1.0f / options.burst_length : 1.0f;
+	enter_loss = loss * leave_loss / (1.0f - loss);
+	losing = false;
+	random_state = 0x9E3779B97F4A7C15ull ^ PlatformTimestampNs();
+
+	stats.sent.store(0, std::memory_order_relaxed);
+	stats.dropped.store(0, std::memory_order_relaxed);
+	stats.retransmitted.store(0, std::memory_order_relaxed);
+
+	if(!enabled) {
+		return;
+	}
+	printf("Emulating %.2f%% loss in bursts of %.1f packets, %u us delay, %u us jitter, %u kbps\n",
+		   options.loss_percent, options.burst_length, options.delay_us, options.jitter_us, options.rate_kbps);
+	if(options.retransmit_us != 0) {
+		printf("Lost packets arrive %u us late instead\n", options.retransmit_us);
+	}
+
+	slots = static_cast<uint8_t *>(PlatformAllocate(SLOTS_SIZE));
+	next_slot = 0;
+	last_due_ns = 0;
+	last_departure_ns = 0;
+	running.store(true, std::memory_order_relaxed);
+	delay_thread = std::thread(&LinkEmulator::DelayLoop, this);
+}
+
+float LinkEmulator::Random() {
+	// xorshift64*, plenty for picking losses
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return static_cast<float>((random_state * 0x2545F4914F6CDD1Dull) >> 40) / static_cast<float>(1u << 24);
+}
+
+bool LinkEmulator::Send(const NetBuffer *buffers, uint32_t buffer_count) {
+	if(!enabled) {
+		return NetSendAllv(socket, buffers, buffer_count);
+	}
+
+	losing = losing ? Random() >= leave_loss : Random() < enter_loss;
+	if(losing && options.retransmit_us == 0) {
+		stats.dropped.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	uint64_t retransmit_ns = 0;
+	if(losing) {
+		stats.retransmitted.fetch_add(1, std::memory_order_relaxed);
+		retransmit_ns = options.retransmit_us * 1000ull;
+	}
+
+	// One more slot may be held by the packet the delay thread is sending
+	while(options.retransmit_us != 0 && queue.Size() >= EMULATOR_QUEUE_SIZE - 1) {
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+	if(queue.Size() >= EMULATOR_QUEUE_SIZE - 1) {
+		stats.dropped.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	uint32_t slot = next_slot++ % EMULATOR_QUEUE_SIZE;
+	uint8_t *packet = slots + static_cast<size_t>(slot) * MAX_DATAGRAM_SIZE;
+	uint32_t size = 0;
+	for(uint32_t i = 0; i < buffer_count; ++i) {
+		assert(size + buffers[i].size <= MAX_DATAGRAM_SIZE && "Datagram too large");
+		memcpy(packet + size, buffers[i].ptr, buffers[i].size);
+		size += buffers[i].size;
+	}
+
+	// Packets leave in order, jitter can only hold a packet back behind the previous one
+	uint64_t jitter_ns = options.jitter_us ? static_cast<uint64_t>(Random() * options.jitter_us * 1000.0f) : 0;
+	uint64_t departure_ns = PlatformTimestampNs();
+	if(options.rate_kbps != 0) {
+		departure_ns = departure_ns < last_departure_ns ? last_departure_ns : departure_ns;
+		departure_ns += size * 8000000ull / options.rate_kbps;
+		last_departure_ns = departure_ns;
+	}
+	uint64_t due_ns = departure_ns + options.delay_us * 1000ull + jitter_ns + retransmit_ns;
+	due_ns = due_ns < last_due_ns ? last_due_ns : due_ns;
+	last_due_ns = due_ns;
+
+	queue.Push(DelayedPacket {
+		.due_ns = due_ns,
+		.slot = slot,
+		.size = size
+	});
+	queued_count.release();
+	return true;
+}
+
+void LinkEmulator::DelayLoop() {
+	for(;;) {
+		queued_count.acquire();
+		DelayedPacket packet;
+		if(!queue.Pop(&packet)) {
+			// Woken up by Shutdown with nothing left to send
+			break;
+		}
+
+		int64_t remaining_ns = static_cast<int64_t>(packet.due_ns - PlatformTimestampNs());
+		if(remaining_ns > 0) {
+			std::this_thread::sleep_for(std::chrono::nanoseconds(remaining_ns));
+		}
+
+		NetBuffer buffer {
+			.ptr = slots + static_cast<size_t>(packet.slot) * MAX_DATAGRAM_SIZE,
+			.size = packet.size
+		};
+		NetSendAllv(socket, &buffer, 1);
+		stats.sent.fetch_add(1, std::memory_order_relaxed);
+
+		if(!running.load(std::memory_order_relaxed) && queue.Size() == 0) {
+			break;
+		}
+	}
+}
+
+void LinkEmulator::Shutdown() {
+	if(!enabled) {
+		return;
+	}
+	running.store(false, std::memory_order_relaxed);
+	queued_count.release();
+	delay_thread.join();
+
+	DelayedPacket packet;
+	while(queue.Pop(&packet));
+	while(queued_count.try_acquire());
+	PlatformFree(slots, SLOTS_SIZE);
+	slots = nullptr;
+	enabled = false;
+}
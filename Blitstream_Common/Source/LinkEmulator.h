@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <semaphore>
+#include <thread>
+#include "Socket.h"
+#include "SpscQueue.h"
+
+// Datagrams that can be held back at once, further packets are dropped
+constexpr uint32_t EMULATOR_QUEUE_SIZE = 1024;
+
+struct LinkEmulatorOptions {
+	// Share of packets lost in percent
+	float loss_percent = 0.0f;
+	// Average number of consecutive packets lost, 1 for independent losses
+	float burst_length = 1.0f;
+	uint32_t delay_us = 0;
+	// Uniformly distributed extra delay, packets are never reordered
+	uint32_t jitter_us = 0;
+	// Bottleneck rate, 0 for unlimited. Packets wait for the ones before them
+	// to go through and are dropped once the queue is full
+	uint32_t rate_kbps = 0;
+	// Deliver lost packets this much later instead of dropping them, like a
+	// reliable stream that sends them again. Packets behind one wait for it,
+	// and the sender waits for room in the queue instead of packets being
+	// dropped, so a stream socket can be put through the emulator
+	uint32_t retransmit_us = 0;
+};
+
+struct DelayedPacket {
+	uint64_t due_ns;
+	uint32_t slot;
+	uint32_t size;
+};
+
+struct LinkEmulatorStats {
+	std::atomic<uint64_t> sent;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> retransmitted;
+};
+
+// Drops and delays outgoing datagrams to test the UDP transport without a lossy
+// network. Losses follow a two-state Gilbert-Elliott model: every packet is
+// lost in the bad state and the state changes are chosen so that losses
+// average loss_percent in bursts of burst_length. Delayed packets are copied
+// and sent in order from a separate thread. If no loss or delay is configured
+// packets are sent directly
+struct LinkEmulator {
+	SocketHandle socket;
+	LinkEmulatorOptions options;
+	bool enabled;
+
+	// Chance per packet of entering and leaving the bad state
+	float enter_loss;
+	float leave_loss;
+	bool losing;
+	uint64_t random_state;
+
+	// EMULATOR_QUEUE_SIZE slots of MAX_DATAGRAM_SIZE bytes, used in order
+	uint8_t *slots;
+	uint32_t next_slot;
+	uint64_t last_due_ns;
+	// When the bottleneck is done with the last queued packet
+	uint64_t last_departure_ns;
+	SpscQueue<DelayedPacket, EMULATOR_QUEUE_SIZE> queue;
+	std::counting_semaphore<EMULATOR_QUEUE_SIZE> queued_count { 0 };
+	std::atomic<bool> running;
+	std::thread delay_thread;
+
+	LinkEmulatorStats stats;
+
+	void Initialize(SocketHandle datagram_socket, const LinkEmulatorOptions &emulator_options);
+
+	// Same contract as NetSendAllv on a connected datagram socket, or on a
+	// stream socket with retransmit_us set. May only be called from one thread
+	bool Send(const NetBuffer *buffers, uint32_t buffer_count);
+
+	void Shutdown();
+
+	float Random();
+	void DelayLoop();
+};
@@ -0,0 +1,56 @@
+#include "Platform.h"
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <ctime>
+#include <sys/mman.h>
+#endif
+
+void *PlatformAllocate(size_t size) {
+#ifdef _WIN32
+	return VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+}
+
+void PlatformFree(void *ptr, size_t size) {
+	if(!ptr) {
+		return;
+	}
+#ifdef _WIN32
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, size);
+#endif
+}
+
+uint64_t PlatformTimestamp() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t PlatformTimestampNs() {
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t PlatformThreadCpuTimeNs() {
+#ifdef _WIN32
+	// In 100 ns units
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	uint64_t kernel_time = (static_cast<uint64_t>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+	uint64_t user_time = (static_cast<uint64_t>(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+	return (kernel_time + user_time) * 100;
+#else
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return static_cast<uint64_t>(time.tv_sec) * 1000000000ull + static_cast<uint64_t>(time.tv_nsec);
+#endif
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Page granular allocations, backed by VirtualAlloc on Windows and mmap elsewhere
+void *PlatformAllocate(size_t size);
+void PlatformFree(void *ptr, size_t size);
+
+// Monotonic clock in microseconds, only meaningful relative to other readings
+uint64_t PlatformTimestamp();
+// Same clock in nanoseconds, for timing individual stages
+uint64_t PlatformTimestampNs();
+// CPU time the calling thread has used in nanoseconds
+uint64_t PlatformThreadCpuTimeNs();
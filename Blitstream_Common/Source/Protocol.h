@@ -0,0 +1,337 @@
+#pragma once
+#include <cstdint>
+
+constexpr const char *PORT = "4646";
+constexpr uint32_t PROTOCOL_MAGIC = 0x4646;
+
+enum class Transport : uint32_t {
+	// Frames follow the InitMessage on the TCP connection
+	Tcp,
+	// Frames are split into datagrams sent over UDP from the port given in the
+	// InitMessage, the TCP connection stays open for control messages
+	Udp
+};
+
+enum class Codec : uint32_t {
+	// NVENC HEVC, decoded by NVDEC
+	Hevc,
+	// Lossless tiles coded on the CPU, each frame is a TileFrame
+	Tiles
+};
+
+struct InitMessage {
+	uint32_t MAGIC;
+	uint32_t encoded_width;
+	uint32_t encoded_height;
+	Transport transport;
+	// UDP port the client sends its hello and NACKs to, 0 over TCP
+	uint32_t media_port;
+	Codec codec;
+};
+
+// Logical streams multiplexed on the TCP connection from sender to receiver,
+// lower values are more urgent. Messages are split into chunks and the
+// sender always writes the next chunk of the most urgent channel that has
+// one, so a control message waits for at most one write of video chunks
+// rather than for a whole keyframe
+enum class Channel : uint8_t {
+	// A ControlMessage followed by the body its type calls for
+	Control,
+	// A CursorMessage, followed by a CursorShape and its data for new shapes
+	Cursor,
+	// A DataHeader followed by the encoded data, TCP transport only
+	Video
+};
+constexpr uint32_t CHANNEL_COUNT = 3;
+
+// Type and length in front of every chunk the sender writes to the TCP
+// connection after the InitMessage. The receiver only ever sends
+// ControlMessages, which are not chunked
+struct ChunkHeader {
+	Channel channel;
+	// CHUNK_FLAG_* bits
+	uint8_t flags;
+	// Payload bytes following the header
+	uint16_t size;
+};
+
+// Last chunk of its message
+constexpr uint8_t CHUNK_FLAG_END = 1u << 0;
+// Most payload bytes per chunk, about 0.7 ms on a 50 Mbit/s link
+constexpr uint32_t MAX_CHUNK_PAYLOAD = 4096;
+// Largest message on the control channel
+constexpr uint32_t MAX_CONTROL_MESSAGE_SIZE = 256;
+
+// Precedes every frame. Timestamps are in microseconds of the sender's
+// PlatformTimestamp clock
+struct DataHeader {
+	uint32_t MAGIC;
+	uint32_t size;
+	// Incremented for every header, duplicate frames included
+	uint32_t sequence;
+	// DATA_FLAG_* bits
+	uint32_t flags;
+	uint64_t capture_timestamp;
+	// Taken right before the header is written to the socket
+	uint64_t send_timestamp;
+};
+
+// The frame decodes without any earlier one and carries the parameter sets
+constexpr uint32_t DATA_FLAG_KEYFRAME = 1u << 0;
+// The data starts with a FrameRegions, the encoded picture follows it
+constexpr uint32_t DATA_FLAG_REGIONS = 1u << 1;
+
+constexpr uint32_t MAX_COPY_RECTS = 16;
+constexpr uint32_t MAX_DIRTY_RECTS = 32;
+
+// The width by height pixels at source_x, source_y of the receiver's
+// retained frame moved to x, y, as for a scrolled document or dragged window.
+// Source and destination may overlap
+struct CopyRect {
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+	uint16_t source_x;
+	uint16_t source_y;
+};
+
+struct DirtyRect {
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+};
+
+// Followed by copy_count CopyRects, then dirty_count DirtyRects. The receiver
+// applies the copies in order to the frame it retains, then takes only the
+// dirty rects from the decoded picture, the rest of which is stale. A frame
+// without DATA_FLAG_REGIONS replaces the retained frame entirely, one without
+// an encoded picture only carries copies
+struct FrameRegions {
+	uint16_t copy_count;
+	uint16_t dirty_count;
+};
+
+constexpr uint32_t MAX_FRAME_REGIONS_SIZE = sizeof(FrameRegions) + MAX_COPY_RECTS * sizeof(CopyRect) +
+											MAX_DIRTY_RECTS * sizeof(DirtyRect);
+
+// Tiles are TILE_SIZE pixels square in raster order, the last column and row
+// are cut off at the frame's edge
+constexpr uint32_t TILE_SIZE = 64;
+
+enum class TileMode : uint8_t {
+	// The payload is the one BGRA pixel the tile is filled with
+	Fill,
+	// The payload is palette_size BGRA pixels, then one index per pixel in
+	// 1, 2 or 4 bits for up to 2, 4 or 16 colors. Rows start on a byte and
+	// the first pixel is in the lowest bits
+	Palette,
+	// The payload is B, G and R of every pixel
+	Raw
+};
+
+// Palette indices or raw pixels went through TileLzCompress
+constexpr uint8_t TILE_FLAG_LZ = 1u << 0;
+
+// One changed tile, followed by size bytes of payload. The receiver sets
+// alpha to opaque
+struct TileRecord {
+	uint32_t index;
+	TileMode mode;
+	uint8_t flags;
+	uint8_t palette_size;
+	uint8_t reserved;
+	uint32_t size;
+};
+
+// The data of a frame with Codec::Tiles, followed by tile_count TileRecords
+// in ascending order of index. Tiles not in it are unchanged, a keyframe has
+// all of them
+struct TileFrame {
+	uint32_t tile_count;
+};
+
+enum class ControlType : uint32_t {
+	// From the sender it is followed by a ClockSyncAnswer, the timestamp is
+	// when the answer was sent
+	ClockSync = 1,
+	// Followed by a FeedbackMessage
+	Feedback = 2,
+	// The receiver cannot decode until the next keyframe
+	KeyframeRequest = 3
+};
+
+// Receiver -> sender on the TCP connection, sender -> receiver on the
+// control channel
+struct ControlMessage {
+	uint32_t MAGIC;
+	ControlType type;
+	// PlatformTimestamp of whoever sent the message, taken when it was sent
+	uint64_t timestamp;
+};
+
+// Answer to a clock sync request, sent on the control channel as soon as the
+// request has been read
+struct ClockSyncAnswer {
+	// Receiver's timestamp from the request
+	uint64_t originate_timestamp;
+	// When the sender read the request
+	uint64_t receive_timestamp;
+};
+
+// Cursor shapes wider or taller than this are not sent, the cursor is hidden
+// while one of them is in use
+constexpr uint32_t MAX_CURSOR_DIMENSION = 256;
+// Shapes the receiver keeps, the sender only sends a shape that is not among them
+constexpr uint32_t CURSOR_CACHE_SIZE = 16;
+// Worst case of a run-length encoded shape, see CursorCompress
+constexpr uint32_t MAX_CURSOR_DATA_SIZE = MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION * 4 +
+										  (MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION + 127) / 128;
+
+enum class CursorType : uint32_t {
+	// Where the cursor is and which of the cached shapes it has
+	Position = 1,
+	// Same as Position, followed by a CursorShape and its data to be cached in
+	// slot before it is used
+	Shape = 2
+};
+
+// The cursor is drawn, otherwise position and slot are meaningless
+constexpr uint32_t CURSOR_FLAG_VISIBLE = 1u << 0;
+
+// Sender -> receiver on the cursor channel whenever the pointer moved or
+// changed its shape, so pointer movement alone never costs a video frame
+struct CursorMessage {
+	uint32_t MAGIC;
+	CursorType type;
+	// Top left corner of the shape in encoded frame pixels, may be negative
+	// or beyond the frame while the shape is partly off screen
+	int32_t x;
+	int32_t y;
+	// CURSOR_FLAG_* bits
+	uint32_t flags;
+	// Cache slot of the shape, below CURSOR_CACHE_SIZE
+	uint32_t slot;
+};
+
+// A shape as straight alpha BGRA pixels, row by row without padding and run
+// length encoded, see CursorCompress
+struct CursorShape {
+	uint16_t width;
+	uint16_t height;
+	// Pixel within the shape that points at the position
+	uint16_t hot_x;
+	uint16_t hot_y;
+	// Bytes of encoded pixels following, at most MAX_CURSOR_DATA_SIZE
+	uint32_t data_size;
+};
+
+// Largest message on the cursor channel
+constexpr uint32_t MAX_CURSOR_MESSAGE_SIZE = sizeof(CursorMessage) + sizeof(CursorShape) + MAX_CURSOR_DATA_SIZE;
+
+constexpr uint32_t MAX_FEEDBACK_FRAMES = 16;
+
+struct FeedbackFrame {
+	uint32_t sequence;
+	// Encoded data, DataHeader not included
+	uint32_t size;
+	// DataHeader send_timestamp, sender's clock
+	uint64_t send_timestamp;
+	// Receiver's PlatformTimestamp when the frame's data had arrived. Over UDP
+	// the last packet that was not a retransmission counts, so recovering
+	// losses does not look like queuing
+	uint64_t arrival_timestamp;
+};
+
+// Receiver -> sender, arrival times of recently received frames for the
+// sender's bandwidth estimate. Sent whole, only the first frame_count frames
+// are valid. Over UDP it is also sent without frames so that losses are
+// reported while nothing gets through, the ControlMessage timestamp tells
+// the sender when
+struct FeedbackMessage {
+	uint32_t frame_count;
+	// Receiver's current round trip estimate in microseconds, 0 if unknown
+	uint32_t round_trip;
+	// UDP packets the sender sent since the previous report going by their
+	// sequences, and how many of those never arrived in their original
+	// transmission. Both zero over TCP
+	uint32_t packets_expected;
+	uint32_t packets_lost;
+	FeedbackFrame frames[MAX_FEEDBACK_FRAMES];
+};
+
+// Largest datagram sent over UDP, leaves room for IP and UDP headers plus
+// tunnel overhead within a 1280 byte MTU
+constexpr uint32_t MAX_DATAGRAM_SIZE = 1200;
+
+enum class PacketType : uint8_t {
+	// Part of a frame, the frame is its DataHeader followed by the encoded data
+	Frame,
+	// Receiver -> sender until the first frame packet arrives, tells the
+	// sender where to send to
+	Hello,
+	// Reed-Solomon parity over one block of a frame's packets, sent after all
+	// frame packets. Packets are padded with zeros to MAX_PACKET_PAYLOAD for the code
+	Parity,
+	// Receiver -> sender, a NackPacket
+	Nack
+};
+
+enum PacketFlags : uint16_t {
+	// Sent again in answer to a NACK, the sequence is the original one
+	PACKET_FLAG_RETRANSMIT = 1 << 0
+};
+
+struct PacketHeader {
+	uint16_t MAGIC;
+	PacketType type;
+	// Parity packets: index of the parity packet within its block
+	uint8_t fec_index;
+	// Incremented for every packet sent
+	uint32_t sequence;
+	// DataHeader sequence of the frame the packet belongs to
+	uint32_t frame_sequence;
+	// Size of the DataHeader plus the encoded data
+	uint32_t frame_size;
+	// Frame packets: index within the frame. Parity packets: index of the
+	// block, blocks are interleaved so that block b of n holds frame packets
+	// b, b + n, b + 2n and so on and a burst of losses is spread over all of them
+	uint16_t packet_index;
+	// Frame packets in the frame, parity packets not included
+	uint16_t packet_count;
+	// Most frame packets per block and parity packets sent for a full block,
+	// both zero without FEC. See FecBlockCount and FecParityCount
+	uint8_t fec_block_size;
+	uint8_t fec_parity_count;
+	// PacketFlags
+	uint16_t flags;
+};
+
+constexpr uint32_t MAX_PACKET_PAYLOAD = MAX_DATAGRAM_SIZE - sizeof(PacketHeader);
+
+// Largest encoded frame that fits in UINT16_MAX packets behind its DataHeader
+constexpr uint32_t MAX_UDP_FRAME_SIZE = UINT16_MAX * MAX_PACKET_PAYLOAD - sizeof(DataHeader);
+
+// Receivers keep at most this many parity packets per frame, the sender does
+// not send more
+constexpr uint32_t MAX_FRAME_PARITY_PACKETS = 1024;
+
+// Receivers give up on a frame this long after its first packet arrived,
+// senders do not retransmit packets that would arrive later than that
+constexpr uint64_t FRAME_DEADLINE_US = 100000;
+
+constexpr uint32_t MAX_NACK_SEQUENCES = 64;
+
+// Receiver -> sender over UDP, asks for packets to be sent again. Only the
+// first sequence_count sequences are sent
+struct NackPacket {
+	uint16_t MAGIC;
+	// PacketType::Nack, at the same offset as in PacketHeader
+	PacketType type;
+	uint8_t sequence_count;
+	// Receiver's current round trip estimate in microseconds, 0 if unknown
+	uint32_t round_trip;
+	// PacketHeader sequences of the missing packets
+	uint32_t sequences[MAX_NACK_SEQUENCES];
+};
@@ -0,0 +1,127 @@
+#include "ReedSolomon.h"
+#include <cassert>
+#include <cstring>
+#include "GaloisField.h"
+
+static uint8_t CauchyCoefficient(uint32_t parity_index, uint32_t data_index) {
+	return GfInverse(static_cast<uint8_t>((255 - parity_index) ^ data_index));
+}
+
+void ReedSolomonEncode(const uint8_t *const *data, uint32_t data_count, uint8_t *const *parity, uint32_t parity_count,
+					   uint32_t shard_size) {
+	assert(data_count <= MAX_FEC_DATA_SHARDS && parity_count <= MAX_FEC_PARITY_SHARDS && "Too many shards");
+	for(uint32_t j = 0; j < parity_count; ++j) {
+		GfMultiplyRegion(parity[j], data[0], CauchyCoefficient(j, 0), shard_size);
+		for(uint32_t i = 1; i < data_count; ++i) {
+			GfMultiplyAddRegion(parity[j], data[i], CauchyCoefficient(j, i), shard_size);
+		}
+	}
+}
+
+// Gauss-Jordan elimination of [matrix | identity], every square submatrix of
+// a Cauchy matrix is invertible so a pivot always exists
+static void InvertMatrix(uint8_t matrix[MAX_FEC_DATA_SHARDS][MAX_FEC_DATA_SHARDS],
+						 uint8_t inverse[MAX_FEC_DATA_SHARDS][MAX_FEC_DATA_SHARDS], uint32_t size) {
+	for(uint32_t row = 0; row < size; ++row) {
+		memset(inverse[row], 0, size);
+		inverse[row][row] = 1;
+	}
+
+	for(uint32_t column = 0; column < size; ++column) {
+		uint32_t pivot = column;
+		while(matrix[pivot][column] == 0) {
+			++pivot;
+			assert(pivot < size && "Singular matrix");
+		}
+		if(pivot != column) {
+			for(uint32_t k = 0; k < size; ++k) {
+				uint8_t value = matrix[pivot][k];
+				matrix[pivot][k] = matrix[column][k];
+				matrix[column][k] = value;
+				value = inverse[pivot][k];
+				inverse[pivot][k] = inverse[column][k];
+				inverse[column][k] = value;
+			}
+		}
+
+		uint8_t scale = GfInverse(matrix[column][column]);
+		for(uint32_t k = 0; k < size; ++k) {
+			matrix[column][k] = GfMultiply(matrix[column][k], scale);
+			inverse[column][k] = GfMultiply(inverse[column][k], scale);
+		}
+
+		for(uint32_t row = 0; row < size; ++row) {
+			uint8_t factor = matrix[row][column];
+			if(row == column || factor == 0) {
+				continue;
+			}
+			for(uint32_t k = 0; k < size; ++k) {
+				matrix[row][k] ^= GfMultiply(matrix[column][k], factor);
+				inverse[row][k] ^= GfMultiply(inverse[column][k], factor);
+			}
+		}
+	}
+}
+
+bool ReedSolomonReconstruct(uint8_t *const *shards, const bool *present, uint32_t data_count, uint32_t parity_count,
+							uint32_t shard_size) {
+	assert(data_count <= MAX_FEC_DATA_SHARDS && parity_count <= MAX_FEC_PARITY_SHARDS && "Too many shards");
+
+	uint32_t missing[MAX_FEC_DATA_SHARDS];
+	uint32_t missing_count = 0;
+	for(uint32_t i = 0; i < data_count; ++i) {
+		if(!present[i]) {
+			missing[missing_count++] = i;
+		}
+	}
+	if(missing_count == 0) {
+		return true;
+	}
+
+	// As many parity rows as there are missing data shards
+	uint32_t rows[MAX_FEC_DATA_SHARDS];
+	uint32_t row_count = 0;
+	for(uint32_t j = 0; j < parity_count && row_count < missing_count; ++j) {
+		if(present[data_count + j]) {
+			rows[row_count++] = j;
+		}
+	}
+	if(row_count < missing_count) {
+		return false;
+	}
+
+	// The chosen parity rows say A * missing = parity + B * present, where A
+	// and B are the coefficients of the missing and present data shards, so
+	// each missing shard is a combination of the chosen parity shards and the
+	// present data shards with the coefficients A^-1 and A^-1 * B
+	uint8_t matrix[MAX_FEC_DATA_SHARDS][MAX_FEC_DATA_SHARDS];
+	uint8_t inverse[MAX_FEC_DATA_SHARDS][MAX_FEC_DATA_SHARDS];
+	for(uint32_t r = 0; r < missing_count; ++r) {
+		for(uint32_t m = 0; m < missing_count; ++m) {
+			matrix[r][m] = CauchyCoefficient(rows[r], missing[m]);
+		}
+	}
+	InvertMatrix(matrix, inverse, missing_count);
+
+	for(uint32_t m = 0; m < missing_count; ++m) {
+		uint8_t *output = shards[missing[m]];
+		GfMultiplyRegion(output, shards[data_count + rows[0]], inverse[m][0], shard_size);
+		for(uint32_t r = 1; r < missing_count; ++r) {
+			GfMultiplyAddRegion(output, shards[data_count + rows[r]], inverse[m][r], shard_size);
+		}
+
+		for(uint32_t i = 0; i < data_count; ++i) {
+			if(!present[i]) {
+				continue;
+			}
+			uint8_t coefficient = 0;
+			for(uint32_t r = 0; r < missing_count; ++r) {
+				coefficient ^= GfMultiply(inverse[m][r], CauchyCoefficient(rows[r], i));
+			}
+			if(coefficient != 0) {
+				GfMultiplyAddRegion(output, shards[i], coefficient, shard_size);
+			}
+		}
+	}
+	return true;
+}
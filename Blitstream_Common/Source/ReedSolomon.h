@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+
+// Shards per block on either side, keeps the Cauchy matrix rows and columns on
+// distinct field elements
+constexpr uint32_t MAX_FEC_DATA_SHARDS = 128;
+constexpr uint32_t MAX_FEC_PARITY_SHARDS = 128;
+
+// Packets of a frame are dealt out to blocks of at most block_size packets in
+// turn, packet i goes to block i % block_count as shard i / block_count
+inline uint32_t FecBlockCount(uint32_t packet_count, uint32_t block_size) {
+	return (packet_count + block_size - 1) / block_size;
+}
+
+inline uint32_t FecBlockDataCount(uint32_t packet_count, uint32_t block_count, uint32_t block) {
+	return (packet_count - block + block_count - 1) / block_count;
+}
+
+// Parity shards for a block of data_count shards when a full block of
+// block_size data shards gets parity_count, short blocks get proportionally fewer
+inline uint32_t FecParityCount(uint32_t data_count, uint32_t block_size, uint32_t parity_count) {
+	return (data_count * parity_count + block_size - 1) / block_size;
+}
+
+// Systematic Reed-Solomon erasure code over GF(2^8) built on a Cauchy matrix,
+// any data_count of the data_count + parity_count shards restore the data.
+// Parity shard j is the sum of C[j][i] * data[i] with C[j][i] = 1 / (x_j + y_i),
+// x_j = 255 - j and y_i = i. GfInitialize has to be called first
+
+void ReedSolomonEncode(const uint8_t *const *data, uint32_t data_count, uint8_t *const *parity, uint32_t parity_count,
+					   uint32_t shard_size);
+
+// shards holds the data shards followed by the parity shards and present tells
+// which of them arrived. Missing data shards are written to their buffers,
+// missing parity shards are left alone. False if fewer than data_count
+// shards are present
+bool ReedSolomonReconstruct(uint8_t *const *shards, const bool *present, uint32_t data_count, uint32_t parity_count,
+							uint32_t shard_size);
@@ -0,0 +1,509 @@
+#include "Socket.h"
+#include <cassert>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <mstcpip.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#define NET_CHECK(x) { \
+int ret = x; \
+if(ret != 0) printf("NET Error: %s is 0x%08x in %s at line %d\n", #x, ret, __FILE__, __LINE__); \
+}
+
+#ifdef _WIN32
+constexpr int SEND_FLAGS = 0;
+#else
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#endif
+
+bool NetStartup() {
+#ifdef _WIN32
+	WSAData wsa_data;
+	return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+#else
+	return true;
+#endif
+}
+
+void NetCleanup() {
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+SocketHandle NetListen(const char *port) {
+	addrinfo hints {
+		.ai_flags = AI_PASSIVE,
+		.ai_family = PF_INET,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP
+	};
+
+	addrinfo *result;
+	NET_CHECK(getaddrinfo(nullptr, port, &hints, &result));
+
+	SocketHandle listen_socket = socket(result->ai_family,
+										result->ai_socktype,
+										result->ai_protocol);
+	if(listen_socket == INVALID_SOCKET_HANDLE) {
+		freeaddrinfo(result);
+		return INVALID_SOCKET_HANDLE;
+	}
+
+	// Allow immediate rebinding after the encoder restarts
+	int reuse = 1;
+	setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char *>(&reuse), sizeof(reuse));
+
+	NET_CHECK(bind(listen_socket, result->ai_addr,
+				   static_cast<int>(result->ai_addrlen)));
+	freeaddrinfo(result);
+
+	NET_CHECK(listen(listen_socket, SOMAXCONN));
+	return listen_socket;
+}
+
+SocketHandle NetAccept(SocketHandle listen_socket, char *address, uint32_t address_size) {
+	sockaddr_in client_addr {};
+	socklen_t client_addrlen = sizeof(client_addr);
+	SocketHandle client_socket = accept(listen_socket, reinterpret_cast<sockaddr *>(&client_addr), &client_addrlen);
+	if(client_socket != INVALID_SOCKET_HANDLE && address) {
+		inet_ntop(AF_INET, &(client_addr.sin_addr), address, address_size);
+	}
+	return client_socket;
+}
+
+SocketHandle NetConnect(const char *address, const char *port) {
+	addrinfo hints {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP
+	};
+
+	addrinfo *result;
+	if(getaddrinfo(address, port, &hints, &result) != 0) {
+		return INVALID_SOCKET_HANDLE;
+	}
+
+	SocketHandle connection_socket = socket(result->ai_family,
+											result->ai_socktype,
+											result->ai_protocol);
+	if(connection_socket != INVALID_SOCKET_HANDLE &&
+	   connect(connection_socket, result->ai_addr, static_cast<int>(result->ai_addrlen)) != 0) {
+		NetClose(connection_socket);
+		connection_socket = INVALID_SOCKET_HANDLE;
+	}
+	freeaddrinfo(result);
+
+	return connection_socket;
+}
+
+void NetClose(SocketHandle socket) {
+	if(socket == INVALID_SOCKET_HANDLE) {
+		return;
+	}
+#ifdef _WIN32
+	closesocket(socket);
+#else
+	close(socket);
+#endif
+}
+
+void NetDisconnect(SocketHandle socket) {
+	if(socket == INVALID_SOCKET_HANDLE) {
+		return;
+	}
+#ifdef _WIN32
+	shutdown(socket, SD_BOTH);
+#else
+	shutdown(socket, SHUT_RDWR);
+#endif
+}
+
+static SocketHandle CreateUdpSocket(const addrinfo *info) {
+	SocketHandle udp_socket = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+#ifdef _WIN32
+	// Otherwise an ICMP port unreachable fails the next recv with WSAECONNRESET
+	if(udp_socket != INVALID_SOCKET_HANDLE) {
+		BOOL report = FALSE;
+		DWORD bytes_returned = 0;
+		WSAIoctl(udp_socket, SIO_UDP_CONNRESET, &report, sizeof(report), nullptr, 0, &bytes_returned, nullptr, nullptr);
+	}
+#endif
+	return udp_socket;
+}
+
+SocketHandle NetBindUdp(const char *port) {
+	addrinfo hints {
+		.ai_flags = AI_PASSIVE,
+		.ai_family = PF_INET,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_protocol = IPPROTO_UDP
+	};
+
+	addrinfo *result;
+	NET_CHECK(getaddrinfo(nullptr, port, &hints, &result));
+
+	SocketHandle udp_socket = CreateUdpSocket(result);
+	if(udp_socket == INVALID_SOCKET_HANDLE) {
+		freeaddrinfo(result);
+		return INVALID_SOCKET_HANDLE;
+	}
+
+	int reuse = 1;
+	setsockopt(udp_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char *>(&reuse), sizeof(reuse));
+
+	NET_CHECK(bind(udp_socket, result->ai_addr, static_cast<int>(result->ai_addrlen)));
+	freeaddrinfo(result);
+	return udp_socket;
+}
+
+SocketHandle NetConnectUdp(const char *address, const char *port) {
+	addrinfo hints {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_protocol = IPPROTO_UDP
+	};
+
+	addrinfo *result;
+	if(getaddrinfo(address, port, &hints, &result) != 0) {
+		return INVALID_SOCKET_HANDLE;
+	}
+
+	SocketHandle udp_socket = CreateUdpSocket(result);
+	if(udp_socket != INVALID_SOCKET_HANDLE &&
+	   connect(udp_socket, result->ai_addr, static_cast<int>(result->ai_addrlen)) != 0) {
+		NetClose(udp_socket);
+		udp_socket = INVALID_SOCKET_HANDLE;
+	}
+	freeaddrinfo(result);
+
+	return udp_socket;
+}
+
+int64_t NetRecvFrom(SocketHandle socket, void *ptr, uint32_t size, NetAddress *address) {
+	socklen_t address_size = sizeof(address->storage);
+	int64_t result = recvfrom(socket, static_cast<char *>(ptr), static_cast<int>(size), 0,
+							  reinterpret_cast<sockaddr *>(address->storage), &address_size);
+	address->size = static_cast<uint32_t>(address_size);
+	return result;
+}
+
+bool NetConnectAddress(SocketHandle socket, const NetAddress &address) {
+	return connect(socket, reinterpret_cast<const sockaddr *>(address.storage), static_cast<int>(address.size)) == 0;
+}
+
+uint16_t NetLocalPort(SocketHandle socket) {
+	sockaddr_storage address {};
+	socklen_t address_size = sizeof(address);
+	if(getsockname(socket, reinterpret_cast<sockaddr *>(&address), &address_size) != 0) {
+		return 0;
+	}
+	if(address.ss_family == AF_INET6) {
+		return ntohs(reinterpret_cast<const sockaddr_in6 *>(&address)->sin6_port);
+	}
+	return ntohs(reinterpret_cast<const sockaddr_in *>(&address)->sin_port);
+}
+
+int64_t NetSend(SocketHandle socket, const void *ptr, uint32_t size) {
+	return send(socket, static_cast<const char *>(ptr), static_cast<int>(size), SEND_FLAGS);
+}
+
+int64_t NetRecv(SocketHandle socket, void *ptr, uint32_t size) {
+	return recv(socket, static_cast<char *>(ptr), static_cast<int>(size), 0);
+}
+
+bool NetSendAll(SocketHandle socket, const void *ptr, uint32_t size) {
+	const char *bytes = static_cast<const char *>(ptr);
+	while(size > 0) {
+		int64_t result = NetSend(socket, bytes, size);
+		if(result <= 0) return false;
+		bytes += result;
+		size -= static_cast<uint32_t>(result);
+	}
+	return true;
+}
+
+bool NetRecvAll(SocketHandle socket, void *ptr, uint32_t size) {
+	char *bytes = static_cast<char *>(ptr);
+	while(size > 0) {
+		int64_t result = NetRecv(socket, bytes, size);
+		if(result <= 0) return false;
+		bytes += result;
+		size -= static_cast<uint32_t>(result);
+	}
+	return true;
+}
+
+bool NetSendAllv(SocketHandle socket, const NetBuffer *buffers, uint32_t buffer_count) {
+	assert(buffer_count <= MAX_SEND_BUFFERS && "Too many buffers for a single gather write");
+
+#ifdef _WIN32
+	WSABUF wsa_buffers[MAX_SEND_BUFFERS];
+	for(uint32_t i = 0; i < buffer_count; ++i) {
+		wsa_buffers[i] = WSABUF {
+			.len = buffers[i].size,
+			.buf = static_cast<char *>(const_cast<void *>(buffers[i].ptr))
+		};
+	}
+	WSABUF *pending = wsa_buffers;
+#else
+	iovec io_vectors[MAX_SEND_BUFFERS];
+	for(uint32_t i = 0; i < buffer_count; ++i) {
+		io_vectors[i] = iovec {
+			.iov_base = const_cast<void *>(buffers[i].ptr),
+			.iov_len = buffers[i].size
+		};
+	}
+	iovec *pending = io_vectors;
+#endif
+
+	uint32_t pending_count = buffer_count;
+	while(pending_count > 0) {
+#ifdef _WIN32
+		DWORD bytes_sent = 0;
+		if(WSASend(socket, pending, pending_count, &bytes_sent, 0, nullptr, nullptr) != 0) return false;
+		uint64_t sent = bytes_sent;
+#else
+		msghdr message {
+			.msg_iov = pending,
+			.msg_iovlen = pending_count
+		};
+		ssize_t bytes_sent = sendmsg(socket, &message, SEND_FLAGS);
+		if(bytes_sent < 0) {
+			if(errno == EINTR) continue;
+			return false;
+		}
+		uint64_t sent = static_cast<uint64_t>(bytes_sent);
+#endif
+
+		// Skip fully written buffers and advance into the partially written one
+		while(pending_count > 0) {
+#ifdef _WIN32
+			uint64_t length = pending->len;
+#else
+			uint64_t length = pending->iov_len;
+#endif
+			if(sent < length) {
+#ifdef _WIN32
+				pending->buf += sent;
+				pending->len -= static_cast<ULONG>(sent);
+#else
+				pending->iov_base = static_cast<char *>(pending->iov_base) + sent;
+				pending->iov_len -= sent;
+#endif
+				break;
+			}
+			sent -= length;
+			++pending;
+			--pending_count;
+		}
+	}
+	return true;
+}
+
+bool NetSetNoDelay(SocketHandle socket, bool no_delay) {
+	int value = no_delay ? 1 : 0;
+	return setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char *>(&value), sizeof(value)) == 0;
+}
+
+bool NetSetSendBufferSize(SocketHandle socket, uint32_t size) {
+	int value = static_cast<int>(size);
+	return setsockopt(socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char *>(&value), sizeof(value)) == 0;
+}
+
+bool NetSetReceiveBufferSize(SocketHandle socket, uint32_t size) {
+	int value = static_cast<int>(size);
+	return setsockopt(socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char *>(&value), sizeof(value)) == 0;
+}
+
+bool NetSetUnsentLimit(SocketHandle socket, uint32_t size) {
+#ifdef TCP_NOTSENT_LOWAT
+	int value = static_cast<int>(size);
+	return setsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, reinterpret_cast<char *>(&value), sizeof(value)) == 0;
+#else
+	return false;
+#endif
+}
+
+bool NetSetNonBlocking(SocketHandle socket, bool non_blocking) {
+#ifdef _WIN32
+	u_long mode = non_blocking ? 1 : 0;
+	return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+	int flags = fcntl(socket, F_GETFL, 0);
+	if(flags < 0) return false;
+	flags = non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(socket, F_SETFL, flags) == 0;
+#endif
+}
+
+bool NetWouldBlock() {
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+bool NetWaitWritable(SocketHandle socket, int timeout_ms) {
+#ifdef _WIN32
+	WSAPOLLFD fd {
+		.fd = socket,
+		.events = POLLWRNORM
+	};
+	int result = WSAPoll(&fd, 1, timeout_ms);
+#else
+	pollfd fd {
+		.fd = socket,
+		.events = POLLOUT
+	};
+	int result;
+	do {
+		result = poll(&fd, 1, timeout_ms);
+	} while(result < 0 && errno == EINTR);
+#endif
+	return result == 1 && (fd.revents & (POLLERR | POLLHUP)) == 0;
+}
+
+#ifdef _WIN32
+static short ToPollEvents(uint32_t flags) {
+	short events = 0;
+	if(flags & NET_POLL_READ) events |= POLLRDNORM;
+	if(flags & NET_POLL_WRITE) events |= POLLWRNORM;
+	return events;
+}
+
+bool NetPoller::Initialize() {
+	fd_count = 0;
+	return true;
+}
+
+bool NetPoller::Add(SocketHandle socket, uint32_t flags) {
+	if(fd_count == MAX_POLL_EVENTS) return false;
+	fds[fd_count++] = WSAPOLLFD {
+		.fd = socket,
+		.events = ToPollEvents(flags)
+	};
+	return true;
+}
+
+bool NetPoller::Modify(SocketHandle socket, uint32_t flags) {
+	for(uint32_t i = 0; i < fd_count; ++i) {
+		if(fds[i].fd == socket) {
+			fds[i].events = ToPollEvents(flags);
+			return true;
+		}
+	}
+	return false;
+}
+
+void NetPoller::Remove(SocketHandle socket) {
+	for(uint32_t i = 0; i < fd_count; ++i) {
+		if(fds[i].fd == socket) {
+			fds[i] = fds[--fd_count];
+			return;
+		}
+	}
+}
+
+int NetPoller::Wait(NetPollEvent *events, uint32_t max_events, int timeout_ms) {
+	if(fd_count == 0) {
+		Sleep(timeout_ms < 0 ? 0 : timeout_ms);
+		return 0;
+	}
+
+	int result = WSAPoll(fds, fd_count, timeout_ms);
+	if(result <= 0) return result;
+
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < fd_count && count < max_events; ++i) {
+		if(fds[i].revents == 0) continue;
+
+		uint32_t flags = 0;
+		if(fds[i].revents & (POLLRDNORM | POLLHUP)) flags |= NET_POLL_READ;
+		if(fds[i].revents & POLLWRNORM) flags |= NET_POLL_WRITE;
+		if(fds[i].revents & (POLLERR | POLLNVAL)) flags |= NET_POLL_ERROR;
+		events[count++] = NetPollEvent {
+			.socket = fds[i].fd,
+			.flags = flags
+		};
+	}
+	return static_cast<int>(count);
+}
+
+void NetPoller::Shutdown() {
+	fd_count = 0;
+}
+#else
+static uint32_t ToEpollEvents(uint32_t flags) {
+	uint32_t events = 0;
+	if(flags & NET_POLL_READ) events |= EPOLLIN;
+	if(flags & NET_POLL_WRITE) events |= EPOLLOUT;
+	return events;
+}
+
+bool NetPoller::Initialize() {
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	return epoll_fd >= 0;
+}
+
+bool NetPoller::Add(SocketHandle socket, uint32_t flags) {
+	epoll_event event {
+		.events = ToEpollEvents(flags),
+		.data = { .fd = socket }
+	};
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &event) == 0;
+}
+
+bool NetPoller::Modify(SocketHandle socket, uint32_t flags) {
+	epoll_event event {
+		.events = ToEpollEvents(flags),
+		.data = { .fd = socket }
+	};
+	return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, socket, &event) == 0;
+}
+
+void NetPoller::Remove(SocketHandle socket) {
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket, nullptr);
+}
+
+int NetPoller::Wait(NetPollEvent *events, uint32_t max_events, int timeout_ms) {
+	epoll_event epoll_events[MAX_POLL_EVENTS];
+	if(max_events > MAX_POLL_EVENTS) max_events = MAX_POLL_EVENTS;
+
+	int result = epoll_wait(epoll_fd, epoll_events, static_cast<int>(max_events), timeout_ms);
+	if(result < 0) return errno == EINTR ? 0 : -1;
+
+	for(int i = 0; i < result; ++i) {
+		uint32_t flags = 0;
+		if(epoll_events[i].events & (EPOLLIN | EPOLLHUP)) flags |= NET_POLL_READ;
+		if(epoll_events[i].events & EPOLLOUT) flags |= NET_POLL_WRITE;
+		if(epoll_events[i].events & EPOLLERR) flags |= NET_POLL_ERROR;
+		events[i] = NetPollEvent {
+			.socket = epoll_events[i].data.fd,
+			.flags = flags
+		};
+	}
+	return result;
+}
+
+void NetPoller::Shutdown() {
+	if(epoll_fd >= 0) {
+		close(epoll_fd);
+	}
+	epoll_fd = -1;
+}
+#endif
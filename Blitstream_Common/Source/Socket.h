@@ -0,0 +1,110 @@
+#pragma once
+#include <cstdint>
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+using SocketHandle = SOCKET;
+constexpr SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+using SocketHandle = int;
+constexpr SocketHandle INVALID_SOCKET_HANDLE = -1;
+#endif
+
+constexpr uint32_t MAX_POLL_EVENTS = 64;
+constexpr uint32_t MAX_SEND_BUFFERS = 16;
+// Large enough for a dotted IPv4 address, matches INET_ADDRSTRLEN
+constexpr uint32_t NET_ADDRESS_SIZE = 16;
+
+// Opaque socket address, large enough for sockaddr_storage
+struct NetAddress {
+	alignas(8) uint8_t storage[128];
+	uint32_t size;
+};
+
+// Thin layer over Winsock and BSD sockets, all calls are blocking unless
+// the socket has been switched to non-blocking mode with NetSetNonBlocking
+bool NetStartup();
+void NetCleanup();
+
+SocketHandle NetListen(const char *port);
+SocketHandle NetAccept(SocketHandle listen_socket, char *address, uint32_t address_size);
+SocketHandle NetConnect(const char *address, const char *port);
+void NetClose(SocketHandle socket);
+// Shut down both directions, wakes up any thread blocked on the socket
+void NetDisconnect(SocketHandle socket);
+
+// Datagram sockets. A socket bound with NetBindUdp learns its peer from the
+// first datagram and is then connected to it with NetConnectAddress, after
+// which NetSend/NetRecv and NetSendAllv transfer one datagram per call
+SocketHandle NetBindUdp(const char *port);
+SocketHandle NetConnectUdp(const char *address, const char *port);
+int64_t NetRecvFrom(SocketHandle socket, void *ptr, uint32_t size, NetAddress *address);
+bool NetConnectAddress(SocketHandle socket, const NetAddress &address);
+// Port the socket is bound to, for sockets bound to port "0". Returns 0 on error
+uint16_t NetLocalPort(SocketHandle socket);
+
+// Returns the number of bytes transferred, 0 if the peer closed the
+// connection or -1 on error (including would-block on non-blocking sockets)
+int64_t NetSend(SocketHandle socket, const void *ptr, uint32_t size);
+int64_t NetRecv(SocketHandle socket, void *ptr, uint32_t size);
+
+// Loop until every byte has been transferred
+bool NetSendAll(SocketHandle socket, const void *ptr, uint32_t size);
+bool NetRecvAll(SocketHandle socket, void *ptr, uint32_t size);
+
+struct NetBuffer {
+	const void *ptr;
+	uint32_t size;
+};
+
+// Gather write of up to MAX_SEND_BUFFERS buffers in a single syscall
+// (sendmsg on POSIX, WSASend on Windows), partial writes are resumed
+// from where the previous call stopped
+bool NetSendAllv(SocketHandle socket, const NetBuffer *buffers, uint32_t buffer_count);
+
+// Disable Nagle's algorithm so small writes are not held back waiting for ACKs
+bool NetSetNoDelay(SocketHandle socket, bool no_delay);
+bool NetSetSendBufferSize(SocketHandle socket, uint32_t size);
+bool NetSetReceiveBufferSize(SocketHandle socket, uint32_t size);
+// Caps the bytes a TCP socket holds that have not been sent yet, sends block
+// beyond that instead of queuing behind the data already in flight. Returns
+// false where the platform has no such limit (Windows)
+bool NetSetUnsentLimit(SocketHandle socket, uint32_t size);
+
+bool NetSetNonBlocking(SocketHandle socket, bool non_blocking);
+bool NetWouldBlock();
+// Waits until a send would not block, returns false on timeout or error.
+// A negative timeout waits indefinitely
+bool NetWaitWritable(SocketHandle socket, int timeout_ms);
+
+enum NetPollFlags : uint32_t {
+	NET_POLL_READ = 1 << 0,
+	NET_POLL_WRITE = 1 << 1,
+	NET_POLL_ERROR = 1 << 2
+};
+
+struct NetPollEvent {
+	SocketHandle socket;
+	uint32_t flags;
+};
+
+// Readiness notification over a set of sockets, epoll on Linux and WSAPoll on Windows
+struct NetPoller {
+#ifdef _WIN32
+	WSAPOLLFD fds[MAX_POLL_EVENTS];
+	uint32_t fd_count;
+#else
+	int epoll_fd;
+#endif
+
+	bool Initialize();
+	bool Add(SocketHandle socket, uint32_t flags);
+	bool Modify(SocketHandle socket, uint32_t flags);
+	void Remove(SocketHandle socket);
+
+	// Returns the number of events written, 0 on timeout and -1 on error
+	int Wait(NetPollEvent *events, uint32_t max_events, int timeout_ms);
+
+	void Shutdown();
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Bounded wait-free queue for exactly one producer thread and one consumer thread
+template<typename T, uint32_t CAPACITY>
+struct SpscQueue {
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+	// Keep the producer and consumer indices on separate cache lines
+	alignas(64) std::atomic<uint32_t> head;
+	alignas(64) std::atomic<uint32_t> tail;
+	alignas(64) T items[CAPACITY];
+
+	bool Push(const T &item) {
+		uint32_t current_tail = tail.load(std::memory_order_relaxed);
+		if(current_tail - head.load(std::memory_order_acquire) == CAPACITY) {
+			return false;
+		}
+		items[current_tail & (CAPACITY - 1)] = item;
+		tail.store(current_tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T *item) {
+		uint32_t current_head = head.load(std::memory_order_relaxed);
+		if(current_head == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		*item = items[current_head & (CAPACITY - 1)];
+		head.store(current_head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Approximate when called concurrently with Push or Pop
+	uint32_t Size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+};
@@ -0,0 +1,628 @@
+#include "TileCodec.h"
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define TILE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define TILE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// MSVC accepts any intrinsic without a matching /arch, GCC and Clang have to
+// be told per function
+#if defined(TILE_X86) && !defined(_MSC_VER)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+// The hash runs 32 independent lanes of an xxHash32 style round over the
+// pixels of a row, pixel x going to lane x % 32, so that vector kernels
+// keep all lanes in registers and still agree with the scalar one
+constexpr uint32_t HASH_LANES = 32;
+constexpr uint32_t HASH_PRIME_1 = 0x9E3779B1u;
+constexpr uint32_t HASH_PRIME_2 = 0x85EBCA77u;
+constexpr uint32_t HASH_SEED = 0x165667B1u;
+
+using HashFunction = void (*)(uint32_t *lanes, const uint32_t *pixels, uint32_t stride, uint32_t width,
+							  uint32_t height);
+
+struct TileState {
+	bool initialized;
+	TileKernel kernel;
+	HashFunction hash;
+};
+
+static TileState state;
+
+static inline uint32_t HashRound(uint32_t acc, uint32_t value) {
+	acc += value * HASH_PRIME_2;
+	acc = (acc << 13) | (acc >> 19);
+	return acc * HASH_PRIME_1;
+}
+
+static void HashRowTail(uint32_t *lanes, const uint32_t *row, uint32_t begin, uint32_t width) {
+	for(uint32_t x = begin; x < width; ++x) {
+		lanes[x % HASH_LANES] = HashRound(lanes[x % HASH_LANES], row[x]);
+	}
+}
+
+static void HashScalar(uint32_t *lanes, const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height) {
+	for(uint32_t y = 0; y < height; ++y) {
+		HashRowTail(lanes, pixels + static_cast<size_t>(y) * stride, 0, width);
+	}
+}
+
+#ifdef TILE_X86
+TARGET_SSE41 static inline __m128i HashRoundSse41(__m128i acc, __m128i value, __m128i prime_1, __m128i prime_2) {
+	acc = _mm_add_epi32(acc, _mm_mullo_epi32(value, prime_2));
+	acc = _mm_or_si128(_mm_slli_epi32(acc, 13), _mm_srli_epi32(acc, 19));
+	return _mm_mullo_epi32(acc, prime_1);
+}
+
+TARGET_SSE41 static void HashSse41(uint32_t *lanes, const uint32_t *pixels, uint32_t stride, uint32_t width,
+								   uint32_t height) {
+	__m128i prime_1 = _mm_set1_epi32(static_cast<int>(HASH_PRIME_1));
+	__m128i prime_2 = _mm_set1_epi32(static_cast<int>(HASH_PRIME_2));
+	__m128i acc[8];
+	for(uint32_t i = 0; i < 8; ++i) {
+		acc[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes + i * 4));
+	}
+	uint32_t full = width - width % HASH_LANES;
+	for(uint32_t y = 0; y < height; ++y) {
+		const uint32_t *row = pixels + static_cast<size_t>(y) * stride;
+		for(uint32_t x = 0; x < full; x += HASH_LANES) {
+			for(uint32_t i = 0; i < 8; ++i) {
+				__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + i * 4));
+				acc[i] = HashRoundSse41(acc[i], value, prime_1, prime_2);
+			}
+		}
+		// Only tiles cut off at the frame's right edge get here
+		if(full != width) {
+			for(uint32_t i = 0; i < 8; ++i) {
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + i * 4), acc[i]);
+			}
+			HashRowTail(lanes, row, full, width);
+			for(uint32_t i = 0; i < 8; ++i) {
+				acc[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes + i * 4));
+			}
+		}
+	}
+	for(uint32_t i = 0; i < 8; ++i) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + i * 4), acc[i]);
+	}
+}
+
+TARGET_AVX2 static inline __m256i HashRoundAvx2(__m256i acc, __m256i value, __m256i prime_1, __m256i prime_2) {
+	acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(value, prime_2));
+	acc = _mm256_or_si256(_mm256_slli_epi32(acc, 13), _mm256_srli_epi32(acc, 19));
+	return _mm256_mullo_epi32(acc, prime_1);
+}
+
+TARGET_AVX2 static void HashAvx2(uint32_t *lanes, const uint32_t *pixels, uint32_t stride, uint32_t width,
+								 uint32_t height) {
+	__m256i prime_1 = _mm256_set1_epi32(static_cast<int>(HASH_PRIME_1));
+	__m256i prime_2 = _mm256_set1_epi32(static_cast<int>(HASH_PRIME_2));
+	__m256i acc[4];
+	for(uint32_t i = 0; i < 4; ++i) {
+		acc[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lanes + i * 8));
+	}
+	uint32_t full = width - width % HASH_LANES;
+	for(uint32_t y = 0; y < height; ++y) {
+		const uint32_t *row = pixels + static_cast<size_t>(y) * stride;
+		for(uint32_t x = 0; x < full; x += HASH_LANES) {
+			for(uint32_t i = 0; i < 4; ++i) {
+				__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + x + i * 8));
+				acc[i] = HashRoundAvx2(acc[i], value, prime_1, prime_2);
+			}
+		}
+		if(full != width) {
+			for(uint32_t i = 0; i < 4; ++i) {
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + i * 8), acc[i]);
+			}
+			HashRowTail(lanes, row, full, width);
+			for(uint32_t i = 0; i < 4; ++i) {
+				acc[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lanes + i * 8));
+			}
+		}
+	}
+	for(uint32_t i = 0; i < 4; ++i) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + i * 8), acc[i]);
+	}
+}
+#endif
+
+#ifdef TILE_NEON
+static inline uint32x4_t HashRoundNeon(uint32x4_t acc, uint32x4_t value, uint32x4_t prime_1, uint32x4_t prime_2) {
+	acc = vmlaq_u32(acc, value, prime_2);
+	acc = vsriq_n_u32(vshlq_n_u32(acc, 13), acc, 19);
+	return vmulq_u32(acc, prime_1);
+}
+
+static void HashNeon(uint32_t *lanes, const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height) {
+	uint32x4_t prime_1 = vdupq_n_u32(HASH_PRIME_1);
+	uint32x4_t prime_2 = vdupq_n_u32(HASH_PRIME_2);
+	uint32x4_t acc[8];
+	for(uint32_t i = 0; i < 8; ++i) {
+		acc[i] = vld1q_u32(lanes + i * 4);
+	}
+	uint32_t full = width - width % HASH_LANES;
+	for(uint32_t y = 0; y < height; ++y) {
+		const uint32_t *row = pixels + static_cast<size_t>(y) * stride;
+		for(uint32_t x = 0; x < full; x += HASH_LANES) {
+			for(uint32_t i = 0; i < 8; ++i) {
+				acc[i] = HashRoundNeon(acc[i], vld1q_u32(row + x + i * 4), prime_1, prime_2);
+			}
+		}
+		if(full != width) {
+			for(uint32_t i = 0; i < 8; ++i) {
+				vst1q_u32(lanes + i * 4, acc[i]);
+			}
+			HashRowTail(lanes, row, full, width);
+			for(uint32_t i = 0; i < 8; ++i) {
+				acc[i] = vld1q_u32(lanes + i * 4);
+			}
+		}
+	}
+	for(uint32_t i = 0; i < 8; ++i) {
+		vst1q_u32(lanes + i * 4, acc[i]);
+	}
+}
+#endif
+
+static bool CpuSupports(TileKernel kernel) {
+	if(kernel == TileKernel::Scalar) {
+		return true;
+	}
+#if defined(TILE_X86)
+	if(kernel == TileKernel::Neon) {
+		return false;
+	}
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	if(kernel == TileKernel::Sse41) {
+		return (info[2] & (1 << 19)) != 0;
+	}
+	// AVX state has to be enabled by the OS as well
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	return avx && (info[1] & (1 << 5)) != 0;
+#else
+	if(kernel == TileKernel::Sse41) {
+		return __builtin_cpu_supports("sse4.1");
+	}
+	return __builtin_cpu_supports("avx2");
+#endif
+#elif defined(TILE_NEON)
+	// NEON is part of AArch64
+	return kernel == TileKernel::Neon;
+#else
+	return false;
+#endif
+}
+
+void TileInitialize() {
+	if(state.initialized) {
+		return;
+	}
+	state.initialized = true;
+	if(!TileSelectKernel(TileKernel::Avx2) && !TileSelectKernel(TileKernel::Sse41) &&
+	   !TileSelectKernel(TileKernel::Neon)) {
+		TileSelectKernel(TileKernel::Scalar);
+	}
+}
+
+bool TileSelectKernel(TileKernel kernel) {
+	if(!CpuSupports(kernel)) {
+		return false;
+	}
+
+	state.kernel = kernel;
+	switch(kernel) {
+#ifdef TILE_X86
+	case TileKernel::Avx2:
+		state.hash = HashAvx2;
+		break;
+	case TileKernel::Sse41:
+		state.hash = HashSse41;
+		break;
+#endif
+#ifdef TILE_NEON
+	case TileKernel::Neon:
+		state.hash = HashNeon;
+		break;
+#endif
+	default:
+		state.hash = HashScalar;
+		break;
+	}
+	return true;
+}
+
+TileKernel TileSelectedKernel() {
+	return state.kernel;
+}
+
+const char *TileKernelName(TileKernel kernel) {
+	switch(kernel) {
+	case TileKernel::Sse41:
+		return "sse4.1";
+	case TileKernel::Avx2:
+		return "avx2";
+	case TileKernel::Neon:
+		return "neon";
+	default:
+		return "scalar";
+	}
+}
+
+uint64_t TileHash(const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height) {
+	uint32_t lanes[HASH_LANES];
+	for(uint32_t i = 0; i < HASH_LANES; ++i) {
+		lanes[i] = HASH_SEED + i * HASH_PRIME_2;
+	}
+	state.hash(lanes, pixels, stride, width, height);
+
+	// Blocks of different shapes with the same pixels must not collide
+	uint64_t hash = ((static_cast<uint64_t>(width) << 32) | height) * 0x9E3779B97F4A7C15ull;
+	for(uint32_t i = 0; i < HASH_LANES; ++i) {
+		hash = (hash ^ lanes[i]) * 0x100000001B3ull;
+		hash ^= hash >> 29;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static inline uint32_t Load32(const uint8_t *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+// Writes the length beyond what fits into a token nibble
+static inline uint8_t *WriteLength(uint8_t *out, uint32_t length) {
+	for(; length >= 255; length -= 255) {
+		*out++ = 255;
+	}
+	*out++ = static_cast<uint8_t>(length);
+	return out;
+}
+
+// Literals, then a match unless match_length is 0. False if it does not fit
+static bool WriteSequence(uint8_t *&out, const uint8_t *end, const uint8_t *literals, uint32_t literal_count,
+						  uint32_t offset, uint32_t match_length) {
+	uint32_t extra = match_length >= TILE_LZ_MIN_MATCH ? match_length - TILE_LZ_MIN_MATCH : 0;
+	size_t needed = 1 + (literal_count >= 15 ? (literal_count - 15) / 255 + 1 : 0) + literal_count +
+					(match_length != 0 ? 2 + (extra >= 15 ? (extra - 15) / 255 + 1 : 0) : 0);
+	if(needed > static_cast<size_t>(end - out)) {
+		return false;
+	}
+
+	uint8_t *token = out++;
+	*token = static_cast<uint8_t>((literal_count < 15 ? literal_count : 15) << 4);
+	if(literal_count >= 15) {
+		out = WriteLength(out, literal_count - 15);
+	}
+	memcpy(out, literals, literal_count);
+	out += literal_count;
+	if(match_length != 0) {
+		*token |= static_cast<uint8_t>(extra < 15 ? extra : 15);
+		*out++ = static_cast<uint8_t>(offset);
+		*out++ = static_cast<uint8_t>(offset >> 8);
+		if(extra >= 15) {
+			out = WriteLength(out, extra - 15);
+		}
+	}
+	return true;
+}
+
+uint32_t TileLzCompress(const uint8_t *src, uint32_t size, uint8_t *data, uint32_t capacity, TileScratch *scratch) {
+	// Positions are kept in 16 bits
+	assert(size <= 65536);
+	memset(scratch->lz_table, 0, sizeof(scratch->lz_table));
+
+	uint8_t *out = data;
+	const uint8_t *end = data + capacity;
+	uint32_t anchor = 0;
+	uint32_t i = 0;
+	while(i + TILE_LZ_MIN_MATCH <= size) {
+		uint32_t sequence = Load32(src + i);
+		uint32_t slot = (sequence * 2654435761u) >> (32 - TILE_LZ_HASH_BITS);
+		uint32_t candidate = scratch->lz_table[slot];
+		scratch->lz_table[slot] = static_cast<uint16_t>(i);
+		// A stale slot is harmless, the bytes are compared anyway
+		if(candidate >= i || Load32(src + candidate) != sequence) {
+			++i;
+			continue;
+		}
+
+		uint32_t length = TILE_LZ_MIN_MATCH;
+		while(i + length < size && src[candidate + length] == src[i + length]) {
+			++length;
+		}
+		if(!WriteSequence(out, end, src + anchor, i - anchor, i - candidate, length)) {
+			return 0;
+		}
+		i += length;
+		anchor = i;
+	}
+	if(!WriteSequence(out, end, src + anchor, size - anchor, 0, 0)) {
+		return 0;
+	}
+	return static_cast<uint32_t>(out - data);
+}
+
+// Adds the bytes continuing a length of 15, false if data ends first
+static bool ReadLength(const uint8_t *data, uint32_t data_size, uint32_t &position, uint32_t &length) {
+	uint8_t byte;
+	do {
+		if(position >= data_size) {
+			return false;
+		}
+		byte = data[position++];
+		length += byte;
+	} while(byte == 255);
+	return true;
+}
+
+bool TileLzDecompress(const uint8_t *data, uint32_t data_size, uint8_t *dst, uint32_t size) {
+	uint32_t position = 0;
+	uint32_t written = 0;
+	// The last sequence has literals only, data that ends after a match was cut off
+	while(true) {
+		if(position == data_size) {
+			return false;
+		}
+		uint8_t token = data[position++];
+		uint32_t literal_count = token >> 4;
+		if(literal_count == 15 && !ReadLength(data, data_size, position, literal_count)) {
+			return false;
+		}
+		if(literal_count > size - written || literal_count > data_size - position) {
+			return false;
+		}
+		memcpy(dst + written, data + position, literal_count);
+		written += literal_count;
+		position += literal_count;
+		if(position == data_size) {
+			break;
+		}
+
+		if(data_size - position < 2) {
+			return false;
+		}
+		uint32_t offset = data[position] | (static_cast<uint32_t>(data[position + 1]) << 8);
+		position += 2;
+		uint32_t length = token & 15;
+		if(length == 15 && !ReadLength(data, data_size, position, length)) {
+			return false;
+		}
+		length += TILE_LZ_MIN_MATCH;
+		if(offset == 0 || offset > written || length > size - written) {
+			return false;
+		}
+		uint8_t *match = dst + written - offset;
+		if(offset >= length) {
+			memcpy(dst + written, match, length);
+		} else {
+			// Overlapping matches repeat the last offset bytes
+			for(uint32_t i = 0; i < length; ++i) {
+				dst[written + i] = match[i];
+			}
+		}
+		written += length;
+	}
+	return written == size;
+}
+
+// Bits per palette index for a palette of count colors
+static uint32_t PaletteBits(uint32_t count) {
+	return count <= 2 ? 1 : count <= 4 ? 2 : 4;
+}
+
+// Payload bytes of the indices before compression
+static uint32_t PaletteIndicesSize(uint32_t width, uint32_t height, uint32_t bits) {
+	return (width * bits + 7) / 8 * height;
+}
+
+// Writes src to payload as it is or compressed if that is smaller, returns the
+// bytes used and sets TILE_FLAG_LZ accordingly
+static uint32_t WriteMaybeCompressed(TileRecord *record, const uint8_t *src, uint32_t size, uint8_t *payload,
+									 TileScratch *scratch) {
+	uint32_t compressed = size > 1 ? TileLzCompress(src, size, payload, size - 1, scratch) : 0;
+	if(compressed != 0) {
+		record->flags |= TILE_FLAG_LZ;
+		return compressed;
+	}
+	memcpy(payload, src, size);
+	return size;
+}
+
+uint32_t TileCompress(const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height, uint32_t index,
+					  uint8_t *data, TileScratch *scratch) {
+	assert(width != 0 && width <= TILE_SIZE && height != 0 && height <= TILE_SIZE);
+
+	// Alpha is not sent, so colors only differing in it are the same
+	uint32_t palette[MAX_TILE_PALETTE];
+	uint32_t palette_size = 0;
+	uint32_t last = 0;
+	bool fits = true;
+	for(uint32_t y = 0; y < height && fits; ++y) {
+		const uint32_t *row = pixels + static_cast<size_t>(y) * stride;
+		uint8_t *indices = scratch->indices + y * width;
+		for(uint32_t x = 0; x < width; ++x) {
+			uint32_t color = row[x] | 0xFF000000;
+			// Runs of one color are the common case in office content
+			if(palette_size != 0 && palette[last] == color) {
+				indices[x] = static_cast<uint8_t>(last);
+				continue;
+			}
+			uint32_t i = 0;
+			while(i < palette_size && palette[i] != color) {
+				++i;
+			}
+			if(i == palette_size) {
+				if(palette_size == MAX_TILE_PALETTE) {
+					fits = false;
+					break;
+				}
+				palette[palette_size++] = color;
+			}
+			indices[x] = static_cast<uint8_t>(i);
+			last = i;
+		}
+	}
+
+	TileRecord record = {
+		.index = index,
+		.mode = TileMode::Raw,
+		.flags = 0,
+		.palette_size = 0,
+		.reserved = 0,
+		.size = 0,
+	};
+	uint8_t *payload = data + sizeof(TileRecord);
+	if(fits && palette_size == 1) {
+		record.mode = TileMode::Fill;
+		memcpy(payload, palette, sizeof(uint32_t));
+		record.size = sizeof(uint32_t);
+	} else if(fits) {
+		record.mode = TileMode::Palette;
+		record.palette_size = static_cast<uint8_t>(palette_size);
+		memcpy(payload, palette, palette_size * sizeof(uint32_t));
+
+		uint32_t bits = PaletteBits(palette_size);
+		uint32_t row_bytes = (width * bits + 7) / 8;
+		uint8_t *packed = scratch->staging;
+		memset(packed, 0, row_bytes * height);
+		for(uint32_t y = 0; y < height; ++y) {
+			const uint8_t *indices = scratch->indices + y * width;
+			uint8_t *row = packed + y * row_bytes;
+			for(uint32_t x = 0; x < width; ++x) {
+				uint32_t bit = x * bits;
+				row[bit / 8] |= static_cast<uint8_t>(indices[x] << (bit % 8));
+			}
+		}
+		uint32_t palette_bytes = palette_size * sizeof(uint32_t);
+		record.size = palette_bytes + WriteMaybeCompressed(&record, packed, row_bytes * height,
+														   payload + palette_bytes, scratch);
+	} else {
+		uint8_t *bgr = scratch->staging;
+		for(uint32_t y = 0; y < height; ++y) {
+			const uint32_t *row = pixels + static_cast<size_t>(y) * stride;
+			for(uint32_t x = 0; x < width; ++x) {
+				uint32_t pixel = row[x];
+				*bgr++ = static_cast<uint8_t>(pixel);
+				*bgr++ = static_cast<uint8_t>(pixel >> 8);
+				*bgr++ = static_cast<uint8_t>(pixel >> 16);
+			}
+		}
+		record.size = WriteMaybeCompressed(&record, scratch->staging, width * height * 3, payload, scratch);
+	}
+
+	memcpy(data, &record, sizeof(record));
+	return sizeof(TileRecord) + record.size;
+}
+
+// Points src at size bytes of the payload, decompressing them if needed
+static bool ReadMaybeCompressed(const TileRecord &record, const uint8_t *payload, uint32_t payload_size,
+								uint32_t size, const uint8_t *&src, TileScratch *scratch) {
+	if((record.flags & TILE_FLAG_LZ) == 0) {
+		src = payload;
+		return payload_size == size;
+	}
+	src = scratch->staging;
+	return TileLzDecompress(payload, payload_size, scratch->staging, size);
+}
+
+bool TileDecompress(const TileRecord &record, const uint8_t *payload, uint32_t *pixels, uint32_t stride,
+					uint32_t width, uint32_t height, TileScratch *scratch) {
+	if(width == 0 || width > TILE_SIZE || height == 0 || height > TILE_SIZE || (record.flags & ~TILE_FLAG_LZ) != 0) {
+		return false;
+	}
+
+	switch(record.mode) {
+	case TileMode::Fill: {
+		if(record.size != sizeof(uint32_t) || record.flags != 0) {
+			return false;
+		}
+		uint32_t color;
+		memcpy(&color, payload, sizeof(color));
+		color |= 0xFF000000;
+		for(uint32_t y = 0; y < height; ++y) {
+			uint32_t *row = pixels + static_cast<size_t>(y) * stride;
+			for(uint32_t x = 0; x < width; ++x) {
+				row[x] = color;
+			}
+		}
+		return true;
+	}
+	case TileMode::Palette: {
+		uint32_t palette_size = record.palette_size;
+		uint32_t palette_bytes = palette_size * sizeof(uint32_t);
+		if(palette_size < 2 || palette_size > MAX_TILE_PALETTE || record.size < palette_bytes) {
+			return false;
+		}
+		uint32_t palette[MAX_TILE_PALETTE];
+		memcpy(palette, payload, palette_bytes);
+		for(uint32_t i = 0; i < palette_size; ++i) {
+			palette[i] |= 0xFF000000;
+		}
+
+		uint32_t bits = PaletteBits(palette_size);
+		uint32_t row_bytes = (width * bits + 7) / 8;
+		const uint8_t *packed;
+		if(!ReadMaybeCompressed(record, payload + palette_bytes, record.size - palette_bytes,
+								PaletteIndicesSize(width, height, bits), packed, scratch)) {
+			return false;
+		}
+		uint32_t mask = (1u << bits) - 1;
+		for(uint32_t y = 0; y < height; ++y) {
+			const uint8_t *row = packed + y * row_bytes;
+			uint32_t *out = pixels + static_cast<size_t>(y) * stride;
+			for(uint32_t x = 0; x < width; ++x) {
+				uint32_t bit = x * bits;
+				uint32_t index = (row[bit / 8] >> (bit % 8)) & mask;
+				if(index >= palette_size) {
+					return false;
+				}
+				out[x] = palette[index];
+			}
+		}
+		return true;
+	}
+	case TileMode::Raw: {
+		if(record.palette_size != 0) {
+			return false;
+		}
+		const uint8_t *bgr;
+		if(!ReadMaybeCompressed(record, payload, record.size, width * height * 3, bgr, scratch)) {
+			return false;
+		}
+		for(uint32_t y = 0; y < height; ++y) {
+			uint32_t *out = pixels + static_cast<size_t>(y) * stride;
+			for(uint32_t x = 0; x < width; ++x) {
+				out[x] = 0xFF000000 | (static_cast<uint32_t>(bgr[2]) << 16) | (static_cast<uint32_t>(bgr[1]) << 8) |
+						 bgr[0];
+				bgr += 3;
+			}
+		}
+		return true;
+	}
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include "Protocol.h"
+
+// Coding of single tiles for Codec::Tiles, see TileRecord. A tile with one
+// color is a fill, one with up to MAX_TILE_PALETTE colors a palette, anything
+// else is raw. Palette indices and raw pixels then go through an LZ4 style
+// compressor: a token byte holds the literal count in its high and the match
+// length minus TILE_LZ_MIN_MATCH in its low nibble, either continued in extra
+// bytes while they are 255 when the nibble is 15. The literals follow, then a
+// 2 byte offset back into the output and the extra match length bytes. The
+// last sequence has literals only
+
+constexpr uint32_t MAX_TILE_PALETTE = 16;
+constexpr uint32_t TILE_LZ_MIN_MATCH = 4;
+// Positions of 4 byte sequences the compressor remembers
+constexpr uint32_t TILE_LZ_HASH_BITS = 12;
+
+enum class TileKernel : uint32_t {
+	Scalar,
+	// 4 hash lanes per register
+	Sse41,
+	// 8 hash lanes per register
+	Avx2,
+	// 4 hash lanes per register
+	Neon
+};
+
+// Selects the fastest kernel the CPU supports, must be called before
+// anything else in here. Calling it again is harmless
+void TileInitialize();
+
+// Overrides the kernel for benchmarking, false if the CPU does not support it
+bool TileSelectKernel(TileKernel kernel);
+TileKernel TileSelectedKernel();
+const char *TileKernelName(TileKernel kernel);
+
+// Hash of a width by height block of pixels, stride in pixels. Every kernel
+// gives the same value
+uint64_t TileHash(const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height);
+
+constexpr uint32_t TileLzCompressBound(uint32_t size) {
+	return size + size / 255 + 16;
+}
+
+// Worst case of a TileRecord and its payload
+constexpr uint32_t MAX_TILE_RECORD_SIZE = sizeof(TileRecord) + TileLzCompressBound(TILE_SIZE * TILE_SIZE * 3);
+
+// Working memory of one thread compressing or decompressing tiles
+struct TileScratch {
+	uint16_t lz_table[1u << TILE_LZ_HASH_BITS];
+	uint8_t indices[TILE_SIZE * TILE_SIZE];
+	uint8_t staging[TILE_SIZE * TILE_SIZE * 3];
+};
+
+// Returns the bytes written to data, or 0 if they would not fit into capacity
+uint32_t TileLzCompress(const uint8_t *src, uint32_t size, uint8_t *data, uint32_t capacity, TileScratch *scratch);
+// Returns false unless data decompresses to exactly size bytes
+bool TileLzDecompress(const uint8_t *data, uint32_t data_size, uint8_t *dst, uint32_t size);
+
+// Writes the tile as a TileRecord and its payload to data, which must hold
+// MAX_TILE_RECORD_SIZE bytes, and returns the bytes used. Stride in pixels
+uint32_t TileCompress(const uint32_t *pixels, uint32_t stride, uint32_t width, uint32_t height, uint32_t index,
+					  uint8_t *data, TileScratch *scratch);
+// Decodes a record's payload into a width by height block, false if the
+// payload is malformed. The block is unspecified then
+bool TileDecompress(const TileRecord &record, const uint8_t *payload, uint32_t *pixels, uint32_t stride, uint32_t width,
+					uint32_t height, TileScratch *scratch);
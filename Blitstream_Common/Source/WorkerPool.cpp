@@ -0,0 +1,83 @@
+#include "WorkerPool.h"
+
+void WorkerPool::Initialize(uint32_t thread_total) {
+	if(thread_total == 0) {
+		thread_total = std::thread::hardware_concurrency();
+	}
+	thread_total = thread_total < 1 ? 1 : thread_total;
+	thread_count = thread_total - 1 > MAX_WORKER_THREADS ? MAX_WORKER_THREADS : thread_total - 1;
+	generation = 0;
+	active = 0;
+	stopping = false;
+	job_count = 0;
+	next_job.store(0, std::memory_order_relaxed);
+	for(uint32_t i = 0; i < thread_count; ++i) {
+		threads[i] = std::thread(&WorkerPool::WorkerLoop, this);
+	}
+}
+
+void WorkerPool::RunJobs() {
+	for(uint32_t i = next_job.fetch_add(1, std::memory_order_relaxed); i < job_count;
+		i = next_job.fetch_add(1, std::memory_order_relaxed)) {
+		job(job_user_data, i);
+	}
+}
+
+void WorkerPool::WorkerLoop() {
+	uint64_t seen_generation = 0;
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			batch_started.wait(lock, [&] { return stopping || generation != seen_generation; });
+			if(stopping) {
+				return;
+			}
+			seen_generation = generation;
+		}
+		RunJobs();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(--active == 0) {
+				batch_finished.notify_one();
+			}
+		}
+	}
+}
+
+void WorkerPool::Run(uint32_t count, void (*job_function)(void *user_data, uint32_t index), void *user_data) {
+	// Waking threads costs more than a single job
+	if(thread_count == 0 || count <= 1) {
+		for(uint32_t i = 0; i < count; ++i) {
+			job_function(user_data, i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = job_function;
+		job_user_data = user_data;
+		job_count = count;
+		next_job.store(0, std::memory_order_relaxed);
+		active = thread_count;
+		++generation;
+	}
+	batch_started.notify_all();
+	RunJobs();
+
+	// The jobs' results are visible once every thread has been through the mutex
+	std::unique_lock<std::mutex> lock(mutex);
+	batch_finished.wait(lock, [&] { return active == 0; });
+}
+
+void WorkerPool::Shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	batch_started.notify_all();
+	for(uint32_t i = 0; i < thread_count; ++i) {
+		threads[i].join();
+	}
+	thread_count = 0;
+}
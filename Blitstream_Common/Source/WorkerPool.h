@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+constexpr uint32_t MAX_WORKER_THREADS = 32;
+
+// Runs batches of independent jobs on a fixed set of threads, the thread
+// calling Run takes part and returns once every job of the batch is done.
+// Jobs are handed out one at a time, so uneven jobs still balance
+struct WorkerPool {
+	// Threads besides the caller's
+	std::thread threads[MAX_WORKER_THREADS];
+	uint32_t thread_count;
+
+	// Guards everything up to next_job
+	std::mutex mutex;
+	// Notified with mutex when a batch starts or the pool stops
+	std::condition_variable batch_started;
+	// Notified with mutex when the last thread leaves a batch
+	std::condition_variable batch_finished;
+	uint64_t generation;
+	// Threads still working on the current batch
+	uint32_t active;
+	bool stopping;
+	void (*job)(void *user_data, uint32_t index);
+	void *job_user_data;
+	uint32_t job_count;
+	std::atomic<uint32_t> next_job;
+
+	// thread_total counts the caller too, 0 uses every hardware thread
+	void Initialize(uint32_t thread_total);
+	// Calls job with every index below count, from the pool's threads and this one
+	void Run(uint32_t count, void (*job_function)(void *user_data, uint32_t index), void *user_data);
+	void Shutdown();
+
+	void WorkerLoop();
+	void RunJobs();
+};
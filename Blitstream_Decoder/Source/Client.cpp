@@ -1,80 +1,448 @@
 #include "Client.h"
 #include <cassert>
+#include <cstddef>
 #include <cstdio>
-
-#define WSA_CHECK(x) { \
-int ret = x; \
-if(ret != 0) printf("WSA Error: %s is 0x%08x in %s at line %d\n", #x, x, __FILE__, __LINE__); \
-}
-constexpr const char *PORT = "4646";
+#include <cstring>
+#include "Platform.h"
 
 InitMessage Client::Initialize(const char *ip_address) {
-	WSA_CHECK(WSAStartup(MAKEWORD(2, 2), &wsa_data));
+	[[maybe_unused]] bool startup_result = NetStartup();
+	assert(startup_result && "Failed to initialize networking");
 
-    addrinfo hints {
-        .ai_family = AF_UNSPEC,
-        .ai_socktype = SOCK_STREAM,
-        .ai_protocol = IPPROTO_TCP
-    };
+	connect_timestamp = PlatformTimestamp();
+	connection_socket = NetConnect(ip_address, PORT);
+	assert(connection_socket != INVALID_SOCKET_HANDLE && "Failed to create connection socket");
+	// Control messages are small and would otherwise wait for the ACK of the
+	// previous one, which the sender delays until its next frame
+	NetSetNoDelay(connection_socket, true);
 
-    addrinfo *result;
-    WSA_CHECK(getaddrinfo(ip_address, PORT, &hints, &result));
+	frame_pool.Initialize();
+	assembler.Initialize();
+	cursor.Initialize();
+	clock_sync.sample_count = 0;
+	clock_sync.synchronized.store(false, std::memory_order_relaxed);
+	next_sequence = 0;
+	feedback.frame_count = 0;
+	last_feedback_timestamp = PlatformTimestamp();
+	loss_started = false;
+	// The server forces a keyframe for every new viewer, it is only asked
+	// for one if that does not arrive in time
+	waiting_for_keyframe = true;
+	last_keyframe_request_timestamp = connect_timestamp;
+	keyframe_requested.store(false, std::memory_order_relaxed);
+	stats.first_keyframe_us.store(0, std::memory_order_relaxed);
 
-    connection_socket = socket(result->ai_family,
-                               result->ai_socktype,
-                               result->ai_protocol);
-    assert(connection_socket != INVALID_SOCKET && "Failed to create connection socket");
+	// Receive initial message
+	InitMessage init_message {};
+	[[maybe_unused]] bool init_message_result = NetRecvAll(connection_socket, &init_message, sizeof(InitMessage));
+	assert(init_message_result && "Failed to receive initial message");
+	assert(init_message.MAGIC == PROTOCOL_MAGIC && "Unrecognized header");
 
-    WSA_CHECK(connect(connection_socket, result->ai_addr, 
-                      static_cast<int>(result->ai_addrlen)));
-    freeaddrinfo(result);
+	transport = init_message.transport;
+	width = init_message.encoded_width;
+	height = init_message.encoded_height;
+	media_socket = INVALID_SOCKET_HANDLE;
+	if(transport == Transport::Udp) {
+		char media_port[8];
+		snprintf(media_port, sizeof(media_port), "%u", init_message.media_port);
+		media_socket = NetConnectUdp(ip_address, media_port);
+		assert(media_socket != INVALID_SOCKET_HANDLE && "Failed to create media socket");
+		NetSetReceiveBufferSize(media_socket, UDP_RECEIVE_BUFFER_SIZE);
+		NetSetNonBlocking(media_socket, true);
 
-    data_buffer = VirtualAlloc(nullptr, 1024u * 1024u, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		[[maybe_unused]] bool poller_result = poller.Initialize();
+		assert(poller_result && "Failed to create poller");
+		poller.Add(connection_socket, NET_POLL_READ);
+		poller.Add(media_socket, NET_POLL_READ);
 
-    // Receive initial message
-    InitMessage init_message {};
-    int init_message_result = recv(connection_socket, reinterpret_cast<char *>(&init_message), sizeof(InitMessage), 0);
-    assert(init_message_result != SOCKET_ERROR && "Failed to receive initial message");
-    assert(init_message.MAGIC == 0x4646 && "Unrecognized header");
+		packet_assembler.Initialize();
+		media_started = false;
+		SendHello();
+	}
 
-    return init_message;
+	return init_message;
 }
 
 EncodedData Client::ReceiveData() {
-    DataHeader header {};
-
-    int result = recv(connection_socket, reinterpret_cast<char *>(&header), sizeof(DataHeader), 0);
-    if(result == SOCKET_ERROR) {
-        return EncodedData {
-            .result = EncodedDataResult::Abort
-        };
-    }
-    assert(header.MAGIC == 0x4646 && "Unrecognized header");
-
-    // Return early if duplicate frame request
-    if(header.size == 0) {
-        return EncodedData {
-            .result = EncodedDataResult::Duplicate
-        };
-    }
-
-    uint32_t bytes_left = header.size;
-
-    while(bytes_left > 0) {
-        result = recv(connection_socket, reinterpret_cast<char *>(data_buffer) + header.size - bytes_left, bytes_left, 0);
-        assert(result > 0 && "Failed to receive encoded data");
-        bytes_left -= result;
-    }
-    assert(bytes_left == 0 && "Failed to receive encoded data");
-
-    return EncodedData {
-        .result = EncodedDataResult::Success,
-        .ptr = data_buffer,
-        .size = header.size
-    };
+	AssembledFrame frame {};
+	AssembleResult result = transport == Transport::Udp ? ReceivePackets(&frame) :
+														  assembler.Receive(connection_socket, frame_pool, &frame);
+
+	switch(result) {
+	case AssembleResult::Frame: {
+		ProcessHeader(frame);
+		AddFeedback(frame);
+		stats.receive.Record(PlatformTimestampNs() - frame.header_timestamp_ns);
+		uint8_t *ptr = frame_pool.buffers[frame.index].ptr;
+		uint32_t regions_size = 0;
+		if(frame.header.flags & DATA_FLAG_REGIONS) {
+			regions_size = ParseFrameRegions(ptr, frame.header.size, width, height);
+			if(regions_size == 0) {
+				// Dropped like a lost frame, the next keyframe repairs the picture
+				printf("Dropping frame %u with malformed regions\n", frame.header.sequence);
+				frame_pool.Release(frame.index);
+				waiting_for_keyframe = true;
+				last_keyframe_request_timestamp = 0;
+				return EncodedData {
+					.result = EncodedDataResult::Pending,
+					.buffer_index = INVALID_FRAME_INDEX
+				};
+			}
+		}
+		return EncodedData {
+			.result = EncodedDataResult::Success,
+			.ptr = ptr + regions_size,
+			.size = frame.header.size - regions_size,
+			.regions = regions_size != 0 ? reinterpret_cast<const FrameRegions *>(ptr) : nullptr,
+			.buffer_index = frame.index,
+			.sequence = frame.header.sequence,
+			.keyframe = (frame.header.flags & DATA_FLAG_KEYFRAME) != 0,
+			.capture_timestamp = frame.header.capture_timestamp
+		};
+	}
+	case AssembleResult::Duplicate:
+		ProcessHeader(frame);
+		return EncodedData {
+			.result = EncodedDataResult::Duplicate,
+			.buffer_index = INVALID_FRAME_INDEX,
+			.sequence = frame.header.sequence,
+			.capture_timestamp = frame.header.capture_timestamp
+		};
+	case AssembleResult::Message:
+		return EncodedData {
+			.result = ProcessMessage() ? EncodedDataResult::Pending : EncodedDataResult::Abort,
+			.buffer_index = INVALID_FRAME_INDEX
+		};
+	case AssembleResult::Pending:
+		return EncodedData {
+			.result = EncodedDataResult::Pending,
+			.buffer_index = INVALID_FRAME_INDEX
+		};
+	default:
+		return EncodedData {
+			.result = EncodedDataResult::Abort,
+			.buffer_index = INVALID_FRAME_INDEX
+		};
+	}
 }
 
-void Client::Shutdown() {
-    VirtualFree(data_buffer, 0, MEM_RELEASE);
+AssembleResult Client::ReceivePackets(AssembledFrame *frame) {
+	uint64_t start_ns = PlatformTimestampNs();
+	for(;;) {
+		uint64_t now_ns = PlatformTimestampNs();
+		AssembleResult result = packet_assembler.NextFrame(frame_pool, now_ns, frame);
+		if(result != AssembleResult::Pending) {
+			return result;
+		}
+
+		// Drain the socket before waiting again
+		int64_t size = NetRecv(media_socket, packet_assembler.datagram, MAX_DATAGRAM_SIZE);
+		if(size > 0) {
+			media_started = true;
+			packet_assembler.AddPacket(static_cast<uint32_t>(size), frame_pool, now_ns);
+			continue;
+		}
+
+		packet_assembler.Expire(frame_pool, now_ns);
+		SendNacks();
+		if(!media_started && PlatformTimestamp() - last_hello_timestamp > HELLO_INTERVAL_US) {
+			SendHello();
+		}
+
+		// Wake up in time to release a frame that is waiting for an older one
+		NetPollEvent events[2];
+		int event_count = poller.Wait(events, 2, packet_assembler.holding ? 1 : RECEIVE_POLL_TIMEOUT_MS);
+		bool media_readable = false;
+		for(int i = 0; i < event_count; ++i) {
+			if(events[i].socket == connection_socket) {
+				// Only control and cursor messages arrive on it
+				AssembledFrame control_frame;
+				AssembleResult control_result = assembler.Receive(connection_socket, frame_pool, &control_frame);
+				if(control_result == AssembleResult::Closed) {
+					return AssembleResult::Closed;
+				}
+				if(control_result == AssembleResult::Message && !ProcessMessage()) {
+					return AssembleResult::Closed;
+				}
+			}
+			else {
+				media_readable = true;
+			}
+		}
+		// Give the caller a chance to do periodic work, also while packets keep
+		// coming in without completing a frame
+		if(!media_readable || now_ns - start_ns >= RECEIVE_POLL_TIMEOUT_MS * 1000000ull) {
+			return AssembleResult::Pending;
+		}
+	}
+}
+
+void Client::SendHello() {
+	PacketHeader hello {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = PacketType::Hello
+	};
+	NetSend(media_socket, &hello, sizeof(PacketHeader));
+	last_hello_timestamp = PlatformTimestamp();
+}
+
+void Client::SendNacks() {
+	NackPacket nack {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = PacketType::Nack
+	};
+	if(clock_sync.synchronized.load(std::memory_order_relaxed)) {
+		nack.round_trip = static_cast<uint32_t>(clock_sync.round_trip.load(std::memory_order_relaxed));
+	}
+	packet_assembler.round_trip_ns = nack.round_trip * 1000ull;
+
+	uint32_t count;
+	do {
+		count = packet_assembler.nack_tracker.CollectNacks(PlatformTimestampNs(), nack.round_trip * 1000ull,
+														   nack.sequences, MAX_NACK_SEQUENCES);
+		if(count != 0) {
+			nack.sequence_count = static_cast<uint8_t>(count);
+			NetSend(media_socket, &nack, static_cast<uint32_t>(offsetof(NackPacket, sequences) + count * sizeof(uint32_t)));
+		}
+	} while(count == MAX_NACK_SEQUENCES);
+}
+
+void Client::AddFeedback(const AssembledFrame &frame) {
+	feedback.frames[feedback.frame_count++] = FeedbackFrame {
+		.sequence = frame.header.sequence,
+		.size = frame.header.size,
+		.send_timestamp = frame.header.send_timestamp,
+		.arrival_timestamp = frame.arrival_timestamp_ns / 1000
+	};
+}
+
+void Client::SendFeedback(uint64_t now) {
+	feedback.round_trip = 0;
+	if(clock_sync.synchronized.load(std::memory_order_relaxed)) {
+		feedback.round_trip = static_cast<uint32_t>(clock_sync.round_trip.load(std::memory_order_relaxed));
+	}
+
+	// Packets the sender's sequences say were sent against those that made
+	// it the first time, starting from the first report
+	feedback.packets_expected = 0;
+	feedback.packets_lost = 0;
+	if(transport == Transport::Udp && packet_assembler.nack_tracker.started) {
+		uint32_t highest_sequence = packet_assembler.nack_tracker.highest_sequence;
+		if(loss_started) {
+			uint32_t received = packet_assembler.original_packets - reported_original_packets;
+			feedback.packets_expected = highest_sequence - reported_highest_sequence;
+			feedback.packets_lost = feedback.packets_expected > received ? feedback.packets_expected - received : 0;
+		}
+		loss_started = true;
+		reported_highest_sequence = highest_sequence;
+		reported_original_packets = packet_assembler.original_packets;
+	}
+
+	ControlMessage message {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = ControlType::Feedback,
+		.timestamp = now
+	};
+	NetBuffer buffers[] = {
+		{ .ptr = &message, .size = sizeof(ControlMessage) },
+		{ .ptr = &feedback, .size = sizeof(FeedbackMessage) }
+	};
+	NetSendAllv(connection_socket, buffers, 2);
+	feedback.frame_count = 0;
+	last_feedback_timestamp = now;
+}
+
+void Client::SendKeyframeRequest(uint64_t now) {
+	ControlMessage message {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = ControlType::KeyframeRequest,
+		.timestamp = now
+	};
+	NetSendAll(connection_socket, &message, sizeof(ControlMessage));
+	stats.keyframe_requests.fetch_add(1, std::memory_order_relaxed);
+	last_keyframe_request_timestamp = now;
+}
+
+bool Client::ProcessMessage() {
+	return assembler.message_channel == Channel::Cursor ? ProcessCursor() : ProcessControl();
+}
+
+bool Client::ProcessCursor() {
+	if(!cursor.Apply(assembler.message, assembler.message_size)) {
+		printf("Malformed cursor message, closing the connection\n");
+		return false;
+	}
+	if(data_callback) {
+		data_callback(data_callback_user_data);
+	}
+	return true;
+}
+
+bool Client::ProcessControl() {
+	uint64_t arrival_ns = PlatformTimestampNs();
+	ControlMessage message;
+	if(assembler.message_size < sizeof(ControlMessage)) {
+		printf("Truncated control message, closing the connection\n");
+		return false;
+	}
+	memcpy(&message, assembler.message, sizeof(ControlMessage));
+	if(message.MAGIC != PROTOCOL_MAGIC) {
+		printf("Unrecognized control message, closing the connection\n");
+		return false;
+	}
+
+	if(message.type == ControlType::ClockSync && assembler.message_size >= sizeof(ControlMessage) + sizeof(ClockSyncAnswer)) {
+		ClockSyncAnswer answer;
+		memcpy(&answer, assembler.message + sizeof(ControlMessage), sizeof(ClockSyncAnswer));
+		clock_sync.AddExchange(answer.originate_timestamp, answer.receive_timestamp, message.timestamp, arrival_ns / 1000);
+		uint64_t originate_ns = answer.originate_timestamp * 1000;
+		stats.control.Record(arrival_ns > originate_ns ? arrival_ns - originate_ns : 0);
+	}
+	return true;
 }
 
+void Client::ProcessHeader(const AssembledFrame &frame) {
+	const DataHeader &header = frame.header;
+
+	if(header.sequence != next_sequence) {
+		stats.sequence_gaps.fetch_add(header.sequence - next_sequence, std::memory_order_relaxed);
+		// Nothing after a lost frame decodes cleanly until the next keyframe,
+		// ask right away rather than waiting for the GOP to come around
+		if(!waiting_for_keyframe) {
+			waiting_for_keyframe = true;
+			last_keyframe_request_timestamp = 0;
+		}
+	}
+	next_sequence = header.sequence + 1;
+
+	if(header.flags & DATA_FLAG_KEYFRAME) {
+		waiting_for_keyframe = false;
+		if(stats.first_keyframe_us.load(std::memory_order_relaxed) == 0) {
+			stats.first_keyframe_us.store(PlatformTimestamp() - connect_timestamp, std::memory_order_relaxed);
+		}
+	}
+
+	if(header.size != 0 && clock_sync.synchronized.load(std::memory_order_acquire)) {
+		uint64_t capture_ns = clock_sync.ToLocal(header.capture_timestamp) * 1000;
+		uint64_t now_ns = PlatformTimestampNs();
+		stats.age.Record(now_ns > capture_ns ? now_ns - capture_ns : 0);
+	}
+}
+
+void Client::ReceiveLoop() {
+	while(running.load(std::memory_order_relaxed)) {
+		// Clock sync requests are answered on the control channel
+		uint64_t now = PlatformTimestamp();
+		if(clock_sync.RequestDue(now)) {
+			ControlMessage message {
+				.MAGIC = PROTOCOL_MAGIC,
+				.type = ControlType::ClockSync,
+				.timestamp = now
+			};
+			NetSendAll(connection_socket, &message, sizeof(ControlMessage));
+		}
+		if(keyframe_requested.exchange(false, std::memory_order_relaxed)) {
+			waiting_for_keyframe = true;
+			last_keyframe_request_timestamp = 0;
+		}
+		if(waiting_for_keyframe && now - last_keyframe_request_timestamp >= KEYFRAME_REQUEST_INTERVAL_US) {
+			SendKeyframeRequest(now);
+		}
+		bool reporting = feedback.frame_count != 0 || transport == Transport::Udp;
+		if(feedback.frame_count == MAX_FEEDBACK_FRAMES ||
+		   (reporting && now - last_feedback_timestamp >= FEEDBACK_INTERVAL_US)) {
+			SendFeedback(now);
+		}
+
+		EncodedData data = ReceiveData();
+		if(data.result == EncodedDataResult::Duplicate || data.result == EncodedDataResult::Pending) {
+			continue;
+		}
+
+		QueuedData queued_data {
+			.data = data,
+			.enqueue_timestamp_ns = PlatformTimestampNs()
+		};
+		while(!data_queue.Push(queued_data)) {
+			if(!running.load(std::memory_order_relaxed)) {
+				ReleaseData(data);
+				return;
+			}
+			std::this_thread::yield();
+		}
+
+		uint32_t depth = data_queue.Size();
+		if(depth > stats.max_queue_depth.load(std::memory_order_relaxed)) {
+			stats.max_queue_depth.store(depth, std::memory_order_relaxed);
+		}
+
+		if(data_callback) {
+			data_callback(data_callback_user_data);
+		}
+
+		if(data.result == EncodedDataResult::Abort) {
+			return;
+		}
+	}
+}
+
+void Client::Start(void (*callback)(void *user_data), void *user_data) {
+	data_callback = callback;
+	data_callback_user_data = user_data;
+	running.store(true, std::memory_order_relaxed);
+	receive_thread = std::thread(&Client::ReceiveLoop, this);
+}
+
+uint32_t Client::PollData(EncodedData *data, uint32_t max_count) {
+	uint64_t now = PlatformTimestampNs();
+
+	uint32_t count = 0;
+	QueuedData queued_data;
+	while(count < max_count && data_queue.Pop(&queued_data)) {
+		stats.queue.Record(now - queued_data.enqueue_timestamp_ns);
+		data[count++] = queued_data.data;
+	}
+	return count;
+}
+
+void Client::RequestKeyframe() {
+	keyframe_requested.store(true, std::memory_order_relaxed);
+}
+
+void Client::AddLatencyStages(LatencyReport *report) {
+	report->Add("receive", &stats.receive);
+	report->Add("age", &stats.age);
+	report->Add("control", &stats.control);
+	report->Add("queue", &stats.queue);
+}
+
+void Client::ReleaseData(const EncodedData &data) {
+	if(data.buffer_index != INVALID_FRAME_INDEX) {
+		frame_pool.Release(data.buffer_index);
+	}
+}
+
+void Client::Shutdown() {
+	running.store(false, std::memory_order_relaxed);
+	NetDisconnect(connection_socket);
+	if(receive_thread.joinable()) {
+		receive_thread.join();
+	}
+
+	// Return frames that were never consumed
+	QueuedData queued_data;
+	while(data_queue.Pop(&queued_data)) {
+		ReleaseData(queued_data.data);
+	}
+
+	NetClose(connection_socket);
+	if(transport == Transport::Udp) {
+		NetClose(media_socket);
+		poller.Shutdown();
+		packet_assembler.Shutdown(frame_pool);
+	}
+	NetCleanup();
+	assembler.Shutdown();
+	cursor.Shutdown();
+	frame_pool.Shutdown();
+}
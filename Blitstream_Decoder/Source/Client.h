@@ -1,38 +1,163 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
-#include <Winsock2.h>
-#include <Ws2tcpip.h>
+#include <thread>
+#include "ClockSync.h"
+#include "CursorOverlay.h"
+#include "FramePool.h"
+#include "FrameRegions.h"
+#include "LatencyHistogram.h"
+#include "PacketAssembler.h"
+#include "Protocol.h"
+#include "Socket.h"
+#include "SpscQueue.h"
+#include "StreamAssembler.h"
 
-struct InitMessage {
-	uint32_t MAGIC;
-	uint32_t encoded_width;
-	uint32_t encoded_height;
-};
+// Frames in flight between the receive thread and the consumer, kept small so
+// that drained + queued + partially received frames always fit in the pool
+constexpr uint32_t FRAME_QUEUE_SIZE = 4;
+static_assert(FRAME_QUEUE_SIZE * 2 + MAX_PARTIAL_FRAMES <= FRAME_POOL_SIZE, "Frame pool too small for frame queue");
 
-struct DataHeader {
-	uint32_t MAGIC;
-	uint32_t size;
-};
+// How long the UDP receive loop waits before doing periodic work
+constexpr int RECEIVE_POLL_TIMEOUT_MS = 10;
+// Receive buffer for the UDP socket, holds a few large frames
+constexpr uint32_t UDP_RECEIVE_BUFFER_SIZE = 4u * 1024u * 1024u;
+constexpr uint64_t HELLO_INTERVAL_US = 100000;
+// Arrival times are reported after this long, or earlier once
+// MAX_FEEDBACK_FRAMES frames have arrived
+constexpr uint64_t FEEDBACK_INTERVAL_US = 50000;
+// A keyframe request is repeated this often until a keyframe arrives, in case
+// the request or the keyframe itself was lost
+constexpr uint64_t KEYFRAME_REQUEST_INTERVAL_US = 500000;
 
 enum class EncodedDataResult : uint32_t {
 	Success,
 	Duplicate,
+	// Nothing received yet, never queued
+	Pending,
 	Abort
 };
 
 struct EncodedData {
 	EncodedDataResult result;
+	// The encoded picture, may be empty for a frame with regions
 	void *ptr;
 	uint32_t size;
+	// In front of the picture in the same buffer, null for a frame that
+	// replaces the whole picture
+	const FrameRegions *regions;
+	uint32_t buffer_index;
+	uint32_t sequence;
+	// Decodable without any earlier frame
+	bool keyframe;
+	// Server clock, convert with Client::clock_sync
+	uint64_t capture_timestamp;
+};
+
+struct QueuedData {
+	EncodedData data;
+	uint64_t enqueue_timestamp_ns;
+};
+
+struct ClientStats {
+	// Written by the receive thread
+	std::atomic<uint32_t> max_queue_depth;
+	std::atomic<uint64_t> sequence_gaps;
+	std::atomic<uint64_t> keyframe_requests;
+	// Connecting until the first keyframe arrived, 0 before then
+	std::atomic<uint64_t> first_keyframe_us;
+	// Header parsed until the whole payload has arrived
+	LatencyHistogram receive;
+	// Capture on the server until the whole payload has arrived, once the clocks are synchronized
+	LatencyHistogram age;
+	// Clock sync request sent until its answer arrived, the round trip of the
+	// control channel
+	LatencyHistogram control;
+
+	// Written by the consuming thread
+	LatencyHistogram queue;
 };
 
 struct Client {
-	WSAData wsa_data;
-	SOCKET connection_socket;
+	SocketHandle connection_socket;
+	Transport transport;
+	// Encoded frame size, frame regions have to stay inside it
+	uint32_t width;
+	uint32_t height;
+
+	FramePool frame_pool;
+	StreamAssembler assembler;
+
+	// UDP transport only, the poller waits on both sockets so a closed
+	// connection is noticed while waiting for packets
+	SocketHandle media_socket;
+	NetPoller poller;
+	PacketAssembler packet_assembler;
+	bool media_started;
+	uint64_t last_hello_timestamp;
+
+	std::thread receive_thread;
+	std::atomic<bool> running;
+	SpscQueue<QueuedData, FRAME_QUEUE_SIZE> data_queue;
+	ClientStats stats;
 
-	void *data_buffer;
+	// Owned by the receive thread
+	ClockSync clock_sync;
+	uint32_t next_sequence;
+	// Frames not yet reported to the sender's bandwidth estimate
+	FeedbackMessage feedback;
+	uint64_t last_feedback_timestamp;
+	// Packet counts at the previous report, UDP only
+	bool loss_started;
+	uint32_t reported_highest_sequence;
+	uint32_t reported_original_packets;
+	// PlatformTimestamp reading from before connecting
+	uint64_t connect_timestamp;
+	// Set from the start and after a gap in the sequences, cleared by the next
+	// keyframe
+	bool waiting_for_keyframe;
+	uint64_t last_keyframe_request_timestamp;
+	// Set by RequestKeyframe, sent from the receive thread
+	std::atomic<bool> keyframe_requested;
+
+	// Updated from the cursor channel, drawn by the consumer
+	CursorOverlay cursor;
+
+	// Invoked on the receive thread after each queued frame and cursor
+	// update, lets the consumer wake up instead of polling
+	void (*data_callback)(void *user_data);
+	void *data_callback_user_data;
 
 	InitMessage Initialize(const char *ip_address);
-	EncodedData ReceiveData();
+
+	// Start receiving on a dedicated thread
+	void Start(void (*callback)(void *user_data), void *user_data);
+
+	// Drains up to max_count queued frames in arrival order, the frames stay
+	// valid until they are passed to ReleaseData
+	uint32_t PollData(EncodedData *data, uint32_t max_count);
+	void ReleaseData(const EncodedData &data);
+
+	// Asks the server for a keyframe, for a consumer that failed to decode.
+	// May be called from any thread
+	void RequestKeyframe();
+
 	void Shutdown();
-};
\ No newline at end of file
+
+	void AddLatencyStages(LatencyReport *report);
+
+	EncodedData ReceiveData();
+	AssembleResult ReceivePackets(AssembledFrame *frame);
+	void SendHello();
+	void SendNacks();
+	void AddFeedback(const AssembledFrame &frame);
+	void SendFeedback(uint64_t now);
+	void SendKeyframeRequest(uint64_t now);
+	void ProcessHeader(const AssembledFrame &frame);
+	// Handles the control or cursor message the assembler holds, false if it
+	// is malformed and the connection has to be dropped
+	bool ProcessMessage();
+	bool ProcessControl();
+	bool ProcessCursor();
+	void ReceiveLoop();
+};
@@ -0,0 +1,36 @@
+#include "ClockSync.h"
+
+bool ClockSync::RequestDue(uint64_t now) {
+	if(sample_count >= CLOCK_SYNC_WINDOW && now - last_request_timestamp < CLOCK_SYNC_INTERVAL_US) {
+		return false;
+	}
+	last_request_timestamp = now;
+	return true;
+}
+
+void ClockSync::AddExchange(uint64_t originate, uint64_t receive, uint64_t transmit, uint64_t arrival) {
+	int64_t outbound = static_cast<int64_t>(receive - originate);
+	int64_t inbound = static_cast<int64_t>(transmit - arrival);
+	ClockSample sample {
+		.offset = (outbound + inbound) / 2,
+		// Time spent on the wire, excluding the time the sender held the request
+		.round_trip = static_cast<int64_t>(arrival - originate) - static_cast<int64_t>(transmit - receive)
+	};
+	samples[sample_count % CLOCK_SYNC_WINDOW] = sample;
+	++sample_count;
+
+	uint32_t count = sample_count < CLOCK_SYNC_WINDOW ? sample_count : CLOCK_SYNC_WINDOW;
+	ClockSample best = samples[0];
+	for(uint32_t i = 1; i < count; ++i) {
+		if(samples[i].round_trip < best.round_trip) {
+			best = samples[i];
+		}
+	}
+	offset.store(best.offset, std::memory_order_relaxed);
+	round_trip.store(best.round_trip, std::memory_order_relaxed);
+	synchronized.store(true, std::memory_order_release);
+}
+
+uint64_t ClockSync::ToLocal(uint64_t sender_timestamp) const {
+	return sender_timestamp - offset.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Number of recent exchanges the estimate is picked from
+constexpr uint32_t CLOCK_SYNC_WINDOW = 8;
+constexpr uint64_t CLOCK_SYNC_INTERVAL_US = 250000;
+
+struct ClockSample {
+	int64_t offset;
+	int64_t round_trip;
+};
+
+// NTP-style estimate of the offset between the sender's clock and ours. Each
+// exchange yields an offset whose error is bounded by half its round trip,
+// so the sample with the shortest round trip in the window is used, which
+// filters out exchanges delayed by queued frame data.
+// Exchanges are added on the receive thread, the estimate may be
+// read from any thread
+struct ClockSync {
+	ClockSample samples[CLOCK_SYNC_WINDOW];
+	uint32_t sample_count;
+	uint64_t last_request_timestamp;
+
+	// Sender clock minus local clock, in microseconds
+	std::atomic<int64_t> offset;
+	std::atomic<int64_t> round_trip;
+	std::atomic<bool> synchronized;
+
+	// Returns true if a request should be sent now. Until the window has been
+	// filled once there is no minimum interval between requests
+	bool RequestDue(uint64_t now);
+
+	// originate and arrival are local timestamps, receive and transmit are the
+	// sender's timestamps of when it read the request and sent the answer
+	void AddExchange(uint64_t originate, uint64_t receive, uint64_t transmit, uint64_t arrival);
+
+	// Converts a sender timestamp to the local clock
+	uint64_t ToLocal(uint64_t sender_timestamp) const;
+};
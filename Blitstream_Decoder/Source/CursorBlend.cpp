@@ -0,0 +1,191 @@
+#include "CursorBlend.h"
+#include <cstddef>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define BLEND_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts any intrinsic without a matching /arch, GCC and Clang have to
+// be told per function
+#if defined(BLEND_X86) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+using RowFunction = void (*)(uint32_t *dst, const uint32_t *src, uint32_t count);
+
+struct BlendState {
+	bool initialized;
+	BlendKernel kernel;
+	RowFunction blend_row;
+};
+
+static BlendState state;
+
+static void BlendRowScalar(uint32_t *dst, const uint32_t *src, uint32_t count) {
+	for(uint32_t i = 0; i < count; ++i) {
+		uint32_t s = src[i];
+		uint32_t a = s >> 24;
+		if(a == 0) {
+			continue;
+		}
+		uint32_t d = dst[i];
+		uint32_t result = d & 0xFF000000;
+		for(uint32_t shift = 0; shift < 24; shift += 8) {
+			// x / 255 rounded is (x + 128 + ((x + 128) >> 8)) >> 8 for x up to 255 * 255
+			uint32_t t = ((s >> shift) & 0xFF) * a + ((d >> shift) & 0xFF) * (255 - a) + 128;
+			result |= ((t + (t >> 8)) >> 8) << shift;
+		}
+		dst[i] = result;
+	}
+}
+
+#ifdef BLEND_X86
+// Blends the two pixels in each 64-bit half of 16-bit lanes
+static inline __m128i BlendSse2(__m128i s, __m128i d, __m128i max, __m128i round) {
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+	__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_xor_si128(a, max))), round);
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static void BlendRowSse2(uint32_t *dst, const uint32_t *src, uint32_t count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i max = _mm_set1_epi16(0xFF);
+	__m128i round = _mm_set1_epi16(128);
+	__m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+	uint32_t i = 0;
+	for(; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		// Most of a cursor is fully transparent
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero)) == 0xFFFF) {
+			continue;
+		}
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+		__m128i low = BlendSse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), max, round);
+		__m128i high = BlendSse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), max, round);
+		__m128i result = _mm_packus_epi16(low, high);
+		result = _mm_or_si128(_mm_andnot_si128(alpha, result), _mm_and_si128(alpha, d));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), result);
+	}
+	BlendRowScalar(dst + i, src + i, count - i);
+}
+
+TARGET_AVX2 static inline __m256i BlendAvx2(__m256i s, __m256i d, __m256i max, __m256i round) {
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+	__m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, a),
+												  _mm256_mullo_epi16(d, _mm256_xor_si256(a, max))), round);
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+TARGET_AVX2 static void BlendRowAvx2(uint32_t *dst, const uint32_t *src, uint32_t count) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i max = _mm256_set1_epi16(0xFF);
+	__m256i round = _mm256_set1_epi16(128);
+	__m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+
+	uint32_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+		if(_mm256_testz_si256(s, alpha)) {
+			continue;
+		}
+		__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+		// Unpacking and packing both work within 128-bit lanes, so the pixels
+		// end up where they started
+		__m256i low = BlendAvx2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero), max, round);
+		__m256i high = BlendAvx2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero), max, round);
+		__m256i result = _mm256_packus_epi16(low, high);
+		result = _mm256_or_si256(_mm256_andnot_si256(alpha, result), _mm256_and_si256(alpha, d));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), result);
+	}
+	BlendRowScalar(dst + i, src + i, count - i);
+}
+#endif
+
+static bool CpuSupports(BlendKernel kernel) {
+	if(kernel == BlendKernel::Scalar) {
+		return true;
+	}
+#ifdef BLEND_X86
+	// SSE2 is part of x86-64
+	if(kernel == BlendKernel::Sse2) {
+		return true;
+	}
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	// AVX state has to be enabled by the OS as well
+	bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	return avx && (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+#else
+	return false;
+#endif
+}
+
+void BlendInitialize() {
+	if(state.initialized) {
+		return;
+	}
+	state.initialized = true;
+	if(!BlendSelectKernel(BlendKernel::Avx2) && !BlendSelectKernel(BlendKernel::Sse2)) {
+		BlendSelectKernel(BlendKernel::Scalar);
+	}
+}
+
+bool BlendSelectKernel(BlendKernel kernel) {
+	if(!CpuSupports(kernel)) {
+		return false;
+	}
+
+	state.kernel = kernel;
+	switch(kernel) {
+#ifdef BLEND_X86
+	case BlendKernel::Avx2:
+		state.blend_row = BlendRowAvx2;
+		break;
+	case BlendKernel::Sse2:
+		state.blend_row = BlendRowSse2;
+		break;
+#endif
+	default:
+		state.blend_row = BlendRowScalar;
+		break;
+	}
+	return true;
+}
+
+BlendKernel BlendSelectedKernel() {
+	return state.kernel;
+}
+
+const char *BlendKernelName(BlendKernel kernel) {
+	switch(kernel) {
+	case BlendKernel::Sse2:
+		return "sse2";
+	case BlendKernel::Avx2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+void BlendRow(uint32_t *dst, const uint32_t *src, uint32_t count) {
+	state.blend_row(dst, src, count);
+}
+
+void BlendImage(uint32_t *dst, uint32_t dst_stride, const uint32_t *src, uint32_t src_stride, uint32_t width,
+				uint32_t height) {
+	for(uint32_t y = 0; y < height; ++y) {
+		state.blend_row(dst + static_cast<size_t>(y) * dst_stride, src + static_cast<size_t>(y) * src_stride, width);
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+
+// Draws straight alpha BGRA pixels over BGRA pixels:
+// dst = (src * a + dst * (255 - a)) / 255 per color channel, rounded to
+// nearest, while dst keeps its own alpha. Every kernel gives exactly the
+// scalar result
+
+enum class BlendKernel : uint32_t {
+	Scalar,
+	// 4 pixels at a time in 16-bit lanes
+	Sse2,
+	// Same as Sse2 with 8 pixels at a time
+	Avx2
+};
+
+// Selects the fastest kernel the CPU supports, must be called before
+// anything else in here. Calling it again is harmless
+void BlendInitialize();
+
+// Overrides the kernel for benchmarking, false if the CPU does not support it
+bool BlendSelectKernel(BlendKernel kernel);
+BlendKernel BlendSelectedKernel();
+const char *BlendKernelName(BlendKernel kernel);
+
+void BlendRow(uint32_t *dst, const uint32_t *src, uint32_t count);
+// Strides are in pixels
+void BlendImage(uint32_t *dst, uint32_t dst_stride, const uint32_t *src, uint32_t src_stride, uint32_t width,
+				uint32_t height);
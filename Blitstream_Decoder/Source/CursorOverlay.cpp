@@ -0,0 +1,119 @@
+#include "CursorOverlay.h"
+#include <cstring>
+#include "CursorBlend.h"
+#include "CursorShape.h"
+#include "Platform.h"
+
+static constexpr size_t SLOT_PIXELS = MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION;
+static constexpr size_t PIXELS_SIZE = CURSOR_CACHE_SIZE * SLOT_PIXELS * sizeof(uint32_t);
+
+void CursorOverlay::Initialize() {
+	BlendInitialize();
+	for(CursorSlot &cursor_slot : slots) {
+		cursor_slot = CursorSlot {};
+	}
+	pixels = static_cast<uint32_t *>(PlatformAllocate(PIXELS_SIZE));
+	x = 0;
+	y = 0;
+	visible = false;
+	slot = 0;
+	version.store(0, std::memory_order_relaxed);
+	stats.updates.store(0, std::memory_order_relaxed);
+	stats.shapes.store(0, std::memory_order_relaxed);
+	stats.bytes.store(0, std::memory_order_relaxed);
+}
+
+void CursorOverlay::Shutdown() {
+	PlatformFree(pixels, PIXELS_SIZE);
+	pixels = nullptr;
+}
+
+bool CursorOverlay::Apply(const uint8_t *message, uint32_t size) {
+	CursorMessage cursor_message;
+	if(size < sizeof(CursorMessage)) {
+		return false;
+	}
+	memcpy(&cursor_message, message, sizeof(CursorMessage));
+	if(cursor_message.MAGIC != PROTOCOL_MAGIC || cursor_message.slot >= CURSOR_CACHE_SIZE) {
+		return false;
+	}
+	stats.bytes.fetch_add(size, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	bool valid = true;
+	if(cursor_message.type == CursorType::Shape) {
+		CursorShape shape;
+		uint32_t data_offset = sizeof(CursorMessage) + sizeof(CursorShape);
+		if(size < data_offset) {
+			return false;
+		}
+		memcpy(&shape, message + sizeof(CursorMessage), sizeof(CursorShape));
+
+		CursorSlot &cursor_slot = slots[cursor_message.slot];
+		cursor_slot = CursorSlot {
+			.valid = false,
+			.width = shape.width,
+			.height = shape.height,
+			.hot_x = shape.hot_x,
+			.hot_y = shape.hot_y
+		};
+		valid = shape.width <= MAX_CURSOR_DIMENSION && shape.height <= MAX_CURSOR_DIMENSION &&
+			shape.data_size == size - data_offset &&
+			CursorDecompress(message + data_offset, shape.data_size, pixels + cursor_message.slot * SLOT_PIXELS,
+							 static_cast<uint32_t>(shape.width) * shape.height);
+		cursor_slot.valid = valid;
+		stats.shapes.fetch_add(1, std::memory_order_relaxed);
+	}
+	else if(cursor_message.type != CursorType::Position) {
+		return false;
+	}
+
+	x = cursor_message.x;
+	y = cursor_message.y;
+	visible = (cursor_message.flags & CURSOR_FLAG_VISIBLE) != 0;
+	slot = cursor_message.slot;
+	stats.updates.fetch_add(1, std::memory_order_relaxed);
+	version.fetch_add(1, std::memory_order_release);
+	return valid;
+}
+
+bool CursorOverlay::Locate(const CursorPlacement &placement, CursorRect *rect) {
+	const CursorSlot &cursor_slot = slots[slot];
+	if(!visible || !cursor_slot.valid || placement.frame_width == 0 || placement.frame_height == 0) {
+		return false;
+	}
+
+	// The hot spot is what points at the position, so it is what gets scaled
+	int64_t hot_x = placement.rect_left +
+		(static_cast<int64_t>(x) + cursor_slot.hot_x) * placement.rect_width / placement.frame_width;
+	int64_t hot_y = placement.rect_top +
+		(static_cast<int64_t>(y) + cursor_slot.hot_y) * placement.rect_height / placement.frame_height;
+	int64_t left = hot_x - cursor_slot.hot_x;
+	int64_t top = hot_y - cursor_slot.hot_y;
+	int64_t right = left + cursor_slot.width;
+	int64_t bottom = top + cursor_slot.height;
+
+	int64_t clipped_left = left < 0 ? 0 : left;
+	int64_t clipped_top = top < 0 ? 0 : top;
+	int64_t clipped_right = right > placement.image_width ? placement.image_width : right;
+	int64_t clipped_bottom = bottom > placement.image_height ? placement.image_height : bottom;
+	if(clipped_left >= clipped_right || clipped_top >= clipped_bottom) {
+		return false;
+	}
+
+	*rect = CursorRect {
+		.x = static_cast<uint32_t>(clipped_left),
+		.y = static_cast<uint32_t>(clipped_top),
+		.width = static_cast<uint32_t>(clipped_right - clipped_left),
+		.height = static_cast<uint32_t>(clipped_bottom - clipped_top),
+		.shape_x = static_cast<uint32_t>(clipped_left - left),
+		.shape_y = static_cast<uint32_t>(clipped_top - top)
+	};
+	return true;
+}
+
+void CursorOverlay::Draw(const CursorRect &rect, uint32_t *image, uint32_t stride) {
+	const CursorSlot &cursor_slot = slots[slot];
+	const uint32_t *shape = pixels + slot * SLOT_PIXELS + rect.shape_y * cursor_slot.width + rect.shape_x;
+	BlendImage(image, stride, shape, cursor_slot.width, rect.width, rect.height);
+}
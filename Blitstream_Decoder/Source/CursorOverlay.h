@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "Protocol.h"
+
+// Written by the receive thread, may be read and reset from another
+struct CursorOverlayStats {
+	std::atomic<uint64_t> updates;
+	std::atomic<uint64_t> shapes;
+	// Bytes of cursor messages, shapes included
+	std::atomic<uint64_t> bytes;
+};
+
+struct CursorSlot {
+	// Holds a shape, only set once its pixels decoded
+	bool valid;
+	uint32_t width;
+	uint32_t height;
+	uint32_t hot_x;
+	uint32_t hot_y;
+};
+
+// Where the decoded frame ends up in the image the cursor is drawn into
+struct CursorPlacement {
+	// Encoded frame size, the coordinates the sender uses
+	uint32_t frame_width;
+	uint32_t frame_height;
+	// Area the frame is scaled into
+	int32_t rect_left;
+	int32_t rect_top;
+	int32_t rect_width;
+	int32_t rect_height;
+	uint32_t image_width;
+	uint32_t image_height;
+};
+
+// Part of the image the cursor covers, already clipped to it
+struct CursorRect {
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	// Pixel of the shape drawn at x, y
+	uint32_t shape_x;
+	uint32_t shape_y;
+};
+
+// The receiver's side of the cursor channel: the cached shapes and where the
+// cursor currently is. Messages are applied on the receive thread, the
+// cursor is drawn over each presented frame on the decoding thread. Shapes
+// are drawn unscaled, only their position follows the frame's scaling
+struct CursorOverlay {
+	// Held while applying a message and while drawing
+	std::mutex mutex;
+	CursorSlot slots[CURSOR_CACHE_SIZE];
+	// MAX_CURSOR_DIMENSION squared straight alpha BGRA pixels per slot
+	uint32_t *pixels;
+	int32_t x;
+	int32_t y;
+	bool visible;
+	uint32_t slot;
+	// Incremented with every message applied, the image needs to be drawn
+	// again once it differs from the version it was drawn with
+	std::atomic<uint32_t> version;
+	CursorOverlayStats stats;
+
+	void Initialize();
+	void Shutdown();
+
+	// Applies a message from the cursor channel, returns false if it is
+	// malformed. A shape that fails to decode hides the cursor until the
+	// slot is sent again
+	bool Apply(const uint8_t *message, uint32_t size);
+
+	// Call with mutex held. Returns false if the cursor is hidden or entirely
+	// outside the image
+	bool Locate(const CursorPlacement &placement, CursorRect *rect);
+	// Call with mutex held. Blends the cursor over the part of the image rect
+	// covers, image points at the rect's top left pixel and stride is in pixels
+	void Draw(const CursorRect &rect, uint32_t *image, uint32_t stride);
+};
@@ -1,6 +1,7 @@
 #include "Decoder.h"
 #include <cassert>
 #include <cstdio>
+#include <utility>
 #include <cudaD3D11.h>
 #include <nppi.h>
 
@@ -96,6 +97,8 @@ void Decoder::Initialize(HWND hwnd) {
 	assert(number_of_gpus > 0 && "No GPUs found");
 	CU_CHECK(cuDeviceGet(&cu_device, 0));
 	CU_CHECK(cuCtxCreate(&cu_context, 0, cu_device));
+	CU_CHECK(cuMemAllocHost(reinterpret_cast<void **>(&cursor_patch),
+							MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION * sizeof(uint32_t)));
 
 	CUVIDDECODECAPS decode_capabilities {
 		.eCodecType = cudaVideoCodec_HEVC,
@@ -155,10 +158,28 @@ void Decoder::Initialize(HWND hwnd) {
 	dxgi_factory->Release();
 	WIN_CHECK(d3d11_swapchain->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void **>(&d3d11_backbuffer)));
 
-	CU_CHECK(cuMemAlloc(&device_ptr_converted_intermediate, 
-						static_cast<uint64_t>(dimensions.target_width) * static_cast<uint64_t>(dimensions.target_height) * 3));
-	CU_CHECK(cuMemAlloc(&device_ptr_converted_result, 
-						static_cast<uint64_t>(dimensions.target_width) * static_cast<uint64_t>(dimensions.target_height) * 4));
+	// The frame buffers follow once the encoded size is known
+	uint64_t scaled_size = static_cast<uint64_t>(dimensions.target_width) * static_cast<uint64_t>(dimensions.target_height) * 4;
+	CU_CHECK(cuMemAlloc(&device_ptr_scaled, scaled_size));
+	CU_CHECK(cuMemsetD8(device_ptr_scaled, 0, scaled_size));
+	pending_regions = nullptr;
+	tiles_initialized = false;
+}
+
+void Decoder::AllocateFrameBuffers() {
+	uint64_t pixels = static_cast<uint64_t>(encoded_width) * static_cast<uint64_t>(encoded_height);
+	CU_CHECK(cuMemAlloc(&device_ptr_converted_result, pixels * 4));
+	CU_CHECK(cuMemAlloc(&device_ptr_retained, pixels * 4));
+	CU_CHECK(cuMemAlloc(&device_ptr_copy_scratch, pixels * 4));
+}
+
+void Decoder::FreeFrameBuffers() {
+	if(device_ptr_retained) {
+		CU_CHECK(cuMemFree(device_ptr_converted_result));
+		CU_CHECK(cuMemFree(device_ptr_retained));
+		CU_CHECK(cuMemFree(device_ptr_copy_scratch));
+		device_ptr_retained = 0;
+	}
 }
 
 void Decoder::Resize(uint32_t width, uint32_t height) {
@@ -167,22 +188,6 @@ void Decoder::Resize(uint32_t width, uint32_t height) {
 	}
 
 	CalculateTargetDimensions(width, height, dimensions);
-	
-	// Reconfigure decoder
-	CUVIDRECONFIGUREDECODERINFO reconfigure_params = {
-		.ulWidth = encoded_width,
-		.ulHeight = encoded_height,
-		.ulTargetWidth = dimensions.target_width,
-		.ulTargetHeight = dimensions.target_height,
-		.ulNumDecodeSurfaces = NUMBER_OF_DECODE_SURFACES,
-		.target_rect = {
-			.left = dimensions.target_rect_left,
-			.top = dimensions.target_rect_top,
-			.right = dimensions.target_rect_right,
-			.bottom = dimensions.target_rect_bottom
-		}
-	};
-	CU_CHECK(cuvidReconfigureDecoder(cu_decoder, &reconfigure_params));
 
 	// Release reference counted instance of the backbuffer
 	d3d11_backbuffer->Release();
@@ -191,29 +196,110 @@ void Decoder::Resize(uint32_t width, uint32_t height) {
 	WIN_CHECK(d3d11_swapchain->ResizeBuffers(0, dimensions.target_width, dimensions.target_height, DXGI_FORMAT_UNKNOWN, 0));
 	WIN_CHECK(d3d11_swapchain->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void **>(&d3d11_backbuffer)));
 
-	// Reallocate CUDA buffers
-	CU_CHECK(cuMemFree(device_ptr_converted_intermediate));
-	CU_CHECK(cuMemFree(device_ptr_converted_result));
-	CU_CHECK(cuMemAlloc(&device_ptr_converted_intermediate,
-						static_cast<uint64_t>(dimensions.target_width) * static_cast<uint64_t>(dimensions.target_height) * 3));
-	CU_CHECK(cuMemAlloc(&device_ptr_converted_result,
-						static_cast<uint64_t>(dimensions.target_width) * static_cast<uint64_t>(dimensions.target_height) * 4));
-
+	// Only the scaled buffer depends on the window, the retained frame stays
+	// and can be drawn again right away
+	uint64_t scaled_size = static_cast<uint64_t>(dimensions.target_width) * static_cast<uint64_t>(dimensions.target_height) * 4;
+	CU_CHECK(cuMemFree(device_ptr_scaled));
+	CU_CHECK(cuMemAlloc(&device_ptr_scaled, scaled_size));
+	CU_CHECK(cuMemsetD8(device_ptr_scaled, 0, scaled_size));
 }
 
-void Decoder::Decode(void *ptr, uint32_t size) {
+bool Decoder::Decode(void *ptr, uint32_t size, const FrameRegions *regions) {
+	if(codec == Codec::Tiles) {
+		return DecodeTiles(ptr, size);
+	}
+	if(size == 0) {
+		// Only copies, which apply to the retained frame directly
+		if(has_frame) {
+			ApplyRegions(regions);
+			CopyToBackbuffer();
+		}
+		return true;
+	}
+
+	// Without display delay or B-frames the picture is displayed from
+	// within the parse call, which is when the regions are applied
+	pending_regions = regions;
+	corrupted = false;
 	CUVIDSOURCEDATAPACKET data_packet {
 		.payload_size = size,
 		.payload = reinterpret_cast<uint8_t *>(ptr)
 	};
 	CU_CHECK(cuvidParseVideoData(cu_parser, &data_packet));
+	pending_regions = nullptr;
+	return !corrupted;
+}
+
+bool Decoder::DecodeTiles(const void *ptr, uint32_t size) {
+	if(!tiles_initialized) {
+		AllocateFrameBuffers();
+		tiles.Initialize(encoded_width, encoded_height, 0);
+		tiles_initialized = true;
+	}
+
+	// Tiles decoded before the malformed one are kept, the picture is wrong
+	// until the next keyframe either way
+	if(!tiles.Decode(ptr, size)) {
+		return false;
+	}
+
+	// Only the rows of tiles that changed go to the GPU
+	if(tiles.end_row != 0) {
+		uint32_t first_line = tiles.first_row * TILE_SIZE;
+		uint32_t end_line = tiles.end_row * TILE_SIZE < encoded_height ? tiles.end_row * TILE_SIZE : encoded_height;
+		size_t pitch = encoded_width * sizeof(uint32_t);
+		CUDA_MEMCPY2D upload {
+			.srcY = first_line,
+			.srcMemoryType = CU_MEMORYTYPE_HOST,
+			.srcHost = tiles.frame,
+			.srcPitch = pitch,
+			.dstY = first_line,
+			.dstMemoryType = CU_MEMORYTYPE_DEVICE,
+			.dstDevice = device_ptr_retained,
+			.dstPitch = pitch,
+			.WidthInBytes = pitch,
+			.Height = end_line - first_line
+		};
+		CU_CHECK(cuMemcpy2D(&upload));
+	}
+	has_frame = true;
+	CopyToBackbuffer();
+	return true;
+}
+
+void Decoder::Present() {
 	WIN_CHECK(d3d11_swapchain->Present(0, 0));
 }
 
+bool Decoder::Redraw() {
+	if(!has_frame) {
+		// Drawn with the first frame
+		if(cursor) {
+			cursor_version = cursor->version.load(std::memory_order_acquire);
+		}
+		return false;
+	}
+	CopyToBackbuffer();
+	return true;
+}
+
 //  0: fail, 
 //  1: driver should not override ulMaxNumDecodeSurfaces
 // >1: driver should override ulMaxNumDecodeSurfaces with returned value
 int Decoder::SequenceCallback(CUVIDEOFORMAT *video_format) {
+	if(!device_ptr_retained) {
+		AllocateFrameBuffers();
+	}
+
+	// The encoder leaves the matrix unspecified, which is BT.601 as before
+	ColorMatrix matrix = video_format->video_signal_description.matrix_coefficients == 1 ? ColorMatrix::Bt709
+																						   : ColorMatrix::Bt601;
+	ColorRange range = video_format->video_signal_description.video_full_range_flag ? ColorRange::Full
+																					 : ColorRange::Limited;
+	color_coefficients = ColorYuvCoefficients(matrix, range);
+
+	// Decoded at the encoded size, frame regions refer to it. Scaling to the
+	// window happens on the way to the backbuffer
 	CUVIDDECODECREATEINFO video_decode_info {
 		.ulWidth = encoded_width,
 		.ulHeight = encoded_height,
@@ -226,15 +312,15 @@ int Decoder::SequenceCallback(CUVIDEOFORMAT *video_format) {
 		.ulMaxHeight = 2160,
 		.OutputFormat = cudaVideoSurfaceFormat_NV12,
 		.DeinterlaceMode = cudaVideoDeinterlaceMode_Weave,
-		.ulTargetWidth = dimensions.target_width,
-		.ulTargetHeight = dimensions.target_height,
+		.ulTargetWidth = encoded_width,
+		.ulTargetHeight = encoded_height,
 		.ulNumOutputSurfaces = 2,
 		.vidLock = nullptr,
 		.target_rect = {
-			.left = dimensions.target_rect_left,
-			.top = dimensions.target_rect_top,
-			.right = dimensions.target_rect_right,
-			.bottom = dimensions.target_rect_bottom
+			.left = 0,
+			.top = 0,
+			.right = static_cast<short>(encoded_width),
+			.bottom = static_cast<short>(encoded_height)
 		}
 	};
 	CU_CHECK(cuvidCreateDecoder(&cu_decoder, &video_decode_info));
@@ -272,34 +358,131 @@ int Decoder::DisplayCallback(CUVIDPARSERDISPINFO *display_info) {
 	if(decode_status.decodeStatus == cuvidDecodeStatus_InProgress) {
 		return 1;
 	}
-	assert(decode_status.decodeStatus == cuvidDecodeStatus_Success && "Decoding was unsuccessful");
-	
-	NppiSize size {
-		.width = static_cast<int>(dimensions.target_width),
-		.height = static_cast<int>(dimensions.target_height)
-	};
+	// A concealed picture is still shown, one that failed is not
+	if(decode_status.decodeStatus != cuvidDecodeStatus_Success) {
+		corrupted = true;
+		if(decode_status.decodeStatus != cuvidDecodeStatus_Error_Concealed) {
+			CU_CHECK(cuvidUnmapVideoFrame(cu_decoder, device_ptr_source_frame));
+			return 1;
+		}
+	}
 
-	// Convert NV12 -> BGR
 	// The first part of the NV12 encoded image holds the Y part of the YUV,
 	// the second part holds the U and V parts interleaved
-	Npp8u *dst[] = {
-		reinterpret_cast<uint8_t *>(device_ptr_source_frame),
-		reinterpret_cast<uint8_t *>(device_ptr_source_frame + (static_cast<uint64_t>(source_pitch) * size.height))
-	};
+	ConvertNv12ToBgraDevice(device_ptr_source_frame, source_pitch, encoded_width, encoded_height, color_coefficients,
+							device_ptr_converted_result);
+
+	// A frame with regions only updates part of the retained one, any other
+	// replaces it
+	if(pending_regions && has_frame) {
+		ApplyRegions(pending_regions);
+	}
+	else {
+		std::swap(device_ptr_converted_result, device_ptr_retained);
+	}
+	has_frame = true;
+	CopyToBackbuffer();
+
+	CU_CHECK(cuvidUnmapVideoFrame(cu_decoder, device_ptr_source_frame));
+	return 1;
+}
 
-	NPP_CHECK(nppiNV12ToBGR_8u_P2C3R(dst, source_pitch, 
-									 reinterpret_cast<uint8_t *>(device_ptr_converted_intermediate), 
-									 size.width * 3, size));
+void Decoder::ApplyRegions(const FrameRegions *regions) {
+	size_t pitch = encoded_width * sizeof(uint32_t);
+
+	// In order, each one may read what an earlier one wrote
+	const CopyRect *copies = FrameCopies(regions);
+	for(uint32_t i = 0; i < regions->copy_count; ++i) {
+		const CopyRect &copy = copies[i];
+		CUDA_MEMCPY2D memcpy_2d {
+			.srcXInBytes = copy.source_x * sizeof(uint32_t),
+			.srcY = copy.source_y,
+			.srcMemoryType = CU_MEMORYTYPE_DEVICE,
+			.srcDevice = device_ptr_retained,
+			.srcPitch = pitch,
+			.dstXInBytes = copy.x * sizeof(uint32_t),
+			.dstY = copy.y,
+			.dstMemoryType = CU_MEMORYTYPE_DEVICE,
+			.dstDevice = device_ptr_retained,
+			.dstPitch = pitch,
+			.WidthInBytes = copy.width * sizeof(uint32_t),
+			.Height = copy.height
+		};
+		// Copies within a buffer must not overlap, a scroll goes through the
+		// scratch buffer at the source position
+		bool overlap = copy.x < copy.source_x + copy.width && copy.source_x < copy.x + copy.width &&
+					   copy.y < copy.source_y + copy.height && copy.source_y < copy.y + copy.height;
+		if(overlap) {
+			CUDA_MEMCPY2D to_scratch = memcpy_2d;
+			to_scratch.dstXInBytes = memcpy_2d.srcXInBytes;
+			to_scratch.dstY = memcpy_2d.srcY;
+			to_scratch.dstDevice = device_ptr_copy_scratch;
+			CU_CHECK(cuMemcpy2D(&to_scratch));
+			memcpy_2d.srcDevice = device_ptr_copy_scratch;
+		}
+		CU_CHECK(cuMemcpy2D(&memcpy_2d));
+	}
 
-	// Convert BGR -> BGRA
-	int order[] = { 0, 1, 2, 3 };
-	NPP_CHECK(nppiSwapChannels_8u_C3C4R(reinterpret_cast<uint8_t *>(device_ptr_converted_intermediate), 
-										size.width * 3,
-									    reinterpret_cast<uint8_t *>(device_ptr_converted_result), 
-										size.width * 4,
-									    size, order, 0xFF));
+	// Everything else in the decoded picture is stale
+	const DirtyRect *dirty_rects = FrameDirtyRects(regions);
+	for(uint32_t i = 0; i < regions->dirty_count; ++i) {
+		const DirtyRect &rect = dirty_rects[i];
+		CUDA_MEMCPY2D memcpy_2d {
+			.srcXInBytes = rect.x * sizeof(uint32_t),
+			.srcY = rect.y,
+			.srcMemoryType = CU_MEMORYTYPE_DEVICE,
+			.srcDevice = device_ptr_converted_result,
+			.srcPitch = pitch,
+			.dstXInBytes = rect.x * sizeof(uint32_t),
+			.dstY = rect.y,
+			.dstMemoryType = CU_MEMORYTYPE_DEVICE,
+			.dstDevice = device_ptr_retained,
+			.dstPitch = pitch,
+			.WidthInBytes = rect.width * sizeof(uint32_t),
+			.Height = rect.height
+		};
+		CU_CHECK(cuMemcpy2D(&memcpy_2d));
+	}
+}
 
-	// Map and copy decoded image to backbuffer
+void Decoder::CopyToBackbuffer() {
+	// The retained frame goes straight to the backbuffer if it fills it
+	// exactly, otherwise it is scaled into the target rect first
+	bool fills_target = dimensions.target_width == encoded_width && dimensions.target_height == encoded_height &&
+						dimensions.target_rect_left == 0 && dimensions.target_rect_top == 0 &&
+						dimensions.target_rect_right == static_cast<short>(encoded_width) &&
+						dimensions.target_rect_bottom == static_cast<short>(encoded_height);
+	if(fills_target) {
+		device_ptr_display = device_ptr_retained;
+	}
+	else {
+		NppiSize source_size {
+			.width = static_cast<int>(encoded_width),
+			.height = static_cast<int>(encoded_height)
+		};
+		NppiSize target_size {
+			.width = static_cast<int>(dimensions.target_width),
+			.height = static_cast<int>(dimensions.target_height)
+		};
+		NppiRect source_rect {
+			.x = 0,
+			.y = 0,
+			.width = source_size.width,
+			.height = source_size.height
+		};
+		NppiRect target_rect {
+			.x = dimensions.target_rect_left,
+			.y = dimensions.target_rect_top,
+			.width = dimensions.target_rect_right - dimensions.target_rect_left,
+			.height = dimensions.target_rect_bottom - dimensions.target_rect_top
+		};
+		NPP_CHECK(nppiResize_8u_C4R(reinterpret_cast<uint8_t *>(device_ptr_retained), source_size.width * 4, source_size,
+									source_rect, reinterpret_cast<uint8_t *>(device_ptr_scaled), target_size.width * 4,
+									target_size, target_rect, NPPI_INTER_LINEAR));
+		device_ptr_display = device_ptr_scaled;
+	}
+
+	// Map and copy the decoded image to the backbuffer
 	// Note: Calling cuGraphicsD3D11RegisterResource every frame is against the recommendations
 	// in the CUDA docs, however I don't have a better way of making it work with a swap chain
 	// in FLIP_DISCARD mode
@@ -311,7 +494,7 @@ int Decoder::DisplayCallback(CUVIDPARSERDISPINFO *display_info) {
 
 	CUDA_MEMCPY2D memcpy_2d {
 		.srcMemoryType = CU_MEMORYTYPE_DEVICE,
-		.srcDevice = device_ptr_converted_result,
+		.srcDevice = device_ptr_display,
 		.srcPitch = dimensions.target_width * sizeof(uint32_t),
 		.dstMemoryType = CU_MEMORYTYPE_ARRAY,
 		.dstArray = mapped_array,
@@ -320,11 +503,63 @@ int Decoder::DisplayCallback(CUVIDPARSERDISPINFO *display_info) {
 	};
 
 	CU_CHECK(cuMemcpy2D(&memcpy_2d));
+	DrawCursor(mapped_array);
 	CU_CHECK(cuGraphicsUnmapResources(1, &cu_graphics_resource, 0));
 	CU_CHECK(cuGraphicsUnregisterResource(cu_graphics_resource));
+}
 
-	CU_CHECK(cuvidUnmapVideoFrame(cu_decoder, device_ptr_source_frame));
-	return 1;
+void Decoder::DrawCursor(CUarray array) {
+	if(!cursor) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(cursor->mutex);
+	cursor_version = cursor->version.load(std::memory_order_acquire);
+	CursorPlacement placement {
+		.frame_width = encoded_width,
+		.frame_height = encoded_height,
+		.rect_left = dimensions.target_rect_left,
+		.rect_top = dimensions.target_rect_top,
+		.rect_width = dimensions.target_rect_right - dimensions.target_rect_left,
+		.rect_height = dimensions.target_rect_bottom - dimensions.target_rect_top,
+		.image_width = dimensions.target_width,
+		.image_height = dimensions.target_height
+	};
+	CursorRect rect;
+	if(!cursor->Locate(placement, &rect)) {
+		return;
+	}
+
+	// Only the pixels under the cursor go through host memory, the frame
+	// buffer itself stays without the cursor for the next redraw
+	CUDA_MEMCPY2D download {
+		.srcXInBytes = rect.x * sizeof(uint32_t),
+		.srcY = rect.y,
+		.srcMemoryType = CU_MEMORYTYPE_DEVICE,
+		.srcDevice = device_ptr_display,
+		.srcPitch = dimensions.target_width * sizeof(uint32_t),
+		.dstMemoryType = CU_MEMORYTYPE_HOST,
+		.dstHost = cursor_patch,
+		.dstPitch = rect.width * sizeof(uint32_t),
+		.WidthInBytes = rect.width * sizeof(uint32_t),
+		.Height = rect.height
+	};
+	CU_CHECK(cuMemcpy2D(&download));
+
+	cursor->Draw(rect, cursor_patch, rect.width);
+
+	CUDA_MEMCPY2D upload {
+		.srcMemoryType = CU_MEMORYTYPE_HOST,
+		.srcHost = cursor_patch,
+		.srcPitch = rect.width * sizeof(uint32_t),
+		.dstXInBytes = rect.x * sizeof(uint32_t),
+		.dstY = rect.y,
+		.dstMemoryType = CU_MEMORYTYPE_ARRAY,
+		.dstArray = array,
+		.WidthInBytes = rect.width * sizeof(uint32_t),
+		.Height = rect.height
+	};
+	CU_CHECK(cuMemcpy2D(&upload));
 }
 
 void Decoder::Shutdown() {
@@ -341,6 +576,10 @@ void Decoder::Shutdown() {
 
 	cuvidDestroyVideoParser(cu_parser);
 
-	CU_CHECK(cuMemFree(device_ptr_converted_intermediate));
-	CU_CHECK(cuMemFree(device_ptr_converted_result));
+	FreeFrameBuffers();
+	if(tiles_initialized) {
+		tiles.Shutdown();
+	}
+	CU_CHECK(cuMemFree(device_ptr_scaled));
+	CU_CHECK(cuMemFreeHost(cursor_patch));
 }
@@ -2,6 +2,10 @@
 #include <cstdint>
 #include <nvcuvid.h>
 #include <d3d11_1.h>
+#include "CursorOverlay.h"
+#include "FrameRegions.h"
+#include "Nv12ToBgra.h"
+#include "TileDecoder.h"
 
 struct OutputDimensions {
 	uint32_t target_width;
@@ -15,6 +19,8 @@ struct OutputDimensions {
 struct Decoder {
 	uint32_t encoded_width;
 	uint32_t encoded_height;
+	// Set with the encoded size from the InitMessage
+	Codec codec;
 
 	OutputDimensions dimensions;
 
@@ -28,17 +34,66 @@ struct Decoder {
 	CUgraphicsResource cu_graphics_resource;
 	CUvideoparser cu_parser;
 	CUvideodecoder cu_decoder;
-	CUdeviceptr device_ptr_converted_intermediate = 0;
+	// Decoded pictures are converted at the encoded size in one pass, with
+	// the matrix and range the stream signals
 	CUdeviceptr device_ptr_converted_result = 0;
+	YuvCoefficients color_coefficients;
+	// The frame shown last at the encoded size, frame regions are applied to
+	// it. A picture that replaces it entirely is swapped in instead
+	CUdeviceptr device_ptr_retained = 0;
+	// Copies whose source and destination overlap go through here
+	CUdeviceptr device_ptr_copy_scratch = 0;
+	// The retained frame scaled into the target rect, with black borders
+	CUdeviceptr device_ptr_scaled = 0;
+	// Either device_ptr_retained or device_ptr_scaled, at the target size
+	CUdeviceptr device_ptr_display = 0;
+	// Regions of the frame being decoded, null for a picture that replaces the retained frame
+	const FrameRegions *pending_regions;
+	// device_ptr_retained holds a frame, the cursor is never drawn into it
+	bool has_frame;
+	// Set by DisplayCallback when a picture of the frame being decoded failed
+	bool corrupted;
+
+	// Codec::Tiles decodes on the CPU, the rows of tiles a frame changed are
+	// uploaded to device_ptr_retained. Set up with the first frame
+	TileDecoder tiles;
+	bool tiles_initialized;
+
+	// Drawn over every frame copied to the backbuffer, null for none.
+	// cursor_version is the overlay's version as last drawn
+	CursorOverlay *cursor;
+	uint32_t cursor_version;
+	// Page-locked staging for the pixels under the cursor, MAX_CURSOR_DIMENSION squared
+	uint32_t *cursor_patch;
 
 	void Initialize(HWND hwnd);
 
 	void Resize(uint32_t width, uint32_t height);
-	void Decode(void *ptr, uint32_t size);
+	// regions may be null, ptr and size cover only the encoded picture which
+	// is empty for a frame that only carries copies. Returns false if the
+	// frame did not decode cleanly, the picture stays wrong until a keyframe
+	bool Decode(void *ptr, uint32_t size, const FrameRegions *regions);
+	bool DecodeTiles(const void *ptr, uint32_t size);
+	void Present();
+	// Copies the last frame to the backbuffer again with the cursor where it
+	// is now, for a cursor update without a new frame. Returns false if there
+	// is nothing to present
+	bool Redraw();
+
+	// Applies the copies of regions to the retained frame, then the dirty
+	// rects from device_ptr_converted_result
+	void ApplyRegions(const FrameRegions *regions);
+	// Scales the retained frame to the target size if needed, copies it to
+	// the backbuffer and draws the cursor over it
+	void CopyToBackbuffer();
+	void DrawCursor(CUarray array);
 
 	int SequenceCallback(CUVIDEOFORMAT *video_format);
 	int DecodeCallback(CUVIDPICPARAMS *pic_params);
 	int DisplayCallback(CUVIDPARSERDISPINFO *display_info);
 
+	void AllocateFrameBuffers();
+	void FreeFrameBuffers();
+
 	void Shutdown();
 };
\ No newline at end of file
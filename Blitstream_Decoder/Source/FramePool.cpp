@@ -0,0 +1,64 @@
+#include "FramePool.h"
+#include <cassert>
+#include <cstdint>
+#include "Platform.h"
+
+static_assert(FRAME_POOL_SIZE <= 32, "Frame pool is tracked with a 32-bit mask");
+
+// Buffers grow in 1 MiB steps, this covers most P-frames without growing
+constexpr size_t FRAME_BUFFER_GRANULARITY = 1024u * 1024u;
+
+void FramePool::Initialize() {
+	for(uint32_t i = 0; i < FRAME_POOL_SIZE; ++i) {
+		buffers[i] = FrameBuffer {
+			.ptr = static_cast<uint8_t *>(PlatformAllocate(FRAME_BUFFER_GRANULARITY)),
+			.capacity = FRAME_BUFFER_GRANULARITY
+		};
+	}
+	used_mask.store(0, std::memory_order_relaxed);
+}
+
+uint32_t FramePool::Acquire(uint32_t size) {
+	uint32_t mask = used_mask.load(std::memory_order_acquire);
+	uint32_t index;
+	do {
+		for(index = 0; index < FRAME_POOL_SIZE; ++index) {
+			if((mask & (1u << index)) == 0) break;
+		}
+		if(index == FRAME_POOL_SIZE) {
+			return INVALID_FRAME_INDEX;
+		}
+	} while(!used_mask.compare_exchange_weak(mask, mask | (1u << index), std::memory_order_acq_rel));
+
+	// Grow the buffer if the frame does not fit, the old contents are not
+	// preserved. The size comes from the network, rounding it up must not wrap
+	FrameBuffer &buffer = buffers[index];
+	if(buffer.capacity < size) {
+		PlatformFree(buffer.ptr, buffer.capacity);
+		buffer.ptr = nullptr;
+		buffer.capacity = 0;
+		if(size <= SIZE_MAX - (FRAME_BUFFER_GRANULARITY - 1)) {
+			size_t capacity = (size + FRAME_BUFFER_GRANULARITY - 1) / FRAME_BUFFER_GRANULARITY * FRAME_BUFFER_GRANULARITY;
+			buffer.ptr = static_cast<uint8_t *>(PlatformAllocate(capacity));
+			buffer.capacity = buffer.ptr ? capacity : 0;
+		}
+		if(!buffer.ptr) {
+			Release(index);
+			return INVALID_FRAME_INDEX;
+		}
+	}
+
+	return index;
+}
+
+void FramePool::Release(uint32_t index) {
+	assert(index < FRAME_POOL_SIZE && "Invalid frame index");
+	used_mask.fetch_and(~(1u << index), std::memory_order_release);
+}
+
+void FramePool::Shutdown() {
+	for(uint32_t i = 0; i < FRAME_POOL_SIZE; ++i) {
+		PlatformFree(buffers[i].ptr, buffers[i].capacity);
+		buffers[i] = {};
+	}
+}
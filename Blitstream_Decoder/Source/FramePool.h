@@ -0,0 +1,28 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+constexpr uint32_t FRAME_POOL_SIZE = 16;
+constexpr uint32_t INVALID_FRAME_INDEX = 0xFFFFFFFF;
+
+struct FrameBuffer {
+	uint8_t *ptr;
+	size_t capacity;
+};
+
+// Fixed set of growable frame buffers. A buffer handed out by Acquire stays
+// valid and untouched until it is given back with Release, which may happen
+// from another thread than the one acquiring
+struct FramePool {
+	FrameBuffer buffers[FRAME_POOL_SIZE];
+	std::atomic<uint32_t> used_mask;
+
+	void Initialize();
+
+	// Returns INVALID_FRAME_INDEX if every buffer is currently in use or the
+	// buffer could not grow to size bytes
+	uint32_t Acquire(uint32_t size);
+	void Release(uint32_t index);
+
+	void Shutdown();
+};
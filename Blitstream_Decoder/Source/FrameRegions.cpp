@@ -0,0 +1,76 @@
+#include "FrameRegions.h"
+#include <cstring>
+
+static bool InFrame(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t frame_width,
+					uint32_t frame_height) {
+	return width != 0 && height != 0 && x + width <= frame_width && y + height <= frame_height;
+}
+
+uint32_t ParseFrameRegions(const void *data, uint32_t size, uint32_t frame_width, uint32_t frame_height) {
+	if(size < sizeof(FrameRegions)) {
+		return 0;
+	}
+	const FrameRegions *regions = static_cast<const FrameRegions *>(data);
+	if(regions->copy_count > MAX_COPY_RECTS || regions->dirty_count > MAX_DIRTY_RECTS) {
+		return 0;
+	}
+	uint32_t regions_size = static_cast<uint32_t>(sizeof(FrameRegions) + regions->copy_count * sizeof(CopyRect) +
+												  regions->dirty_count * sizeof(DirtyRect));
+	if(size < regions_size) {
+		return 0;
+	}
+
+	const CopyRect *copies = FrameCopies(regions);
+	for(uint32_t i = 0; i < regions->copy_count; ++i) {
+		const CopyRect &copy = copies[i];
+		if(!InFrame(copy.x, copy.y, copy.width, copy.height, frame_width, frame_height) ||
+		   !InFrame(copy.source_x, copy.source_y, copy.width, copy.height, frame_width, frame_height)) {
+			return 0;
+		}
+	}
+	const DirtyRect *dirty_rects = FrameDirtyRects(regions);
+	for(uint32_t i = 0; i < regions->dirty_count; ++i) {
+		const DirtyRect &rect = dirty_rects[i];
+		if(!InFrame(rect.x, rect.y, rect.width, rect.height, frame_width, frame_height)) {
+			return 0;
+		}
+	}
+	return regions_size;
+}
+
+void ApplyCopyRect(uint32_t *frame, uint32_t stride, const CopyRect &copy) {
+	// Moving down reads rows below the ones written, so it goes bottom up.
+	// Within a row memmove handles the overlap
+	size_t row_size = copy.width * sizeof(uint32_t);
+	if(copy.y > copy.source_y) {
+		for(uint32_t row = copy.height; row-- > 0;) {
+			memmove(frame + (copy.y + row) * stride + copy.x, frame + (copy.source_y + row) * stride + copy.source_x,
+					row_size);
+		}
+	}
+	else {
+		for(uint32_t row = 0; row < copy.height; ++row) {
+			memmove(frame + (copy.y + row) * stride + copy.x, frame + (copy.source_y + row) * stride + copy.source_x,
+					row_size);
+		}
+	}
+}
+
+void ApplyDirtyRect(uint32_t *frame, uint32_t stride, const uint32_t *decoded, uint32_t decoded_stride,
+					const DirtyRect &rect) {
+	for(uint32_t row = rect.y; row < rect.y + rect.height; ++row) {
+		memcpy(frame + row * stride + rect.x, decoded + row * decoded_stride + rect.x, rect.width * sizeof(uint32_t));
+	}
+}
+
+void ApplyFrameRegions(const FrameRegions *regions, uint32_t *frame, uint32_t stride, const uint32_t *decoded,
+					   uint32_t decoded_stride) {
+	const CopyRect *copies = FrameCopies(regions);
+	for(uint32_t i = 0; i < regions->copy_count; ++i) {
+		ApplyCopyRect(frame, stride, copies[i]);
+	}
+	const DirtyRect *dirty_rects = FrameDirtyRects(regions);
+	for(uint32_t i = 0; i < regions->dirty_count; ++i) {
+		ApplyDirtyRect(frame, stride, decoded, decoded_stride, dirty_rects[i]);
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include "Protocol.h"
+
+// Reads the FrameRegions in front of a frame's data and applies it to a
+// retained 32 bit per pixel frame on the CPU. The decoder does the same on the
+// GPU, this is the reference it has to match. Strides are in pixels
+
+// Returns the size of the FrameRegions at the start of data, or 0 if it does
+// not fit into size bytes, holds too many rects or one of them leaves the frame
+uint32_t ParseFrameRegions(const void *data, uint32_t size, uint32_t frame_width, uint32_t frame_height);
+
+inline const CopyRect *FrameCopies(const FrameRegions *regions) {
+	return reinterpret_cast<const CopyRect *>(regions + 1);
+}
+
+inline const DirtyRect *FrameDirtyRects(const FrameRegions *regions) {
+	return reinterpret_cast<const DirtyRect *>(FrameCopies(regions) + regions->copy_count);
+}
+
+// In place, rows and pixels go in the order that never reads one already overwritten
+void ApplyCopyRect(uint32_t *frame, uint32_t stride, const CopyRect &copy);
+void ApplyDirtyRect(uint32_t *frame, uint32_t stride, const uint32_t *decoded, uint32_t decoded_stride,
+					const DirtyRect &rect);
+// The copies in order, then the dirty rects. decoded may be null for a frame
+// without an encoded picture, which has no dirty rects
+void ApplyFrameRegions(const FrameRegions *regions, uint32_t *frame, uint32_t stride, const uint32_t *decoded,
+					   uint32_t decoded_stride);
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <semaphore>
+
+#include "Client.h"
+#include "LatencyHistogram.h"
+#include "Platform.h"
+
+// Receives a stream without decoding or presenting it, for the synthetic
+// source and for measuring the transport on hosts without a display or GPU.
+// Command line is "<ip> [--latency-json <path>] [--seconds <n>]"
+
+// How long the loop waits for a frame before checking the stats timer
+constexpr uint32_t HEADLESS_POLL_TIMEOUT_MS = 100;
+
+static void WakeLoop(void *user_data) {
+	static_cast<std::counting_semaphore<FRAME_QUEUE_SIZE * 2> *>(user_data)->release();
+}
+
+int main(int argc, char **argv) {
+	if(argc < 2) {
+		printf("Usage: %s <ip> [--latency-json <path>] [--seconds <n>]\n", argv[0]);
+		return 1;
+	}
+	const char *ip_address = argv[1];
+	const char *latency_json_path = nullptr;
+	uint64_t duration_us = 0;
+	for(int i = 2; i < argc; ++i) {
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if(strcmp(argv[i], "--latency-json") == 0 && value) {
+			latency_json_path = value;
+			++i;
+		}
+		else if(strcmp(argv[i], "--seconds") == 0 && value) {
+			duration_us = strtoull(value, nullptr, 10) * 1000000;
+			++i;
+		}
+		else {
+			printf("Ignoring unrecognized argument: %s\n", argv[i]);
+		}
+	}
+
+	Client client {};
+	LatencyReport latency_report {};
+	latency_report.Initialize(latency_json_path);
+	client.AddLatencyStages(&latency_report);
+
+	InitMessage init_message = client.Initialize(ip_address);
+	printf("Connected to %s, %ux%u\n", ip_address, init_message.encoded_width, init_message.encoded_height);
+
+	// Released once per callback, the loop may fall behind by a whole queue
+	std::counting_semaphore<FRAME_QUEUE_SIZE * 2> wake { 0 };
+	client.Start(WakeLoop, &wake);
+
+	EncodedData frames[FRAME_QUEUE_SIZE];
+	uint64_t start = PlatformTimestamp();
+	uint64_t stats_timestamp = start;
+	uint64_t frame_total = 0;
+	uint64_t byte_total = 0;
+	bool running = true;
+	while(running && (duration_us == 0 || PlatformTimestamp() - start < duration_us)) {
+		wake.try_acquire_for(std::chrono::milliseconds(HEADLESS_POLL_TIMEOUT_MS));
+		uint32_t frame_count = client.PollData(frames, FRAME_QUEUE_SIZE);
+		for(uint32_t i = 0; i < frame_count; ++i) {
+			if(frames[i].result == EncodedDataResult::Abort) {
+				running = false;
+				break;
+			}
+			++frame_total;
+			byte_total += frames[i].size;
+			client.ReleaseData(frames[i]);
+		}
+
+		uint64_t now = PlatformTimestamp();
+		if(now - stats_timestamp > 1000000) {
+			double seconds = (now - stats_timestamp) / 1000000.0;
+			printf("Received %llu frames, %.1f Mbit/s, max queue depth %u, %llu sequence gaps\n",
+				   static_cast<unsigned long long>(frame_total), byte_total * 8 / seconds / 1000000.0,
+				   client.stats.max_queue_depth.exchange(0, std::memory_order_relaxed),
+				   static_cast<unsigned long long>(client.stats.sequence_gaps.load(std::memory_order_relaxed)));
+			latency_report.Report(now);
+			stats_timestamp = now;
+			frame_total = 0;
+			byte_total = 0;
+		}
+	}
+
+	client.Shutdown();
+	latency_report.Shutdown();
+	return 0;
+}
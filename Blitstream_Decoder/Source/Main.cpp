@@ -2,9 +2,12 @@
 #define NOMINMAX
 #include <Windows.h>
 #include <cstdio>
+#include <cstring>
 
 #include "Decoder.h"
 #include "Client.h"
+#include "LatencyHistogram.h"
+#include "Platform.h"
 
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 	Decoder *decoder = reinterpret_cast<Decoder *>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
@@ -32,11 +35,70 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 	return DefWindowProc(hwnd, msg, wparam, lparam);
 }
 
+static void WakeMessageLoop(void *user_data) {
+	DWORD thread_id = static_cast<DWORD>(reinterpret_cast<uintptr_t>(user_data));
+	PostThreadMessage(thread_id, WM_NULL, 0, 0);
+}
+
+static void PrintClientStats(Client &client) {
+	printf("Receive queue: max depth %u, sequence gaps %llu, keyframe requests %llu\n",
+		   client.stats.max_queue_depth.exchange(0, std::memory_order_relaxed),
+		   static_cast<unsigned long long>(client.stats.sequence_gaps.load(std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(client.stats.keyframe_requests.load(std::memory_order_relaxed)));
+	uint64_t first_keyframe_us = client.stats.first_keyframe_us.load(std::memory_order_relaxed);
+	if(first_keyframe_us != 0) {
+		printf("First keyframe: %.1f ms after connecting\n", first_keyframe_us / 1000.0);
+	}
+	CursorOverlayStats &cursor_stats = client.cursor.stats;
+	printf("Cursor: %llu updates, %llu shapes, %llu bytes\n",
+		   static_cast<unsigned long long>(cursor_stats.updates.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(cursor_stats.shapes.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(cursor_stats.bytes.exchange(0, std::memory_order_relaxed)));
+	if(client.clock_sync.synchronized.load(std::memory_order_acquire)) {
+		printf("Clock: offset %lld us, round trip %lld us\n",
+			   static_cast<long long>(client.clock_sync.offset.load(std::memory_order_relaxed)),
+			   static_cast<long long>(client.clock_sync.round_trip.load(std::memory_order_relaxed)));
+	}
+	if(client.transport == Transport::Udp) {
+		PacketAssemblerStats &packet_stats = client.packet_assembler.stats;
+		printf("Packets: %llu received, %llu parity, %llu recovered, %llu retransmitted, %llu late recoveries, %llu duplicate, %llu late, %llu invalid\n",
+			   static_cast<unsigned long long>(packet_stats.packets.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.parity_packets.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.recovered_packets.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.retransmitted_packets.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.late_recoveries.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.duplicate_packets.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.late_packets.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.invalid_packets.load(std::memory_order_relaxed)));
+		printf("Frames: %llu completed, %llu held, %llu expired, %llu dropped\n",
+			   static_cast<unsigned long long>(packet_stats.frames_completed.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.frames_held.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.frames_expired.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(packet_stats.frames_dropped.load(std::memory_order_relaxed)));
+
+		NackStats &nack_stats = client.packet_assembler.nack_tracker.stats;
+		printf("NACKs: %llu sent for %llu packets, %llu losses resolved, %llu abandoned\n",
+			   static_cast<unsigned long long>(nack_stats.nacks_sent.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(nack_stats.sequences_requested.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(nack_stats.losses_resolved.load(std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(nack_stats.losses_abandoned.load(std::memory_order_relaxed)));
+	}
+}
+
 int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_line, int n_cmd_show) {
 	uint64_t ip_address_str_size;
 	char *ip_address = (char *)malloc(1024);
 	wcstombs_s(&ip_address_str_size, ip_address, 1024, p_cmd_line, 1024);
 
+	// Command line is "<ip> [--latency-json <path>]"
+	char *next_token = nullptr;
+	strtok_s(ip_address, " ", &next_token);
+	const char *option = strtok_s(nullptr, " ", &next_token);
+	const char *latency_json_path = nullptr;
+	if(option && strcmp(option, "--latency-json") == 0) {
+		latency_json_path = strtok_s(nullptr, " ", &next_token);
+	}
+
 	SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_SYSTEM_AWARE);
 
 
@@ -79,6 +141,18 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 
 	Client client {};
 
+	// Decode and present both run on this thread
+	LatencyHistogram decode_latency {};
+	LatencyHistogram present_latency {};
+	// Capture on the server until presented here, glass to glass minus the display scanout
+	LatencyHistogram display_latency {};
+	LatencyReport latency_report {};
+	latency_report.Initialize(latency_json_path);
+	client.AddLatencyStages(&latency_report);
+	latency_report.Add("decode", &decode_latency);
+	latency_report.Add("present", &present_latency);
+	latency_report.Add("display", &display_latency);
+
 	InitMessage init_message = client.Initialize(ip_address);
 
 	char title[128];
@@ -89,30 +163,80 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR p_cmd_lin
 
 	decoder.encoded_width = init_message.encoded_width;
 	decoder.encoded_height = init_message.encoded_height;
+	decoder.codec = init_message.codec;
+	decoder.cursor = &client.cursor;
 
-	while(true) {
+	// Network receive runs on its own thread and wakes this loop whenever a frame is queued
+	client.Start(WakeMessageLoop, reinterpret_cast<void *>(static_cast<uintptr_t>(GetCurrentThreadId())));
+
+	EncodedData frames[FRAME_QUEUE_SIZE];
+	uint64_t stats_timestamp = PlatformTimestamp();
+	bool running = true;
+	while(running) {
 		MSG msg;
 		while(PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
 			if(msg.message == WM_QUIT) {
-				UnregisterClass(window_class_name, instance);
-				decoder.Shutdown();
-				return 0;
+				running = false;
 			}
 		}
+		if(!running) {
+			break;
+		}
 
-		EncodedData data = client.ReceiveData();
+		uint32_t frame_count = client.PollData(frames, FRAME_QUEUE_SIZE);
+		// A cursor update without a new frame only draws the last one again
+		bool cursor_changed = client.cursor.version.load(std::memory_order_acquire) != decoder.cursor_version;
+		if(frame_count == 0 && !cursor_changed) {
+			MsgWaitForMultipleObjectsEx(0, nullptr, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+			continue;
+		}
 
-		if(data.result == EncodedDataResult::Success) {
-			decoder.Decode(data.ptr, data.size);
+		// Frames reference each other so every queued frame has to be decoded,
+		// but only the newest one is presented
+		bool decoded = false;
+		uint64_t capture_timestamp = 0;
+		for(uint32_t i = 0; i < frame_count; ++i) {
+			if(frames[i].result == EncodedDataResult::Abort) {
+				running = false;
+				break;
+			}
+			uint64_t decode_start = PlatformTimestampNs();
+			// The server is asked for a keyframe rather than waiting for the GOP to come around
+			if(!decoder.Decode(frames[i].ptr, frames[i].size, frames[i].regions)) {
+				client.RequestKeyframe();
+			}
+			decode_latency.Record(PlatformTimestampNs() - decode_start);
+			client.ReleaseData(frames[i]);
+			capture_timestamp = frames[i].capture_timestamp;
+			decoded = true;
 		}
-		else if(data.result == EncodedDataResult::Abort) {
-			break;
+		if(decoded) {
+			uint64_t present_start = PlatformTimestampNs();
+			decoder.Present();
+			uint64_t present_end = PlatformTimestampNs();
+			present_latency.Record(present_end - present_start);
+
+			if(client.clock_sync.synchronized.load(std::memory_order_acquire)) {
+				uint64_t capture_ns = client.clock_sync.ToLocal(capture_timestamp) * 1000;
+				display_latency.Record(present_end > capture_ns ? present_end - capture_ns : 0);
+			}
+		}
+		else if(cursor_changed && decoder.Redraw()) {
+			decoder.Present();
 		}
 
+		uint64_t now = PlatformTimestamp();
+		if(now - stats_timestamp > 1000000) {
+			PrintClientStats(client);
+			latency_report.Report(now);
+			stats_timestamp = now;
+		}
 	}
 
+	client.Shutdown();
+	latency_report.Shutdown();
 	UnregisterClass(window_class_name, instance);
 	decoder.Shutdown();
 	return 0;
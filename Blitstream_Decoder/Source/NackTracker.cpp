@@ -0,0 +1,92 @@
+#include "NackTracker.h"
+#include "Protocol.h"
+
+void NackTracker::Initialize() {
+	loss_count = 0;
+	highest_sequence = 0;
+	started = false;
+}
+
+void NackTracker::RemoveLoss(uint32_t index) {
+	losses[index] = losses[--loss_count];
+}
+
+void NackTracker::AddPacket(uint32_t sequence, uint64_t now_ns) {
+	if(!started) {
+		started = true;
+		highest_sequence = sequence;
+		return;
+	}
+
+	int32_t distance = static_cast<int32_t>(sequence - highest_sequence);
+	if(distance <= 0) {
+		// Reordered or retransmitted, fills a gap if it is one
+		for(uint32_t i = 0; i < loss_count; ++i) {
+			if(losses[i].sequence == sequence) {
+				RemoveLoss(i);
+				stats.losses_resolved.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+		}
+		return;
+	}
+
+	// Gaps longer than the table only track their newest packets
+	uint32_t first_missing = highest_sequence + 1;
+	if(static_cast<uint32_t>(distance - 1) > MAX_TRACKED_LOSSES) {
+		stats.losses_abandoned.fetch_add(distance - 1 - MAX_TRACKED_LOSSES, std::memory_order_relaxed);
+		first_missing = sequence - MAX_TRACKED_LOSSES;
+	}
+	for(uint32_t missing = first_missing; missing != sequence; ++missing) {
+		if(loss_count == MAX_TRACKED_LOSSES) {
+			// Make room by giving up on the oldest loss
+			uint32_t oldest = 0;
+			for(uint32_t i = 1; i < loss_count; ++i) {
+				if(static_cast<int32_t>(losses[i].sequence - losses[oldest].sequence) < 0) {
+					oldest = i;
+				}
+			}
+			RemoveLoss(oldest);
+			stats.losses_abandoned.fetch_add(1, std::memory_order_relaxed);
+		}
+		losses[loss_count++] = TrackedLoss {
+			.sequence = missing,
+			.attempts = 0,
+			.detect_timestamp_ns = now_ns,
+			.nack_timestamp_ns = 0
+		};
+	}
+	highest_sequence = sequence;
+}
+
+uint32_t NackTracker::CollectNacks(uint64_t now_ns, uint64_t round_trip_ns, uint32_t *sequences,
+								   uint32_t max_sequences) {
+	uint64_t interval_ns = round_trip_ns > NACK_MIN_INTERVAL_NS ? round_trip_ns : NACK_MIN_INTERVAL_NS;
+
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < loss_count && count < max_sequences;) {
+		TrackedLoss &loss = losses[i];
+		bool last_attempt_over = loss.attempts == MAX_NACK_ATTEMPTS && now_ns - loss.nack_timestamp_ns >= interval_ns;
+		if(last_attempt_over || now_ns - loss.detect_timestamp_ns > FRAME_DEADLINE_US * 1000) {
+			RemoveLoss(i);
+			stats.losses_abandoned.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		bool due = loss.attempts == MAX_NACK_ATTEMPTS ? false :
+				   loss.attempts == 0 ? now_ns - loss.detect_timestamp_ns >= NACK_REORDER_DELAY_NS :
+										now_ns - loss.nack_timestamp_ns >= interval_ns;
+		if(due) {
+			sequences[count++] = loss.sequence;
+			loss.nack_timestamp_ns = now_ns;
+			++loss.attempts;
+		}
+		++i;
+	}
+
+	if(count != 0) {
+		stats.nacks_sent.fetch_add(1, std::memory_order_relaxed);
+		stats.sequences_requested.fetch_add(count, std::memory_order_relaxed);
+	}
+	return count;
+}
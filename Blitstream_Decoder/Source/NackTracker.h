@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Missing packet sequences tracked at once, the oldest are given up first
+constexpr uint32_t MAX_TRACKED_LOSSES = 512;
+// A packet is only reported missing after this long, tolerates mild reordering
+constexpr uint64_t NACK_REORDER_DELAY_NS = 1000000;
+// Repeated NACKs for the same packet wait at least one round trip, and at
+// least this long while the round trip is unknown
+constexpr uint64_t NACK_MIN_INTERVAL_NS = 5000000;
+constexpr uint32_t MAX_NACK_ATTEMPTS = 3;
+
+struct TrackedLoss {
+	uint32_t sequence;
+	uint32_t attempts;
+	uint64_t detect_timestamp_ns;
+	uint64_t nack_timestamp_ns;
+};
+
+// Written by the receive thread, may be read from another
+struct NackStats {
+	// NACK packets sent and the sequences they asked for
+	std::atomic<uint64_t> nacks_sent;
+	std::atomic<uint64_t> sequences_requested;
+	// Missing packets that arrived late or were sent again
+	std::atomic<uint64_t> losses_resolved;
+	// Missing packets dropped after MAX_NACK_ATTEMPTS or the frame deadline
+	std::atomic<uint64_t> losses_abandoned;
+};
+
+// Detects gaps in the packet sequence and decides when to ask for the missing
+// packets again. A NACK is repeated once a round trip has passed without the
+// packet showing up, so a retransmission that is still in flight is not
+// asked for twice
+struct NackTracker {
+	TrackedLoss losses[MAX_TRACKED_LOSSES];
+	uint32_t loss_count;
+	// Highest sequence seen, packets older than it fill gaps
+	uint32_t highest_sequence;
+	bool started;
+
+	NackStats stats;
+
+	void Initialize();
+
+	// Every valid packet from the sender, retransmitted ones included
+	void AddPacket(uint32_t sequence, uint64_t now_ns);
+
+	// Writes the sequences due for a NACK and returns their number
+	uint32_t CollectNacks(uint64_t now_ns, uint64_t round_trip_ns, uint32_t *sequences, uint32_t max_sequences);
+
+	void RemoveLoss(uint32_t index);
+};
@@ -0,0 +1,44 @@
+#include "Nv12ToBgra.h"
+#include <cstdio>
+#include <cuda_runtime.h>
+
+// Threads per block, each thread covers one chroma sample and so 2x2 pixels
+constexpr uint32_t BLOCK_WIDTH = 32;
+constexpr uint32_t BLOCK_HEIGHT = 8;
+
+__global__ static void Nv12ToBgraKernel(const uint8_t *luma, const uint8_t *chroma, uint32_t pitch, uint32_t width,
+										uint32_t height, YuvCoefficients coefficients, uint32_t *bgra) {
+	uint32_t x = (blockIdx.x * blockDim.x + threadIdx.x) * 2;
+	uint32_t y = (blockIdx.y * blockDim.y + threadIdx.y) * 2;
+	if(x >= width || y >= height) {
+		return;
+	}
+
+	const uint8_t *uv = chroma + static_cast<size_t>(y / 2) * pitch + x;
+	uint8_t u = uv[0];
+	uint8_t v = uv[1];
+	for(uint32_t row = y; row < y + 2 && row < height; ++row) {
+		const uint8_t *luma_row = luma + static_cast<size_t>(row) * pitch;
+		uint32_t *bgra_row = bgra + static_cast<size_t>(row) * width;
+		bgra_row[x] = YuvToBgra(coefficients, luma_row[x], u, v);
+		if(x + 1 < width) {
+			bgra_row[x + 1] = YuvToBgra(coefficients, luma_row[x + 1], u, v);
+		}
+	}
+}
+
+void ConvertNv12ToBgraDevice(CUdeviceptr frame, uint32_t pitch, uint32_t width, uint32_t height,
+							 const YuvCoefficients &coefficients, CUdeviceptr bgra) {
+	const uint8_t *luma = reinterpret_cast<const uint8_t *>(frame);
+	const uint8_t *chroma = luma + static_cast<size_t>(pitch) * height;
+	dim3 block(BLOCK_WIDTH, BLOCK_HEIGHT);
+	dim3 grid(((width + 1) / 2 + BLOCK_WIDTH - 1) / BLOCK_WIDTH, ((height + 1) / 2 + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT);
+	Nv12ToBgraKernel<<<grid, block>>>(luma, chroma, pitch, width, height, coefficients,
+									  reinterpret_cast<uint32_t *>(bgra));
+#ifdef _DEBUG
+	cudaError_t error = cudaGetLastError();
+	if(error != cudaSuccess) {
+		printf("CUDA_RUNTIME: Nv12ToBgraKernel is %i in %s at line %d\n", error, __FILE__, __LINE__);
+	}
+#endif
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+#include <cuda.h>
+#include "ColorConvert.h"
+
+// Converts a decoded NV12 picture to opaque BGRA on the GPU in a single pass.
+// The chroma plane follows height rows of luma, both with the given pitch,
+// and bgra is width by height pixels without padding. Uses YuvToBgra like
+// ConvertNv12ToBgra, so the pixels should match, Nv12ToBgraCudaTest compares
+// them where CUDA is available. Queued on the default stream
+void ConvertNv12ToBgraDevice(CUdeviceptr frame, uint32_t pitch, uint32_t width, uint32_t height,
+							 const YuvCoefficients &coefficients, CUdeviceptr bgra);
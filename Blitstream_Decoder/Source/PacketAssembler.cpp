@@ -0,0 +1,394 @@
+#include "PacketAssembler.h"
+#include <cassert>
+#include <cstring>
+#include "GaloisField.h"
+#include "Platform.h"
+
+static constexpr uint32_t BITMAP_WORDS = MAX_FRAME_PACKETS / 64;
+static constexpr uint32_t PARITY_BITMAP_WORDS = MAX_FRAME_PARITY_PACKETS / 64;
+static constexpr size_t BITMAPS_SIZE = MAX_PARTIAL_FRAMES * (BITMAP_WORDS + PARITY_BITMAP_WORDS) * sizeof(uint64_t);
+static constexpr size_t PARITY_BUFFERS_SIZE = static_cast<size_t>(MAX_PARTIAL_FRAMES) * MAX_FRAME_PARITY_PACKETS * MAX_PACKET_PAYLOAD;
+static constexpr size_t RECOVERY_BUFFERS_SIZE = (MAX_FEC_PARITY_SHARDS + 2) * MAX_PACKET_PAYLOAD;
+static constexpr uint32_t HEADER_SIZE = sizeof(DataHeader);
+
+// Sequence numbers wrap, a is older than b if it is less than half the range behind
+static bool IsOlder(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) < 0;
+}
+
+static bool TestBit(const uint64_t *bitmap, uint32_t index) {
+	return (bitmap[index / 64] >> (index % 64)) & 1;
+}
+
+static void SetBit(uint64_t *bitmap, uint32_t index) {
+	bitmap[index / 64] |= 1ull << (index % 64);
+}
+
+static uint32_t CountBits(const uint64_t *bitmap, uint32_t begin, uint32_t count, uint32_t stride) {
+	uint32_t set_count = 0;
+	for(uint32_t i = 0; i < count; ++i) {
+		set_count += TestBit(bitmap, begin + i * stride);
+	}
+	return set_count;
+}
+
+// Payload size of a frame packet, every packet but the last one is full
+static uint32_t PacketPayloadSize(uint32_t frame_size, uint32_t packet_index) {
+	uint32_t begin = packet_index * MAX_PACKET_PAYLOAD;
+	return begin + MAX_PACKET_PAYLOAD < frame_size ? MAX_PACKET_PAYLOAD : frame_size - begin;
+}
+
+// Parity packets the sender sends for a block, see Server::SendParity
+static uint32_t BlockParityCount(const PartialFrame &partial, uint32_t block, uint32_t data_count) {
+	uint32_t first_parity = block * partial.fec_parity_count;
+	if(first_parity >= MAX_FRAME_PARITY_PACKETS) {
+		return 0;
+	}
+	uint32_t parity_count = FecParityCount(data_count, partial.fec_block_size, partial.fec_parity_count);
+	return first_parity + parity_count > MAX_FRAME_PARITY_PACKETS ? MAX_FRAME_PARITY_PACKETS - first_parity : parity_count;
+}
+
+void PacketAssembler::Initialize() {
+	GfInitialize();
+	bitmaps = static_cast<uint64_t *>(PlatformAllocate(BITMAPS_SIZE));
+	parity_buffers = static_cast<uint8_t *>(PlatformAllocate(PARITY_BUFFERS_SIZE));
+	recovery_buffers = static_cast<uint8_t *>(PlatformAllocate(RECOVERY_BUFFERS_SIZE));
+	for(uint32_t i = 0; i < MAX_PARTIAL_FRAMES; ++i) {
+		partials[i] = PartialFrame {
+			.active = false,
+			.received = bitmaps + i * BITMAP_WORDS,
+			.parity_received = bitmaps + MAX_PARTIAL_FRAMES * BITMAP_WORDS + i * PARITY_BITMAP_WORDS,
+			.parity = parity_buffers + static_cast<size_t>(i) * MAX_FRAME_PARITY_PACKETS * MAX_PACKET_PAYLOAD
+		};
+	}
+	next_sequence = 0;
+	delivered_any = false;
+	round_trip_ns = 0;
+	holding = false;
+	original_packets = 0;
+	nack_tracker.Initialize();
+}
+
+void PacketAssembler::Discard(PartialFrame &partial, FramePool &pool) {
+	if(partial.frame_index != INVALID_FRAME_INDEX) {
+		pool.Release(partial.frame_index);
+	}
+	partial.active = false;
+}
+
+void PacketAssembler::AddPacket(uint32_t size, FramePool &pool, uint64_t now_ns) {
+	stats.packets.fetch_add(1, std::memory_order_relaxed);
+
+	PacketHeader packet;
+	if(size < sizeof(PacketHeader)) {
+		stats.invalid_packets.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	memcpy(&packet, datagram, sizeof(PacketHeader));
+	uint32_t payload_size = size - sizeof(PacketHeader);
+
+	uint32_t expected_count = (packet.frame_size + MAX_PACKET_PAYLOAD - 1) / MAX_PACKET_PAYLOAD;
+	bool valid = packet.MAGIC == PROTOCOL_MAGIC && packet.frame_size >= HEADER_SIZE &&
+				 packet.packet_count == expected_count && packet.fec_block_size <= MAX_FEC_DATA_SHARDS &&
+				 packet.fec_parity_count <= MAX_FEC_PARITY_SHARDS &&
+				 (packet.fec_block_size != 0) == (packet.fec_parity_count != 0);
+	bool parity = packet.type == PacketType::Parity;
+	if(valid && packet.type == PacketType::Frame) {
+		valid = packet.packet_index < packet.packet_count &&
+				payload_size == PacketPayloadSize(packet.frame_size, packet.packet_index);
+	}
+	else if(valid && parity) {
+		uint32_t block_count = packet.fec_block_size != 0 ? FecBlockCount(packet.packet_count, packet.fec_block_size) : 0;
+		valid = packet.packet_index < block_count && payload_size == MAX_PACKET_PAYLOAD &&
+				packet.fec_index < FecParityCount(FecBlockDataCount(packet.packet_count, block_count, packet.packet_index),
+												  packet.fec_block_size, packet.fec_parity_count) &&
+				static_cast<uint32_t>(packet.packet_index * packet.fec_parity_count + packet.fec_index) < MAX_FRAME_PARITY_PACKETS;
+	}
+	else {
+		valid = false;
+	}
+	if(!valid) {
+		stats.invalid_packets.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	if(parity) {
+		stats.parity_packets.fetch_add(1, std::memory_order_relaxed);
+	}
+	bool retransmit = (packet.flags & PACKET_FLAG_RETRANSMIT) != 0;
+	if(retransmit) {
+		stats.retransmitted_packets.fetch_add(1, std::memory_order_relaxed);
+	}
+	else {
+		++original_packets;
+	}
+	nack_tracker.AddPacket(packet.sequence, now_ns);
+
+	if(delivered_any && IsOlder(packet.frame_sequence, next_sequence)) {
+		// Parity that was not needed is expected to arrive after its frame
+		if(!parity) {
+			stats.late_packets.fetch_add(1, std::memory_order_relaxed);
+		}
+		return;
+	}
+
+	// Find the frame, or start it in a free slot or in place of the oldest one
+	PartialFrame *partial = nullptr;
+	PartialFrame *oldest = nullptr;
+	PartialFrame *free_partial = nullptr;
+	for(uint32_t i = 0; i < MAX_PARTIAL_FRAMES; ++i) {
+		PartialFrame &candidate = partials[i];
+		if(!candidate.active) {
+			free_partial = free_partial ? free_partial : &candidate;
+			continue;
+		}
+		if(candidate.sequence == packet.frame_sequence) {
+			partial = &candidate;
+			break;
+		}
+		if(!oldest || IsOlder(candidate.sequence, oldest->sequence)) {
+			oldest = &candidate;
+		}
+	}
+	if(!partial) {
+		if(!free_partial) {
+			stats.frames_dropped.fetch_add(1, std::memory_order_relaxed);
+			Discard(*oldest, pool);
+			free_partial = oldest;
+		}
+		partial = free_partial;
+		partial->active = true;
+		partial->complete = false;
+		partial->sequence = packet.frame_sequence;
+		partial->frame_size = packet.frame_size;
+		partial->packet_count = packet.packet_count;
+		partial->received_count = 0;
+		partial->first_timestamp_ns = now_ns;
+		partial->header_timestamp_ns = now_ns;
+		partial->arrival_timestamp_ns = now_ns;
+		partial->fec_block_size = packet.fec_block_size;
+		partial->fec_parity_count = packet.fec_parity_count;
+		memset(partial->received, 0, (packet.packet_count + 63) / 64 * sizeof(uint64_t));
+		memset(partial->parity_received, 0, PARITY_BITMAP_WORDS * sizeof(uint64_t));
+
+		partial->frame_index = INVALID_FRAME_INDEX;
+		if(packet.frame_size > HEADER_SIZE) {
+			partial->frame_index = pool.Acquire(packet.frame_size - HEADER_SIZE);
+			if(partial->frame_index == INVALID_FRAME_INDEX) {
+				partial->active = false;
+				stats.frames_dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+	else if(partial->frame_size != packet.frame_size || partial->fec_block_size != packet.fec_block_size ||
+			partial->fec_parity_count != packet.fec_parity_count) {
+		stats.invalid_packets.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	const uint8_t *payload = datagram + sizeof(PacketHeader);
+	uint32_t block;
+	if(parity) {
+		uint32_t parity_index = packet.packet_index * partial->fec_parity_count + packet.fec_index;
+		if(TestBit(partial->parity_received, parity_index)) {
+			stats.duplicate_packets.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		SetBit(partial->parity_received, parity_index);
+		memcpy(partial->parity + static_cast<size_t>(parity_index) * MAX_PACKET_PAYLOAD, payload, MAX_PACKET_PAYLOAD);
+		block = packet.packet_index;
+	}
+	else {
+		if(TestBit(partial->received, packet.packet_index)) {
+			stats.duplicate_packets.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		SetBit(partial->received, packet.packet_index);
+		++partial->received_count;
+		WritePayload(*partial, pool, packet.packet_index, payload, now_ns);
+		block = partial->fec_block_size != 0 ?
+					packet.packet_index % FecBlockCount(partial->packet_count, partial->fec_block_size) : 0;
+	}
+	// Duplicates, including packets already rebuilt from parity, have returned by now
+	if(retransmit) {
+		stats.late_recoveries.fetch_add(1, std::memory_order_relaxed);
+	}
+	else {
+		partial->arrival_timestamp_ns = now_ns;
+	}
+
+	if(partial->fec_block_size != 0) {
+		RecoverBlock(*partial, pool, block, now_ns);
+	}
+	if(partial->received_count == partial->packet_count && !partial->complete) {
+		// Every packet was well formed, the header they carried may still not be
+		if(partial->header.MAGIC != PROTOCOL_MAGIC || partial->header.size != partial->frame_size - HEADER_SIZE) {
+			stats.frames_dropped.fetch_add(1, std::memory_order_relaxed);
+			Discard(*partial, pool);
+			return;
+		}
+		partial->complete = true;
+		partial->complete_timestamp_ns = now_ns;
+		stats.frames_completed.fetch_add(1, std::memory_order_relaxed);
+
+		for(uint32_t i = 0; i < MAX_PARTIAL_FRAMES; ++i) {
+			if(partials[i].active && !partials[i].complete && IsOlder(partials[i].sequence, partial->sequence)) {
+				stats.frames_held.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+		}
+	}
+}
+
+AssembleResult PacketAssembler::NextFrame(FramePool &pool, uint64_t now_ns, AssembledFrame *frame) {
+	uint64_t hold_ns = NACK_REORDER_DELAY_NS + round_trip_ns + FRAME_HOLD_MARGIN_NS;
+	holding = false;
+	for(;;) {
+		PartialFrame *oldest = nullptr;
+		PartialFrame *oldest_complete = nullptr;
+		for(uint32_t i = 0; i < MAX_PARTIAL_FRAMES; ++i) {
+			PartialFrame &candidate = partials[i];
+			if(!candidate.active) {
+				continue;
+			}
+			if(!oldest || IsOlder(candidate.sequence, oldest->sequence)) {
+				oldest = &candidate;
+			}
+			if(candidate.complete && (!oldest_complete || IsOlder(candidate.sequence, oldest_complete->sequence))) {
+				oldest_complete = &candidate;
+			}
+		}
+		if(!oldest_complete) {
+			return AssembleResult::Pending;
+		}
+
+		if(oldest != oldest_complete) {
+			// Give the older frame until the newer one has waited long enough
+			if(now_ns - oldest_complete->complete_timestamp_ns < hold_ns) {
+				holding = true;
+				return AssembleResult::Pending;
+			}
+			stats.frames_dropped.fetch_add(1, std::memory_order_relaxed);
+			Discard(*oldest, pool);
+			continue;
+		}
+
+		*frame = AssembledFrame {
+			.index = oldest->frame_index,
+			.header = oldest->header,
+			.header_timestamp_ns = oldest->header_timestamp_ns,
+			.arrival_timestamp_ns = oldest->arrival_timestamp_ns
+		};
+		oldest->active = false;
+		next_sequence = oldest->sequence + 1;
+		delivered_any = true;
+		return frame->header.size != 0 ? AssembleResult::Frame : AssembleResult::Duplicate;
+	}
+}
+
+void PacketAssembler::WritePayload(PartialFrame &partial, FramePool &pool, uint32_t packet_index, const uint8_t *payload,
+								   uint64_t now_ns) {
+	// The first HEADER_SIZE bytes of the frame are the DataHeader, the rest goes to the frame buffer
+	uint32_t begin = packet_index * MAX_PACKET_PAYLOAD;
+	uint32_t end = begin + PacketPayloadSize(partial.frame_size, packet_index);
+	if(begin < HEADER_SIZE) {
+		uint32_t header_end = end < HEADER_SIZE ? end : HEADER_SIZE;
+		memcpy(reinterpret_cast<uint8_t *>(&partial.header) + begin, payload, header_end - begin);
+		partial.header_timestamp_ns = now_ns;
+	}
+	if(end > HEADER_SIZE) {
+		uint32_t frame_begin = begin > HEADER_SIZE ? begin : HEADER_SIZE;
+		memcpy(pool.buffers[partial.frame_index].ptr + (frame_begin - HEADER_SIZE), payload + (frame_begin - begin),
+			   end - frame_begin);
+	}
+}
+
+void PacketAssembler::RecoverBlock(PartialFrame &partial, FramePool &pool, uint32_t block, uint64_t now_ns) {
+	uint32_t block_count = FecBlockCount(partial.packet_count, partial.fec_block_size);
+	uint32_t data_count = FecBlockDataCount(partial.packet_count, block_count, block);
+	uint32_t received_count = CountBits(partial.received, block, data_count, block_count);
+	if(received_count == data_count) {
+		return;
+	}
+
+	uint32_t first_parity = block * partial.fec_parity_count;
+	uint32_t parity_count = BlockParityCount(partial, block, data_count);
+	if(received_count + CountBits(partial.parity_received, first_parity, parity_count, 1) < data_count) {
+		return;
+	}
+
+	// Packets entirely within the frame buffer are used in place, the first and
+	// last packet of the frame are copied out and padded with zeros like the
+	// sender does. Missing packets are rebuilt into recovery slots
+	uint8_t *shards[MAX_FEC_DATA_SHARDS + MAX_FEC_PARITY_SHARDS] {};
+	bool present[MAX_FEC_DATA_SHARDS + MAX_FEC_PARITY_SHARDS] {};
+	uint32_t slot_count = 0;
+	for(uint32_t i = 0; i < data_count; ++i) {
+		uint32_t packet_index = block + i * block_count;
+		uint32_t begin = packet_index * MAX_PACKET_PAYLOAD;
+		uint32_t payload_size = PacketPayloadSize(partial.frame_size, packet_index);
+		present[i] = TestBit(partial.received, packet_index);
+		if(present[i] && begin >= HEADER_SIZE && payload_size == MAX_PACKET_PAYLOAD) {
+			shards[i] = pool.buffers[partial.frame_index].ptr + (begin - HEADER_SIZE);
+			continue;
+		}
+
+		uint8_t *slot = recovery_buffers + static_cast<size_t>(slot_count++) * MAX_PACKET_PAYLOAD;
+		shards[i] = slot;
+		if(!present[i]) {
+			continue;
+		}
+		uint32_t end = begin + payload_size;
+		uint32_t header_end = end < HEADER_SIZE ? end : HEADER_SIZE;
+		if(begin < HEADER_SIZE) {
+			memcpy(slot, reinterpret_cast<const uint8_t *>(&partial.header) + begin, header_end - begin);
+		}
+		if(end > HEADER_SIZE) {
+			uint32_t frame_begin = begin > HEADER_SIZE ? begin : HEADER_SIZE;
+			memcpy(slot + (frame_begin - begin), pool.buffers[partial.frame_index].ptr + (frame_begin - HEADER_SIZE),
+				   end - frame_begin);
+		}
+		memset(slot + payload_size, 0, MAX_PACKET_PAYLOAD - payload_size);
+	}
+	assert(slot_count <= MAX_FEC_PARITY_SHARDS + 2 && "Recovery slots exhausted");
+	for(uint32_t j = 0; j < parity_count; ++j) {
+		shards[data_count + j] = partial.parity + static_cast<size_t>(first_parity + j) * MAX_PACKET_PAYLOAD;
+		present[data_count + j] = TestBit(partial.parity_received, first_parity + j);
+	}
+
+	[[maybe_unused]] bool result = ReedSolomonReconstruct(shards, present, data_count, parity_count, MAX_PACKET_PAYLOAD);
+	assert(result && "Enough shards were counted");
+
+	for(uint32_t i = 0; i < data_count; ++i) {
+		if(present[i]) {
+			continue;
+		}
+		SetBit(partial.received, block + i * block_count);
+		++partial.received_count;
+		WritePayload(partial, pool, block + i * block_count, shards[i], now_ns);
+		stats.recovered_packets.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void PacketAssembler::Expire(FramePool &pool, uint64_t now_ns) {
+	for(uint32_t i = 0; i < MAX_PARTIAL_FRAMES; ++i) {
+		if(partials[i].active && now_ns - partials[i].first_timestamp_ns > FRAME_DEADLINE_NS) {
+			stats.frames_expired.fetch_add(1, std::memory_order_relaxed);
+			Discard(partials[i], pool);
+		}
+	}
+}
+
+void PacketAssembler::Shutdown(FramePool &pool) {
+	for(uint32_t i = 0; i < MAX_PARTIAL_FRAMES; ++i) {
+		if(partials[i].active) {
+			Discard(partials[i], pool);
+		}
+	}
+	PlatformFree(bitmaps, BITMAPS_SIZE);
+	PlatformFree(parity_buffers, PARITY_BUFFERS_SIZE);
+	PlatformFree(recovery_buffers, RECOVERY_BUFFERS_SIZE);
+	bitmaps = nullptr;
+	parity_buffers = nullptr;
+	recovery_buffers = nullptr;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "FramePool.h"
+#include "NackTracker.h"
+#include "Protocol.h"
+#include "ReedSolomon.h"
+#include "StreamAssembler.h"
+
+// Frames that can be partially received or wait for older frames at once, a
+// packet of a newer frame evicts the oldest one when all are in use
+constexpr uint32_t MAX_PARTIAL_FRAMES = 6;
+constexpr uint32_t MAX_FRAME_PACKETS = 1u << 16;
+// Frames still incomplete this long after their first packet are discarded
+constexpr uint64_t FRAME_DEADLINE_NS = FRAME_DEADLINE_US * 1000;
+// A complete frame waits for older incomplete ones for as long as it takes to
+// ask for a lost packet and get it back, plus this
+constexpr uint64_t FRAME_HOLD_MARGIN_NS = 2000000;
+
+struct PartialFrame {
+	bool active;
+	// Every packet is there, waiting for older frames to be delivered first
+	bool complete;
+	uint64_t complete_timestamp_ns;
+	uint32_t sequence;
+	// INVALID_FRAME_INDEX if the frame carries no data
+	uint32_t frame_index;
+	uint32_t frame_size;
+	uint32_t packet_count;
+	uint32_t received_count;
+	uint64_t first_timestamp_ns;
+	uint64_t header_timestamp_ns;
+	// Latest packet of the frame that was not a retransmission
+	uint64_t arrival_timestamp_ns;
+	DataHeader header;
+	// One bit per packet, MAX_FRAME_PACKETS bits
+	uint64_t *received;
+
+	// Both zero without FEC
+	uint32_t fec_block_size;
+	uint32_t fec_parity_count;
+	// One bit and one MAX_PACKET_PAYLOAD slot per parity packet, parity packet
+	// j of block b is at b * fec_parity_count + j
+	uint64_t *parity_received;
+	uint8_t *parity;
+};
+
+// Written by the receive thread, may be read from another
+struct PacketAssemblerStats {
+	std::atomic<uint64_t> packets;
+	std::atomic<uint64_t> duplicate_packets;
+	std::atomic<uint64_t> late_packets;
+	std::atomic<uint64_t> invalid_packets;
+	std::atomic<uint64_t> parity_packets;
+	// Frame packets restored from parity
+	std::atomic<uint64_t> recovered_packets;
+	std::atomic<uint64_t> retransmitted_packets;
+	// Retransmitted packets that were still needed
+	std::atomic<uint64_t> late_recoveries;
+	std::atomic<uint64_t> frames_completed;
+	// Complete frames that had to wait for an older one
+	std::atomic<uint64_t> frames_held;
+	// Incomplete frames that passed the deadline
+	std::atomic<uint64_t> frames_expired;
+	// Incomplete frames given up because a newer frame had waited for them
+	// long enough or their slot was needed
+	std::atomic<uint64_t> frames_dropped;
+};
+
+// Reassembles frames out of UDP packets, directly into frame pool buffers so
+// the decoder consumes them the same way as frames received over TCP. Frames
+// are delivered in order. A complete frame is held back while an older one is
+// still missing packets, for about a round trip so that retransmissions can
+// arrive, after which the older frame is discarded. Packets of frames older
+// than the last delivered one are ignored. Missing packets of a block are
+// rebuilt as soon as enough of its parity packets have arrived
+struct PacketAssembler {
+	PartialFrame partials[MAX_PARTIAL_FRAMES];
+	uint64_t *bitmaps;
+	uint8_t *parity_buffers;
+	// Missing packets and padded copies of partial packets while recovering a
+	// block, MAX_FEC_PARITY_SHARDS + 2 slots
+	uint8_t *recovery_buffers;
+	// Oldest frame sequence that may still be delivered
+	uint32_t next_sequence;
+	bool delivered_any;
+	// Set by the owner, decides how long complete frames are held
+	uint64_t round_trip_ns;
+	// A complete frame is waiting for an older one
+	bool holding;
+	// Valid packets received in their original transmission, for the loss
+	// reported to the sender
+	uint32_t original_packets;
+
+	alignas(8) uint8_t datagram[MAX_DATAGRAM_SIZE];
+
+	// Fed with every valid packet, asks for missing ones to be sent again
+	NackTracker nack_tracker;
+
+	PacketAssemblerStats stats;
+
+	void Initialize();
+
+	// Adds the packet in datagram
+	void AddPacket(uint32_t size, FramePool &pool, uint64_t now_ns);
+
+	// Returns the next frame in order as Frame or Duplicate if it is complete
+	// and Pending otherwise, to be called until it returns Pending
+	AssembleResult NextFrame(FramePool &pool, uint64_t now_ns, AssembledFrame *frame);
+
+	// Discards partial frames whose first packet arrived before the deadline
+	void Expire(FramePool &pool, uint64_t now_ns);
+
+	void Shutdown(FramePool &pool);
+
+	void Discard(PartialFrame &partial, FramePool &pool);
+	// Copies a packet's payload to the frame header and buffer
+	void WritePayload(PartialFrame &partial, FramePool &pool, uint32_t packet_index, const uint8_t *payload, uint64_t now_ns);
+	void RecoverBlock(PartialFrame &partial, FramePool &pool, uint32_t block, uint64_t now_ns);
+};
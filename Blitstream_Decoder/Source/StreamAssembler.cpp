@@ -0,0 +1,204 @@
+#include "StreamAssembler.h"
+#include <cstdio>
+#include <cstring>
+#include "Platform.h"
+
+void StreamAssembler::Initialize() {
+	staging = static_cast<uint8_t *>(PlatformAllocate(RECEIVE_BUFFER_SIZE));
+	staging_begin = 0;
+	staging_end = 0;
+	chunk_header_bytes = 0;
+	chunk_remaining = 0;
+	header_bytes = 0;
+	frame_index = INVALID_FRAME_INDEX;
+	frame_bytes = 0;
+	messages[static_cast<uint32_t>(Channel::Control)].capacity = MAX_CONTROL_MESSAGE_SIZE;
+	messages[static_cast<uint32_t>(Channel::Cursor)].capacity = MAX_CURSOR_MESSAGE_SIZE;
+	messages[static_cast<uint32_t>(Channel::Video)].capacity = 0;
+	for(ChannelMessage &channel_message : messages) {
+		channel_message.data = channel_message.capacity != 0 ?
+			static_cast<uint8_t *>(PlatformAllocate(channel_message.capacity)) : nullptr;
+		channel_message.bytes = 0;
+	}
+	message = nullptr;
+	message_size = 0;
+}
+
+AssembleResult StreamAssembler::Receive(SocketHandle socket, FramePool &pool, AssembledFrame *frame) {
+	for(;;) {
+		uint32_t available = staging_end - staging_begin;
+
+		if(available == 0) {
+			staging_begin = 0;
+			staging_end = 0;
+			uint32_t direct_size = DirectReadSize();
+			int64_t result = direct_size != 0 ?
+				NetRecv(socket, pool.buffers[frame_index].ptr + frame_bytes, direct_size) :
+				NetRecv(socket, staging, RECEIVE_BUFFER_SIZE);
+			if(result <= 0) {
+				return Close(pool);
+			}
+			if(direct_size == 0) {
+				staging_end = static_cast<uint32_t>(result);
+				continue;
+			}
+
+			frame_bytes += static_cast<uint32_t>(result);
+			chunk_remaining -= static_cast<uint32_t>(result);
+			if(chunk_remaining == 0) {
+				chunk_header_bytes = 0;
+			}
+			if(CompleteFrame(frame)) {
+				return AssembleResult::Frame;
+			}
+			continue;
+		}
+
+		if(chunk_header_bytes < sizeof(ChunkHeader)) {
+			uint32_t count = sizeof(ChunkHeader) - chunk_header_bytes;
+			count = count < available ? count : available;
+			memcpy(reinterpret_cast<uint8_t *>(&chunk) + chunk_header_bytes, staging + staging_begin, count);
+			chunk_header_bytes += count;
+			staging_begin += count;
+
+			if(chunk_header_bytes == sizeof(ChunkHeader)) {
+				if(static_cast<uint32_t>(chunk.channel) >= CHANNEL_COUNT) {
+					printf("Unrecognized channel %u, closing the connection\n", static_cast<uint32_t>(chunk.channel));
+					return Close(pool);
+				}
+				chunk_remaining = chunk.size;
+			}
+			continue;
+		}
+
+		uint32_t count = chunk_remaining < available ? chunk_remaining : available;
+		AssembleResult result = AssembleResult::Pending;
+		uint32_t used = chunk.channel == Channel::Video ?
+			ReceiveVideo(staging + staging_begin, count, pool, frame, &result) :
+			ReceiveMessage(staging + staging_begin, count, &result);
+		staging_begin += used;
+		chunk_remaining -= used;
+		if(chunk_remaining == 0) {
+			chunk_header_bytes = 0;
+		}
+		if(result == AssembleResult::Closed) {
+			return Close(pool);
+		}
+		if(result != AssembleResult::Pending) {
+			return result;
+		}
+	}
+}
+
+uint32_t StreamAssembler::ReceiveVideo(const uint8_t *data, uint32_t size, FramePool &pool, AssembledFrame *frame,
+									   AssembleResult *result) {
+	if(frame_index == INVALID_FRAME_INDEX) {
+		// Parse the header, which may be split across two chunks
+		uint32_t count = sizeof(DataHeader) - header_bytes;
+		count = count < size ? count : size;
+		memcpy(reinterpret_cast<uint8_t *>(&header) + header_bytes, data, count);
+		header_bytes += count;
+
+		if(header_bytes < sizeof(DataHeader)) return count;
+		if(header.MAGIC != PROTOCOL_MAGIC) {
+			printf("Unrecognized frame header, closing the connection\n");
+			*result = AssembleResult::Closed;
+			return count;
+		}
+		header_bytes = 0;
+		header_timestamp_ns = PlatformTimestampNs();
+
+		if(header.size == 0) {
+			*frame = AssembledFrame {
+				.index = INVALID_FRAME_INDEX,
+				.header = header,
+				.header_timestamp_ns = header_timestamp_ns,
+				.arrival_timestamp_ns = header_timestamp_ns
+			};
+			*result = AssembleResult::Duplicate;
+			return count;
+		}
+
+		frame_index = pool.Acquire(header.size);
+		if(frame_index == INVALID_FRAME_INDEX) {
+			printf("No buffer for a frame of %u bytes, closing the connection\n", header.size);
+			*result = AssembleResult::Closed;
+			return count;
+		}
+		frame_bytes = 0;
+		return count;
+	}
+
+	uint32_t count = header.size - frame_bytes;
+	count = count < size ? count : size;
+	memcpy(pool.buffers[frame_index].ptr + frame_bytes, data, count);
+	frame_bytes += count;
+
+	if(CompleteFrame(frame)) {
+		*result = AssembleResult::Frame;
+	}
+	return count;
+}
+
+uint32_t StreamAssembler::DirectReadSize() {
+	if(chunk_header_bytes < sizeof(ChunkHeader) || chunk.channel != Channel::Video ||
+	   frame_index == INVALID_FRAME_INDEX) {
+		return 0;
+	}
+	uint32_t size = header.size - frame_bytes;
+	size = size < chunk_remaining ? size : chunk_remaining;
+	return size >= MIN_DIRECT_READ_SIZE ? size : 0;
+}
+
+bool StreamAssembler::CompleteFrame(AssembledFrame *frame) {
+	if(frame_bytes != header.size) {
+		return false;
+	}
+	*frame = AssembledFrame {
+		.index = frame_index,
+		.header = header,
+		.header_timestamp_ns = header_timestamp_ns,
+		.arrival_timestamp_ns = PlatformTimestampNs()
+	};
+	frame_index = INVALID_FRAME_INDEX;
+	return true;
+}
+
+uint32_t StreamAssembler::ReceiveMessage(const uint8_t *data, uint32_t size, AssembleResult *result) {
+	ChannelMessage &channel_message = messages[static_cast<uint32_t>(chunk.channel)];
+	if(size > channel_message.capacity - channel_message.bytes) {
+		printf("Message too large for channel %u, closing the connection\n", static_cast<uint32_t>(chunk.channel));
+		*result = AssembleResult::Closed;
+		return 0;
+	}
+	memcpy(channel_message.data + channel_message.bytes, data, size);
+	channel_message.bytes += size;
+
+	if(size == chunk_remaining && (chunk.flags & CHUNK_FLAG_END)) {
+		message_channel = chunk.channel;
+		message = channel_message.data;
+		message_size = channel_message.bytes;
+		channel_message.bytes = 0;
+		*result = AssembleResult::Message;
+	}
+	return size;
+}
+
+AssembleResult StreamAssembler::Close(FramePool &pool) {
+	if(frame_index != INVALID_FRAME_INDEX) {
+		pool.Release(frame_index);
+		frame_index = INVALID_FRAME_INDEX;
+	}
+	return AssembleResult::Closed;
+}
+
+void StreamAssembler::Shutdown() {
+	PlatformFree(staging, RECEIVE_BUFFER_SIZE);
+	staging = nullptr;
+	for(ChannelMessage &channel_message : messages) {
+		if(channel_message.data) {
+			PlatformFree(channel_message.data, channel_message.capacity);
+			channel_message.data = nullptr;
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include "FramePool.h"
+#include "Protocol.h"
+#include "Socket.h"
+
+// Size of each staging read, small chunks arriving back to back are parsed
+// out of the same read instead of costing a recv each
+constexpr uint32_t RECEIVE_BUFFER_SIZE = 64u * 1024u;
+// When a read ends inside a video chunk with at least this much of it left,
+// the rest is read straight into the frame buffer instead of through staging
+constexpr uint32_t MIN_DIRECT_READ_SIZE = MAX_CHUNK_PAYLOAD / 2;
+
+enum class AssembleResult : uint32_t {
+	Frame,
+	Duplicate,
+	// Nothing complete yet, only returned by the packet assembler
+	Pending,
+	// A control or cursor message, held in the stream assembler until its next call
+	Message,
+	Closed
+};
+
+struct AssembledFrame {
+	// INVALID_FRAME_INDEX for duplicates
+	uint32_t index;
+	DataHeader header;
+	// When the header was parsed, the payload arrives between this and Receive returning
+	uint64_t header_timestamp_ns;
+	// When the last of the frame arrived. Over UDP retransmitted packets do
+	// not count, they measure the loss rather than the link
+	uint64_t arrival_timestamp_ns;
+};
+
+// Demultiplexes the channels out of the sender's chunked TCP stream and
+// reassembles the messages on them. Bytes are read in RECEIVE_BUFFER_SIZE
+// pieces into a staging buffer and chunks are parsed out of it, video chunks
+// are copied into their frame buffer and other messages into the buffer of
+// their channel. The bulk of a video chunk a read ended in skips the staging
+// copy
+struct ChannelMessage {
+	// capacity bytes, allocated for every channel but video
+	uint8_t *data;
+	uint32_t capacity;
+	// Received so far of the message being assembled
+	uint32_t bytes;
+};
+
+struct StreamAssembler {
+	uint8_t *staging;
+	uint32_t staging_begin;
+	uint32_t staging_end;
+
+	// Chunk being read, its header may be split across two reads
+	ChunkHeader chunk;
+	uint32_t chunk_header_bytes;
+	uint32_t chunk_remaining;
+
+	// Video channel
+	DataHeader header;
+	uint32_t header_bytes;
+	uint32_t frame_index;
+	uint32_t frame_bytes;
+	uint64_t header_timestamp_ns;
+
+	// Control and cursor channels, chunks of one may arrive in between
+	// chunks of the other
+	ChannelMessage messages[CHANNEL_COUNT];
+	// Last complete message, valid until the next call
+	Channel message_channel;
+	const uint8_t *message;
+	uint32_t message_size;
+
+	void Initialize();
+
+	// Blocks until a complete frame, a duplicate header or a control or
+	// cursor message has been received, the frame buffer stays owned by the caller until it
+	// is released to the pool. Closed when the connection ended or sent
+	// something malformed, it must not be read from again
+	AssembleResult Receive(SocketHandle socket, FramePool &pool, AssembledFrame *frame);
+
+	void Shutdown();
+
+	// Each takes up to size bytes of the current chunk's payload and returns
+	// how many it used, result is set once a message is complete or to Closed
+	// if the payload is malformed
+	uint32_t ReceiveVideo(const uint8_t *data, uint32_t size, FramePool &pool, AssembledFrame *frame,
+						  AssembleResult *result);
+	uint32_t ReceiveMessage(const uint8_t *data, uint32_t size, AssembleResult *result);
+	// Bytes of the current video chunk that can be read into the frame buffer, 0 if none
+	uint32_t DirectReadSize();
+	// Hands the frame out once all of it has arrived
+	bool CompleteFrame(AssembledFrame *frame);
+	// Gives back the frame being received
+	AssembleResult Close(FramePool &pool);
+};
@@ -0,0 +1,111 @@
+#include "TileDecoder.h"
+#include <cstddef>
+#include <cstring>
+#include "Platform.h"
+
+void TileDecoder::Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t thread_total) {
+	width = frame_width;
+	height = frame_height;
+	columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+	rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+	first_row = 0;
+	end_row = 0;
+
+	TileInitialize();
+	pool.Initialize(thread_total);
+
+	frame = static_cast<uint32_t *>(PlatformAllocate(static_cast<size_t>(width) * height * sizeof(uint32_t)));
+	tiles = static_cast<ParsedTile *>(PlatformAllocate(TileCount() * sizeof(ParsedTile)));
+	row_starts = static_cast<uint32_t *>(PlatformAllocate((rows + 1) * sizeof(uint32_t)));
+	row_failed = static_cast<bool *>(PlatformAllocate(rows * sizeof(bool)));
+	row_scratch = static_cast<TileScratch *>(PlatformAllocate(rows * sizeof(TileScratch)));
+}
+
+uint32_t TileDecoder::TileCount() const {
+	return columns * rows;
+}
+
+bool TileDecoder::Decode(const void *data, uint32_t size) {
+	first_row = 0;
+	end_row = 0;
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	if(size < sizeof(TileFrame)) {
+		return false;
+	}
+	TileFrame header;
+	memcpy(&header, bytes, sizeof(header));
+	if(header.tile_count > TileCount()) {
+		return false;
+	}
+
+	// Only the layout is checked here, payloads are checked as they are decoded
+	uint32_t position = sizeof(TileFrame);
+	uint32_t row = 0;
+	row_starts[0] = 0;
+	for(uint32_t i = 0; i < header.tile_count; ++i) {
+		ParsedTile &tile = tiles[i];
+		if(size - position < sizeof(TileRecord)) {
+			return false;
+		}
+		memcpy(&tile.record, bytes + position, sizeof(TileRecord));
+		position += sizeof(TileRecord);
+		if(tile.record.index >= TileCount() || (i != 0 && tile.record.index <= tiles[i - 1].record.index) ||
+		   tile.record.size > size - position) {
+			return false;
+		}
+		tile.payload = bytes + position;
+		position += tile.record.size;
+
+		for(; row < tile.record.index / columns; ++row) {
+			row_starts[row + 1] = i;
+		}
+	}
+	if(position != size) {
+		return false;
+	}
+	for(; row < rows; ++row) {
+		row_starts[row + 1] = header.tile_count;
+	}
+	if(header.tile_count == 0) {
+		return true;
+	}
+
+	first_row = tiles[0].record.index / columns;
+	end_row = tiles[header.tile_count - 1].record.index / columns + 1;
+	pool.Run(end_row - first_row, [](void *user_data, uint32_t job) {
+		TileDecoder *decoder = static_cast<TileDecoder *>(user_data);
+		decoder->DecodeRow(decoder->first_row + job);
+	}, this);
+
+	for(uint32_t i = first_row; i < end_row; ++i) {
+		if(row_failed[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void TileDecoder::DecodeRow(uint32_t row) {
+	row_failed[row] = false;
+	uint32_t y = row * TILE_SIZE;
+	uint32_t tile_height = height - y < TILE_SIZE ? height - y : TILE_SIZE;
+	for(uint32_t i = row_starts[row]; i < row_starts[row + 1]; ++i) {
+		const ParsedTile &tile = tiles[i];
+		uint32_t x = (tile.record.index % columns) * TILE_SIZE;
+		uint32_t tile_width = width - x < TILE_SIZE ? width - x : TILE_SIZE;
+		uint32_t *pixels = frame + static_cast<size_t>(y) * width + x;
+		if(!TileDecompress(tile.record, tile.payload, pixels, width, tile_width, tile_height, &row_scratch[row])) {
+			row_failed[row] = true;
+			return;
+		}
+	}
+}
+
+void TileDecoder::Shutdown() {
+	pool.Shutdown();
+	PlatformFree(frame, static_cast<size_t>(width) * height * sizeof(uint32_t));
+	PlatformFree(tiles, TileCount() * sizeof(ParsedTile));
+	PlatformFree(row_starts, (rows + 1) * sizeof(uint32_t));
+	PlatformFree(row_failed, rows * sizeof(bool));
+	PlatformFree(row_scratch, rows * sizeof(TileScratch));
+}
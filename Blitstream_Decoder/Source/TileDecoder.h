@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include "Protocol.h"
+#include "TileCodec.h"
+#include "WorkerPool.h"
+
+// A record found by parsing, the record is copied out as it may be unaligned
+struct ParsedTile {
+	TileRecord record;
+	const uint8_t *payload;
+};
+
+// Decodes Codec::Tiles frames into a retained BGRA frame on the CPU, the
+// changed tiles of each row of tiles make one job on a WorkerPool
+struct TileDecoder {
+	uint32_t width;
+	uint32_t height;
+	uint32_t columns;
+	uint32_t rows;
+
+	// width by height pixels without padding, stale until the first keyframe
+	uint32_t *frame;
+	// Rows of tiles the last decode changed, from first_row up to but
+	// excluding end_row. Empty if it changed none
+	uint32_t first_row;
+	uint32_t end_row;
+
+	WorkerPool pool;
+	// Records of the frame being decoded in order, row r has those from
+	// row_starts[r] up to row_starts[r + 1]
+	ParsedTile *tiles;
+	uint32_t *row_starts;
+	// Per row of tiles, set by its job if a payload was malformed
+	bool *row_failed;
+	TileScratch *row_scratch;
+
+	// thread_total counts the decoding thread too, 0 uses every hardware thread
+	void Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t thread_total);
+	uint32_t TileCount() const;
+
+	// Applies a TileFrame to frame, returns false if it is malformed. Tiles
+	// decoded before the problem was found stay changed
+	bool Decode(const void *data, uint32_t size);
+	void DecodeRow(uint32_t row);
+
+	void Shutdown();
+};
@@ -0,0 +1,358 @@
+#include "BandwidthEstimator.h"
+#include <cmath>
+
+// Trendline filter
+constexpr double DELAY_SMOOTHING = 0.9;
+constexpr double TREND_GAIN = 4.0;
+constexpr uint32_t TREND_MAX_SAMPLES = 60;
+
+// Overuse detector
+constexpr double INITIAL_THRESHOLD = 12.5;
+constexpr double MIN_THRESHOLD = 6.0;
+constexpr double MAX_THRESHOLD = 600.0;
+// The threshold follows the trend, quickly down towards small trends and
+// slowly up towards large ones so that a real overuse is not absorbed
+constexpr double THRESHOLD_DOWN_RATE = 0.039;
+constexpr double THRESHOLD_UP_RATE = 0.0087;
+// Spikes further than this above the threshold are left out of its adaptation
+constexpr double THRESHOLD_MAX_STEP = 15.0;
+constexpr double OVERUSE_TIME_MS = 10.0;
+
+// Rate control
+constexpr double DECREASE_FACTOR = 0.85;
+constexpr double MIN_DECREASE_FACTOR = 0.5;
+constexpr double QUEUE_DRAIN_MS = 1000.0;
+constexpr double MULTIPLICATIVE_INCREASE = 1.08;
+// Near the link capacity, per response time
+constexpr double ADDITIVE_INCREASE = 0.01;
+constexpr double MIN_ADDITIVE_INCREASE_BPS = 4000.0;
+// Never more than this ahead of what actually arrives, so an encoder that is
+// idle on a static desktop does not push the target up without limit
+constexpr double MAX_INCOMING_RATIO = 1.5;
+constexpr uint64_t MAX_UPDATE_INTERVAL_US = 1000000;
+constexpr uint64_t DEFAULT_ROUND_TRIP_US = 100000;
+constexpr double LINK_SMOOTHING = 0.05;
+// Queuing delay at which increases stop until the queue has drained
+constexpr double MAX_QUEUING_DELAY_MS = 20.0;
+
+// Loss based control
+constexpr double HIGH_LOSS = 0.10;
+constexpr double LOW_LOSS = 0.02;
+constexpr uint64_t LOSS_DECREASE_INTERVAL_US = 300000;
+
+void BandwidthEstimator::Initialize(uint32_t minimum, uint32_t start, uint32_t maximum) {
+	min_bitrate = minimum;
+	max_bitrate = maximum > minimum ? maximum : minimum;
+	start = start < min_bitrate ? min_bitrate : start;
+	start = start > max_bitrate ? max_bitrate : start;
+	target_bitrate = start;
+
+	has_previous = false;
+	accumulated_delay_ms = 0.0;
+	smoothed_delay_ms = 0.0;
+	trend_count = 0;
+	trend = 0.0;
+	previous_trend = 0.0;
+	base_delay_ms[0] = 0.0;
+	base_delay_ms[1] = 0.0;
+	base_window_start_us = 0;
+	queuing_delay_ms = 0.0;
+
+	threshold = INITIAL_THRESHOLD;
+	last_threshold_us = 0;
+	overuse_time_ms = -1.0;
+	overuse_count = 0;
+	usage = BandwidthUsage::Normal;
+
+	arrival_count = 0;
+
+	state = RateControlState::Increase;
+	delay_bitrate = start;
+	last_update_us = 0;
+	last_decrease_us = 0;
+	link_capacity = 0.0;
+	link_deviation = 0.0;
+	round_trip_us = DEFAULT_ROUND_TRIP_US;
+
+	// Loss only ever lowers the target below the delay based one
+	loss_bitrate = max_bitrate;
+	loss_expected = 0;
+	loss_lost = 0;
+	last_loss_update_us = 0;
+	last_loss_decrease_us = 0;
+
+	stats.frames.store(0, std::memory_order_relaxed);
+	stats.overuses.store(0, std::memory_order_relaxed);
+	stats.delay_decreases.store(0, std::memory_order_relaxed);
+	stats.loss_decreases.store(0, std::memory_order_relaxed);
+	stats.incoming_bitrate.store(0, std::memory_order_relaxed);
+}
+
+void BandwidthEstimator::AddFrame(uint64_t send_us, uint64_t arrival_us, uint32_t size) {
+	stats.frames.fetch_add(1, std::memory_order_relaxed);
+	arrivals[arrival_count++ % RATE_WINDOW_FRAMES] = ArrivalSample {
+		.arrival_us = arrival_us,
+		.size = size
+	};
+
+	if(!has_previous) {
+		has_previous = true;
+		first_arrival_us = arrival_us;
+		previous_send_us = send_us;
+		previous_arrival_us = arrival_us;
+		return;
+	}
+
+	// Frames sent out of order mean a sender restart or reordering, neither
+	// says anything about the queue
+	int64_t send_delta = static_cast<int64_t>(send_us - previous_send_us);
+	int64_t arrival_delta = static_cast<int64_t>(arrival_us - previous_arrival_us);
+	if(send_delta < 0 || arrival_delta < 0) {
+		previous_send_us = send_us;
+		previous_arrival_us = arrival_us;
+		return;
+	}
+	previous_send_us = send_us;
+	previous_arrival_us = arrival_us;
+
+	UpdateTrend(send_delta / 1000.0, arrival_delta / 1000.0, arrival_us);
+	Detect(send_delta / 1000.0, arrival_us);
+}
+
+void BandwidthEstimator::UpdateTrend(double send_delta_ms, double arrival_delta_ms, uint64_t arrival_us) {
+	accumulated_delay_ms += arrival_delta_ms - send_delta_ms;
+	smoothed_delay_ms = DELAY_SMOOTHING * smoothed_delay_ms + (1.0 - DELAY_SMOOTHING) * accumulated_delay_ms;
+
+	if(arrival_us - base_window_start_us >= BASE_DELAY_WINDOW_US) {
+		base_delay_ms[0] = base_delay_ms[1];
+		base_delay_ms[1] = smoothed_delay_ms;
+		base_window_start_us = arrival_us;
+	}
+	base_delay_ms[1] = smoothed_delay_ms < base_delay_ms[1] ? smoothed_delay_ms : base_delay_ms[1];
+	double base_delay = base_delay_ms[0] < base_delay_ms[1] ? base_delay_ms[0] : base_delay_ms[1];
+	queuing_delay_ms = smoothed_delay_ms - base_delay;
+
+	uint32_t slot = trend_count++ % TRENDLINE_WINDOW;
+	trend_arrival_ms[slot] = (arrival_us - first_arrival_us) / 1000.0;
+	trend_delay_ms[slot] = smoothed_delay_ms;
+	uint32_t count = trend_count < TRENDLINE_WINDOW ? trend_count : TRENDLINE_WINDOW;
+	if(count < 2) {
+		return;
+	}
+
+	// Least squares slope of the smoothed delay over arrival time
+	double mean_x = 0.0;
+	double mean_y = 0.0;
+	for(uint32_t i = 0; i < count; ++i) {
+		mean_x += trend_arrival_ms[i];
+		mean_y += trend_delay_ms[i];
+	}
+	mean_x /= count;
+	mean_y /= count;
+	double numerator = 0.0;
+	double denominator = 0.0;
+	for(uint32_t i = 0; i < count; ++i) {
+		double dx = trend_arrival_ms[i] - mean_x;
+		numerator += dx * (trend_delay_ms[i] - mean_y);
+		denominator += dx * dx;
+	}
+	if(denominator != 0.0) {
+		trend = numerator / denominator;
+	}
+}
+
+void BandwidthEstimator::Detect(double send_delta_ms, uint64_t arrival_us) {
+	if(trend_count < 2) {
+		return;
+	}
+
+	uint32_t samples = trend_count < TREND_MAX_SAMPLES ? trend_count : TREND_MAX_SAMPLES;
+	double modified_trend = samples * trend * TREND_GAIN;
+	if(modified_trend > threshold) {
+		overuse_time_ms = overuse_time_ms < 0.0 ? send_delta_ms / 2.0 : overuse_time_ms + send_delta_ms;
+		++overuse_count;
+		// Only while the delay is still growing, a queue that has stopped
+		// filling up is already being taken care of
+		if(overuse_time_ms > OVERUSE_TIME_MS && overuse_count > 1 && trend >= previous_trend) {
+			overuse_time_ms = 0.0;
+			overuse_count = 0;
+			if(usage != BandwidthUsage::Overusing) {
+				stats.overuses.fetch_add(1, std::memory_order_relaxed);
+			}
+			usage = BandwidthUsage::Overusing;
+		}
+	}
+	else if(modified_trend < -threshold) {
+		overuse_time_ms = -1.0;
+		overuse_count = 0;
+		usage = BandwidthUsage::Underusing;
+	}
+	else {
+		overuse_time_ms = -1.0;
+		overuse_count = 0;
+		usage = BandwidthUsage::Normal;
+	}
+	previous_trend = trend;
+
+	double magnitude = fabs(modified_trend);
+	if(last_threshold_us == 0 || magnitude > threshold + THRESHOLD_MAX_STEP) {
+		last_threshold_us = arrival_us;
+		return;
+	}
+	double rate = magnitude < threshold ? THRESHOLD_DOWN_RATE : THRESHOLD_UP_RATE;
+	double elapsed_ms = (arrival_us - last_threshold_us) / 1000.0;
+	elapsed_ms = elapsed_ms > 100.0 ? 100.0 : elapsed_ms;
+	threshold += rate * (magnitude - threshold) * elapsed_ms;
+	threshold = threshold < MIN_THRESHOLD ? MIN_THRESHOLD : threshold;
+	threshold = threshold > MAX_THRESHOLD ? MAX_THRESHOLD : threshold;
+	last_threshold_us = arrival_us;
+}
+
+void BandwidthEstimator::AddLoss(uint32_t expected, uint32_t lost) {
+	loss_expected += expected;
+	loss_lost += lost < expected ? lost : expected;
+}
+
+void BandwidthEstimator::SetRoundTrip(uint64_t round_trip) {
+	if(round_trip != 0) {
+		round_trip_us = round_trip;
+	}
+}
+
+double BandwidthEstimator::IncomingBitrate(uint64_t now_us) const {
+	uint32_t count = arrival_count < RATE_WINDOW_FRAMES ? arrival_count : RATE_WINDOW_FRAMES;
+	uint64_t bytes = 0;
+	uint64_t oldest_us = now_us;
+	for(uint32_t i = 0; i < count; ++i) {
+		const ArrivalSample &sample = arrivals[i];
+		if(now_us - sample.arrival_us < RATE_WINDOW_US) {
+			bytes += sample.size;
+			oldest_us = sample.arrival_us < oldest_us ? sample.arrival_us : oldest_us;
+		}
+	}
+
+	// Until a full window has passed the rate is over the time since the
+	// first arrival, which needs a few frames to mean anything
+	uint64_t window_us = now_us - first_arrival_us < RATE_WINDOW_US ? now_us - first_arrival_us : RATE_WINDOW_US;
+	if(!has_previous || window_us < RATE_WINDOW_US / 4 || oldest_us == now_us) {
+		return 0.0;
+	}
+	return bytes * 8.0 * 1000000.0 / window_us;
+}
+
+void BandwidthEstimator::UpdateDelayBitrate(uint64_t now_us, double incoming_bitrate) {
+	switch(usage) {
+	case BandwidthUsage::Normal:
+		state = state == RateControlState::Hold ? RateControlState::Increase : state;
+		break;
+	case BandwidthUsage::Underusing:
+		state = RateControlState::Hold;
+		break;
+	case BandwidthUsage::Overusing:
+		state = RateControlState::Decrease;
+		break;
+	}
+
+	uint64_t elapsed_us = last_update_us != 0 ? now_us - last_update_us : 0;
+	elapsed_us = elapsed_us > MAX_UPDATE_INTERVAL_US ? MAX_UPDATE_INTERVAL_US : elapsed_us;
+
+	switch(state) {
+	case RateControlState::Hold:
+		break;
+	case RateControlState::Increase: {
+		// More arriving than the last capacity suggests, the link has changed
+		if(link_capacity > 0.0 && incoming_bitrate > link_capacity * (1.0 + 3.0 * link_deviation)) {
+			link_capacity = 0.0;
+		}
+		if(queuing_delay_ms > MAX_QUEUING_DELAY_MS ||
+		   (incoming_bitrate > 0.0 && delay_bitrate > MAX_INCOMING_RATIO * incoming_bitrate)) {
+			break;
+		}
+		if(link_capacity > 0.0) {
+			double response_us = 100000.0 + round_trip_us;
+			double increase = link_capacity * ADDITIVE_INCREASE;
+			increase = increase < MIN_ADDITIVE_INCREASE_BPS ? MIN_ADDITIVE_INCREASE_BPS : increase;
+			delay_bitrate += increase * elapsed_us / response_us;
+		}
+		else {
+			delay_bitrate *= pow(MULTIPLICATIVE_INCREASE, elapsed_us / 1000000.0);
+		}
+		break;
+	}
+	case RateControlState::Decrease:
+		// The queue needs a round trip to show the effect of the last decrease
+		if(incoming_bitrate > 0.0 && (last_decrease_us == 0 || now_us - last_decrease_us >= round_trip_us)) {
+			// Relative to what arrives rather than the target, so repeated
+			// overuse signals while the queue drains do not compound. A queue
+			// that has already built up is drained within QUEUE_DRAIN_MS
+			double factor = 1.0 - queuing_delay_ms / QUEUE_DRAIN_MS;
+			factor = factor > DECREASE_FACTOR ? DECREASE_FACTOR : factor;
+			factor = factor < MIN_DECREASE_FACTOR ? MIN_DECREASE_FACTOR : factor;
+			double decreased = factor * incoming_bitrate;
+			delay_bitrate = decreased < delay_bitrate ? decreased : delay_bitrate;
+			last_decrease_us = now_us;
+			stats.delay_decreases.fetch_add(1, std::memory_order_relaxed);
+
+			if(link_capacity > 0.0 && fabs(incoming_bitrate - link_capacity) <= link_capacity * 3.0 * link_deviation) {
+				link_deviation = (1.0 - LINK_SMOOTHING) * link_deviation +
+								 LINK_SMOOTHING * fabs(incoming_bitrate - link_capacity) / link_capacity;
+				link_capacity = (1.0 - LINK_SMOOTHING) * link_capacity + LINK_SMOOTHING * incoming_bitrate;
+			}
+			else {
+				link_capacity = incoming_bitrate;
+				link_deviation = 0.1;
+			}
+			link_deviation = link_deviation < 0.02 ? 0.02 : link_deviation;
+		}
+		state = RateControlState::Hold;
+		break;
+	}
+
+	delay_bitrate = delay_bitrate < min_bitrate ? min_bitrate : delay_bitrate;
+	delay_bitrate = delay_bitrate > max_bitrate ? max_bitrate : delay_bitrate;
+}
+
+void BandwidthEstimator::UpdateLossBitrate(uint64_t now_us) {
+	if(loss_expected < LOSS_MIN_PACKETS) {
+		return;
+	}
+	double loss = static_cast<double>(loss_lost) / loss_expected;
+	loss_expected = 0;
+	loss_lost = 0;
+
+	uint64_t elapsed_us = last_loss_update_us != 0 ? now_us - last_loss_update_us : 0;
+	elapsed_us = elapsed_us > MAX_UPDATE_INTERVAL_US ? MAX_UPDATE_INTERVAL_US : elapsed_us;
+	last_loss_update_us = now_us;
+
+	if(loss > HIGH_LOSS) {
+		if(last_loss_decrease_us == 0 || now_us - last_loss_decrease_us >= LOSS_DECREASE_INTERVAL_US + round_trip_us) {
+			loss_bitrate = target_bitrate * (1.0 - 0.5 * loss);
+			last_loss_decrease_us = now_us;
+			stats.loss_decreases.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	else if(loss < LOW_LOSS) {
+		// Only ever a few percent ahead of the delay based target, which
+		// decides alone while the loss is low
+		double ceiling = delay_bitrate * MULTIPLICATIVE_INCREASE;
+		if(loss_bitrate < ceiling) {
+			loss_bitrate *= pow(MULTIPLICATIVE_INCREASE, elapsed_us / 1000000.0);
+			loss_bitrate = loss_bitrate > ceiling ? ceiling : loss_bitrate;
+		}
+	}
+	loss_bitrate = loss_bitrate < min_bitrate ? min_bitrate : loss_bitrate;
+	loss_bitrate = loss_bitrate > max_bitrate ? max_bitrate : loss_bitrate;
+}
+
+uint32_t BandwidthEstimator::Update(uint64_t now_us) {
+	double incoming_bitrate = IncomingBitrate(now_us);
+	stats.incoming_bitrate.store(static_cast<uint32_t>(incoming_bitrate), std::memory_order_relaxed);
+
+	UpdateDelayBitrate(now_us, incoming_bitrate);
+	UpdateLossBitrate(now_us);
+	last_update_us = now_us;
+
+	double target = delay_bitrate < loss_bitrate ? delay_bitrate : loss_bitrate;
+	target_bitrate = static_cast<uint32_t>(target);
+	return target_bitrate;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Frames the delay trend is fitted over
+constexpr uint32_t TRENDLINE_WINDOW = 20;
+// Receive rate is measured over the frames that arrived this recently
+constexpr uint32_t RATE_WINDOW_FRAMES = 128;
+constexpr uint64_t RATE_WINDOW_US = 250000;
+// The lowest smoothed delay within the last two of these is taken as the
+// delay of an empty queue, so the baseline follows route changes and clock drift
+constexpr uint64_t BASE_DELAY_WINDOW_US = 5000000;
+// Loss is only judged once this many packets have been accounted for
+constexpr uint32_t LOSS_MIN_PACKETS = 50;
+
+enum class BandwidthUsage : uint32_t {
+	Normal,
+	// Queuing delay is shrinking, the link has spare capacity
+	Underusing,
+	// Queuing delay keeps growing, more is sent than the link carries
+	Overusing
+};
+
+enum class RateControlState : uint32_t {
+	Hold,
+	Increase,
+	Decrease
+};
+
+struct ArrivalSample {
+	uint64_t arrival_us;
+	uint32_t size;
+};
+
+// Written by the thread feeding the estimator, may be read from another
+struct BandwidthEstimatorStats {
+	std::atomic<uint64_t> frames;
+	// Overuse detections and the decreases they caused
+	std::atomic<uint64_t> overuses;
+	std::atomic<uint64_t> delay_decreases;
+	std::atomic<uint64_t> loss_decreases;
+	std::atomic<uint32_t> incoming_bitrate;
+};
+
+// Send side bandwidth estimate in the spirit of Google Congestion Control.
+// The delay based part compares the spacing of frames on arrival with their
+// spacing when sent, a growing difference means a queue is building up at the
+// bottleneck. The accumulated difference is smoothed and its slope over the
+// last TRENDLINE_WINDOW frames is compared against a threshold that adapts
+// to the noise, and an AIMD controller follows: multiplicative increase while
+// the capacity is unknown, additive increase close to the last capacity seen
+// and a decrease to 85% of the receive rate on overuse. The loss based part
+// backs off when more than 10% of the packets are lost and grows again below
+// 2%. The target is the lower of the two.
+// Unlike plain GCC the target does not increase while the delay is well
+// above the lowest seen recently, so a queue left over from a sudden drop in
+// capacity is drained before probing for more.
+// Only differences of timestamps taken on the same clock are used, so the
+// sender and receiver clocks need not be synchronized. The arrival clock
+// drives all timing, which makes the estimator deterministic for a given
+// trace of frames
+struct BandwidthEstimator {
+	uint32_t min_bitrate;
+	uint32_t max_bitrate;
+	// Bits per second the encoder should produce
+	uint32_t target_bitrate;
+
+	// Delay trend
+	bool has_previous;
+	uint64_t previous_send_us;
+	uint64_t previous_arrival_us;
+	uint64_t first_arrival_us;
+	double accumulated_delay_ms;
+	double smoothed_delay_ms;
+	// Arrival time and smoothed delay of the last TRENDLINE_WINDOW frames
+	double trend_arrival_ms[TRENDLINE_WINDOW];
+	double trend_delay_ms[TRENDLINE_WINDOW];
+	uint32_t trend_count;
+	double trend;
+	double previous_trend;
+	// Minimum smoothed delay of the current and the previous window
+	double base_delay_ms[2];
+	uint64_t base_window_start_us;
+	// Smoothed delay above the baseline
+	double queuing_delay_ms;
+
+	// Overuse detector, the threshold is in units of the modified trend
+	double threshold;
+	uint64_t last_threshold_us;
+	double overuse_time_ms;
+	uint32_t overuse_count;
+	BandwidthUsage usage;
+
+	// Ring of recent arrivals for the receive rate
+	ArrivalSample arrivals[RATE_WINDOW_FRAMES];
+	uint32_t arrival_count;
+
+	// AIMD on the delay signal
+	RateControlState state;
+	double delay_bitrate;
+	uint64_t last_update_us;
+	uint64_t last_decrease_us;
+	// Receive rate at recent decreases and its relative deviation, 0 if unknown
+	double link_capacity;
+	double link_deviation;
+	uint64_t round_trip_us;
+
+	// Loss
+	double loss_bitrate;
+	uint32_t loss_expected;
+	uint32_t loss_lost;
+	uint64_t last_loss_update_us;
+	uint64_t last_loss_decrease_us;
+
+	BandwidthEstimatorStats stats;
+
+	// The target starts out at start_bitrate
+	void Initialize(uint32_t minimum, uint32_t start, uint32_t maximum);
+
+	// Frames have to be added in arrival order. Timestamps are microseconds,
+	// send_us on the sender's clock and arrival_us on the receiver's
+	void AddFrame(uint64_t send_us, uint64_t arrival_us, uint32_t size);
+	// Packets sent and lost since the previous report
+	void AddLoss(uint32_t expected, uint32_t lost);
+	void SetRoundTrip(uint64_t round_trip);
+
+	// Runs the controllers up to now_us on the arrival clock, returns the new target
+	uint32_t Update(uint64_t now_us);
+
+	// Bits per second received over the last RATE_WINDOW_US, 0 until enough
+	// frames have arrived
+	double IncomingBitrate(uint64_t now_us) const;
+
+	void UpdateTrend(double send_delta_ms, double arrival_delta_ms, uint64_t arrival_us);
+	void Detect(double send_delta_ms, uint64_t arrival_us);
+	void UpdateDelayBitrate(uint64_t now_us, double incoming_bitrate);
+	void UpdateLossBitrate(uint64_t now_us);
+};
@@ -0,0 +1,127 @@
+#include "ChannelWriter.h"
+#include <cassert>
+
+void ChannelWriter::Initialize(SocketHandle connection_socket) {
+	socket = connection_socket;
+	NetSetUnsentLimit(socket, CHANNEL_UNSENT_LIMIT);
+	for(uint32_t i = 0; i < CHANNEL_COUNT; ++i) {
+		waiting[i].store(0, std::memory_order_relaxed);
+		stats.messages[i].store(0, std::memory_order_relaxed);
+		stats.chunks[i].store(0, std::memory_order_relaxed);
+	}
+	stats.preemptions.store(0, std::memory_order_relaxed);
+}
+
+bool ChannelWriter::MoreUrgentWaiting(uint32_t channel) {
+	for(uint32_t i = 0; i < channel; ++i) {
+		if(waiting[i].load(std::memory_order_acquire) != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ChannelWriter::Send(Channel channel, const NetBuffer *buffers, uint32_t buffer_count) {
+	uint32_t channel_index = static_cast<uint32_t>(channel);
+	assert(channel_index < CHANNEL_COUNT && "Unknown channel");
+
+	uint64_t remaining = 0;
+	for(uint32_t i = 0; i < buffer_count; ++i) {
+		remaining += buffers[i].size;
+	}
+	assert(remaining != 0 && "Empty message");
+
+	// Position within the message
+	uint32_t buffer_index = 0;
+	uint32_t buffer_offset = 0;
+
+	ChunkHeader headers[CHUNKS_PER_WRITE];
+	NetBuffer write_buffers[MAX_SEND_BUFFERS];
+	while(remaining > 0) {
+		// Less urgent channels wait for the socket to drain without the lock,
+		// so a control message never waits for a write that is blocked
+		if(channel_index != 0 && !NetWaitWritable(socket, -1)) {
+			return false;
+		}
+		waiting[channel_index].fetch_add(1, std::memory_order_acq_rel);
+		if(MoreUrgentWaiting(channel_index)) {
+			stats.preemptions.fetch_add(1, std::memory_order_relaxed);
+			std::unique_lock<std::mutex> waiting_lock(waiting_mutex);
+			waiting_cleared.wait(waiting_lock, [this, channel_index] { return !MoreUrgentWaiting(channel_index); });
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if(waiting[channel_index].fetch_sub(1, std::memory_order_acq_rel) == 1 && channel_index + 1 < CHANNEL_COUNT) {
+			// A thread that checked before the count dropped is already
+			// waiting once the lock has been held
+			{
+				std::lock_guard<std::mutex> waiting_lock(waiting_mutex);
+			}
+			waiting_cleared.notify_all();
+		}
+
+		// Gather chunks until the write is full, a chunk takes its header and
+		// a slice of every buffer it spans
+		uint32_t chunk_count = 0;
+		uint32_t write_buffer_count = 0;
+		while(remaining > 0 && chunk_count < CHUNKS_PER_WRITE && write_buffer_count + 1 < MAX_SEND_BUFFERS) {
+			// Empty buffers would take a slice of their own
+			while(buffer_offset == buffers[buffer_index].size) {
+				++buffer_index;
+				buffer_offset = 0;
+			}
+
+			uint32_t chunk_size = remaining < MAX_CHUNK_PAYLOAD ? static_cast<uint32_t>(remaining) : MAX_CHUNK_PAYLOAD;
+			// One slice of every buffer the chunk spans, as far as the write has room
+			uint32_t slice_limit = MAX_SEND_BUFFERS - 1 - write_buffer_count;
+			uint32_t slices_needed = 1;
+			uint32_t span = buffers[buffer_index].size - buffer_offset;
+			for(uint32_t i = buffer_index + 1; span < chunk_size && i < buffer_count && slices_needed < slice_limit; ++i) {
+				span += buffers[i].size;
+				++slices_needed;
+			}
+			if(span < chunk_size) {
+				// The rest goes with the next write, unless the chunk would
+				// never fit and has to be cut shorter
+				if(chunk_count != 0) {
+					break;
+				}
+				chunk_size = span;
+			}
+
+			ChunkHeader &header = headers[chunk_count++];
+			header = ChunkHeader {
+				.channel = channel,
+				.flags = chunk_size == remaining ? CHUNK_FLAG_END : static_cast<uint8_t>(0),
+				.size = static_cast<uint16_t>(chunk_size)
+			};
+			write_buffers[write_buffer_count++] = NetBuffer { .ptr = &header, .size = sizeof(ChunkHeader) };
+
+			uint32_t chunk_left = chunk_size;
+			while(chunk_left > 0) {
+				const NetBuffer &buffer = buffers[buffer_index];
+				uint32_t count = buffer.size - buffer_offset;
+				count = count < chunk_left ? count : chunk_left;
+				if(count != 0) {
+					write_buffers[write_buffer_count++] = NetBuffer {
+						.ptr = static_cast<const uint8_t *>(buffer.ptr) + buffer_offset,
+						.size = count
+					};
+				}
+				buffer_offset += count;
+				chunk_left -= count;
+				if(buffer_offset == buffer.size) {
+					++buffer_index;
+					buffer_offset = 0;
+				}
+			}
+			remaining -= chunk_size;
+		}
+
+		if(!NetSendAllv(socket, write_buffers, write_buffer_count)) {
+			return false;
+		}
+		stats.chunks[channel_index].fetch_add(chunk_count, std::memory_order_relaxed);
+	}
+	stats.messages[channel_index].fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
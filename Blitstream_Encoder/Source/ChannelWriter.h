@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include "Protocol.h"
+#include "Socket.h"
+
+// Chunks gathered into one write while no more urgent channel is waiting
+constexpr uint32_t CHUNKS_PER_WRITE = 2;
+// Unsent bytes the socket may hold, anything beyond waits in the writer where
+// a control message can still overtake it
+constexpr uint32_t CHANNEL_UNSENT_LIMIT = 8u * 1024u;
+
+// Written by the threads sending on the channels, read by the stats printer
+struct ChannelWriterStats {
+	std::atomic<uint64_t> messages[CHANNEL_COUNT];
+	std::atomic<uint64_t> chunks[CHANNEL_COUNT];
+	// Writes held back so a more urgent channel could go first
+	std::atomic<uint64_t> preemptions;
+};
+
+// Multiplexes the channels onto the sender's side of a TCP connection. Any
+// number of threads may send at once, each message is split into chunks of at
+// most MAX_CHUNK_PAYLOAD bytes and between two writes a thread steps aside
+// for every thread waiting to send on a more urgent channel. The socket's
+// unsent bytes are capped where the platform allows it, otherwise a control
+// message could still end up queued behind the kernel's send buffer
+struct ChannelWriter {
+	SocketHandle socket;
+	// Serializes the writes, a message's chunks may be interleaved with other
+	// channels' but never torn
+	std::mutex mutex;
+	// Threads about to take the mutex, per channel
+	std::atomic<uint32_t> waiting[CHANNEL_COUNT];
+	// Notified with waiting_mutex once no thread is left waiting on a channel,
+	// less urgent threads stepping aside sleep on it
+	std::mutex waiting_mutex;
+	std::condition_variable waiting_cleared;
+	ChannelWriterStats stats;
+
+	void Initialize(SocketHandle connection_socket);
+
+	// Sends the concatenated buffers as one message, blocks until it has been
+	// written. Any number of buffers is fine, chunks are cut shorter when they
+	// would span more than a single write holds. Returns false if the
+	// connection failed
+	bool Send(Channel channel, const NetBuffer *buffers, uint32_t buffer_count);
+
+	// Returns true if a thread is waiting to send on a channel more urgent than channel
+	bool MoreUrgentWaiting(uint32_t channel);
+};
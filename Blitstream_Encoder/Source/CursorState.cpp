@@ -0,0 +1,88 @@
+#include "CursorState.h"
+#include <chrono>
+#include <cstring>
+#include "CursorShape.h"
+#include "Platform.h"
+
+void CursorSnapshot::Initialize() {
+	version = 0;
+	x = 0;
+	y = 0;
+	visible = false;
+	shape_hash = 0;
+	shape = CursorShape {};
+	data = static_cast<uint8_t *>(PlatformAllocate(MAX_CURSOR_DATA_SIZE));
+}
+
+void CursorSnapshot::Shutdown() {
+	PlatformFree(data, MAX_CURSOR_DATA_SIZE);
+	data = nullptr;
+}
+
+void CursorState::Initialize() {
+	current.Initialize();
+	stats.moves.store(0, std::memory_order_relaxed);
+	stats.shapes.store(0, std::memory_order_relaxed);
+	stats.oversized.store(0, std::memory_order_relaxed);
+}
+
+void CursorState::Shutdown() {
+	current.Shutdown();
+}
+
+void CursorState::SetPosition(int32_t x, int32_t y, bool visible) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(current.version != 0 && current.x == x && current.y == y && current.visible == visible) {
+			return;
+		}
+		current.x = x;
+		current.y = y;
+		current.visible = visible;
+		++current.version;
+	}
+	stats.moves.fetch_add(1, std::memory_order_relaxed);
+	changed.notify_all();
+}
+
+void CursorState::SetShape(const uint32_t *pixels, uint32_t width, uint32_t height, uint32_t hot_x, uint32_t hot_y) {
+	bool oversized = width > MAX_CURSOR_DIMENSION || height > MAX_CURSOR_DIMENSION;
+	uint64_t hash = oversized ? 0 : CursorShapeHash(pixels, width, height, hot_x, hot_y);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(current.version != 0 && current.shape_hash == hash) {
+			return;
+		}
+		current.shape_hash = hash;
+		if(!oversized) {
+			current.shape = CursorShape {
+				.width = static_cast<uint16_t>(width),
+				.height = static_cast<uint16_t>(height),
+				.hot_x = static_cast<uint16_t>(hot_x),
+				.hot_y = static_cast<uint16_t>(hot_y),
+				.data_size = CursorCompress(pixels, width * height, current.data)
+			};
+		}
+		++current.version;
+	}
+	(oversized ? stats.oversized : stats.shapes).fetch_add(1, std::memory_order_relaxed);
+	changed.notify_all();
+}
+
+bool CursorState::Wait(CursorSnapshot *snapshot, uint32_t timeout_ms) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if(!changed.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+						 [this, snapshot] { return current.version != snapshot->version; })) {
+		return false;
+	}
+	snapshot->version = current.version;
+	snapshot->x = current.x;
+	snapshot->y = current.y;
+	snapshot->visible = current.visible;
+	if(snapshot->shape_hash != current.shape_hash) {
+		snapshot->shape_hash = current.shape_hash;
+		snapshot->shape = current.shape;
+		memcpy(snapshot->data, current.data, current.shape.data_size);
+	}
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include "Protocol.h"
+
+// Written by the capture thread, may be read and reset from another
+struct CursorStats {
+	std::atomic<uint64_t> moves;
+	std::atomic<uint64_t> shapes;
+	// Larger than MAX_CURSOR_DIMENSION, the cursor is hidden instead
+	std::atomic<uint64_t> oversized;
+};
+
+// Cursor as last seen by capture. version changes with every update, the
+// shape is encoded once here and copied by each viewer that needs it
+struct CursorSnapshot {
+	// 0 before the first update
+	uint32_t version;
+	int32_t x;
+	int32_t y;
+	bool visible;
+	// 0 without a shape
+	uint64_t shape_hash;
+	CursorShape shape;
+	// MAX_CURSOR_DATA_SIZE bytes, shape.data_size of them in use
+	uint8_t *data;
+
+	void Initialize();
+	void Shutdown();
+};
+
+// Hands pointer updates from the capture thread to the viewers' cursor
+// threads. Only the latest state is kept, a viewer that falls behind skips
+// straight to it
+struct CursorState {
+	std::mutex mutex;
+	// Notified with mutex once current has changed
+	std::condition_variable changed;
+	CursorSnapshot current;
+	CursorStats stats;
+
+	void Initialize();
+	void Shutdown();
+
+	// From the capture thread, x and y are the shape's top left corner in frame pixels
+	void SetPosition(int32_t x, int32_t y, bool visible);
+	// From the capture thread, pixels are width * height straight alpha BGRA
+	// values. Nothing changes if the shape is the one already set
+	void SetShape(const uint32_t *pixels, uint32_t width, uint32_t height, uint32_t hot_x, uint32_t hot_y);
+
+	// Waits until the state differs from snapshot's version and copies it
+	// over, the shape data only if its hash differs as well. Returns false on
+	// timeout
+	bool Wait(CursorSnapshot *snapshot, uint32_t timeout_ms);
+};
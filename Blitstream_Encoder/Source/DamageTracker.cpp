@@ -0,0 +1,366 @@
+#include "DamageTracker.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+static uint64_t RectArea(const DamageRect &rect) {
+	return static_cast<uint64_t>(rect.right - rect.left) * static_cast<uint64_t>(rect.bottom - rect.top);
+}
+
+static DamageRect RectUnion(const DamageRect &a, const DamageRect &b) {
+	return DamageRect {
+		.left = a.left < b.left ? a.left : b.left,
+		.top = a.top < b.top ? a.top : b.top,
+		.right = a.right > b.right ? a.right : b.right,
+		.bottom = a.bottom > b.bottom ? a.bottom : b.bottom
+	};
+}
+
+static bool Intersects(const DamageRect &a, const DamageRect &b) {
+	return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
+}
+
+static uint64_t OverlapArea(const DamageRect &a, const DamageRect &b) {
+	DamageRect overlap {
+		.left = a.left > b.left ? a.left : b.left,
+		.top = a.top > b.top ? a.top : b.top,
+		.right = a.right < b.right ? a.right : b.right,
+		.bottom = a.bottom < b.bottom ? a.bottom : b.bottom
+	};
+	if(overlap.left >= overlap.right || overlap.top >= overlap.bottom) {
+		return 0;
+	}
+	return RectArea(overlap);
+}
+
+// Merged if the union covers at most a quarter more than the two rects do,
+// which takes in rects that contain, overlap or line up with each other
+static bool WorthMerging(const DamageRect &a, const DamageRect &b) {
+	uint64_t covered = RectArea(a) + RectArea(b) - OverlapArea(a, b);
+	return RectArea(RectUnion(a, b)) * 4 <= covered * 5;
+}
+
+void DamageRegion::Clear() {
+	count = 0;
+}
+
+void DamageRegion::Add(DamageRect rect) {
+	if(rect.left >= rect.right || rect.top >= rect.bottom) {
+		return;
+	}
+
+	// A merged rect may now be worth merging with one that was checked before
+	for(uint32_t i = 0; i < count;) {
+		if(WorthMerging(rects[i], rect)) {
+			rect = RectUnion(rects[i], rect);
+			rects[i] = rects[--count];
+			i = 0;
+		}
+		else {
+			++i;
+		}
+	}
+
+	if(count == MAX_DAMAGE_RECTS) {
+		// Goes to the rect it wastes the least area with, which may then be
+		// worth merging with others
+		uint32_t best = 0;
+		uint64_t best_waste = UINT64_MAX;
+		for(uint32_t i = 0; i < count; ++i) {
+			uint64_t waste = RectArea(RectUnion(rects[i], rect)) -
+				(RectArea(rects[i]) + RectArea(rect) - OverlapArea(rects[i], rect));
+			if(waste < best_waste) {
+				best = i;
+				best_waste = waste;
+			}
+		}
+		rect = RectUnion(rects[best], rect);
+		rects[best] = rects[--count];
+		Add(rect);
+		return;
+	}
+	rects[count++] = rect;
+}
+
+void DamageRegion::Merge(const DamageRegion &region) {
+	for(uint32_t i = 0; i < region.count; ++i) {
+		Add(region.rects[i]);
+	}
+}
+
+uint64_t DamageRegion::Area() const {
+	uint64_t area = 0;
+	for(uint32_t i = 0; i < count; ++i) {
+		area += RectArea(rects[i]);
+	}
+	return area;
+}
+
+bool DamageRegion::Intersects(const DamageRect &rect) const {
+	for(uint32_t i = 0; i < count; ++i) {
+		if(::Intersects(rects[i], rect)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DamageRegion::Covers(uint32_t width, uint32_t height) const {
+	for(uint32_t i = 0; i < count; ++i) {
+		if(rects[i].left <= 0 && rects[i].top <= 0 && rects[i].right >= static_cast<int32_t>(width) &&
+		   rects[i].bottom >= static_cast<int32_t>(height)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void DamageTracker::Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t block_size_pixels,
+							   bool keep_moves_for_copies) {
+	assert(block_size_pixels != 0 && (block_size_pixels & (block_size_pixels - 1)) == 0 &&
+		   "Block size has to be a power of two");
+	width = frame_width;
+	height = frame_height;
+	block_size = block_size_pixels;
+	keep_moves = keep_moves_for_copies;
+	pending.dirty.Clear();
+	pending.moves.count = 0;
+	for(uint32_t i = 0; i < DAMAGE_HISTORY; ++i) {
+		history[i].dirty.Clear();
+		history[i].moves.count = 0;
+	}
+	next_sequence = 0;
+	collected_sequence = 0;
+	invalidated = true;
+}
+
+bool DamageTracker::Snap(DamageRect *rect) const {
+	int32_t mask = ~static_cast<int32_t>(block_size - 1);
+	int32_t left = rect->left < 0 ? 0 : rect->left;
+	int32_t top = rect->top < 0 ? 0 : rect->top;
+	int32_t right = rect->right > static_cast<int32_t>(width) ? static_cast<int32_t>(width) : rect->right;
+	int32_t bottom = rect->bottom > static_cast<int32_t>(height) ? static_cast<int32_t>(height) : rect->bottom;
+	if(left >= right || top >= bottom) {
+		return false;
+	}
+
+	right = (right + static_cast<int32_t>(block_size) - 1) & mask;
+	bottom = (bottom + static_cast<int32_t>(block_size) - 1) & mask;
+	*rect = DamageRect {
+		.left = left & mask,
+		.top = top & mask,
+		.right = right > static_cast<int32_t>(width) ? static_cast<int32_t>(width) : right,
+		.bottom = bottom > static_cast<int32_t>(height) ? static_cast<int32_t>(height) : bottom
+	};
+	return true;
+}
+
+bool DamageTracker::Clip(DamageMove *move) const {
+	DamageRect &destination = move->destination;
+	int32_t dx = destination.left - move->source_x;
+	int32_t dy = destination.top - move->source_y;
+	int32_t frame_width = static_cast<int32_t>(width);
+	int32_t frame_height = static_cast<int32_t>(height);
+	// The source is the destination shifted by -dx, -dy, both have to be in the frame
+	int32_t left = destination.left > dx ? destination.left : dx;
+	int32_t top = destination.top > dy ? destination.top : dy;
+	int32_t right = destination.right < frame_width + dx ? destination.right : frame_width + dx;
+	int32_t bottom = destination.bottom < frame_height + dy ? destination.bottom : frame_height + dy;
+	left = left < 0 ? 0 : left;
+	top = top < 0 ? 0 : top;
+	right = right > frame_width ? frame_width : right;
+	bottom = bottom > frame_height ? frame_height : bottom;
+	if(left >= right || top >= bottom) {
+		return false;
+	}
+	destination = DamageRect {
+		.left = left,
+		.top = top,
+		.right = right,
+		.bottom = bottom
+	};
+	move->source_x = left - dx;
+	move->source_y = top - dy;
+	return true;
+}
+
+void DamageTracker::AddDirty(DamageRect rect) {
+	if(Snap(&rect)) {
+		pending.dirty.Add(rect);
+	}
+}
+
+void DamageTracker::AddMove(DamageRect destination, int32_t source_x, int32_t source_y) {
+	// Only the destination changes, whatever was uncovered at the source is
+	// reported dirty separately
+	if(destination.left == source_x && destination.top == source_y) {
+		return;
+	}
+	DamageMove move {
+		.destination = destination,
+		.source_x = source_x,
+		.source_y = source_y
+	};
+	if(!keep_moves || pending.moves.count == MAX_DAMAGE_MOVES || !Clip(&move)) {
+		AddDirty(destination);
+		return;
+	}
+	pending.moves.moves[pending.moves.count++] = move;
+}
+
+void DamageTracker::AddFrame() {
+	pending.moves.count = 0;
+	pending.dirty.Clear();
+	pending.dirty.Add(DamageRect {
+		.left = 0,
+		.top = 0,
+		.right = static_cast<int32_t>(width),
+		.bottom = static_cast<int32_t>(height)
+	});
+}
+
+uint32_t DamageTracker::Commit() {
+	std::lock_guard<std::mutex> lock(mutex);
+	history[next_sequence % DAMAGE_HISTORY] = pending;
+	pending.dirty.Clear();
+	pending.moves.count = 0;
+	return next_sequence++;
+}
+
+bool DamageTracker::Collect(uint32_t sequence, DamageRegion *region, DamageMoves *moves) {
+	region->Clear();
+	moves->count = 0;
+	bool overflow;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// The oldest capture not collected yet has to still be in the history
+		overflow = next_sequence - collected_sequence > DAMAGE_HISTORY ||
+			sequence - collected_sequence >= DAMAGE_HISTORY;
+		if(invalidated || overflow) {
+			region->Add(DamageRect {
+				.left = 0,
+				.top = 0,
+				.right = static_cast<int32_t>(width),
+				.bottom = static_cast<int32_t>(height)
+			});
+		}
+		else {
+			for(uint32_t i = collected_sequence; i != sequence + 1; ++i) {
+				const DamageCapture &capture = history[i % DAMAGE_HISTORY];
+				for(uint32_t j = 0; j < capture.moves.count; ++j) {
+					// A damaged source is stale on the receiver, so is what it
+					// would be copied to
+					const DamageMove &move = capture.moves.moves[j];
+					DamageRect source {
+						.left = move.source_x,
+						.top = move.source_y,
+						.right = move.source_x + (move.destination.right - move.destination.left),
+						.bottom = move.source_y + (move.destination.bottom - move.destination.top)
+					};
+					if(moves->count == MAX_DAMAGE_MOVES || region->Intersects(source)) {
+						DamageRect destination = move.destination;
+						Snap(&destination);
+						region->Add(destination);
+					}
+					else {
+						moves->moves[moves->count++] = move;
+					}
+				}
+				region->Merge(capture.dirty);
+			}
+			// Nothing survives a picture that replaces all of it
+			if(region->Covers(width, height)) {
+				moves->count = 0;
+			}
+		}
+		collected_sequence = sequence + 1;
+		invalidated = false;
+	}
+
+	uint64_t blocks = 0;
+	for(uint32_t i = 0; i < region->count; ++i) {
+		const DamageRect &rect = region->rects[i];
+		uint64_t columns = (rect.right - rect.left + block_size - 1) / block_size;
+		uint64_t rows = (rect.bottom - rect.top + block_size - 1) / block_size;
+		blocks += columns * rows;
+	}
+	stats.frames.fetch_add(1, std::memory_order_relaxed);
+	stats.unchanged.fetch_add(region->count == 0 && moves->count == 0 ? 1 : 0, std::memory_order_relaxed);
+	stats.overflows.fetch_add(overflow ? 1 : 0, std::memory_order_relaxed);
+	stats.rects.fetch_add(region->count, std::memory_order_relaxed);
+	stats.moves.fetch_add(moves->count, std::memory_order_relaxed);
+	stats.damaged_blocks.fetch_add(blocks, std::memory_order_relaxed);
+	return region->count != 0 || moves->count != 0;
+}
+
+void DamageTracker::Invalidate() {
+	std::lock_guard<std::mutex> lock(mutex);
+	invalidated = true;
+}
+
+uint32_t DamageTracker::BlockCount() const {
+	return ((width + block_size - 1) / block_size) * ((height + block_size - 1) / block_size);
+}
+
+void DamageTracker::FillBlockMap(const DamageRegion &region, int8_t damaged, int8_t undamaged, int8_t *map) const {
+	uint32_t columns = (width + block_size - 1) / block_size;
+	memset(map, undamaged, BlockCount());
+	for(uint32_t i = 0; i < region.count; ++i) {
+		const DamageRect &rect = region.rects[i];
+		uint32_t first_column = static_cast<uint32_t>(rect.left) / block_size;
+		uint32_t end_column = (static_cast<uint32_t>(rect.right) + block_size - 1) / block_size;
+		uint32_t first_row = static_cast<uint32_t>(rect.top) / block_size;
+		uint32_t end_row = (static_cast<uint32_t>(rect.bottom) + block_size - 1) / block_size;
+		for(uint32_t row = first_row; row < end_row; ++row) {
+			memset(map + row * columns + first_column, damaged, end_column - first_column);
+		}
+	}
+}
+
+void DamageTracker::PrintStats() {
+	uint64_t frames = stats.frames.exchange(0, std::memory_order_relaxed);
+	uint64_t unchanged = stats.unchanged.exchange(0, std::memory_order_relaxed);
+	uint64_t overflows = stats.overflows.exchange(0, std::memory_order_relaxed);
+	uint64_t rects = stats.rects.exchange(0, std::memory_order_relaxed);
+	uint64_t moves = stats.moves.exchange(0, std::memory_order_relaxed);
+	uint64_t damaged_blocks = stats.damaged_blocks.exchange(0, std::memory_order_relaxed);
+	uint64_t changed = frames - unchanged;
+	printf("Damage: %llu of %llu frames unchanged, changed ones %.1f rects, %.1f copies and %.1f%% of the frame, "
+		   "%llu overflows\n",
+		   static_cast<unsigned long long>(unchanged), static_cast<unsigned long long>(frames),
+		   changed != 0 ? static_cast<double>(rects) / changed : 0.0,
+		   changed != 0 ? static_cast<double>(moves) / changed : 0.0,
+		   changed != 0 ? 100.0 * damaged_blocks / changed / BlockCount() : 0.0,
+		   static_cast<unsigned long long>(overflows));
+}
+
+uint32_t WriteFrameRegions(const DamageRegion &region, const DamageMoves &moves, uint8_t *data) {
+	FrameRegions *header = reinterpret_cast<FrameRegions *>(data);
+	header->copy_count = static_cast<uint16_t>(moves.count);
+	header->dirty_count = static_cast<uint16_t>(region.count);
+
+	CopyRect *copies = reinterpret_cast<CopyRect *>(header + 1);
+	for(uint32_t i = 0; i < moves.count; ++i) {
+		const DamageMove &move = moves.moves[i];
+		copies[i] = CopyRect {
+			.x = static_cast<uint16_t>(move.destination.left),
+			.y = static_cast<uint16_t>(move.destination.top),
+			.width = static_cast<uint16_t>(move.destination.right - move.destination.left),
+			.height = static_cast<uint16_t>(move.destination.bottom - move.destination.top),
+			.source_x = static_cast<uint16_t>(move.source_x),
+			.source_y = static_cast<uint16_t>(move.source_y)
+		};
+	}
+
+	DirtyRect *dirty_rects = reinterpret_cast<DirtyRect *>(copies + moves.count);
+	for(uint32_t i = 0; i < region.count; ++i) {
+		const DamageRect &rect = region.rects[i];
+		dirty_rects[i] = DirtyRect {
+			.x = static_cast<uint16_t>(rect.left),
+			.y = static_cast<uint16_t>(rect.top),
+			.width = static_cast<uint16_t>(rect.right - rect.left),
+			.height = static_cast<uint16_t>(rect.bottom - rect.top)
+		};
+	}
+	return static_cast<uint32_t>(sizeof(FrameRegions) + moves.count * sizeof(CopyRect) + region.count * sizeof(DirtyRect));
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "Protocol.h"
+
+// Rects a region is merged down to, the union of everything added is always covered
+constexpr uint32_t MAX_DAMAGE_RECTS = 32;
+static_assert(MAX_DAMAGE_RECTS <= MAX_DIRTY_RECTS, "A region has to fit into FrameRegions");
+// Moves kept per capture and per collect, further ones are treated as dirty
+constexpr uint32_t MAX_DAMAGE_MOVES = MAX_COPY_RECTS;
+// Captures whose damage is kept until it is collected, an encode that
+// skipped more than this many captures treats the whole frame as damaged
+constexpr uint32_t DAMAGE_HISTORY = 16;
+
+// Pixels from left, top up to but excluding right, bottom, as in a RECT
+struct DamageRect {
+	int32_t left;
+	int32_t top;
+	int32_t right;
+	int32_t bottom;
+};
+
+// Damaged part of a frame as a few rects on the block grid, which may
+// overlap. Adding a rect merges it with any it would barely grow, once
+// MAX_DAMAGE_RECTS are in use it goes to the one it wastes the least area with
+struct DamageRegion {
+	uint32_t count;
+	DamageRect rects[MAX_DAMAGE_RECTS];
+
+	void Clear();
+	// rect has to be clipped and snapped already, empty rects are ignored
+	void Add(DamageRect rect);
+	void Merge(const DamageRegion &region);
+	// Sum of the rect areas, overlaps count twice
+	uint64_t Area() const;
+	bool Intersects(const DamageRect &rect) const;
+	bool Covers(uint32_t width, uint32_t height) const;
+};
+
+// Content moved to destination from the same size rect at source_x, source_y
+struct DamageMove {
+	DamageRect destination;
+	int32_t source_x;
+	int32_t source_y;
+};
+
+// In the order the moves happened
+struct DamageMoves {
+	uint32_t count;
+	DamageMove moves[MAX_DAMAGE_MOVES];
+};
+
+// What one capture changed, its moves happened before its dirty rects were drawn
+struct DamageCapture {
+	DamageRegion dirty;
+	DamageMoves moves;
+};
+
+// Written by the encoding thread, read by the stats printer
+struct DamageStats {
+	std::atomic<uint64_t> frames;
+	// Collected without any damage
+	std::atomic<uint64_t> unchanged;
+	// More captures were skipped than the history holds
+	std::atomic<uint64_t> overflows;
+	std::atomic<uint64_t> rects;
+	std::atomic<uint64_t> moves;
+	// In units of block_size squared
+	std::atomic<uint64_t> damaged_blocks;
+};
+
+// Collects the dirty and move rects of each capture on the grid of the
+// encoder's blocks. The capture thread commits every capture's damage under a
+// sequence number, the encoding thread collects the damage of all captures
+// since the one it encoded last, the ones it never saw included. Moves are
+// either kept for the receiver to replay or count as dirty at their destination
+struct DamageTracker {
+	uint32_t width;
+	uint32_t height;
+	uint32_t block_size;
+	bool keep_moves;
+
+	// Damage of the capture in progress, owned by the capture thread
+	DamageCapture pending;
+
+	// Guards everything below
+	std::mutex mutex;
+	// Indexed by sequence % DAMAGE_HISTORY
+	DamageCapture history[DAMAGE_HISTORY];
+	// Sequence of the next commit
+	uint32_t next_sequence;
+	// Every capture up to and excluding this one has been collected
+	uint32_t collected_sequence;
+	// The next collect returns the whole frame
+	bool invalidated;
+	DamageStats stats;
+
+	// block_size is a power of two, the first collect returns the whole frame
+	void Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t block_size_pixels, bool keep_moves_for_copies);
+
+	// From the capture thread, add the capture's damage then commit it
+	void AddDirty(DamageRect rect);
+	// Content moved to destination from the same size rect at source_x, source_y
+	void AddMove(DamageRect destination, int32_t source_x, int32_t source_y);
+	void AddFrame();
+	// Returns the sequence number of the capture
+	uint32_t Commit();
+
+	// From the encoding thread, merges the damage of every capture since the
+	// last collect up to and including sequence into region and moves. Applying
+	// the moves in order to the last collected frame, then taking the region
+	// from the new one, gives the new frame. A move whose source was damaged
+	// before it happened turns into damage at its destination. Returns false
+	// if nothing changed
+	bool Collect(uint32_t sequence, DamageRegion *region, DamageMoves *moves);
+	// From any thread, the next collect returns the whole frame
+	void Invalidate();
+
+	// Fills one byte per block, blocks in the region get damaged and the
+	// others undamaged. map holds BlockCount bytes in raster order
+	void FillBlockMap(const DamageRegion &region, int8_t damaged, int8_t undamaged, int8_t *map) const;
+	uint32_t BlockCount() const;
+
+	void PrintStats();
+
+	// Clips to the frame and grows to the block grid, false if nothing is left
+	bool Snap(DamageRect *rect) const;
+	// Clips source and destination to the frame alike, false if nothing is left
+	bool Clip(DamageMove *move) const;
+};
+
+// Writes region and moves as a FrameRegions block, returns its size which is
+// at most MAX_FRAME_REGIONS_SIZE
+uint32_t WriteFrameRegions(const DamageRegion &region, const DamageMoves &moves, uint8_t *data);
@@ -1,6 +1,8 @@
 #include "Encoder.h"
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include "Platform.h"
 
 #ifdef _DEBUG
 #define WIN_CHECK(x) { \
@@ -16,7 +18,25 @@ if(ret != NV_ENC_SUCCESS) printf("NVENC_API: %s is 0x%08x in %s at line %d\n", #
 #define NVENC_CHECK
 #endif
 
-void Encoder::Initialize() {
+// Granularity of the QP delta map for H264, HEVC_CTB_SIZE for HEVC
+static constexpr uint32_t H264_MACROBLOCK_SIZE = 16;
+// Added to the rate control's QP in damaged blocks, the rest of the frame
+// is unchanged and mostly skipped anyway
+static constexpr int8_t DAMAGED_QP_DELTA = -3;
+// The end of stream completes right away with nothing in flight, this only
+// keeps a hung driver from hanging the shutdown
+static constexpr uint32_t EOS_TIMEOUT_MS = 1000;
+
+void Encoder::Initialize(uint32_t fps, const EncoderOptions &options) {
+	frame_rate = fps;
+	codec = options.codec;
+	// Tiles are coded synchronously and already send only what changed
+	async_encode = options.async_encode && codec == Codec::Hevc;
+	damage_tracking = options.damage_tracking;
+	copy_rects = options.damage_tracking && options.copy_rects && codec == Codec::Hevc;
+	encoder_profile = FindEncoderProfile(options.profile);
+	assert(encoder_profile && "Unknown encoder profile");
+
 	uint32_t deviceFlags = 0;
 #ifdef _DEBUG
 	deviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
@@ -28,33 +48,108 @@ void Encoder::Initialize() {
 								feature_levels, ARRAYSIZE(feature_levels), D3D11_SDK_VERSION,
 								&d3d11_device, &feature_level, &d3d11_context));
 
-	CreateDisplayDuplication();
-	CreateEncoder();
+	// Capture and encode run on separate threads and share the immediate context
+	ID3D11Multithread *multithread;
+	WIN_CHECK(d3d11_context->QueryInterface(__uuidof(ID3D11Multithread), reinterpret_cast<void **>(&multithread)));
+	multithread->SetMultithreadProtected(TRUE);
+	multithread->Release();
+
+	[[maybe_unused]] bool duplicated = CreateDisplayDuplication();
+	assert(duplicated && "Error duplicating desktop output");
+	width = desktop_width;
+	height = desktop_height;
+	printf("Starting encoder @ %ux%u\n", width, height);
+	CreateCaptureTextures();
+	if(codec == Codec::Tiles) {
+		CreateTileEncoder(options.tile_threads);
+	}
+	else {
+		CreateEncoder();
+	}
+
+	pointer_shape_buffer = nullptr;
+	pointer_shape_buffer_size = 0;
+	pointer_pixels = static_cast<uint32_t *>(PlatformAllocate(MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION * sizeof(uint32_t)));
+	metadata_buffer = nullptr;
+	metadata_buffer_size = 0;
 }
 
-void Encoder::CreateDisplayDuplication() {
+bool Encoder::CreateDisplayDuplication() {
 	IDXGIDevice2 *temp_device;
 	IDXGIAdapter *temp_adapter;
 	IDXGIOutput *temp_output;
 	IDXGIOutput6 *temp_output6;
 
+	d3d11_output_duplication = nullptr;
 	WIN_CHECK(d3d11_device->QueryInterface(__uuidof(IDXGIDevice2), reinterpret_cast<void **>(&temp_device)));
 	WIN_CHECK(temp_device->GetParent(__uuidof(IDXGIAdapter), reinterpret_cast<void **>(&temp_adapter)));
-	WIN_CHECK(temp_adapter->EnumOutputs(0, &temp_output));
-	WIN_CHECK(temp_output->QueryInterface(__uuidof(IDXGIOutput6), reinterpret_cast<void **>(&temp_output6)));
-	WIN_CHECK(temp_output6->DuplicateOutput(temp_device, &d3d11_output_duplication));
-
+	// The output may be gone after a mode change, and duplicating it is
+	// denied while the secure desktop is shown
+	if(SUCCEEDED(temp_adapter->EnumOutputs(0, &temp_output))) {
+		WIN_CHECK(temp_output->QueryInterface(__uuidof(IDXGIOutput6), reinterpret_cast<void **>(&temp_output6)));
+		if(FAILED(temp_output6->DuplicateOutput(temp_device, &d3d11_output_duplication))) {
+			d3d11_output_duplication = nullptr;
+		}
+		temp_output->Release();
+		temp_output6->Release();
+	}
 	temp_device->Release();
 	temp_adapter->Release();
-	temp_output->Release();
-	temp_output6->Release();
+	if(!d3d11_output_duplication) {
+		return false;
+	}
 
 	DXGI_OUTDUPL_DESC desc {};
 	d3d11_output_duplication->GetDesc(&desc);
-	width = desc.ModeDesc.Width;
-	height = desc.ModeDesc.Height;
+	desktop_width = desc.ModeDesc.Width;
+	desktop_height = desc.ModeDesc.Height;
+	return true;
+}
 
-	printf("Starting encoder @ %ux%u\n", width, height);
+bool Encoder::RecreateDisplayDuplication() {
+	if(!CreateDisplayDuplication()) {
+		return false;
+	}
+	if(desktop_width != width || desktop_height != height) {
+		printf("Desktop is now %ux%u, streaming its top left %ux%u\n", desktop_width, desktop_height, width, height);
+	}
+	// Updates went by unseen while the duplication was lost, and the
+	// registrations may have gone stale with it
+	if(damage_tracking) {
+		damage.Invalidate();
+	}
+	if(codec == Codec::Hevc) {
+		registration_cache.RequestEviction();
+	}
+	return true;
+}
+
+void Encoder::CreateCaptureTextures() {
+	D3D11_TEXTURE2D_DESC texture_desc {
+		.Width = width,
+		.Height = height,
+		.MipLevels = 1,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = DXGI_SAMPLE_DESC {
+			.Count = 1,
+			.Quality = 0
+		},
+		.Usage = D3D11_USAGE_DEFAULT,
+		.BindFlags = D3D11_BIND_RENDER_TARGET
+	};
+
+	for(uint32_t i = 0; i < NUM_CAPTURE_BUFFERS; ++i) {
+		WIN_CHECK(d3d11_device->CreateTexture2D(&texture_desc, nullptr, &capture_textures[i]));
+	}
+	last_capture_index = INVALID_CAPTURE_INDEX;
+	if(copy_rects) {
+		for(uint32_t i = 0; i < NUM_IO_BUFFERS; ++i) {
+			WIN_CHECK(d3d11_device->CreateTexture2D(&texture_desc, nullptr, &canvas_textures[i]));
+		}
+		// The first collect is the whole frame, which does not read it
+		last_canvas = 0;
+	}
 }
 
 void Encoder::CreateEncoder() {
@@ -94,21 +189,31 @@ void Encoder::CreateEncoder() {
 	}
 	assert(nvenc_encode_guid != GUID {} && "Couldn't find appropriate codec for encoding");
 
-	// Iterate and choose a preset GUID
+	if(async_encode) {
+		NV_ENC_CAPS_PARAM caps_param {
+			.version = NV_ENC_CAPS_PARAM_VER,
+			.capsToQuery = NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT
+		};
+		int async_supported = 0;
+		NVENC_CHECK(nvenc_api.nvEncGetEncodeCaps(nvenc_encoder, nvenc_encode_guid, &caps_param, &async_supported));
+		if(!async_supported) {
+			printf("Asynchronous encoding not supported, falling back to synchronous mode\n");
+			async_encode = false;
+		}
+	}
+
+	// Make sure the profile's preset is available
 	uint32_t preset_guid_count;
 	nvenc_api.nvEncGetEncodePresetCount(nvenc_encoder, nvenc_encode_guid, &preset_guid_count);
 	GUID *preset_guids = reinterpret_cast<GUID *>(malloc(preset_guid_count * sizeof(GUID)));
 	nvenc_api.nvEncGetEncodePresetGUIDs(nvenc_encoder, nvenc_encode_guid, preset_guids, preset_guid_count, &preset_guid_count);
 	for(uint32_t i = 0; i < preset_guid_count; ++i) {
-		if(preset_guids[i] == NV_ENC_PRESET_P7_GUID) {
+		if(preset_guids[i] == encoder_profile->preset_guid) {
 			nvenc_preset_guid = preset_guids[i];
 			break;
 		}
-		if(preset_guids[i] == NV_ENC_PRESET_P6_GUID) {
-			nvenc_preset_guid = preset_guids[i];
-		}
 	}
-	assert(nvenc_preset_guid != GUID {} && "Couldn't find appropriate profile for encoding");
+	assert(nvenc_preset_guid != GUID {} && "Couldn't find appropriate preset for encoding");
 
 	// Iterate and choose a profile GUID
 	uint32_t profile_guid_count;
@@ -127,37 +232,35 @@ void Encoder::CreateEncoder() {
 	free(preset_guids);
 	free(profile_guids);
 
-	// Get encoding config from preset
+	// Get encoding config from preset and apply the profile on top of it
 	NV_ENC_PRESET_CONFIG preset_config {
 		.version = NV_ENC_PRESET_CONFIG_VER,
 		.presetCfg = NV_ENC_CONFIG {
 			.version = NV_ENC_CONFIG_VER
 		}
 	};
-	NVENC_CHECK(nvenc_api.nvEncGetEncodePresetConfig(nvenc_encoder, nvenc_encode_guid, 
-													 nvenc_preset_guid, &preset_config));
-	NV_ENC_CONFIG encode_config = preset_config.presetCfg;
-
-
-	NV_ENC_INITIALIZE_PARAMS encoder_init_params {
-		.version = NV_ENC_INITIALIZE_PARAMS_VER,
-		.encodeGUID = nvenc_encode_guid,
-		.presetGUID = nvenc_preset_guid,
-		.encodeWidth = width,
-		.encodeHeight = height,
-		.darWidth = width,
-		.darHeight = height,
-		.frameRateNum = 60,
-		.frameRateDen = 1,
-		.enableEncodeAsync = 0, // TODO: Unsure
-		.enablePTD = 1,
-		.encodeConfig = &encode_config,
-		.maxEncodeWidth = 3840,
-		.maxEncodeHeight = 2160,
-		.tuningInfo = NV_ENC_TUNING_INFO_HIGH_QUALITY
+	NVENC_CHECK(nvenc_api.nvEncGetEncodePresetConfigEx(nvenc_encoder, nvenc_encode_guid, nvenc_preset_guid,
+													   encoder_profile->tuning_info, &preset_config));
+
+	// Damage hints go in as a QP delta map, emphasis maps would be simpler
+	// but are H264 only and do not work with adaptive quantization
+	EncoderConfigInput config_input {
+		.codec_guid = nvenc_encode_guid,
+		.profile_guid = nvenc_profile_guid,
+		.width = width,
+		.height = height,
+		.fps = frame_rate,
+		.async_encode = async_encode,
+		.qp_map_mode = damage_tracking ? NV_ENC_QP_MAP_DELTA : NV_ENC_QP_MAP_DISABLED,
+		.preset_config = preset_config.presetCfg
 	};
+	BuildEncoderConfig(*encoder_profile, config_input, &encoder_config);
+	PrintEncoderConfig(*encoder_profile, encoder_config);
 
-	NVENC_CHECK(nvenc_api.nvEncInitializeEncoder(nvenc_encoder, &encoder_init_params));
+	NVENC_CHECK(nvenc_api.nvEncInitializeEncoder(nvenc_encoder, &encoder_config.init_params));
+	initial_rate_control = encoder_config.config.rcParams;
+	bitrate = initial_rate_control.rateControlMode != NV_ENC_PARAMS_RC_CONSTQP ? initial_rate_control.averageBitRate : 0;
+	force_keyframe = false;
 
 	// Output buffers
 	for(int i = 0; i < NUM_IO_BUFFERS; i++) {
@@ -166,95 +269,493 @@ void Encoder::CreateEncoder() {
 		};
 		NVENC_CHECK(nvenc_api.nvEncCreateBitstreamBuffer(nvenc_encoder, &create_bitstream_buffer));
 		nvenc_output_buffers[i] = create_bitstream_buffer.bitstreamBuffer;
+
+		if(async_encode) {
+			completion_events[i] = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+			NV_ENC_EVENT_PARAMS event_params {
+				.version = NV_ENC_EVENT_PARAMS_VER,
+				.completionEvent = completion_events[i]
+			};
+			NVENC_CHECK(nvenc_api.nvEncRegisterAsyncEvent(nvenc_encoder, &event_params));
+		}
 	}
-}
 
-EncodedData Encoder::Encode() {
-	int index = current_buffer_index % NUM_IO_BUFFERS;
+	registration_cache.Initialize(&nvenc_api, nvenc_encoder);
 
-	NV_ENC_REGISTER_RESOURCE register_resource {
-		.version = NV_ENC_REGISTER_RESOURCE_VER,
-		.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX,
-		.width = width,
-		.height = height,
-		.pitch = 0,
-		.subResourceIndex = 0,
-		.resourceToRegister = d3d11_texture,
-		.bufferFormat = NV_ENC_BUFFER_FORMAT_ARGB,
-		.bufferUsage = NV_ENC_INPUT_IMAGE
+	if(damage_tracking) {
+		damage.Initialize(width, height, nvenc_encode_guid == NV_ENC_CODEC_HEVC_GUID ? HEVC_CTB_SIZE : H264_MACROBLOCK_SIZE,
+						  copy_rects);
+		damage_maps = static_cast<int8_t *>(PlatformAllocate(NUM_IO_BUFFERS * damage.BlockCount()));
+	}
+}
+
+void Encoder::CreateTileEncoder(uint32_t thread_total) {
+	D3D11_TEXTURE2D_DESC texture_desc {
+		.Width = width,
+		.Height = height,
+		.MipLevels = 1,
+		.ArraySize = 1,
+		.Format = DXGI_FORMAT_B8G8R8A8_UNORM,
+		.SampleDesc = DXGI_SAMPLE_DESC {
+			.Count = 1,
+			.Quality = 0
+		},
+		.Usage = D3D11_USAGE_STAGING,
+		.BindFlags = 0,
+		.CPUAccessFlags = D3D11_CPU_ACCESS_READ
 	};
+	WIN_CHECK(d3d11_device->CreateTexture2D(&texture_desc, nullptr, &staging_texture));
 
-	NVENC_CHECK(nvenc_api.nvEncRegisterResource(nvenc_encoder, &register_resource));
+	tiles.Initialize(width, height, thread_total);
+	bitrate = 0;
+	force_keyframe = false;
 
-	NV_ENC_MAP_INPUT_RESOURCE input_resource {
-		.version = NV_ENC_MAP_INPUT_RESOURCE_VER,
-		.registeredResource = register_resource.registeredResource
-	};
-	NVENC_CHECK(nvenc_api.nvEncMapInputResource(nvenc_encoder, &input_resource));
+	// One block per tile, a tile outside the damage is not even hashed
+	if(damage_tracking) {
+		damage.Initialize(width, height, TILE_SIZE, false);
+		damage_maps = static_cast<int8_t *>(PlatformAllocate(NUM_IO_BUFFERS * damage.BlockCount()));
+	}
+}
+
+bool Encoder::Capture(uint32_t capture_index) {
+	// Tried again on every capture until the output can be duplicated
+	if(!d3d11_output_duplication && !RecreateDisplayDuplication()) {
+		return false;
+	}
+
+	DXGI_OUTDUPL_FRAME_INFO frame_info {};
+	IDXGIResource *resource = nullptr;
+	HRESULT dxgi_result = d3d11_output_duplication->AcquireNextFrame(1, &frame_info, &resource);
+	if(dxgi_result == DXGI_ERROR_WAIT_TIMEOUT) {
+		return false;
+	}
+	// DXGI_ERROR_ACCESS_LOST on a mode change, when the secure desktop is
+	// shown or a fullscreen application takes the output
+	if(FAILED(dxgi_result)) {
+		printf("Desktop duplication failed with 0x%08x, duplicating the output again\n",
+			   static_cast<uint32_t>(dxgi_result));
+		d3d11_output_duplication->Release();
+		RecreateDisplayDuplication();
+		return false;
+	}
+
+	// The shape goes first so the position never refers to one not sent yet
+	if(cursor && frame_info.PointerShapeBufferSize != 0) {
+		CapturePointerShape(frame_info.PointerShapeBufferSize);
+	}
+	if(cursor && frame_info.LastMouseUpdateTime.QuadPart != 0) {
+		cursor->SetPosition(frame_info.PointerPosition.Position.x, frame_info.PointerPosition.Position.y,
+							frame_info.PointerPosition.Visible != FALSE);
+	}
+
+	// Without a present only the pointer changed, which costs no frame
+	bool desktop_updated = frame_info.LastPresentTime.QuadPart != 0;
+	if(desktop_updated) {
+		// Copy out of the duplication surface so the frame can be released
+		// immediately and the next capture is not held up by the encoder
+		ID3D11Texture2D *texture;
+		WIN_CHECK(resource->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void **>(&texture)));
+		if(desktop_width == width && desktop_height == height) {
+			d3d11_context->CopyResource(capture_textures[capture_index], texture);
+		}
+		else {
+			D3D11_BOX box {
+				.right = desktop_width < width ? desktop_width : width,
+				.bottom = desktop_height < height ? desktop_height : height,
+				.back = 1
+			};
+			d3d11_context->CopySubresourceRegion(capture_textures[capture_index], 0, 0, 0, 0, texture, 0, &box);
+		}
+		texture->Release();
+
+		if(damage_tracking) {
+			CaptureDamage(frame_info.TotalMetadataBufferSize);
+			capture_sequences[capture_index] = damage.Commit();
+		}
+		last_capture_index = capture_index;
+	}
+	resource->Release();
+	d3d11_output_duplication->ReleaseFrame();
+
+	return desktop_updated;
+}
+
+bool Encoder::RepeatCapture(uint32_t capture_index) {
+	if(last_capture_index == INVALID_CAPTURE_INDEX) {
+		return false;
+	}
+	// Only ever written by a capture, so the last one is still there even if
+	// its buffer has been encoded and handed back since
+	if(capture_index != last_capture_index) {
+		d3d11_context->CopyResource(capture_textures[capture_index], capture_textures[last_capture_index]);
+		capture_sequences[capture_index] = capture_sequences[last_capture_index];
+		last_capture_index = capture_index;
+	}
+	return true;
+}
+
+// Converts a pointer shape to straight alpha BGRA. Pixels that invert the
+// screen cannot be expressed that way and become opaque black, or white for
+// masked color pixels that invert with a color
+static void ConvertPointerShape(const DXGI_OUTDUPL_POINTER_SHAPE_INFO &info, const uint8_t *shape,
+								uint32_t width, uint32_t height, uint32_t *pixels) {
+	constexpr uint32_t TRANSPARENT_PIXEL = 0x00000000;
+	constexpr uint32_t BLACK_PIXEL = 0xFF000000;
+	constexpr uint32_t WHITE_PIXEL = 0xFFFFFFFF;
+
+	for(uint32_t y = 0; y < height; ++y) {
+		uint32_t *row = pixels + y * width;
+		if(info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME) {
+			// AND mask in the top half, XOR mask in the bottom half, one bit per pixel
+			const uint8_t *and_mask = shape + y * info.Pitch;
+			const uint8_t *xor_mask = shape + (y + height) * info.Pitch;
+			for(uint32_t x = 0; x < width; ++x) {
+				uint8_t bit = static_cast<uint8_t>(0x80 >> (x % 8));
+				bool and_set = (and_mask[x / 8] & bit) != 0;
+				bool xor_set = (xor_mask[x / 8] & bit) != 0;
+				row[x] = and_set ? (xor_set ? BLACK_PIXEL : TRANSPARENT_PIXEL) : (xor_set ? WHITE_PIXEL : BLACK_PIXEL);
+			}
+			continue;
+		}
+
+		memcpy(row, shape + y * info.Pitch, width * sizeof(uint32_t));
+		if(info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MASKED_COLOR) {
+			// The alpha byte is a mask, 0 replaces the screen and 0xFF XORs the color onto it
+			for(uint32_t x = 0; x < width; ++x) {
+				uint32_t color = row[x] & 0x00FFFFFF;
+				row[x] = (row[x] & 0xFF000000) == 0 ? (BLACK_PIXEL | color) :
+					(color == 0 ? TRANSPARENT_PIXEL : WHITE_PIXEL);
+			}
+		}
+	}
+}
+
+void Encoder::CapturePointerShape(uint32_t size) {
+	if(pointer_shape_buffer_size < size) {
+		if(pointer_shape_buffer) {
+			PlatformFree(pointer_shape_buffer, pointer_shape_buffer_size);
+		}
+		pointer_shape_buffer = static_cast<uint8_t *>(PlatformAllocate(size));
+		pointer_shape_buffer_size = size;
+	}
+
+	UINT required_size = 0;
+	DXGI_OUTDUPL_POINTER_SHAPE_INFO info {};
+	HRESULT dxgi_result = d3d11_output_duplication->GetFramePointerShape(pointer_shape_buffer_size, pointer_shape_buffer,
+																		 &required_size, &info);
+	if(FAILED(dxgi_result)) {
+		return;
+	}
+
+	uint32_t shape_width = info.Width;
+	uint32_t shape_height = info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME ? info.Height / 2 : info.Height;
+	if(shape_width <= MAX_CURSOR_DIMENSION && shape_height <= MAX_CURSOR_DIMENSION) {
+		ConvertPointerShape(info, pointer_shape_buffer, shape_width, shape_height, pointer_pixels);
+	}
+	cursor->SetShape(pointer_pixels, shape_width, shape_height, info.HotSpot.x, info.HotSpot.y);
+}
+
+void Encoder::CaptureDamage(uint32_t size) {
+	// Without metadata the update changed nothing
+	if(size == 0) {
+		return;
+	}
+	if(metadata_buffer_size < size) {
+		if(metadata_buffer) {
+			PlatformFree(metadata_buffer, metadata_buffer_size);
+		}
+		metadata_buffer = static_cast<uint8_t *>(PlatformAllocate(size));
+		metadata_buffer_size = size;
+	}
+
+	// Moves first, the dirty rects go behind them in the same buffer. If
+	// either cannot be read the whole frame counts as damaged
+	UINT move_size = 0;
+	HRESULT dxgi_result = d3d11_output_duplication->GetFrameMoveRects(
+		metadata_buffer_size, reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT *>(metadata_buffer), &move_size);
+	if(FAILED(dxgi_result)) {
+		damage.AddFrame();
+		return;
+	}
+	const DXGI_OUTDUPL_MOVE_RECT *moves = reinterpret_cast<const DXGI_OUTDUPL_MOVE_RECT *>(metadata_buffer);
+	for(uint32_t i = 0; i < move_size / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++i) {
+		const RECT &destination = moves[i].DestinationRect;
+		damage.AddMove(DamageRect {
+			.left = destination.left,
+			.top = destination.top,
+			.right = destination.right,
+			.bottom = destination.bottom
+		}, moves[i].SourcePoint.x, moves[i].SourcePoint.y);
+	}
+
+	UINT dirty_size = 0;
+	RECT *dirty_rects = reinterpret_cast<RECT *>(metadata_buffer + move_size);
+	dxgi_result = d3d11_output_duplication->GetFrameDirtyRects(metadata_buffer_size - move_size, dirty_rects, &dirty_size);
+	if(FAILED(dxgi_result)) {
+		damage.AddFrame();
+		return;
+	}
+	for(uint32_t i = 0; i < dirty_size / sizeof(RECT); ++i) {
+		damage.AddDirty(DamageRect {
+			.left = dirty_rects[i].left,
+			.top = dirty_rects[i].top,
+			.right = dirty_rects[i].right,
+			.bottom = dirty_rects[i].bottom
+		});
+	}
+}
+
+ID3D11Texture2D *Encoder::UpdateCanvas(uint32_t capture_index, uint32_t output_index, const DamageRegion *region) {
+	ID3D11Texture2D *canvas = canvas_textures[output_index];
+	ID3D11Texture2D *capture = capture_textures[capture_index];
+	if(!region) {
+		d3d11_context->CopyResource(canvas, capture);
+	}
+	else {
+		// Consecutive frames only share a canvas if the output buffer came
+		// straight back, then it holds the last picture already
+		if(last_canvas != output_index) {
+			d3d11_context->CopyResource(canvas, canvas_textures[last_canvas]);
+		}
+		for(uint32_t i = 0; i < region->count; ++i) {
+			const DamageRect &rect = region->rects[i];
+			D3D11_BOX box {
+				.left = static_cast<UINT>(rect.left),
+				.top = static_cast<UINT>(rect.top),
+				.front = 0,
+				.right = static_cast<UINT>(rect.right),
+				.bottom = static_cast<UINT>(rect.bottom),
+				.back = 1
+			};
+			d3d11_context->CopySubresourceRegion(canvas, 0, box.left, box.top, 0, capture, 0, &box);
+		}
+	}
+	last_canvas = output_index;
+	return canvas;
+}
+
+EncodedData Encoder::Encode(uint32_t capture_index, uint32_t output_index) {
+	if(codec == Codec::Tiles) {
+		return EncodeTiles(capture_index, output_index);
+	}
+
+	// Unless a keyframe is due, a capture that changed nothing since the last
+	// encoded one is repeated by the client instead. Blocks that did change
+	// get a lower QP unless the whole frame did. With copy rects only moves
+	// are sent if nothing else changed
+	int8_t *damage_map = nullptr;
+	ID3D11Texture2D *input = capture_textures[capture_index];
+	frame_regions_sizes[output_index] = 0;
+	if(damage_tracking) {
+		DamageRegion region;
+		DamageMoves moves;
+		bool changed = damage.Collect(capture_sequences[capture_index], &region, &moves);
+		bool whole_frame = force_keyframe || region.Covers(width, height);
+		if(copy_rects && changed && !whole_frame) {
+			frame_regions_sizes[output_index] = WriteFrameRegions(region, moves, frame_regions[output_index]);
+		}
+		skipped_outputs[output_index] = region.count == 0 && !force_keyframe;
+		if(skipped_outputs[output_index]) {
+			return EncodedData {
+				.regions = frame_regions_sizes[output_index] != 0 ? frame_regions[output_index] : nullptr,
+				.regions_size = frame_regions_sizes[output_index]
+			};
+		}
+		if(!whole_frame) {
+			damage_map = damage_maps + output_index * damage.BlockCount();
+			damage.FillBlockMap(region, DAMAGED_QP_DELTA, 0, damage_map);
+		}
+		if(copy_rects) {
+			input = UpdateCanvas(capture_index, output_index, whole_frame ? nullptr : &region);
+		}
+	}
+	encoded_textures[output_index] = input;
+
+	NV_ENC_MAP_INPUT_RESOURCE input_resource = registration_cache.Map(input,
+																	  NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX,
+																	  width, height, NV_ENC_BUFFER_FORMAT_ARGB);
 
 	NV_ENC_PIC_PARAMS pic_params = {
 		.version = NV_ENC_PIC_PARAMS_VER,
 		.inputWidth = width,
 		.inputHeight = height,
+		.encodePicFlags = force_keyframe ? static_cast<uint32_t>(NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS) : 0u,
 		.inputBuffer = input_resource.mappedResource,
-		.outputBitstream = nvenc_output_buffers[index],
+		.outputBitstream = nvenc_output_buffers[output_index],
+		.completionEvent = async_encode ? completion_events[output_index] : nullptr,
 		.bufferFmt = input_resource.mappedBufferFmt,
-		.pictureStruct = NV_ENC_PIC_STRUCT_FRAME
+		.pictureStruct = NV_ENC_PIC_STRUCT_FRAME,
+		.qpDeltaMap = damage_map,
+		.qpDeltaMapSize = damage_map ? damage.BlockCount() : 0u
 	};
 	NVENC_CHECK(nvenc_api.nvEncEncodePicture(nvenc_encoder, &pic_params));
+	force_keyframe = false;
+
+	if(async_encode) {
+		return {};
+	}
+	return LockOutput(capture_index, output_index);
+}
 
+EncodedData Encoder::EncodeTiles(uint32_t capture_index, uint32_t output_index) {
+	const int8_t *tile_mask = nullptr;
+	if(damage_tracking) {
+		DamageRegion region;
+		DamageMoves moves;
+		damage.Collect(capture_sequences[capture_index], &region, &moves);
+		if(region.count == 0 && !force_keyframe) {
+			return {};
+		}
+		if(!force_keyframe && !region.Covers(width, height)) {
+			int8_t *damage_map = damage_maps + output_index * damage.BlockCount();
+			damage.FillBlockMap(region, 1, 0, damage_map);
+			tile_mask = damage_map;
+		}
+	}
+
+	// Mapping waits for the copy, the tiles are coded straight from the mapping
+	d3d11_context->CopyResource(staging_texture, capture_textures[capture_index]);
+	D3D11_MAPPED_SUBRESOURCE mapped {};
+	WIN_CHECK(d3d11_context->Map(staging_texture, 0, D3D11_MAP_READ, 0, &mapped));
+	EncodedData data = tiles.Encode(static_cast<const uint32_t *>(mapped.pData), mapped.RowPitch / sizeof(uint32_t),
+									tile_mask, force_keyframe, output_index);
+	d3d11_context->Unmap(staging_texture, 0);
+	force_keyframe = false;
+	return data;
+}
+
+EncodedData Encoder::Retrieve(uint32_t capture_index, uint32_t output_index) {
+	if(damage_tracking && skipped_outputs[output_index]) {
+		return EncodedData {
+			.regions = frame_regions_sizes[output_index] != 0 ? frame_regions[output_index] : nullptr,
+			.regions_size = frame_regions_sizes[output_index]
+		};
+	}
+	WaitForSingleObject(completion_events[output_index], INFINITE);
+	return LockOutput(capture_index, output_index);
+}
+
+EncodedData Encoder::LockOutput(uint32_t capture_index, uint32_t output_index) {
 	NV_ENC_LOCK_BITSTREAM lock_bitstream {
 		.version = NV_ENC_LOCK_BITSTREAM_VER,
-		.outputBitstream = nvenc_output_buffers[index]
+		.outputBitstream = nvenc_output_buffers[output_index]
 	};
 	NVENC_CHECK(nvenc_api.nvEncLockBitstream(nvenc_encoder, &lock_bitstream));
 
+	// Locking waits for the encode to finish, the input is no longer needed
+	registration_cache.Unmap(encoded_textures[output_index]);
+
 	return EncodedData {
 		.ptr = lock_bitstream.bitstreamBufferPtr,
-		.size = lock_bitstream.bitstreamSizeInBytes
+		.size = lock_bitstream.bitstreamSizeInBytes,
+		.keyframe = lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
+		.regions = frame_regions_sizes[output_index] != 0 ? frame_regions[output_index] : nullptr,
+		.regions_size = frame_regions_sizes[output_index]
 	};
 }
 
-
-EncodedData Encoder::StartCapture() {
-	if(d3d11_resource) {
-		d3d11_output_duplication->ReleaseFrame();
-		d3d11_resource->Release();
-		d3d11_resource = nullptr;
+void Encoder::ReleaseOutput(uint32_t output_index) {
+	// Tile output buffers need no unlocking
+	if(codec == Codec::Tiles || (damage_tracking && skipped_outputs[output_index])) {
+		return;
 	}
+	NVENC_CHECK(nvenc_api.nvEncUnlockBitstream(nvenc_encoder, nvenc_output_buffers[output_index]));
+}
 
-	DXGI_OUTDUPL_FRAME_INFO frame_info {};
-	HRESULT dxgi_result = d3d11_output_duplication->AcquireNextFrame(1, &frame_info, &d3d11_resource);
-	if(dxgi_result == DXGI_ERROR_WAIT_TIMEOUT) {
-		return {};
+void Encoder::SetBitrate(uint32_t new_bitrate) {
+	if(bitrate == 0 || new_bitrate == bitrate) {
+		return;
 	}
-	assert(dxgi_result == 0 && "Error duplicating desktop output"); 
-	WIN_CHECK(d3d11_resource->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void **>(&d3d11_texture)));
-
-	return Encode();
+	bitrate = new_bitrate;
+
+	// The VBV buffer keeps its length in time, so frame sizes stay bounded
+	// the same way at any bitrate
+	NV_ENC_RC_PARAMS &rc = encoder_config.config.rcParams;
+	double scale = static_cast<double>(bitrate) / initial_rate_control.averageBitRate;
+	rc.averageBitRate = bitrate;
+	rc.maxBitRate = static_cast<uint32_t>(initial_rate_control.maxBitRate * scale);
+	rc.vbvBufferSize = static_cast<uint32_t>(initial_rate_control.vbvBufferSize * scale);
+	rc.vbvInitialDelay = static_cast<uint32_t>(initial_rate_control.vbvInitialDelay * scale);
+
+	NV_ENC_RECONFIGURE_PARAMS reconfigure_params {
+		.version = NV_ENC_RECONFIGURE_PARAMS_VER,
+		.reInitEncodeParams = encoder_config.init_params,
+		.resetEncoder = 0,
+		.forceIDR = 0
+	};
+	NVENC_CHECK(nvenc_api.nvEncReconfigureEncoder(nvenc_encoder, &reconfigure_params));
 }
 
-void Encoder::EndCapture() {
-	int index = current_buffer_index % NUM_IO_BUFFERS;
-	NVENC_CHECK(nvenc_api.nvEncUnlockBitstream(nvenc_encoder, nvenc_output_buffers[index]));
-	++current_buffer_index;
+void Encoder::ForceKeyframe() {
+	force_keyframe = true;
 }
 
 void Encoder::Shutdown() {
+	if(codec == Codec::Hevc) {
+		// The pipeline has stopped, its completion thread and Stop have
+		// retrieved every frame. Signal end of stream and, in async mode, wait
+		// for it to complete while its event is still registered
+		NV_ENC_PIC_PARAMS pic_params_eos {
+			.version = NV_ENC_PIC_PARAMS_VER,
+			.encodePicFlags = NV_ENC_PIC_FLAG_EOS,
+			.completionEvent = async_encode ? completion_events[0] : nullptr
+		};
+		NVENC_CHECK(nvenc_api.nvEncEncodePicture(nvenc_encoder, &pic_params_eos));
+		if(async_encode) {
+			uint32_t wait_result = WaitForSingleObject(completion_events[0], EOS_TIMEOUT_MS);
+			if(wait_result != WAIT_OBJECT_0) {
+				printf("End of stream did not complete within %u ms\n", EOS_TIMEOUT_MS);
+			}
+		}
+
+		// Registrations have to be released while the textures are still alive
+		registration_cache.Shutdown();
+	}
+
 	d3d11_device->Release();
 	d3d11_context->Release();
-	d3d11_output_duplication->Release();
+	if(d3d11_output_duplication) {
+		d3d11_output_duplication->Release();
+	}
 
-	for(int i = 0; i < NUM_IO_BUFFERS; ++i) {
-		NVENC_CHECK(nvenc_api.nvEncDestroyBitstreamBuffer(nvenc_encoder, nvenc_output_buffers[i]));
+	for(uint32_t i = 0; i < NUM_CAPTURE_BUFFERS; ++i) {
+		capture_textures[i]->Release();
+	}
+	if(copy_rects) {
+		for(uint32_t i = 0; i < NUM_IO_BUFFERS; ++i) {
+			canvas_textures[i]->Release();
+		}
 	}
 
-	// Signal end of stream
-	NV_ENC_PIC_PARAMS pic_params_eos {
-		.version = NV_ENC_PIC_PARAMS_VER,
-		.encodePicFlags = NV_ENC_PIC_FLAG_EOS
-	};
-	NVENC_CHECK(nvenc_api.nvEncEncodePicture(nvenc_encoder, &pic_params_eos));
+	if(codec == Codec::Tiles) {
+		staging_texture->Release();
+		tiles.Shutdown();
+	}
+	else {
+		for(int i = 0; i < NUM_IO_BUFFERS; ++i) {
+			NVENC_CHECK(nvenc_api.nvEncDestroyBitstreamBuffer(nvenc_encoder, nvenc_output_buffers[i]));
+
+			if(async_encode) {
+				NV_ENC_EVENT_PARAMS event_params {
+					.version = NV_ENC_EVENT_PARAMS_VER,
+					.completionEvent = completion_events[i]
+				};
+				NVENC_CHECK(nvenc_api.nvEncUnregisterAsyncEvent(nvenc_encoder, &event_params));
+				CloseHandle(completion_events[i]);
+			}
+		}
+
+		NVENC_CHECK(nvenc_api.nvEncDestroyEncoder(nvenc_encoder));
+	}
 
-	NVENC_CHECK(nvenc_api.nvEncDestroyEncoder(nvenc_encoder));
+	if(pointer_shape_buffer) {
+		PlatformFree(pointer_shape_buffer, pointer_shape_buffer_size);
+	}
+	PlatformFree(pointer_pixels, MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION * sizeof(uint32_t));
+	if(metadata_buffer) {
+		PlatformFree(metadata_buffer, metadata_buffer_size);
+	}
+	if(damage_tracking) {
+		PlatformFree(damage_maps, NUM_IO_BUFFERS * damage.BlockCount());
+	}
 }
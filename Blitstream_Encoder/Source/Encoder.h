@@ -3,42 +3,145 @@
 #include <d3d11_4.h>
 #include <dxgi1_6.h>
 #include <nvEncodeAPI.h>
-
-constexpr uint32_t NUM_IO_BUFFERS = 4;
-
-struct EncodedData {
-	void *ptr;
-	uint32_t size;
-};
+#include "CursorState.h"
+#include "DamageTracker.h"
+#include "EncoderProfile.h"
+#include "Options.h"
+#include "Pipeline.h"
+#include "RegistrationCache.h"
+#include "TileEncoder.h"
 
 struct Encoder {
 	uint32_t width;
 	uint32_t height;
+	uint32_t frame_rate;
+	bool async_encode;
+	// With Codec::Tiles none of the NVENC state below is used
+	Codec codec;
 	
 	ID3D11Device *d3d11_device;
 	ID3D11DeviceContext *d3d11_context;
+	// Null while it is lost, Capture creates it again
 	IDXGIOutputDuplication *d3d11_output_duplication;
-	IDXGIResource *d3d11_resource;
-	ID3D11Texture2D *d3d11_texture;
+	// Size of the desktop, which after a mode change may differ from the
+	// stream's width and height. Only the top left of a larger desktop is
+	// captured, a smaller one leaves the rest as it was
+	uint32_t desktop_width;
+	uint32_t desktop_height;
+	ID3D11Texture2D *capture_textures[NUM_CAPTURE_BUFFERS];
+	// Holds the last desktop frame captured, INVALID_CAPTURE_INDEX before the
+	// first. Owned by the capture thread
+	uint32_t last_capture_index;
+
+	// Pointer updates are handed to it instead of being encoded, null to
+	// ignore the pointer. Set before the first capture
+	CursorState *cursor;
+	// GetFramePointerShape output, grown as needed
+	uint8_t *pointer_shape_buffer;
+	uint32_t pointer_shape_buffer_size;
+	// The shape converted to straight alpha BGRA, MAX_CURSOR_DIMENSION squared
+	uint32_t *pointer_pixels;
+
+	// Every update's dirty and move rects go to damage under the capture's
+	// sequence number. A capture without changes since the last encoded one
+	// is not encoded, the client repeats its frame instead
+	bool damage_tracking;
+	DamageTracker damage;
+	// GetFrameMoveRects and GetFrameDirtyRects output, grown as needed
+	uint8_t *metadata_buffer;
+	uint32_t metadata_buffer_size;
+	// Written by the capture thread before the capture is handed on
+	uint32_t capture_sequences[NUM_CAPTURE_BUFFERS];
+	// One qpDeltaMap per output buffer, kept until the output is released
+	int8_t *damage_maps;
+	// The encode into the output buffer was skipped, there is nothing to
+	// retrieve or unlock
+	bool skipped_outputs[NUM_IO_BUFFERS];
+
+	// With damage tracking, moves are sent as copies and the encoder sees a
+	// canvas per output buffer instead of the capture. A canvas is the one
+	// encoded last with only the damaged rects taken from the capture, so
+	// moved content is left as it was in the previous picture
+	bool copy_rects;
+	ID3D11Texture2D *canvas_textures[NUM_IO_BUFFERS];
+	// Owned by the encoding thread
+	uint32_t last_canvas;
+	// FrameRegions sent with each output buffer, empty for a whole picture
+	uint8_t frame_regions[NUM_IO_BUFFERS][MAX_FRAME_REGIONS_SIZE];
+	uint32_t frame_regions_sizes[NUM_IO_BUFFERS];
+	// What each output buffer was encoded from, unmapped once it is locked
+	ID3D11Texture2D *encoded_textures[NUM_IO_BUFFERS];
 
 	NV_ENCODE_API_FUNCTION_LIST nvenc_api;
 	void *nvenc_encoder;
 	GUID nvenc_encode_guid;
 	GUID nvenc_preset_guid;
 	GUID nvenc_profile_guid;
+	const EncoderProfile *encoder_profile;
+	EncoderConfig encoder_config;
+	// Rate control as built from the profile, bitrate changes scale it
+	NV_ENC_RC_PARAMS initial_rate_control;
+	// Current average bitrate, 0 if the rate control mode has none
+	uint32_t bitrate;
+	// The next frame is encoded as an IDR, owned by the encoding thread
+	bool force_keyframe;
+	RegistrationCache registration_cache;
+
+	// Codec::Tiles reads each capture back through the staging texture, the
+	// damaged tiles are the tile mask
+	TileEncoder tiles;
+	ID3D11Texture2D *staging_texture;
 
-	uint32_t current_buffer_index;
 	NV_ENC_OUTPUT_PTR nvenc_output_buffers[NUM_IO_BUFFERS];
+	// Signaled when the encode into the matching output buffer completes, async mode only
+	HANDLE completion_events[NUM_IO_BUFFERS];
 
-	void Initialize();
+	void Initialize(uint32_t fps, const EncoderOptions &options);
 
-	void CreateDisplayDuplication();
+	// Duplicates the first output, false if it cannot be duplicated right now
+	bool CreateDisplayDuplication();
+	// After the duplication was lost, from the capture thread. Marks the whole
+	// frame damaged and evicts the encoder's registrations
+	bool RecreateDisplayDuplication();
+	void CreateCaptureTextures();
 	void CreateEncoder();
+	void CreateTileEncoder(uint32_t thread_total);
+
+	// Copies the next desktop frame into a capture texture, returns false if
+	// the desktop has not been updated. Pointer updates go to cursor, one
+	// that only moved the pointer returns false as well
+	bool Capture(uint32_t capture_index);
+	// Copies the last captured desktop frame into a capture texture again,
+	// returns false if nothing has been captured yet
+	bool RepeatCapture(uint32_t capture_index);
+	// Reads the new pointer shape of the frame being captured
+	void CapturePointerShape(uint32_t size);
+	// Adds the move and dirty rects of the frame being captured to damage,
+	// size is the frame's TotalMetadataBufferSize
+	void CaptureDamage(uint32_t size);
+
+	// Encodes a capture texture into an output buffer, the returned data
+	// stays valid until the output buffer is released. In async mode this only
+	// submits the frame and the data is returned from Retrieve instead. With
+	// damage tracking a capture without changes returns no data, which is sent
+	// as a duplicate frame, and one that only moved content returns copies
+	// without a picture
+	EncodedData Encode(uint32_t capture_index, uint32_t output_index);
+	// Takes the region from the capture into the output buffer's canvas, or
+	// the whole capture if region is null, and returns the canvas
+	ID3D11Texture2D *UpdateCanvas(uint32_t capture_index, uint32_t output_index, const DamageRegion *region);
+	// Encode for Codec::Tiles, always synchronous
+	EncodedData EncodeTiles(uint32_t capture_index, uint32_t output_index);
+	EncodedData Retrieve(uint32_t capture_index, uint32_t output_index);
+	void ReleaseOutput(uint32_t output_index);
 
-	EncodedData Encode();
+	// Changes the bitrate without a keyframe, from the encoding thread
+	void SetBitrate(uint32_t new_bitrate);
+	// Makes the next frame an IDR with the parameter sets in front, from the
+	// encoding thread
+	void ForceKeyframe();
 
-	EncodedData StartCapture();
-	void EndCapture();
+	EncodedData LockOutput(uint32_t capture_index, uint32_t output_index);
 
 	void Shutdown();
 };
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include "EncoderProfile.h"
+#include <cstdio>
+#include <cstring>
+
+const EncoderProfile ENCODER_PROFILES[NUM_ENCODER_PROFILES] {
+	{
+		.name = "ultra-low-latency",
+		.preset_guid = NV_ENC_PRESET_P4_GUID,
+		.tuning_info = NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY,
+		.keep_preset_rate_control = false,
+		.rate_control_mode = NV_ENC_PARAMS_RC_CBR,
+		.multi_pass = NV_ENC_MULTI_PASS_DISABLED,
+		.bits_per_pixel = 0.08f,
+		.vbv_frames = 1,
+		.adaptive_quantization = true,
+		.infinite_gop = true,
+		.intra_refresh = true,
+		.intra_refresh_period_ms = 2000,
+		.intra_refresh_duration_ms = 250
+	},
+	{
+		.name = "low-latency",
+		.preset_guid = NV_ENC_PRESET_P5_GUID,
+		.tuning_info = NV_ENC_TUNING_INFO_LOW_LATENCY,
+		.keep_preset_rate_control = false,
+		.rate_control_mode = NV_ENC_PARAMS_RC_CBR,
+		.multi_pass = NV_ENC_TWO_PASS_QUARTER_RESOLUTION,
+		.bits_per_pixel = 0.1f,
+		.vbv_frames = 4,
+		.adaptive_quantization = true,
+		.infinite_gop = true,
+		.intra_refresh = true,
+		.intra_refresh_period_ms = 2000,
+		.intra_refresh_duration_ms = 500
+	},
+	{
+		// Preset defaults, periodic IDR frames and B-frames included
+		.name = "quality",
+		.preset_guid = NV_ENC_PRESET_P7_GUID,
+		.tuning_info = NV_ENC_TUNING_INFO_HIGH_QUALITY,
+		.keep_preset_rate_control = true,
+		.infinite_gop = false,
+		.intra_refresh = false
+	}
+};
+
+const EncoderProfile *FindEncoderProfile(const char *name) {
+	for(uint32_t i = 0; i < NUM_ENCODER_PROFILES; ++i) {
+		if(strcmp(ENCODER_PROFILES[i].name, name) == 0) {
+			return &ENCODER_PROFILES[i];
+		}
+	}
+	return nullptr;
+}
+
+// GUID only has operator== on Windows
+static bool IsHevc(const GUID &codec_guid) {
+	return memcmp(&codec_guid, &NV_ENC_CODEC_HEVC_GUID, sizeof(GUID)) == 0;
+}
+
+static uint32_t MillisecondsToFrames(uint32_t ms, uint32_t fps) {
+	return static_cast<uint32_t>(static_cast<uint64_t>(ms) * fps / 1000);
+}
+
+void BuildEncoderConfig(const EncoderProfile &profile, const EncoderConfigInput &input, EncoderConfig *output) {
+	NV_ENC_CONFIG &config = output->config;
+	config = input.preset_config;
+	config.version = NV_ENC_CONFIG_VER;
+	config.profileGUID = input.profile_guid;
+
+	if(!profile.keep_preset_rate_control) {
+		NV_ENC_RC_PARAMS &rc = config.rcParams;
+		uint64_t bitrate = static_cast<uint64_t>(static_cast<double>(input.width) * input.height *
+												 input.fps * profile.bits_per_pixel);
+		bitrate = bitrate > UINT32_MAX ? UINT32_MAX : bitrate;
+
+		rc.rateControlMode = profile.rate_control_mode;
+		rc.multiPass = profile.multi_pass;
+		rc.averageBitRate = static_cast<uint32_t>(bitrate);
+		rc.maxBitRate = static_cast<uint32_t>(bitrate);
+		rc.vbvBufferSize = static_cast<uint32_t>(bitrate * profile.vbv_frames / input.fps);
+		rc.vbvInitialDelay = rc.vbvBufferSize;
+		rc.enableAQ = profile.adaptive_quantization ? 1 : 0;
+		// Lookahead holds frames back before they are encoded
+		rc.enableLookahead = 0;
+		rc.lookaheadDepth = 0;
+	}
+	config.rcParams.qpMapMode = input.qp_map_mode;
+
+	uint32_t idr_period = config.gopLength;
+	uint32_t refresh_period = 0;
+	uint32_t refresh_count = 0;
+	if(profile.infinite_gop) {
+		config.gopLength = NVENC_INFINITE_GOPLENGTH;
+		idr_period = NVENC_INFINITE_GOPLENGTH;
+		// B-frames add reordering delay and disable intra refresh
+		config.frameIntervalP = 1;
+		config.rcParams.zeroReorderDelay = 1;
+	}
+	if(profile.intra_refresh && profile.infinite_gop) {
+		refresh_period = MillisecondsToFrames(profile.intra_refresh_period_ms, input.fps);
+		refresh_period = refresh_period < 2 ? 2 : refresh_period;
+		refresh_count = MillisecondsToFrames(profile.intra_refresh_duration_ms, input.fps);
+		refresh_count = refresh_count < 1 ? 1 : refresh_count;
+		refresh_count = refresh_count >= refresh_period ? refresh_period - 1 : refresh_count;
+	}
+
+	if(IsHevc(input.codec_guid)) {
+		NV_ENC_CONFIG_HEVC &hevc = config.encodeCodecConfig.hevcConfig;
+		hevc.idrPeriod = idr_period;
+		hevc.enableIntraRefresh = refresh_period ? 1 : 0;
+		hevc.intraRefreshPeriod = refresh_period;
+		hevc.intraRefreshCnt = refresh_count;
+		// Pinned rather than left to the preset, the QP delta map is laid out on HEVC_CTB_SIZE blocks
+		static_assert(HEVC_CTB_SIZE == 32, "maxCUSize has to match HEVC_CTB_SIZE");
+		hevc.maxCUSize = NV_ENC_HEVC_CUSIZE_32x32;
+	}
+	else {
+		NV_ENC_CONFIG_H264 &h264 = config.encodeCodecConfig.h264Config;
+		h264.idrPeriod = idr_period;
+		h264.enableIntraRefresh = refresh_period ? 1 : 0;
+		h264.intraRefreshPeriod = refresh_period;
+		h264.intraRefreshCnt = refresh_count;
+	}
+
+	output->init_params = NV_ENC_INITIALIZE_PARAMS {
+		.version = NV_ENC_INITIALIZE_PARAMS_VER,
+		.encodeGUID = input.codec_guid,
+		.presetGUID = profile.preset_guid,
+		.encodeWidth = input.width,
+		.encodeHeight = input.height,
+		.darWidth = input.width,
+		.darHeight = input.height,
+		.frameRateNum = input.fps,
+		.frameRateDen = 1,
+		.enableEncodeAsync = input.async_encode ? 1u : 0u,
+		.enablePTD = 1,
+		.encodeConfig = &output->config,
+		.maxEncodeWidth = 3840,
+		.maxEncodeHeight = 2160,
+		.tuningInfo = profile.tuning_info
+	};
+}
+
+static const char *RateControlName(NV_ENC_PARAMS_RC_MODE mode) {
+	switch(mode) {
+		case NV_ENC_PARAMS_RC_CONSTQP: return "constqp";
+		case NV_ENC_PARAMS_RC_VBR: return "vbr";
+		case NV_ENC_PARAMS_RC_CBR: return "cbr";
+		default: return "other";
+	}
+}
+
+static const char *TuningName(NV_ENC_TUNING_INFO tuning_info) {
+	switch(tuning_info) {
+		case NV_ENC_TUNING_INFO_HIGH_QUALITY: return "high quality";
+		case NV_ENC_TUNING_INFO_LOW_LATENCY: return "low latency";
+		case NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY: return "ultra low latency";
+		case NV_ENC_TUNING_INFO_LOSSLESS: return "lossless";
+		default: return "undefined";
+	}
+}
+
+void PrintEncoderConfig(const EncoderProfile &profile, const EncoderConfig &output) {
+	const NV_ENC_INITIALIZE_PARAMS &init = output.init_params;
+	const NV_ENC_CONFIG &config = output.config;
+	bool hevc = IsHevc(init.encodeGUID);
+
+	uint32_t idr_period = hevc ? config.encodeCodecConfig.hevcConfig.idrPeriod : config.encodeCodecConfig.h264Config.idrPeriod;
+	uint32_t refresh_period = hevc ? config.encodeCodecConfig.hevcConfig.intraRefreshPeriod : config.encodeCodecConfig.h264Config.intraRefreshPeriod;
+	uint32_t refresh_count = hevc ? config.encodeCodecConfig.hevcConfig.intraRefreshCnt : config.encodeCodecConfig.h264Config.intraRefreshCnt;
+
+	printf("Encoder profile %s: %s %ux%u @ %u fps, %s tuning\n", profile.name, hevc ? "HEVC" : "H264",
+		   init.encodeWidth, init.encodeHeight, init.frameRateNum, TuningName(init.tuningInfo));
+	printf("  rate control %s, %u kbps (max %u), vbv %u bits, multipass %d, aq %u, lookahead %u\n",
+		   RateControlName(config.rcParams.rateControlMode), config.rcParams.averageBitRate / 1000,
+		   config.rcParams.maxBitRate / 1000, config.rcParams.vbvBufferSize, config.rcParams.multiPass,
+		   config.rcParams.enableAQ, config.rcParams.enableLookahead);
+	if(config.gopLength == NVENC_INFINITE_GOPLENGTH) {
+		printf("  gop infinite, ");
+	}
+	else {
+		printf("  gop %u, idr %u, ", config.gopLength, idr_period);
+	}
+	printf("p interval %d, intra refresh %u frames every %u\n", config.frameIntervalP, refresh_count, refresh_period);
+	if(config.rcParams.qpMapMode != NV_ENC_QP_MAP_DISABLED) {
+		printf("  damaged %s get a qp delta\n", hevc ? "CTBs" : "macroblocks");
+	}
+}
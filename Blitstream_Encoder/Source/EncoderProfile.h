@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <nvEncodeAPI.h>
+
+// Named set of encoder settings, the preset's defaults are only kept for
+// whatever a profile does not override
+struct EncoderProfile {
+	const char *name;
+	GUID preset_guid;
+	NV_ENC_TUNING_INFO tuning_info;
+
+	// Rate control, keep_preset_rate_control leaves rcParams as the preset set them
+	bool keep_preset_rate_control;
+	NV_ENC_PARAMS_RC_MODE rate_control_mode;
+	NV_ENC_MULTI_PASS multi_pass;
+	// Target bitrate relative to the pixel rate
+	float bits_per_pixel;
+	// VBV buffer size in frames at the target bitrate, 1 bounds every frame
+	// to its share of the bitrate so no frame takes longer than an interval to send
+	uint32_t vbv_frames;
+	bool adaptive_quantization;
+
+	// Never insert keyframes on a schedule, recover with intra refresh instead
+	bool infinite_gop;
+	bool intra_refresh;
+	// Time between the start of two refresh waves and the time a wave is
+	// spread over
+	uint32_t intra_refresh_period_ms;
+	uint32_t intra_refresh_duration_ms;
+};
+
+// HEVC coding tree block size every profile encodes with, the QP delta map
+// has one entry per block. NVENC supports no other maximum CU size
+constexpr uint32_t HEVC_CTB_SIZE = 32;
+
+constexpr uint32_t NUM_ENCODER_PROFILES = 3;
+constexpr const char *DEFAULT_ENCODER_PROFILE = "ultra-low-latency";
+
+extern const EncoderProfile ENCODER_PROFILES[NUM_ENCODER_PROFILES];
+
+// Returns nullptr if no profile has the given name
+const EncoderProfile *FindEncoderProfile(const char *name);
+
+// Resolved NVENC session configuration, init_params.encodeConfig points into
+// the struct itself so it must not be copied after building
+struct EncoderConfig {
+	NV_ENC_INITIALIZE_PARAMS init_params;
+	NV_ENC_CONFIG config;
+};
+
+struct EncoderConfigInput {
+	GUID codec_guid;
+	GUID profile_guid;
+	uint32_t width;
+	uint32_t height;
+	uint32_t fps;
+	bool async_encode;
+	// How NV_ENC_PIC_PARAMS::qpDeltaMap is read, NV_ENC_QP_MAP_DISABLED
+	// without damage hints
+	NV_ENC_QP_MAP_MODE qp_map_mode;
+	// Configuration returned by nvEncGetEncodePresetConfigEx for the profile's
+	// preset and tuning info
+	NV_ENC_CONFIG preset_config;
+};
+
+// Applies a profile on top of the preset configuration. Only fills in the
+// structs and makes no NVENC calls
+void BuildEncoderConfig(const EncoderProfile &profile, const EncoderConfigInput &input, EncoderConfig *output);
+
+void PrintEncoderConfig(const EncoderProfile &profile, const EncoderConfig &output);
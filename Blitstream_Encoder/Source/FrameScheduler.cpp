@@ -0,0 +1,148 @@
+#include "FrameScheduler.h"
+#include <cstdio>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <cerrno>
+#include <ctime>
+#endif
+
+// Starting spin threshold, timer wakeups are typically late by less than this
+constexpr uint64_t DEFAULT_SPIN_THRESHOLD_NS = 150000;
+constexpr uint64_t MIN_SPIN_THRESHOLD_NS = 50000;
+// Without a high resolution timer Windows wakes up to a scheduler tick late
+constexpr uint64_t COARSE_TIMER_SPIN_THRESHOLD_NS = 2000000;
+// Wakeups later than this share of the interval come from load rather than
+// the timer, spinning longer would not help
+constexpr uint64_t MAX_SPIN_INTERVAL_DIVISOR = 4;
+// Threshold rises by a step for every wakeup later than it and falls by a
+// 64th of a step for every other, so it settles where about one wakeup in 65
+// is later than it. Single outliers move it by no more than a step
+constexpr uint64_t SPIN_CALIBRATION_STEP_NS = 32000;
+constexpr uint64_t SPIN_CALIBRATION_RATIO = 64;
+
+static inline void SpinPause() {
+#if defined(_M_X64) || defined(__x86_64__)
+	_mm_pause();
+#endif
+}
+
+void FrameScheduler::Initialize(uint32_t fps) {
+	fps = fps < MIN_FRAME_RATE ? MIN_FRAME_RATE : fps;
+	fps = fps > MAX_FRAME_RATE ? MAX_FRAME_RATE : fps;
+	interval_ns = 1000000000ull / fps;
+	spin_threshold_ns = DEFAULT_SPIN_THRESHOLD_NS;
+	min_spin_threshold_ns = MIN_SPIN_THRESHOLD_NS;
+	max_spin_threshold_ns = interval_ns / MAX_SPIN_INTERVAL_DIVISOR;
+
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	qpc_frequency = frequency.QuadPart;
+
+	// High resolution timers are available from Windows 10 1803 onwards,
+	// older systems fall back to a regular timer and rely on spinning
+	timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if(!timer) {
+		timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+		spin_threshold_ns = min_spin_threshold_ns = COARSE_TIMER_SPIN_THRESHOLD_NS;
+	}
+#endif
+	if(max_spin_threshold_ns < min_spin_threshold_ns) {
+		max_spin_threshold_ns = min_spin_threshold_ns;
+	}
+
+	next_deadline_ns = Now() + interval_ns;
+}
+
+uint64_t FrameScheduler::Now() {
+#ifdef _WIN32
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	uint64_t seconds = counter.QuadPart / qpc_frequency;
+	uint64_t remainder = counter.QuadPart % qpc_frequency;
+	return seconds * 1000000000ull + remainder * 1000000000ull / qpc_frequency;
+#else
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return static_cast<uint64_t>(time.tv_sec) * 1000000000ull + static_cast<uint64_t>(time.tv_nsec);
+#endif
+}
+
+uint64_t FrameScheduler::WaitForNextFrame() {
+	uint64_t deadline = next_deadline_ns;
+	uint64_t now = Now();
+
+	// Sleep through the bulk of the interval
+	if(deadline > now + spin_threshold_ns) {
+		uint64_t wake_ns = deadline - spin_threshold_ns;
+#ifdef _WIN32
+		// Negative due time is relative, in 100 ns units
+		LARGE_INTEGER due_time;
+		due_time.QuadPart = -static_cast<int64_t>((wake_ns - now) / 100);
+		if(SetWaitableTimerEx(timer, &due_time, 0, nullptr, nullptr, nullptr, 0)) {
+			WaitForSingleObject(timer, INFINITE);
+		}
+#else
+		timespec wake_time {
+			.tv_sec = static_cast<time_t>(wake_ns / 1000000000ull),
+			.tv_nsec = static_cast<long>(wake_ns % 1000000000ull)
+		};
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, nullptr) == EINTR);
+#endif
+		// Calibrate from how late the timer woke
+		now = Now();
+		uint64_t overshoot_ns = now > wake_ns ? now - wake_ns : 0;
+		if(overshoot_ns > spin_threshold_ns) {
+			spin_threshold_ns += SPIN_CALIBRATION_STEP_NS;
+		} else {
+			spin_threshold_ns -= SPIN_CALIBRATION_STEP_NS / SPIN_CALIBRATION_RATIO;
+		}
+		spin_threshold_ns = spin_threshold_ns < min_spin_threshold_ns ? min_spin_threshold_ns : spin_threshold_ns;
+		spin_threshold_ns = spin_threshold_ns > max_spin_threshold_ns ? max_spin_threshold_ns : spin_threshold_ns;
+	}
+
+	// Spin for the remainder
+	while((now = Now()) < deadline) {
+		SpinPause();
+	}
+
+	uint64_t jitter_us = (now - deadline) / 1000;
+	stats.frames.fetch_add(1, std::memory_order_relaxed);
+	stats.total_jitter_us.fetch_add(jitter_us, std::memory_order_relaxed);
+	if(jitter_us > stats.max_jitter_us.load(std::memory_order_relaxed)) {
+		stats.max_jitter_us.store(jitter_us, std::memory_order_relaxed);
+	}
+
+	// Advance from the previous deadline so wakeup error never accumulates,
+	// if whole intervals were missed skip them instead of bursting to catch up
+	next_deadline_ns = deadline + interval_ns;
+	if(now >= next_deadline_ns) {
+		uint64_t missed = (now - deadline) / interval_ns;
+		stats.missed_deadlines.fetch_add(missed, std::memory_order_relaxed);
+		next_deadline_ns = deadline + (missed + 1) * interval_ns;
+	}
+
+	return deadline;
+}
+
+void FrameScheduler::PrintStats() {
+	uint64_t frames = stats.frames.exchange(0, std::memory_order_relaxed);
+	uint64_t total_jitter_us = stats.total_jitter_us.exchange(0, std::memory_order_relaxed);
+	printf("Scheduler: %llu frames, jitter avg %llu us, max %llu us, %llu missed deadlines\n",
+		   static_cast<unsigned long long>(frames),
+		   static_cast<unsigned long long>(frames ? total_jitter_us / frames : 0),
+		   static_cast<unsigned long long>(stats.max_jitter_us.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(stats.missed_deadlines.exchange(0, std::memory_order_relaxed)));
+}
+
+void FrameScheduler::Shutdown() {
+#ifdef _WIN32
+	if(timer) {
+		CloseHandle(timer);
+		timer = nullptr;
+	}
+#endif
+}
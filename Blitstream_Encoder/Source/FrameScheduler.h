@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+constexpr uint32_t MIN_FRAME_RATE = 30;
+constexpr uint32_t MAX_FRAME_RATE = 240;
+
+// Written by the scheduling thread, may be read and reset from another
+struct FrameSchedulerStats {
+	std::atomic<uint64_t> frames;
+	std::atomic<uint64_t> missed_deadlines;
+	std::atomic<uint64_t> total_jitter_us;
+	std::atomic<uint64_t> max_jitter_us;
+};
+
+// Paces a loop at a fixed frame rate. Deadlines are accumulated from the start
+// time rather than from the previous wakeup so errors do not drift, and each
+// wait sleeps on the OS timer until shortly before the deadline and spins for
+// the remainder. How long before is calibrated from how late the timer wakes
+struct FrameScheduler {
+	uint64_t interval_ns;
+	uint64_t next_deadline_ns;
+	// Remaining time below which the scheduler spins instead of sleeping
+	uint64_t spin_threshold_ns;
+	// Bounds of the calibrated threshold, the lower one is raised where the
+	// timer is coarse
+	uint64_t min_spin_threshold_ns;
+	uint64_t max_spin_threshold_ns;
+
+#ifdef _WIN32
+	HANDLE timer;
+	int64_t qpc_frequency;
+#endif
+
+	FrameSchedulerStats stats;
+
+	void Initialize(uint32_t fps);
+
+	// Blocks until the next frame deadline, returns the deadline that was waited for
+	uint64_t WaitForNextFrame();
+
+	// Current time on the scheduler's clock
+	uint64_t Now();
+
+	// Prints and resets the jitter statistics
+	void PrintStats();
+
+	void Shutdown();
+};
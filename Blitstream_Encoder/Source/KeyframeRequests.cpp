@@ -0,0 +1,36 @@
+#include "KeyframeRequests.h"
+
+void KeyframeRequests::Initialize() {
+	pending.store(false, std::memory_order_relaxed);
+	last_forced_timestamp.store(0, std::memory_order_relaxed);
+	stats.requests.store(0, std::memory_order_relaxed);
+	stats.forced.store(0, std::memory_order_relaxed);
+}
+
+void KeyframeRequests::Request() {
+	stats.requests.fetch_add(1, std::memory_order_relaxed);
+	pending.store(true, std::memory_order_release);
+}
+
+bool KeyframeRequests::Due(uint64_t now) {
+	uint64_t last_forced = last_forced_timestamp.load(std::memory_order_relaxed);
+	if(last_forced != 0 && now - last_forced < MIN_KEYFRAME_INTERVAL_US) {
+		return false;
+	}
+	// Requests arriving from here on need a keyframe after this one
+	if(!pending.exchange(false, std::memory_order_acquire)) {
+		return false;
+	}
+
+	last_forced_timestamp.store(now, std::memory_order_relaxed);
+	stats.forced.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool KeyframeRequests::Pending(uint64_t now) const {
+	uint64_t last_forced = last_forced_timestamp.load(std::memory_order_relaxed);
+	if(last_forced != 0 && now - last_forced < MIN_KEYFRAME_INTERVAL_US) {
+		return false;
+	}
+	return pending.load(std::memory_order_acquire);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Shortest time between two forced keyframes, requests in between are merged
+// into the one forced once it has passed
+constexpr uint64_t MIN_KEYFRAME_INTERVAL_US = 100000;
+
+// Written by the threads making and serving requests, may be read and reset
+// from another
+struct KeyframeRequestStats {
+	std::atomic<uint64_t> requests;
+	std::atomic<uint64_t> forced;
+};
+
+// Collects keyframe requests from viewers that joined, fell behind or lost
+// packets, and hands them to the encoding thread. However many arrive at once
+// they end up as a single IDR, and IDRs are forced at most every
+// MIN_KEYFRAME_INTERVAL_US so a flood of requests cannot turn the stream into
+// keyframes only. The first request after a quiet period is served right away
+struct KeyframeRequests {
+	std::atomic<bool> pending;
+	// Written by the encoding thread, 0 if none has been forced yet
+	std::atomic<uint64_t> last_forced_timestamp;
+
+	KeyframeRequestStats stats;
+
+	void Initialize();
+
+	// May be called from any thread
+	void Request();
+
+	// Called by the encoding thread before each frame with a PlatformTimestamp
+	// reading, returns true if the frame should be forced to be a keyframe
+	bool Due(uint64_t now);
+	// True if Due would force a keyframe now, leaves the requests pending.
+	// May be called from the capture thread
+	bool Pending(uint64_t now) const;
+};
@@ -1,45 +1,233 @@
 #define WIN32_LEAN_AND_MEAN
 
 #include <cstdio>
-#include <chrono>
 #include <cassert>
 
+#ifdef _WIN32
 #include "Encoder.h"
+#endif
+#include "LatencyHistogram.h"
+#include "Options.h"
+#include "Pipeline.h"
+#include "Platform.h"
 #include "Server.h"
+#include "Session.h"
+#include "SyntheticSource.h"
 
-int main(int argc, char **argv) {
-	Encoder encoder {};
-	encoder.Initialize();
+// Desktop duplication and NVENC are Windows only, elsewhere the synthetic
+// source is the only one
+struct StreamContext {
+#ifdef _WIN32
+	Encoder *encoder;
+#endif
+	SyntheticSource *synthetic;
+	Server *server;
+	Pipeline *pipeline;
+	LatencyReport *latency_report;
+	uint32_t fps;
+	// Last bitrate handed to the encoder, owned by the encoding thread
+	uint32_t bitrate;
+};
 
-	Server server {};
-	server.Initialize(encoder.width, encoder.height);
+// The viewers' bitrate if it changed since the last call, 0 otherwise
+static uint32_t BitrateChange(StreamContext *context) {
+	uint32_t bitrate = context->server->target_bitrate.load(std::memory_order_relaxed);
+	if(bitrate == context->bitrate) {
+		return 0;
+	}
+	context->bitrate = bitrate;
+	return bitrate;
+}
+
+static bool SyntheticCaptureStage(void *user_data, uint32_t capture_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	return context->synthetic->Capture(capture_index);
+}
+
+// A viewer that joins or asks for a keyframe while nothing changes would
+// otherwise wait for the next change to get a picture
+static bool KeyframeWanted(StreamContext *context) {
+	return context->server->keyframe_requests.Pending(PlatformTimestamp());
+}
 
-	using namespace std::chrono;
-	auto start = high_resolution_clock::now();
-	auto end = high_resolution_clock::now();
+static bool SyntheticRepeatStage(void *user_data, uint32_t capture_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	return KeyframeWanted(context) && context->synthetic->RepeatCapture(capture_index);
+}
 
-	for(;;) {
-		if(duration_cast<microseconds>(end - start).count() > 16666) {
-			start = high_resolution_clock::now();
-			EncodedData data = encoder.StartCapture();
+static EncodedData SyntheticEncodeStage(void *user_data, uint32_t capture_index, uint32_t output_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	uint32_t bitrate = BitrateChange(context);
+	if(bitrate != 0) {
+		context->synthetic->SetBitrate(bitrate, context->fps);
+	}
+	// Requests from any number of viewers come down to one keyframe here
+	if(context->server->keyframe_requests.Due(PlatformTimestamp())) {
+		context->synthetic->ForceKeyframe();
+	}
+	return context->synthetic->Encode(capture_index, output_index);
+}
+
+static void SyntheticReleaseStage(void *user_data, uint32_t output_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	context->synthetic->Release(output_index);
+}
+
+#ifdef _WIN32
+static bool CaptureStage(void *user_data, uint32_t capture_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	return context->encoder->Capture(capture_index);
+}
+
+static bool RepeatStage(void *user_data, uint32_t capture_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	return KeyframeWanted(context) && context->encoder->RepeatCapture(capture_index);
+}
+
+static EncodedData EncodeStage(void *user_data, uint32_t capture_index, uint32_t output_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	uint32_t bitrate = BitrateChange(context);
+	if(bitrate != 0) {
+		context->encoder->SetBitrate(bitrate);
+	}
+	// Requests from any number of viewers come down to one keyframe here
+	if(context->server->keyframe_requests.Due(PlatformTimestamp())) {
+		context->encoder->ForceKeyframe();
+	}
+	return context->encoder->Encode(capture_index, output_index);
+}
 
-			// Send data
-			bool success = server.SendData(data.ptr, data.size);
+static EncodedData RetrieveStage(void *user_data, uint32_t capture_index, uint32_t output_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	return context->encoder->Retrieve(capture_index, output_index);
+}
 
-			if(!success) {
-				encoder.EndCapture();
-				server.Shutdown();
-				encoder.Shutdown();
-				memset(&server, 0, sizeof(Server));
-				memset(&encoder, 0, sizeof(Encoder));
-				encoder.Initialize();
-				server.Initialize(encoder.width, encoder.height);
+static void ReleaseStage(void *user_data, uint32_t output_index) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	context->encoder->ReleaseOutput(output_index);
+}
+#endif
 
-				continue;
-			}
+static bool SendStage(void *user_data, const EncodedData &data, uint64_t capture_timestamp_ns) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	return context->server->SendData(data.ptr, data.size, data.keyframe, data.regions, data.regions_size,
+									 capture_timestamp_ns / 1000);
+}
 
-			encoder.EndCapture();
+static void ReportStats(void *user_data, uint64_t elapsed_us) {
+	StreamContext *context = static_cast<StreamContext *>(user_data);
+	context->pipeline->PrintStats(elapsed_us);
+	context->server->PrintStats();
+	context->latency_report->Report(PlatformTimestamp());
+#ifdef _WIN32
+	if(!context->synthetic) {
+		if(context->encoder->codec == Codec::Tiles) {
+			context->encoder->tiles.PrintStats();
 		}
-		end = high_resolution_clock::now();
+		else {
+			context->encoder->registration_cache.PrintStats();
+		}
+		if(context->encoder->damage_tracking) {
+			context->encoder->damage.PrintStats();
+		}
+	}
+#endif
+}
+
+int main(int argc, char **argv) {
+	Options options = ParseOptions(argc, argv);
+#ifndef _WIN32
+	if(!options.synthetic.enabled) {
+		printf("Desktop capture needs Windows, streaming synthetic frames instead\n");
+		options.synthetic.enabled = true;
+	}
+#endif
+
+#ifdef _WIN32
+	Encoder encoder {};
+#endif
+	SyntheticSource synthetic {};
+	Server server {};
+	Pipeline pipeline {};
+
+	// Set up once, a viewer that reconnects gets its first frame from the
+	// encoder that served the previous one
+	uint32_t width = 0, height = 0, bitrate = 0;
+	Codec codec = Codec::Hevc;
+	if(options.synthetic.enabled) {
+		synthetic.Initialize(1920, 1080, options.synthetic.frame_size, options.synthetic.encode_time_us,
+							 options.synthetic.keyframe_interval);
+		width = synthetic.width;
+		height = synthetic.height;
+		uint64_t synthetic_bitrate = static_cast<uint64_t>(synthetic.frame_size) * 8 * options.fps;
+		bitrate = synthetic_bitrate > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(synthetic_bitrate);
+	}
+#ifdef _WIN32
+	else {
+		encoder.Initialize(options.fps, options.encoder);
+		width = encoder.width;
+		height = encoder.height;
+		bitrate = encoder.bitrate;
+		codec = encoder.codec;
+	}
+#endif
+	server.Initialize(width, height, bitrate, codec, options.server);
+
+	LatencyReport latency_report {};
+	latency_report.Initialize(options.latency_json_path);
+	pipeline.AddLatencyStages(&latency_report);
+	server.AddLatencyStages(&latency_report);
+
+	StreamContext context {
+#ifdef _WIN32
+		.encoder = &encoder,
+#endif
+		.synthetic = options.synthetic.enabled ? &synthetic : nullptr,
+		.server = &server,
+		.pipeline = &pipeline,
+		.latency_report = &latency_report,
+		.fps = options.fps,
+		.bitrate = bitrate
+	};
+	PipelineStages stages {
+		.user_data = &context,
+		.capture = SyntheticCaptureStage,
+		.repeat = SyntheticRepeatStage,
+		.encode = SyntheticEncodeStage,
+		.retrieve = nullptr,
+		.send = SendStage,
+		.release = SyntheticReleaseStage
+	};
+	if(options.synthetic.enabled) {
+		synthetic.cursor = options.synthetic.cursor ? &server.cursor : nullptr;
+		synthetic.cursor_shape_interval = options.fps;
+		synthetic.still = options.synthetic.still;
+	}
+#ifdef _WIN32
+	else {
+		encoder.cursor = &server.cursor;
+		stages.capture = CaptureStage;
+		stages.repeat = RepeatStage;
+		stages.encode = EncodeStage;
+		stages.retrieve = encoder.async_encode ? RetrieveStage : nullptr;
+		stages.release = ReleaseStage;
+	}
+#endif
+
+	Session session {};
+	session.Initialize(&pipeline, &server, stages, options.fps);
+	session.report = ReportStats;
+	session.report_user_data = &context;
+	session.Run();
+
+	server.Shutdown();
+	latency_report.Shutdown();
+	if(options.synthetic.enabled) {
+		synthetic.Shutdown();
+	}
+#ifdef _WIN32
+	else {
+		encoder.Shutdown();
 	}
+#endif
 }
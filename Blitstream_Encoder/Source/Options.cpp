@@ -0,0 +1,148 @@
+#include "Options.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "FrameScheduler.h"
+#include "ReedSolomon.h"
+
+Options ParseOptions(int argc, char **argv) {
+	Options options {};
+
+	for(int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if(strcmp(arg, "--fps") == 0 && value) {
+			options.fps = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			options.fps = options.fps < MIN_FRAME_RATE ? MIN_FRAME_RATE : options.fps;
+			options.fps = options.fps > MAX_FRAME_RATE ? MAX_FRAME_RATE : options.fps;
+			++i;
+		}
+		else if(strcmp(arg, "--latency-json") == 0 && value) {
+			options.latency_json_path = value;
+			++i;
+		}
+		else if(strcmp(arg, "--profile") == 0 && value) {
+			if(FindEncoderProfile(value)) {
+				options.encoder.profile = value;
+			}
+			else {
+				printf("Unknown encoder profile %s, using %s\n", value, options.encoder.profile);
+			}
+			++i;
+		}
+		else if(strcmp(arg, "--sync-encode") == 0) {
+			options.encoder.async_encode = false;
+		}
+		else if(strcmp(arg, "--no-damage") == 0) {
+			options.encoder.damage_tracking = false;
+		}
+		else if(strcmp(arg, "--no-copy-rects") == 0) {
+			options.encoder.copy_rects = false;
+		}
+		else if(strcmp(arg, "--codec") == 0 && value) {
+			if(strcmp(value, "tiles") == 0) {
+				options.encoder.codec = Codec::Tiles;
+			}
+			else if(strcmp(value, "hevc") == 0) {
+				options.encoder.codec = Codec::Hevc;
+			}
+			else {
+				printf("Unknown codec %s, using hevc\n", value);
+			}
+			++i;
+		}
+		else if(strcmp(arg, "--tile-threads") == 0 && value) {
+			options.encoder.tile_threads = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			++i;
+		}
+		else if(strcmp(arg, "--transport") == 0 && value) {
+			if(strcmp(value, "udp") == 0) {
+				options.server.transport = Transport::Udp;
+			}
+			else if(strcmp(value, "tcp") == 0) {
+				options.server.transport = Transport::Tcp;
+			}
+			else {
+				printf("Unknown transport %s, using tcp\n", value);
+			}
+			++i;
+		}
+		else if(strcmp(arg, "--fec") == 0 && value) {
+			options.server.fec_percent = static_cast<float>(atof(value));
+			++i;
+		}
+		else if(strcmp(arg, "--fec-block") == 0 && value) {
+			options.server.fec_block_size = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			options.server.fec_block_size = options.server.fec_block_size < 1 ? 1 : options.server.fec_block_size;
+			options.server.fec_block_size = options.server.fec_block_size > MAX_FEC_DATA_SHARDS ? MAX_FEC_DATA_SHARDS :
+																								   options.server.fec_block_size;
+			++i;
+		}
+		else if(strcmp(arg, "--no-nack") == 0) {
+			options.server.retransmit = false;
+		}
+		else if(strcmp(arg, "--fixed-bitrate") == 0) {
+			options.server.adaptive_bitrate = false;
+		}
+		else if(strcmp(arg, "--min-bitrate") == 0 && value) {
+			options.server.min_bitrate_kbps = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			++i;
+		}
+		else if(strcmp(arg, "--max-viewers") == 0 && value) {
+			options.server.max_viewers = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			++i;
+		}
+		else if(strcmp(arg, "--emulate-loss") == 0 && value) {
+			options.server.emulator.loss_percent = static_cast<float>(atof(value));
+			++i;
+		}
+		else if(strcmp(arg, "--emulate-burst") == 0 && value) {
+			options.server.emulator.burst_length = static_cast<float>(atof(value));
+			++i;
+		}
+		else if(strcmp(arg, "--emulate-delay-ms") == 0 && value) {
+			options.server.emulator.delay_us = static_cast<uint32_t>(atof(value) * 1000.0);
+			++i;
+		}
+		else if(strcmp(arg, "--emulate-jitter-ms") == 0 && value) {
+			options.server.emulator.jitter_us = static_cast<uint32_t>(atof(value) * 1000.0);
+			++i;
+		}
+		else if(strcmp(arg, "--emulate-rate-mbps") == 0 && value) {
+			options.server.emulator.rate_kbps = static_cast<uint32_t>(atof(value) * 1000.0);
+			++i;
+		}
+		else if(strcmp(arg, "--nagle") == 0) {
+			options.server.tcp_nodelay = false;
+		}
+		else if(strcmp(arg, "--sndbuf") == 0 && value) {
+			options.server.send_buffer_size = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			++i;
+		}
+		else if(strcmp(arg, "--synthetic") == 0 && value) {
+			options.synthetic.enabled = true;
+			options.synthetic.frame_size = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			++i;
+		}
+		else if(strcmp(arg, "--synthetic-encode-us") == 0 && value) {
+			options.synthetic.encode_time_us = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			++i;
+		}
+		else if(strcmp(arg, "--synthetic-gop") == 0 && value) {
+			options.synthetic.keyframe_interval = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			++i;
+		}
+		else if(strcmp(arg, "--synthetic-cursor") == 0) {
+			options.synthetic.cursor = true;
+		}
+		else if(strcmp(arg, "--synthetic-still") == 0) {
+			options.synthetic.still = true;
+		}
+		else {
+			printf("Ignoring unrecognized argument: %s\n", arg);
+		}
+	}
+
+	return options;
+}
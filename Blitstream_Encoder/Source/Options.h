@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include "EncoderProfile.h"
+#include "LinkEmulator.h"
+#include "Protocol.h"
+
+struct ServerOptions {
+	// TCP port to listen on, the UDP ports are picked by the system
+	const char *port = PORT;
+	// Disable Nagle so each frame leaves as soon as it is written
+	bool tcp_nodelay = true;
+	// Kernel send buffer size in bytes, 0 keeps the system default
+	uint32_t send_buffer_size = 0;
+	Transport transport = Transport::Tcp;
+	// Reed-Solomon parity packets per block of UDP packets as a share of the
+	// block in percent, 0 disables FEC
+	float fec_percent = 0.0f;
+	// Frame packets per FEC block, up to MAX_FEC_DATA_SHARDS
+	uint32_t fec_block_size = 32;
+	// Keep recently sent UDP packets and send them again when the client
+	// reports them missing
+	bool retransmit = true;
+	// Follow the bandwidth estimate from the client's feedback with the
+	// encoder bitrate, the encoder profile's bitrate is the upper limit
+	bool adaptive_bitrate = true;
+	uint32_t min_bitrate_kbps = 2000;
+	// Clients streamed to at once, up to MAX_VIEWERS
+	uint32_t max_viewers = 16;
+	// Applied to outgoing UDP packets
+	LinkEmulatorOptions emulator;
+};
+
+struct EncoderOptions {
+	// Submit frames with completion events and retrieve bitstreams on a
+	// separate thread, falls back to synchronous mode if unsupported
+	bool async_encode = true;
+	// Read the dirty and move rects of each capture, repeat the last frame
+	// instead of encoding one without changes and favor damaged blocks
+	bool damage_tracking = true;
+	// With damage tracking, send moved content as copies for the client to
+	// replay on its last frame instead of encoding it again
+	bool copy_rects = true;
+	// Name of an entry in ENCODER_PROFILES
+	const char *profile = DEFAULT_ENCODER_PROFILE;
+	// Codec::Tiles codes on the CPU and leaves NVENC and the profile unused
+	Codec codec = Codec::Hevc;
+	// Threads coding tiles, the encoding thread included. 0 uses every hardware thread
+	uint32_t tile_threads = 0;
+};
+
+struct SyntheticOptions {
+	// Replace desktop duplication and NVENC with generated frames
+	bool enabled = false;
+	uint32_t frame_size = 64u * 1024u;
+	uint32_t encode_time_us = 2000;
+	// Every this many frames is marked as a keyframe, 0 for only the first
+	uint32_t keyframe_interval = 60;
+	// Move a generated pointer on every capture and change its shape every second
+	bool cursor = false;
+	// Generate a single frame and no new ones after it, like a desktop that
+	// does not change
+	bool still = false;
+};
+
+struct Options {
+	// Capture rate, clamped to [MIN_FRAME_RATE, MAX_FRAME_RATE]
+	uint32_t fps = 60;
+	// Appends per-stage latency percentiles as JSON lines, null prints them only
+	const char *latency_json_path = nullptr;
+	EncoderOptions encoder;
+	ServerOptions server;
+	SyntheticOptions synthetic;
+};
+
+// Recognized arguments:
+//   --fps <rate>          Capture and encode rate, 30 to 240
+//   --latency-json <path> Append per-stage latency percentiles to a file every second
+//   --profile <name>      Encoder profile: ultra-low-latency, low-latency or quality
+//   --sync-encode         Block on each NVENC encode instead of waiting for completion events
+//   --no-damage           Encode every desktop update in full, whether or not anything changed
+//   --no-copy-rects       Encode moved content instead of sending it as copies
+//   --codec <hevc|tiles>  Encode with NVENC or send changed tiles losslessly from the CPU
+//   --tile-threads <n>    Threads coding tiles, 0 for one per hardware thread
+//   --transport <tcp|udp> Carry frames over the TCP connection or as UDP datagrams
+//   --fec <pct>           Add Reed-Solomon parity packets worth the given share of UDP packets
+//   --fec-block <n>       Packets per FEC block, 1 to 128
+//   --no-nack             Ignore NACKs instead of retransmitting lost UDP packets
+//   --fixed-bitrate       Keep the encoder profile's bitrate instead of adapting to the link
+//   --min-bitrate <kbps>  Lowest bitrate the bandwidth estimate may go down to
+//   --max-viewers <n>     Clients streamed to at once, 1 to 16
+//   --emulate-loss <pct>  Drop the given share of UDP packets
+//   --emulate-burst <n>   Average length of a run of lost packets
+//   --emulate-delay-ms    Delay every UDP packet
+//   --emulate-jitter-ms   Add up to the given random delay to UDP packets
+//   --emulate-rate-mbps   Queue UDP packets behind a bottleneck of the given rate
+//   --nagle               Re-enable Nagle's algorithm on the stream socket
+//   --sndbuf <bytes>      Set SO_SNDBUF on the stream socket
+//   --synthetic <bytes>   Stream generated frames of the given size instead of the desktop
+//   --synthetic-encode-us Simulated encode time per synthetic frame
+//   --synthetic-gop <n>   Frames from one synthetic keyframe to the next
+//   --synthetic-cursor    Move a generated pointer along with the synthetic frames
+//   --synthetic-still     Generate no new frames after the first, like a desktop that does not change
+Options ParseOptions(int argc, char **argv);
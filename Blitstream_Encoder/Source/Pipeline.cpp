@@ -0,0 +1,232 @@
+#include "Pipeline.h"
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include "Platform.h"
+
+void Pipeline::Start(const PipelineStages &pipeline_stages, uint32_t fps) {
+	stages = pipeline_stages;
+	scheduler.Initialize(fps);
+
+	// Reset state left over from a previous run
+	uint32_t index;
+	SubmittedFrame submitted_frame;
+	while(encoded_captures.Pop(&index));
+	while(free_outputs.Pop(&index));
+	while(submitted_frames.Pop(&submitted_frame));
+	while(submitted_count.try_acquire());
+	while(encoded_count.try_acquire());
+	while(free_output_count.try_acquire());
+	while(failure_signal.try_acquire());
+
+	for(uint32_t i = 0; i < NUM_IO_BUFFERS; ++i) {
+		free_outputs.Push(i);
+	}
+	free_output_count.release(NUM_IO_BUFFERS);
+	pending_capture.store(INVALID_CAPTURE_INDEX);
+
+	running.store(true);
+	capture_thread = std::thread(&Pipeline::CaptureLoop, this);
+	encode_thread = std::thread(&Pipeline::EncodeLoop, this);
+	if(stages.retrieve) {
+		completion_thread = std::thread(&Pipeline::CompletionLoop, this);
+	}
+	send_thread = std::thread(&Pipeline::SendLoop, this);
+}
+
+bool Pipeline::Wait(uint32_t timeout_ms) {
+	return failure_signal.try_acquire_for(std::chrono::milliseconds(timeout_ms));
+}
+
+void Pipeline::Stop() {
+	running.store(false);
+
+	// Wake up every stage that might be blocked waiting for another
+	pending_capture.store(STOP_CAPTURE_INDEX);
+	pending_capture.notify_one();
+	submitted_count.release();
+	encoded_count.release();
+	free_output_count.release();
+
+	capture_thread.join();
+	encode_thread.join();
+	if(completion_thread.joinable()) {
+		completion_thread.join();
+	}
+	send_thread.join();
+	scheduler.Shutdown();
+
+	// Wait for frames still being encoded, then unlock everything that was never sent
+	SubmittedFrame submitted_frame;
+	while(submitted_frames.Pop(&submitted_frame)) {
+		stages.retrieve(stages.user_data, submitted_frame.capture_index, submitted_frame.output_index);
+		stages.release(stages.user_data, submitted_frame.output_index);
+	}
+	EncodedFrame frame;
+	while(encoded_frames.Pop(&frame)) {
+		stages.release(stages.user_data, frame.output_index);
+	}
+}
+
+void Pipeline::CaptureLoop() {
+	// Capture buffers not pending or being encoded, owned by this thread
+	uint32_t free_capture_mask = (1u << NUM_CAPTURE_BUFFERS) - 1;
+
+	while(running.load(std::memory_order_relaxed)) {
+		scheduler.WaitForNextFrame();
+
+		uint32_t capture_index;
+		while(encoded_captures.Pop(&capture_index)) {
+			free_capture_mask |= 1u << capture_index;
+		}
+
+		// There is always a free buffer, at most one is pending and one is being encoded
+		assert(free_capture_mask != 0 && "Ran out of capture buffers");
+		for(capture_index = 0; (free_capture_mask & (1u << capture_index)) == 0; ++capture_index);
+		free_capture_mask &= ~(1u << capture_index);
+
+		uint64_t capture_start = PlatformTimestampNs();
+		bool captured = stages.capture(stages.user_data, capture_index);
+		if(!captured && stages.repeat && stages.repeat(stages.user_data, capture_index)) {
+			stats.repeated.fetch_add(1, std::memory_order_relaxed);
+			captured = true;
+		}
+		if(captured) {
+			stats.captured.fetch_add(1, std::memory_order_relaxed);
+			latency.capture.Record(PlatformTimestampNs() - capture_start);
+			capture_timestamps_ns[capture_index] = capture_start;
+
+			// Latest frame wins, reclaim the previous capture if it was never picked up
+			uint32_t replaced = pending_capture.exchange(capture_index, std::memory_order_acq_rel);
+			pending_capture.notify_one();
+			if(replaced == STOP_CAPTURE_INDEX) {
+				break;
+			}
+			if(replaced != INVALID_CAPTURE_INDEX) {
+				stats.dropped.fetch_add(1, std::memory_order_relaxed);
+				free_capture_mask |= 1u << replaced;
+			}
+		}
+		else {
+			free_capture_mask |= 1u << capture_index;
+		}
+	}
+}
+
+void Pipeline::EncodeLoop() {
+	while(running.load(std::memory_order_relaxed)) {
+		pending_capture.wait(INVALID_CAPTURE_INDEX, std::memory_order_acquire);
+		uint32_t capture_index = pending_capture.exchange(INVALID_CAPTURE_INDEX, std::memory_order_acq_rel);
+		if(capture_index == STOP_CAPTURE_INDEX || !running.load(std::memory_order_relaxed)) {
+			break;
+		}
+
+		// Wait for the send stage to hand back an output buffer
+		free_output_count.acquire();
+		if(!running.load(std::memory_order_relaxed)) {
+			break;
+		}
+		uint32_t output_index = 0;
+		free_outputs.Pop(&output_index);
+
+		uint64_t encode_start = PlatformTimestampNs();
+		EncodedFrame frame {
+			.data = stages.encode(stages.user_data, capture_index, output_index),
+			.output_index = output_index,
+			.capture_timestamp_ns = capture_timestamps_ns[capture_index]
+		};
+		uint64_t encode_end = PlatformTimestampNs();
+		stats.encode_busy_ns.fetch_add(encode_end - encode_start, std::memory_order_relaxed);
+		latency.encode.Record(encode_end - encode_start);
+
+		if(stages.retrieve) {
+			// The completion thread picks it up once the hardware is done
+			submitted_frames.Push(SubmittedFrame {
+				.capture_index = capture_index,
+				.output_index = output_index,
+				.capture_timestamp_ns = frame.capture_timestamp_ns,
+				.submit_timestamp_ns = encode_end
+			});
+			submitted_count.release();
+			continue;
+		}
+
+		stats.encoded.fetch_add(1, std::memory_order_relaxed);
+		encoded_captures.Push(capture_index);
+		encoded_frames.Push(frame);
+		encoded_count.release();
+	}
+}
+
+void Pipeline::CompletionLoop() {
+	while(running.load(std::memory_order_relaxed)) {
+		submitted_count.acquire();
+		if(!running.load(std::memory_order_relaxed)) {
+			break;
+		}
+		SubmittedFrame submitted_frame {};
+		submitted_frames.Pop(&submitted_frame);
+
+		// Frames complete in submission order since they share one encode session
+		EncodedFrame frame {
+			.data = stages.retrieve(stages.user_data, submitted_frame.capture_index, submitted_frame.output_index),
+			.output_index = submitted_frame.output_index,
+			.capture_timestamp_ns = submitted_frame.capture_timestamp_ns
+		};
+		stats.encoded.fetch_add(1, std::memory_order_relaxed);
+		latency.complete.Record(PlatformTimestampNs() - submitted_frame.submit_timestamp_ns);
+
+		encoded_captures.Push(submitted_frame.capture_index);
+		encoded_frames.Push(frame);
+		encoded_count.release();
+	}
+}
+
+void Pipeline::SendLoop() {
+	while(running.load(std::memory_order_relaxed)) {
+		encoded_count.acquire();
+		EncodedFrame frame;
+		if(!encoded_frames.Pop(&frame)) {
+			continue;
+		}
+
+		uint64_t send_start = PlatformTimestampNs();
+		bool success = stages.send(stages.user_data, frame.data, frame.capture_timestamp_ns);
+		uint64_t send_end = PlatformTimestampNs();
+		stats.send_busy_ns.fetch_add(send_end - send_start, std::memory_order_relaxed);
+
+		stages.release(stages.user_data, frame.output_index);
+		free_outputs.Push(frame.output_index);
+		free_output_count.release();
+
+		if(!success) {
+			failure_signal.release();
+			break;
+		}
+		stats.sent.fetch_add(1, std::memory_order_relaxed);
+		latency.send.Record(send_end - send_start);
+		latency.total.Record(send_end - frame.capture_timestamp_ns);
+	}
+}
+
+void Pipeline::PrintStats(uint64_t elapsed_us) {
+	uint64_t encode_busy_ns = stats.encode_busy_ns.exchange(0, std::memory_order_relaxed);
+	uint64_t send_busy_ns = stats.send_busy_ns.exchange(0, std::memory_order_relaxed);
+	printf("Pipeline: captured %llu, repeated %llu, dropped %llu, encoded %llu, sent %llu, encode busy %.1f%%, "
+		   "send busy %.1f%%\n",
+		   static_cast<unsigned long long>(stats.captured.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(stats.repeated.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(stats.dropped.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(stats.encoded.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(stats.sent.exchange(0, std::memory_order_relaxed)),
+		   0.1 * encode_busy_ns / elapsed_us, 0.1 * send_busy_ns / elapsed_us);
+	scheduler.PrintStats();
+}
+
+void Pipeline::AddLatencyStages(LatencyReport *report) {
+	report->Add("capture", &latency.capture);
+	report->Add("encode", &latency.encode);
+	report->Add("complete", &latency.complete);
+	report->Add("send", &latency.send);
+	report->Add("total", &latency.total);
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <semaphore>
+#include <thread>
+#include "FrameScheduler.h"
+#include "LatencyHistogram.h"
+#include "SpscQueue.h"
+
+constexpr uint32_t NUM_IO_BUFFERS = 4;
+// One capture being written, one pending and one per output buffer in flight
+constexpr uint32_t NUM_CAPTURE_BUFFERS = NUM_IO_BUFFERS + 2;
+constexpr uint32_t INVALID_CAPTURE_INDEX = 0xFFFFFFFF;
+constexpr uint32_t STOP_CAPTURE_INDEX = 0xFFFFFFFE;
+// Every queue can be full when Stop releases each semaphore once more
+constexpr uint32_t PIPELINE_SEMAPHORE_MAX = NUM_IO_BUFFERS + 1;
+
+struct EncodedData {
+	void *ptr;
+	uint32_t size;
+	// Decodable without any earlier frame
+	bool keyframe;
+	// FrameRegions sent ahead of the picture, null for a picture that
+	// replaces the whole frame. A frame with regions may have no picture
+	const void *regions;
+	uint32_t regions_size;
+};
+
+// Callbacks for each pipeline stage, every stage is invoked from its own thread.
+// Capture buffers and output buffers are identified by index, an output buffer
+// returned from encode stays locked until it is passed to release.
+// If retrieve is set encoding is asynchronous: encode only submits the frame and
+// retrieve is called from a separate completion thread, in submission order, to
+// wait for the bitstream. The capture buffer is reused once retrieve returns
+struct PipelineStages {
+	void *user_data;
+	// Returns false if no new frame is available
+	bool (*capture)(void *user_data, uint32_t capture_index);
+	// Optional, called when capture had no new frame. Fills the capture buffer
+	// with the last captured frame again and returns true if a keyframe is
+	// wanted, so a viewer joining a desktop that does not change still gets a
+	// picture. Returns false if there is no keyframe to serve or nothing has
+	// been captured yet
+	bool (*repeat)(void *user_data, uint32_t capture_index);
+	EncodedData (*encode)(void *user_data, uint32_t capture_index, uint32_t output_index);
+	EncodedData (*retrieve)(void *user_data, uint32_t capture_index, uint32_t output_index);
+	// Returns false if the frame could not be delivered, which stops the pipeline.
+	// The capture timestamp is a PlatformTimestampNs reading from before capture
+	bool (*send)(void *user_data, const EncodedData &data, uint64_t capture_timestamp_ns);
+	void (*release)(void *user_data, uint32_t output_index);
+};
+
+struct PipelineStats {
+	std::atomic<uint64_t> captured;
+	// Captures without a new frame that repeated the last one for a keyframe
+	std::atomic<uint64_t> repeated;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> encoded;
+	std::atomic<uint64_t> sent;
+	std::atomic<uint64_t> encode_busy_ns;
+	std::atomic<uint64_t> send_busy_ns;
+};
+
+// Each histogram is only recorded by the thread running the stage
+struct PipelineLatency {
+	LatencyHistogram capture;
+	LatencyHistogram encode;
+	// Submission to bitstream available, asynchronous encoding only
+	LatencyHistogram complete;
+	LatencyHistogram send;
+	// Start of capture until the frame has been sent
+	LatencyHistogram total;
+};
+
+struct EncodedFrame {
+	EncodedData data;
+	uint32_t output_index;
+	uint64_t capture_timestamp_ns;
+};
+
+struct SubmittedFrame {
+	uint32_t capture_index;
+	uint32_t output_index;
+	uint64_t capture_timestamp_ns;
+	uint64_t submit_timestamp_ns;
+};
+
+// Capture -> encode -> send, each on its own thread. Captured frames are handed
+// to the encoder through a single slot mailbox, if the encoder is still busy
+// (for instance because every output buffer is waiting on a slow send) a newer
+// capture replaces the unencoded one. Frames are never dropped after encoding
+// since the decoder needs every frame that references previous ones
+struct Pipeline {
+	PipelineStages stages;
+	FrameScheduler scheduler;
+
+	std::atomic<bool> running;
+	std::binary_semaphore failure_signal { 0 };
+	std::thread capture_thread;
+	std::thread encode_thread;
+	std::thread completion_thread;
+	std::thread send_thread;
+
+	// Capture -> encode
+	std::atomic<uint32_t> pending_capture;
+	// Written by the capture thread before the index is published
+	uint64_t capture_timestamps_ns[NUM_CAPTURE_BUFFERS];
+	// Encode (or completion) -> capture, returns capture buffers once encoded
+	SpscQueue<uint32_t, 8> encoded_captures;
+	// Encode -> completion, only used for asynchronous encoding
+	SpscQueue<SubmittedFrame, NUM_IO_BUFFERS> submitted_frames;
+	std::counting_semaphore<PIPELINE_SEMAPHORE_MAX> submitted_count { 0 };
+	// Encode (or completion) -> send
+	SpscQueue<EncodedFrame, NUM_IO_BUFFERS> encoded_frames;
+	std::counting_semaphore<PIPELINE_SEMAPHORE_MAX> encoded_count { 0 };
+	// Send -> encode, returns output buffers once sent and released
+	SpscQueue<uint32_t, NUM_IO_BUFFERS> free_outputs;
+	std::counting_semaphore<PIPELINE_SEMAPHORE_MAX> free_output_count { 0 };
+
+	PipelineStats stats;
+	PipelineLatency latency;
+
+	void Start(const PipelineStages &pipeline_stages, uint32_t fps);
+
+	// Returns true if a stage failed within the timeout
+	bool Wait(uint32_t timeout_ms);
+	void Stop();
+
+	// Prints and resets the stage counters
+	void PrintStats(uint64_t elapsed_us);
+	void AddLatencyStages(LatencyReport *report);
+
+	void CaptureLoop();
+	void EncodeLoop();
+	void CompletionLoop();
+	void SendLoop();
+};
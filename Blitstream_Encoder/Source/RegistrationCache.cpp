@@ -0,0 +1,161 @@
+#include "RegistrationCache.h"
+#include <cassert>
+#include <cstdio>
+
+#ifdef _DEBUG
+#define NVENC_CHECK(x) { \
+NVENCSTATUS ret = x; \
+if(ret != NV_ENC_SUCCESS) printf("NVENC_API: %s is 0x%08x in %s at line %d\n", #x, x, __FILE__, __LINE__); \
+}
+#else
+#define NVENC_CHECK
+#endif
+
+void RegistrationCache::Initialize(NV_ENCODE_API_FUNCTION_LIST *nvenc_api, void *nvenc_encoder) {
+	api = nvenc_api;
+	encoder = nvenc_encoder;
+	entry_count = 0;
+	use_counter = 0;
+
+	void *resource;
+	while(pending_unmaps.Pop(&resource));
+	eviction_requested.store(false, std::memory_order_relaxed);
+	hits.store(0, std::memory_order_relaxed);
+	misses.store(0, std::memory_order_relaxed);
+}
+
+NV_ENC_MAP_INPUT_RESOURCE RegistrationCache::Map(void *resource, NV_ENC_INPUT_RESOURCE_TYPE resource_type,
+												 uint32_t width, uint32_t height, NV_ENC_BUFFER_FORMAT format) {
+	ProcessUnmaps();
+	if(eviction_requested.exchange(false, std::memory_order_relaxed)) {
+		// Backwards, Unregister moves the last entry into the freed slot
+		for(uint32_t i = entry_count; i-- > 0;) {
+			if(entries[i].mapped_resource) {
+				entries[i].evicted = true;
+			}
+			else {
+				Unregister(i);
+			}
+		}
+	}
+
+	uint32_t index = entry_count;
+	for(uint32_t i = 0; i < entry_count; ++i) {
+		if(entries[i].resource == resource && !entries[i].evicted) {
+			index = i;
+			break;
+		}
+	}
+
+	// A surface that kept its pointer but changed shape has to be registered again
+	if(index != entry_count && (entries[index].width != width || entries[index].height != height ||
+								entries[index].format != format)) {
+		Unregister(index);
+		index = entry_count;
+	}
+
+	if(index == entry_count) {
+		misses.fetch_add(1, std::memory_order_relaxed);
+
+		// Make room by dropping the least recently used registration
+		if(entry_count == MAX_REGISTERED_RESOURCES) {
+			uint32_t oldest = 0;
+			for(uint32_t i = 1; i < entry_count; ++i) {
+				if(entries[i].last_used < entries[oldest].last_used) oldest = i;
+			}
+			Unregister(oldest);
+			index = entry_count;
+		}
+
+		NV_ENC_REGISTER_RESOURCE register_resource {
+			.version = NV_ENC_REGISTER_RESOURCE_VER,
+			.resourceType = resource_type,
+			.width = width,
+			.height = height,
+			.pitch = 0,
+			.subResourceIndex = 0,
+			.resourceToRegister = resource,
+			.bufferFormat = format,
+			.bufferUsage = NV_ENC_INPUT_IMAGE
+		};
+		NVENC_CHECK(api->nvEncRegisterResource(encoder, &register_resource));
+
+		entries[index] = RegisteredResource {
+			.resource = resource,
+			.width = width,
+			.height = height,
+			.format = format,
+			.registered_resource = register_resource.registeredResource
+		};
+		++entry_count;
+	}
+	else {
+		hits.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	RegisteredResource &entry = entries[index];
+	entry.last_used = ++use_counter;
+	assert(!entry.mapped_resource && "Resource is already mapped");
+
+	NV_ENC_MAP_INPUT_RESOURCE input_resource {
+		.version = NV_ENC_MAP_INPUT_RESOURCE_VER,
+		.registeredResource = entry.registered_resource
+	};
+	NVENC_CHECK(api->nvEncMapInputResource(encoder, &input_resource));
+	entry.mapped_resource = input_resource.mappedResource;
+
+	return input_resource;
+}
+
+void RegistrationCache::Unmap(void *resource) {
+	[[maybe_unused]] bool pushed = pending_unmaps.Push(resource);
+	assert(pushed && "More unmaps pending than registered resources");
+}
+
+void RegistrationCache::ProcessUnmaps() {
+	void *resource;
+	while(pending_unmaps.Pop(&resource)) {
+		for(uint32_t i = 0; i < entry_count; ++i) {
+			if(entries[i].resource == resource && entries[i].mapped_resource) {
+				NVENC_CHECK(api->nvEncUnmapInputResource(encoder, entries[i].mapped_resource));
+				entries[i].mapped_resource = nullptr;
+				if(entries[i].evicted) {
+					Unregister(i);
+				}
+				break;
+			}
+		}
+	}
+}
+
+void RegistrationCache::Unregister(uint32_t index) {
+	RegisteredResource &entry = entries[index];
+	if(entry.mapped_resource) {
+		NVENC_CHECK(api->nvEncUnmapInputResource(encoder, entry.mapped_resource));
+	}
+	NVENC_CHECK(api->nvEncUnregisterResource(encoder, entry.registered_resource));
+
+	entries[index] = entries[--entry_count];
+	entries[entry_count] = {};
+}
+
+void RegistrationCache::Evict() {
+	ProcessUnmaps();
+	while(entry_count > 0) {
+		Unregister(entry_count - 1);
+	}
+}
+
+void RegistrationCache::RequestEviction() {
+	eviction_requested.store(true, std::memory_order_relaxed);
+}
+
+void RegistrationCache::PrintStats() {
+	printf("Registration cache: %llu hits, %llu misses\n",
+		   static_cast<unsigned long long>(hits.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(misses.exchange(0, std::memory_order_relaxed)));
+}
+
+void RegistrationCache::Shutdown() {
+	Evict();
+}
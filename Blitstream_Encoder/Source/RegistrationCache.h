@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <nvEncodeAPI.h>
+#include "SpscQueue.h"
+
+constexpr uint32_t MAX_REGISTERED_RESOURCES = 8;
+
+struct RegisteredResource {
+	void *resource;
+	uint32_t width;
+	uint32_t height;
+	NV_ENC_BUFFER_FORMAT format;
+	NV_ENC_REGISTERED_PTR registered_resource;
+	NV_ENC_INPUT_PTR mapped_resource;
+	uint64_t last_used;
+	// Unregistered as soon as it is unmapped, never mapped again
+	bool evicted;
+};
+
+// Registers each distinct input surface with NVENC once and only maps/unmaps it
+// per frame. All NVENC calls go through the function list so a stub list can
+// stand in for the driver
+struct RegistrationCache {
+	NV_ENCODE_API_FUNCTION_LIST *api;
+	void *encoder;
+
+	RegisteredResource entries[MAX_REGISTERED_RESOURCES];
+	uint32_t entry_count;
+	uint64_t use_counter;
+
+	// Resources released by Unmap, unmapped on the next call to Map so that
+	// only the mapping thread touches the entries
+	SpscQueue<void *, MAX_REGISTERED_RESOURCES> pending_unmaps;
+	// Set by RequestEviction, handled by the next Map
+	std::atomic<bool> eviction_requested;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+
+	void Initialize(NV_ENCODE_API_FUNCTION_LIST *nvenc_api, void *nvenc_encoder);
+
+	// Registers the resource on first use (or when its dimensions or format
+	// changed) and maps it for encoding
+	NV_ENC_MAP_INPUT_RESOURCE Map(void *resource, NV_ENC_INPUT_RESOURCE_TYPE resource_type,
+								  uint32_t width, uint32_t height, NV_ENC_BUFFER_FORMAT format);
+	// May be called from another thread than Map, for instance from the
+	// thread retrieving asynchronously encoded frames
+	void Unmap(void *resource);
+
+	// Unregisters every cached resource, required before the surfaces are
+	// released, for instance on a resize or display mode change
+	void Evict();
+	// From any thread, the next Map evicts every cached resource. Those still
+	// mapped for a frame in flight are unregistered once they are unmapped
+	void RequestEviction();
+
+	void PrintStats();
+
+	void Shutdown();
+
+	void Unregister(uint32_t index);
+	void ProcessUnmaps();
+};
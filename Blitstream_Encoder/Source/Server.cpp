@@ -1,82 +1,273 @@
 #include "Server.h"
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <thread>
+#include "Platform.h"
 
-#define WSA_CHECK(x) { \
-int ret = x; \
-if(ret != 0) printf("WSA Error: %s is 0x%08x in %s at line %d\n", #x, x, __FILE__, __LINE__); \
-}
-constexpr const char *PORT = "4646";
+// Shared frame buffers grow in steps of this many bytes
+static constexpr uint32_t FRAME_ALLOCATION_GRANULARITY = 64u * 1024u;
+// Waits after a failed accept, doubling up to the maximum while it keeps
+// failing, for instance with EMFILE until a descriptor is closed
+static constexpr uint32_t ACCEPT_MIN_BACKOFF_MS = 1;
+static constexpr uint32_t ACCEPT_MAX_BACKOFF_MS = 100;
 
-void Server::Initialize(uint32_t width, uint32_t height) {
-	WSA_CHECK(WSAStartup(MAKEWORD(2, 2), &wsa_data));
+void Server::Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t initial_bitrate, Codec stream_codec,
+						const ServerOptions &server_options) {
+	[[maybe_unused]] bool startup_result = NetStartup();
+	assert(startup_result && "Failed to initialize networking");
 
-	addrinfo hints {
-		.ai_flags = AI_PASSIVE,
-		.ai_family = PF_INET,
-		.ai_socktype = SOCK_STREAM,
-		.ai_protocol = IPPROTO_TCP
-	};
+	options = server_options;
+	options.max_viewers = options.max_viewers < 1 ? 1 : options.max_viewers;
+	options.max_viewers = options.max_viewers > MAX_VIEWERS ? MAX_VIEWERS : options.max_viewers;
+	width = frame_width;
+	height = frame_height;
+	bitrate = initial_bitrate;
+	codec = stream_codec;
+	target_bitrate.store(bitrate, std::memory_order_relaxed);
+	keyframe_requests.Initialize();
+	cursor.Initialize();
+	stats.frames_dropped.store(0, std::memory_order_relaxed);
 
-	addrinfo *result;
-	WSA_CHECK(getaddrinfo(nullptr, PORT, &hints, &result));
+	listen_socket = NetListen(options.port);
+	assert(listen_socket != INVALID_SOCKET_HANDLE && "Failed to create listen socket");
 
-	listen_socket = socket(result->ai_family,
-						   result->ai_socktype,
-						   result->ai_protocol);
-	assert(listen_socket != INVALID_SOCKET && "Failed to create listen socket");
+	printf("Waiting for connections on port %s, up to %u viewers\n", options.port, options.max_viewers);
+	if(options.adaptive_bitrate && bitrate != 0) {
+		printf("Adaptive bitrate: %u to %u kbps\n", options.min_bitrate_kbps, bitrate / 1000);
+	}
 
-	WSA_CHECK(bind(listen_socket, result->ai_addr,
-				   static_cast<int>(result->ai_addrlen)));
+	accepting.store(true, std::memory_order_relaxed);
+	accept_thread = std::thread(&Server::AcceptLoop, this);
+}
+
+void Server::AcceptLoop() {
+	uint32_t backoff_ms = 0;
+	while(accepting.load(std::memory_order_relaxed)) {
+		char ipv4_address[NET_ADDRESS_SIZE];
+		SocketHandle client_socket = NetAccept(listen_socket, ipv4_address, NET_ADDRESS_SIZE);
+		if(client_socket == INVALID_SOCKET_HANDLE) {
+			// Shutdown closes the listen socket, which fails the accept as well
+			if(!accepting.load(std::memory_order_relaxed)) {
+				break;
+			}
+			if(backoff_ms == 0) {
+				printf("Failed to accept a connection, retrying\n");
+			}
+			backoff_ms = backoff_ms == 0 ? ACCEPT_MIN_BACKOFF_MS : backoff_ms * 2;
+			backoff_ms = backoff_ms > ACCEPT_MAX_BACKOFF_MS ? ACCEPT_MAX_BACKOFF_MS : backoff_ms;
+			std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+			continue;
+		}
+		backoff_ms = 0;
+		AddViewer(client_socket, ipv4_address);
+	}
+}
 
-	freeaddrinfo(result);
+void Server::AddViewer(SocketHandle client_socket, const char *ip_address) {
+	printf("Connection established with IP: %s\n", ip_address);
 
-	WSA_CHECK(listen(listen_socket, SOMAXCONN));
+	uint32_t index = 0;
+	while(index < options.max_viewers) {
+		ViewerState state = viewers[index].state.load(std::memory_order_acquire);
+		if(state == ViewerState::Free || state == ViewerState::Closed) {
+			break;
+		}
+		++index;
+	}
+	if(index == options.max_viewers) {
+		printf("Turning %s away, already streaming to %u viewers\n", ip_address, options.max_viewers);
+		NetClose(client_socket);
+		return;
+	}
 
-	printf("Waiting for connections on port %s\n", PORT);
+	Viewer &viewer = viewers[index];
+	{
+		std::lock_guard<std::mutex> slots_lock(slots_mutex);
+		if(viewer.state.load(std::memory_order_acquire) == ViewerState::Closed) {
+			// Once the lock has been held the fan-out has seen the viewer closed
+			// and queues nothing more for it
+			{
+				std::lock_guard<std::mutex> lock(viewers_mutex);
+			}
+			viewer.Shutdown();
+		}
+		viewer.index = index;
+		viewer.Start(client_socket, ip_address, width, height, bitrate, codec, options, &keyframe_requests, &cursor);
+	}
 
-	sockaddr_in client_addr;
-	int client_addrlen = sizeof(client_addr);
-	char ipv4_address[INET_ADDRSTRLEN];
-	client_socket = accept(listen_socket, reinterpret_cast<sockaddr *>(&client_addr), &client_addrlen);
-	assert(client_socket != INVALID_SOCKET && "Failed to create client socket");
-	inet_ntop(AF_INET, &(client_addr.sin_addr), ipv4_address, INET_ADDRSTRLEN);
-	printf("Connection established with IP: %s\n", ipv4_address);
+	// A waiter that checked before the viewer started is already waiting
+	// once the lock has been held
+	{
+		std::lock_guard<std::mutex> lock(viewers_mutex);
+	}
+	viewer_added.notify_all();
+}
 
-	closesocket(listen_socket);
+bool Server::AnyViewer() {
+	for(uint32_t i = 0; i < options.max_viewers; ++i) {
+		ViewerState state = viewers[i].state.load(std::memory_order_acquire);
+		if(state == ViewerState::Connecting || state == ViewerState::Streaming) {
+			return true;
+		}
+	}
+	return false;
+}
 
-	// Send init packet
-	InitMessage init_message {
-		.MAGIC = 0x4646,
-		.encoded_width = width,
-		.encoded_height = height
-	};
-	int init_message_result = send(client_socket, reinterpret_cast<char *>(&init_message), sizeof(InitMessage), 0);
-	assert(init_message_result != SOCKET_ERROR && "Failed to send initial message");
+bool Server::WaitForViewer(uint32_t timeout_ms) {
+	std::unique_lock<std::mutex> lock(viewers_mutex);
+	if(!viewer_added.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return AnyViewer(); })) {
+		return false;
+	}
+	// The estimates of the viewers that have gone no longer apply
+	target_bitrate.store(bitrate, std::memory_order_relaxed);
+	return true;
 }
 
-bool Server::SendData(void *ptr, uint32_t size) {
-	static DataHeader header {
-		.MAGIC = 0x4646,
-		.size = 0
-	};
-	header.size = size;
+bool Server::HasViewers() {
+	std::lock_guard<std::mutex> lock(viewers_mutex);
+	return AnyViewer();
+}
 
-	// Send header
-	int result = send(client_socket, reinterpret_cast<char *>(&header), sizeof(DataHeader), 0);
-	if(result == SOCKET_ERROR) return false;
+SharedFrame *Server::AcquireFrame(uint32_t size) {
+	// Lowest free index first, so the same few buffers stay in use while
+	// every viewer keeps up
+	SharedFrame *frame = nullptr;
+	for(uint32_t i = 0; i < SHARED_FRAME_COUNT; ++i) {
+		if(frames[i].references.load(std::memory_order_acquire) == 0) {
+			frame = &frames[i];
+			break;
+		}
+	}
+	if(!frame) {
+		return nullptr;
+	}
 
-	// Send encoded data if present
-	if(header.size != 0) {
-		result = send(client_socket, static_cast<char *>(ptr), static_cast<int>(size), 0);
-		if(result == SOCKET_ERROR) return false;
+	if(frame->capacity < size) {
+		if(frame->data) {
+			PlatformFree(frame->data, frame->capacity);
+		}
+		frame->data = nullptr;
+		frame->capacity = 0;
+		if(size <= UINT32_MAX - (FRAME_ALLOCATION_GRANULARITY - 1)) {
+			uint32_t capacity = (size + FRAME_ALLOCATION_GRANULARITY - 1) / FRAME_ALLOCATION_GRANULARITY *
+								FRAME_ALLOCATION_GRANULARITY;
+			frame->data = static_cast<uint8_t *>(PlatformAllocate(capacity));
+			frame->capacity = frame->data ? capacity : 0;
+		}
+		if(!frame->data) {
+			return nullptr;
+		}
 	}
-	// Otherwise the header will suffice to tell the 
-	// client that it should simply duplicate the current frame
+	return frame;
+}
 
-	return true;
+bool Server::SendData(void *ptr, uint32_t size, bool keyframe, const void *regions, uint32_t regions_size,
+					  uint64_t capture_timestamp) {
+	SharedFrame *frame = size <= UINT32_MAX - regions_size ? AcquireFrame(regions_size + size) : nullptr;
+	if(!frame) {
+		return DropFrame(size != 0 || regions_size != 0, keyframe);
+	}
+	if(regions_size != 0) {
+		memcpy(frame->data, regions, regions_size);
+	}
+	if(size != 0) {
+		memcpy(frame->data + regions_size, ptr, size);
+	}
+	frame->size = regions_size + size;
+	frame->keyframe = keyframe;
+	frame->regions = regions_size != 0;
+	frame->capture_timestamp = capture_timestamp;
+	frame->queue_timestamp_ns = PlatformTimestampNs();
+	// Held until every viewer had the chance to take its own
+	frame->references.store(1, std::memory_order_relaxed);
+
+	bool any_viewer = false;
+	uint32_t lowest_bitrate = UINT32_MAX;
+	{
+		std::lock_guard<std::mutex> lock(viewers_mutex);
+		for(uint32_t i = 0; i < options.max_viewers; ++i) {
+			Viewer &viewer = viewers[i];
+			ViewerState state = viewer.state.load(std::memory_order_acquire);
+			any_viewer |= state == ViewerState::Connecting || state == ViewerState::Streaming;
+			if(state != ViewerState::Streaming) {
+				continue;
+			}
+
+			if(viewer.Queue(frame) && !viewer.joined) {
+				viewer.joined = true;
+				uint64_t accept_timestamp_ns = viewer.accept_timestamp * 1000;
+				stats.join.Record(frame->queue_timestamp_ns - accept_timestamp_ns);
+			}
+			if(viewer.adaptive_bitrate) {
+				uint32_t viewer_bitrate = viewer.target_bitrate.load(std::memory_order_relaxed);
+				lowest_bitrate = viewer_bitrate < lowest_bitrate ? viewer_bitrate : lowest_bitrate;
+			}
+		}
+	}
+	frame->references.fetch_sub(1, std::memory_order_release);
+
+	// One encode serves everyone, so the slowest link sets the bitrate
+	if(lowest_bitrate != UINT32_MAX) {
+		target_bitrate.store(lowest_bitrate, std::memory_order_relaxed);
+	}
+	return any_viewer;
+}
+
+bool Server::DropFrame(bool has_data, bool keyframe) {
+	stats.frames_dropped.fetch_add(1, std::memory_order_relaxed);
+	bool any_viewer = false;
+	std::lock_guard<std::mutex> lock(viewers_mutex);
+	for(uint32_t i = 0; i < options.max_viewers; ++i) {
+		Viewer &viewer = viewers[i];
+		ViewerState state = viewer.state.load(std::memory_order_acquire);
+		any_viewer |= state == ViewerState::Connecting || state == ViewerState::Streaming;
+		if(state == ViewerState::Streaming) {
+			viewer.Skip(has_data, keyframe);
+		}
+	}
+	return any_viewer;
+}
+
+void Server::PrintStats() {
+	printf("Keyframes: %llu requested, %llu forced, %llu frames dropped\n",
+		   static_cast<unsigned long long>(keyframe_requests.stats.requests.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(keyframe_requests.stats.forced.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(stats.frames_dropped.exchange(0, std::memory_order_relaxed)));
+	std::lock_guard<std::mutex> lock(slots_mutex);
+	for(uint32_t i = 0; i < options.max_viewers; ++i) {
+		if(viewers[i].state.load(std::memory_order_acquire) == ViewerState::Streaming) {
+			viewers[i].PrintStats();
+		}
+	}
+}
+
+void Server::AddLatencyStages(LatencyReport *report) {
+	report->Add("join", &stats.join);
 }
 
 void Server::Shutdown() {
-	closesocket(client_socket);
+	// Unblocks the accept thread
+	accepting.store(false, std::memory_order_relaxed);
+	NetDisconnect(listen_socket);
+	NetClose(listen_socket);
+	if(accept_thread.joinable()) {
+		accept_thread.join();
+	}
+
+	for(uint32_t i = 0; i < options.max_viewers; ++i) {
+		if(viewers[i].state.load(std::memory_order_acquire) != ViewerState::Free) {
+			viewers[i].Shutdown();
+		}
+	}
+	for(uint32_t i = 0; i < SHARED_FRAME_COUNT; ++i) {
+		if(frames[i].data) {
+			PlatformFree(frames[i].data, frames[i].capacity);
+			frames[i].data = nullptr;
+			frames[i].capacity = 0;
+		}
+	}
+	cursor.Shutdown();
+	NetCleanup();
 }
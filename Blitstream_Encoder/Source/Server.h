@@ -1,25 +1,98 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
-#include <Winsock2.h>
-#include <Ws2tcpip.h>
+#include <mutex>
+#include <thread>
+#include "CursorState.h"
+#include "KeyframeRequests.h"
+#include "LatencyHistogram.h"
+#include "Options.h"
+#include "Socket.h"
+#include "Viewer.h"
 
-struct InitMessage {
-	uint32_t MAGIC;
-	uint32_t encoded_width;
-	uint32_t encoded_height;
-};
+// Viewers streamed to at once, further connections are turned away
+constexpr uint32_t MAX_VIEWERS = 16;
+// Every viewer can hold a frame being sent and a full queue while the next
+// frame is being filled in
+constexpr uint32_t SHARED_FRAME_COUNT = MAX_VIEWERS * (VIEWER_QUEUE_SIZE + 1) + 1;
 
-struct DataHeader {
-	uint32_t MAGIC;
-	uint32_t size;
+// Written by the fan-out, read by the stats printer
+struct ServerStats {
+	// Accepted until the first frame was queued for the viewer, which is a
+	// forced keyframe. Covers the handshake and the wait for the encoder, so
+	// for a viewer that reconnects it is the time until it has a picture again
+	LatencyHistogram join;
+	// No shared frame was free or one could not be grown, every viewer
+	// skipped the frame
+	std::atomic<uint64_t> frames_dropped;
 };
 
+// Accepts viewers for as long as it runs and fans every encoded frame out to
+// all of them. Each frame is copied once into a shared buffer that the
+// viewers' sending threads reference, so the encoder's output buffer is
+// returned right away and no viewer waits on another
 struct Server {
-	WSAData wsa_data;
-	SOCKET listen_socket;
-	SOCKET client_socket;
+	SocketHandle listen_socket;
+	ServerOptions options;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bitrate;
+	Codec codec;
+
+	Viewer viewers[MAX_VIEWERS];
+	// Held by the fan-out while queuing frames, taken by the accept thread
+	// before it reclaims a closed viewer so no frame is queued for it anymore
+	std::mutex viewers_mutex;
+	// Notified with viewers_mutex once a viewer has been started
+	std::condition_variable viewer_added;
+	// Held by the accept thread while it reclaims and restarts a viewer and by
+	// PrintStats, so the stats are never read from a slot being torn down.
+	// Separate from viewers_mutex so joining the old threads does not stall
+	// the fan-out
+	std::mutex slots_mutex;
+	std::thread accept_thread;
+	std::atomic<bool> accepting;
+
+	// Owned by the sending thread, a frame is free once nothing references it
+	SharedFrame frames[SHARED_FRAME_COUNT];
 
-	void Initialize(uint32_t width, uint32_t height);
-	bool SendData(void *ptr, uint32_t size);
+	// Lowest bandwidth estimate of the streaming viewers, picked up by the
+	// encoder. Stays at the initial bitrate if adaptive bitrate is off
+	std::atomic<uint32_t> target_bitrate;
+	// Served by the encoding thread before each frame
+	KeyframeRequests keyframe_requests;
+	// Updated by capture, followed by every viewer on the cursor channel
+	CursorState cursor;
+	ServerStats stats;
+
+	// Starts accepting viewers in the background. bitrate is what the encoder
+	// starts out with, 0 if it cannot be changed
+	void Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t initial_bitrate, Codec stream_codec,
+					const ServerOptions &server_options);
+	// Returns true once a viewer is connecting or streaming, false if there
+	// was none within the timeout. Resets the target bitrate to the initial
+	// one for a stream that starts over
+	bool WaitForViewer(uint32_t timeout_ms);
+	// True while a viewer is connecting or streaming
+	bool HasViewers();
+	// Queues the frame for every streaming viewer, returns false once the last
+	// viewer has gone. If the frame cannot be copied it is skipped like by a
+	// viewer that fell behind. The regions, if any, go in front of the data.
+	// capture_timestamp is a PlatformTimestamp reading
+	bool SendData(void *ptr, uint32_t size, bool keyframe, const void *regions, uint32_t regions_size,
+				  uint64_t capture_timestamp);
+	void PrintStats();
+	void AddLatencyStages(LatencyReport *report);
 	void Shutdown();
-};
\ No newline at end of file
+
+	void AcceptLoop();
+	void AddViewer(SocketHandle socket, const char *ip_address);
+	// Call with viewers_mutex held
+	bool AnyViewer();
+	// Returns a frame no viewer references anymore, large enough for size
+	// bytes. Null if none is free or it cannot be grown to size
+	SharedFrame *AcquireFrame(uint32_t size);
+	// Has every streaming viewer skip the frame, returns what SendData does
+	bool DropFrame(bool has_data, bool keyframe);
+};
@@ -0,0 +1,54 @@
+#include "Session.h"
+#include <cstdio>
+#include "Platform.h"
+
+void Session::Initialize(Pipeline *session_pipeline, Server *session_server, const PipelineStages &pipeline_stages,
+						 uint32_t frame_rate) {
+	pipeline = session_pipeline;
+	server = session_server;
+	stages = pipeline_stages;
+	fps = frame_rate;
+	stats.streams.store(0, std::memory_order_relaxed);
+	state.store(SessionState::Listening, std::memory_order_relaxed);
+	running.store(true, std::memory_order_relaxed);
+}
+
+void Session::Run() {
+	while(running.load(std::memory_order_relaxed)) {
+		state.store(SessionState::Listening, std::memory_order_release);
+		if(!server->WaitForViewer(SESSION_POLL_TIMEOUT_MS)) {
+			continue;
+		}
+
+		// Every viewer asks for a keyframe once its handshake is done, so the
+		// encoder resumes with an IDR without having to be reset
+		state.store(SessionState::Streaming, std::memory_order_release);
+		stats.streams.fetch_add(1, std::memory_order_relaxed);
+		pipeline->Start(stages, fps);
+
+		// Run until the last viewer disconnects
+		uint64_t report_timestamp = PlatformTimestamp();
+		while(running.load(std::memory_order_relaxed) && !pipeline->Wait(SESSION_POLL_TIMEOUT_MS)) {
+			uint64_t now = PlatformTimestamp();
+			if(report) {
+				report(report_user_data, now - report_timestamp);
+			}
+			report_timestamp = now;
+			// Nothing is sent while the desktop does not change, so a failed
+			// send cannot be relied on to tell that the last viewer has gone
+			if(!server->HasViewers()) {
+				break;
+			}
+		}
+		pipeline->Stop();
+
+		if(running.load(std::memory_order_relaxed)) {
+			printf("No viewers left, waiting for connections\n");
+		}
+	}
+	state.store(SessionState::Stopped, std::memory_order_release);
+}
+
+void Session::Stop() {
+	running.store(false, std::memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "Pipeline.h"
+#include "Server.h"
+
+// How long the session waits on the server or pipeline before checking
+// whether it should stop, also the interval between stats reports
+constexpr uint32_t SESSION_POLL_TIMEOUT_MS = 1000;
+
+enum class SessionState : uint32_t {
+	// No viewer, the pipeline is stopped but the frame source and encoder
+	// stay initialized
+	Listening,
+	// Frames are captured, encoded and fanned out
+	Streaming,
+	// Run has returned
+	Stopped
+};
+
+// Written by the session thread, read by the stats printer
+struct SessionStats {
+	// Times the pipeline was started for a viewer after none were left
+	std::atomic<uint64_t> streams;
+};
+
+// Runs the pipeline whenever at least one viewer is connected and stops it
+// once the last one has gone, then waits for the next. The frame source and
+// encoder are set up once and kept across connections, a viewer that
+// reconnects only waits for the handshake and the keyframe it asks for
+// instead of for a new capture and encoder session
+struct Session {
+	Pipeline *pipeline;
+	Server *server;
+	PipelineStages stages;
+	uint32_t fps;
+	// Called about every SESSION_POLL_TIMEOUT_MS while streaming, may be null
+	void (*report)(void *user_data, uint64_t elapsed_us);
+	void *report_user_data;
+
+	std::atomic<SessionState> state;
+	std::atomic<bool> running;
+	SessionStats stats;
+
+	// Takes the pipeline and server over, both with their stages and the
+	// encoder already initialized
+	void Initialize(Pipeline *session_pipeline, Server *session_server, const PipelineStages &pipeline_stages,
+					uint32_t frame_rate);
+	// Streams and waits for viewers in turn until Stop is called
+	void Run();
+	// May be called from any thread, Run returns within SESSION_POLL_TIMEOUT_MS
+	void Stop();
+};
@@ -0,0 +1,112 @@
+#include "SyntheticSource.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "Platform.h"
+
+void SyntheticSource::Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t size, uint32_t encode_time,
+								 uint32_t gop) {
+	width = frame_width;
+	height = frame_height;
+	frame_size = size;
+	buffer_size = size;
+	encode_time_us = encode_time;
+	keyframe_interval = gop;
+	force_keyframe = false;
+	still = false;
+	captured = false;
+	frame_counter = 0;
+	cursor = nullptr;
+	cursor_shape_interval = 60;
+	capture_counter = 0;
+
+	// An arrow with a dark outline and a soft edged disc, both mostly transparent
+	for(uint32_t y = 0; y < SYNTHETIC_CURSOR_SIZE; ++y) {
+		for(uint32_t x = 0; x < SYNTHETIC_CURSOR_SIZE; ++x) {
+			uint32_t arrow = 0;
+			if(x <= y / 2 + 1 && y < 24) {
+				arrow = x == 0 || x == y / 2 + 1 || y == 23 ? 0xFF000000 : 0xFFFFFFFF;
+			}
+			cursor_shapes[0][y * SYNTHETIC_CURSOR_SIZE + x] = arrow;
+
+			float dx = x - SYNTHETIC_CURSOR_SIZE / 2.0f + 0.5f;
+			float dy = y - SYNTHETIC_CURSOR_SIZE / 2.0f + 0.5f;
+			float coverage = 12.0f - std::sqrt(dx * dx + dy * dy);
+			coverage = coverage < 0.0f ? 0.0f : (coverage > 1.0f ? 1.0f : coverage);
+			uint32_t alpha = static_cast<uint32_t>(coverage * 255.0f + 0.5f);
+			cursor_shapes[1][y * SYNTHETIC_CURSOR_SIZE + x] = alpha << 24 | 0x3080F0;
+		}
+	}
+
+	for(uint32_t i = 0; i < NUM_IO_BUFFERS; ++i) {
+		output_buffers[i] = static_cast<uint8_t *>(PlatformAllocate(buffer_size));
+		memset(output_buffers[i], 0xAB, buffer_size);
+	}
+
+	printf("Starting synthetic source @ %ux%u, %u bytes per frame\n", width, height, frame_size);
+}
+
+bool SyntheticSource::Capture([[maybe_unused]] uint32_t capture_index) {
+	if(cursor) {
+		if(capture_counter % cursor_shape_interval == 0) {
+			uint32_t shape = capture_counter / cursor_shape_interval % 2;
+			uint32_t hot_spot = shape == 0 ? 0 : SYNTHETIC_CURSOR_SIZE / 2;
+			cursor->SetShape(cursor_shapes[shape], SYNTHETIC_CURSOR_SIZE, SYNTHETIC_CURSOR_SIZE, hot_spot, hot_spot);
+		}
+		float angle = capture_counter * 0.05f;
+		cursor->SetPosition(static_cast<int32_t>(width / 2 + std::cos(angle) * height / 3),
+							static_cast<int32_t>(height / 2 + std::sin(angle) * height / 3), true);
+	}
+	++capture_counter;
+	if(still && captured) {
+		return false;
+	}
+	captured = true;
+	return true;
+}
+
+bool SyntheticSource::RepeatCapture([[maybe_unused]] uint32_t capture_index) {
+	return captured;
+}
+
+EncodedData SyntheticSource::Encode([[maybe_unused]] uint32_t capture_index, uint32_t output_index) {
+	uint64_t start = PlatformTimestamp();
+
+	// Stamp the frame number so the receiving end can detect reordering
+	uint8_t *ptr = output_buffers[output_index];
+	memcpy(ptr, &frame_counter, sizeof(frame_counter) < frame_size ? sizeof(frame_counter) : frame_size);
+	bool keyframe = keyframe_interval != 0 ? frame_counter % keyframe_interval == 0 : frame_counter == 0;
+	keyframe |= force_keyframe;
+	force_keyframe = false;
+	++frame_counter;
+
+	while(PlatformTimestamp() - start < encode_time_us) {
+		std::this_thread::yield();
+	}
+
+	return EncodedData {
+		.ptr = ptr,
+		.size = frame_size,
+		.keyframe = keyframe
+	};
+}
+
+void SyntheticSource::Release([[maybe_unused]] uint32_t output_index) {
+}
+
+void SyntheticSource::SetBitrate(uint32_t bitrate, uint32_t fps) {
+	uint32_t size = bitrate / 8 / fps;
+	frame_size = size < buffer_size ? size : buffer_size;
+}
+
+void SyntheticSource::ForceKeyframe() {
+	force_keyframe = true;
+}
+
+void SyntheticSource::Shutdown() {
+	for(uint32_t i = 0; i < NUM_IO_BUFFERS; ++i) {
+		PlatformFree(output_buffers[i], buffer_size);
+		output_buffers[i] = nullptr;
+	}
+}
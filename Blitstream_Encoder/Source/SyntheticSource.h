@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include "CursorState.h"
+#include "Pipeline.h"
+
+// Stand-in for desktop duplication and NVENC, produces fixed size frames with
+// a simulated encode latency so the pipeline and transport can be exercised
+// without a GPU
+constexpr uint32_t SYNTHETIC_CURSOR_SIZE = 32;
+
+struct SyntheticSource {
+	uint32_t width;
+	uint32_t height;
+	uint32_t frame_size;
+	// Size of each output buffer, frame_size never grows past it
+	uint32_t buffer_size;
+	uint32_t encode_time_us;
+	// Frames from one keyframe to the next, 0 if only the first one is
+	uint32_t keyframe_interval;
+	// The next frame is a keyframe regardless of the interval
+	bool force_keyframe;
+	// Only the first capture has a new frame, like a desktop that does not
+	// change. Set before the first capture
+	bool still;
+	bool captured;
+
+	uint8_t *output_buffers[NUM_IO_BUFFERS];
+	uint32_t frame_counter;
+
+	// Moved in a circle on every capture while set, alternating between two
+	// shapes every cursor_shape_interval captures
+	CursorState *cursor;
+	uint32_t cursor_shape_interval;
+	uint32_t capture_counter;
+	uint32_t cursor_shapes[2][SYNTHETIC_CURSOR_SIZE * SYNTHETIC_CURSOR_SIZE];
+
+	void Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t size, uint32_t encode_time, uint32_t gop);
+
+	bool Capture(uint32_t capture_index);
+	// Takes the last captured frame again, false if there is none
+	bool RepeatCapture(uint32_t capture_index);
+	EncodedData Encode(uint32_t capture_index, uint32_t output_index);
+	void Release(uint32_t output_index);
+
+	// Sizes frames to match the bitrate at the given frame rate
+	void SetBitrate(uint32_t bitrate, uint32_t fps);
+	void ForceKeyframe();
+
+	void Shutdown();
+};
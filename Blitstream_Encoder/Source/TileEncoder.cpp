@@ -0,0 +1,135 @@
+#include "TileEncoder.h"
+#include <cstdio>
+#include <cstring>
+#include "Platform.h"
+
+void TileEncoder::Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t thread_total) {
+	width = frame_width;
+	height = frame_height;
+	columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+	rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	TileInitialize();
+	pool.Initialize(thread_total);
+
+	hashes = static_cast<uint64_t *>(PlatformAllocate(TileCount() * sizeof(uint64_t)));
+	hashes_valid = false;
+	row_records = static_cast<uint8_t *>(PlatformAllocate(TileCount() * MAX_TILE_RECORD_SIZE));
+	row_sizes = static_cast<uint32_t *>(PlatformAllocate(rows * sizeof(uint32_t)));
+	row_tile_counts = static_cast<uint32_t *>(PlatformAllocate(rows * sizeof(uint32_t)));
+	row_tiles_hashed = static_cast<uint32_t *>(PlatformAllocate(rows * sizeof(uint32_t)));
+	row_scratch = static_cast<TileScratch *>(PlatformAllocate(rows * sizeof(TileScratch)));
+	output_capacity = sizeof(TileFrame) + TileCount() * MAX_TILE_RECORD_SIZE;
+	for(uint32_t i = 0; i < NUM_IO_BUFFERS; ++i) {
+		outputs[i] = static_cast<uint8_t *>(PlatformAllocate(output_capacity));
+	}
+
+	printf("Tile codec with %u threads, %s hashing\n", pool.thread_count + 1, TileKernelName(TileSelectedKernel()));
+}
+
+uint32_t TileEncoder::TileCount() const {
+	return columns * rows;
+}
+
+void TileEncoder::EncodeRow(uint32_t row) {
+	uint8_t *records = row_records + static_cast<size_t>(row) * columns * MAX_TILE_RECORD_SIZE;
+	uint32_t size = 0;
+	uint32_t tile_count = 0;
+	uint32_t tiles_hashed = 0;
+	uint32_t y = row * TILE_SIZE;
+	uint32_t tile_height = height - y < TILE_SIZE ? height - y : TILE_SIZE;
+	for(uint32_t column = 0; column < columns; ++column) {
+		uint32_t index = row * columns + column;
+		if(!keyframe && tile_mask && tile_mask[index] == 0) {
+			continue;
+		}
+		uint32_t x = column * TILE_SIZE;
+		uint32_t tile_width = width - x < TILE_SIZE ? width - x : TILE_SIZE;
+		const uint32_t *tile = pixels + static_cast<size_t>(y) * stride + x;
+		uint64_t hash = TileHash(tile, stride, tile_width, tile_height);
+		++tiles_hashed;
+		if(!keyframe && hash == hashes[index]) {
+			continue;
+		}
+		hashes[index] = hash;
+		size += TileCompress(tile, stride, tile_width, tile_height, index, records + size, &row_scratch[row]);
+		++tile_count;
+	}
+	row_sizes[row] = size;
+	row_tile_counts[row] = tile_count;
+	row_tiles_hashed[row] = tiles_hashed;
+}
+
+EncodedData TileEncoder::Encode(const uint32_t *frame_pixels, uint32_t frame_stride, const int8_t *mask,
+								bool force_keyframe, uint32_t output_index) {
+	uint64_t start = PlatformTimestampNs();
+	pixels = frame_pixels;
+	stride = frame_stride;
+	tile_mask = mask;
+	keyframe = force_keyframe || !hashes_valid;
+	hashes_valid = true;
+	pool.Run(rows, [](void *user_data, uint32_t row) {
+		static_cast<TileEncoder *>(user_data)->EncodeRow(row);
+	}, this);
+
+	// Rows were coded in parallel, joining them keeps the indices ascending
+	uint8_t *output = outputs[output_index];
+	uint32_t size = sizeof(TileFrame);
+	uint32_t tile_count = 0;
+	uint32_t tiles_hashed = 0;
+	for(uint32_t row = 0; row < rows; ++row) {
+		memcpy(output + size, row_records + static_cast<size_t>(row) * columns * MAX_TILE_RECORD_SIZE, row_sizes[row]);
+		size += row_sizes[row];
+		tile_count += row_tile_counts[row];
+		tiles_hashed += row_tiles_hashed[row];
+	}
+	TileFrame frame = {
+		.tile_count = tile_count
+	};
+	memcpy(output, &frame, sizeof(frame));
+
+	stats.frames.fetch_add(1, std::memory_order_relaxed);
+	stats.tiles_hashed.fetch_add(tiles_hashed, std::memory_order_relaxed);
+	stats.encode_ns.fetch_add(PlatformTimestampNs() - start, std::memory_order_relaxed);
+	if(tile_count == 0 && !keyframe) {
+		stats.unchanged.fetch_add(1, std::memory_order_relaxed);
+		return {};
+	}
+	stats.tiles_sent.fetch_add(tile_count, std::memory_order_relaxed);
+	stats.bytes_sent.fetch_add(size, std::memory_order_relaxed);
+	return EncodedData {
+		.ptr = output,
+		.size = size,
+		.keyframe = keyframe
+	};
+}
+
+void TileEncoder::PrintStats() {
+	uint64_t frames = stats.frames.exchange(0, std::memory_order_relaxed);
+	uint64_t unchanged = stats.unchanged.exchange(0, std::memory_order_relaxed);
+	uint64_t tiles_hashed = stats.tiles_hashed.exchange(0, std::memory_order_relaxed);
+	uint64_t tiles_sent = stats.tiles_sent.exchange(0, std::memory_order_relaxed);
+	uint64_t bytes_sent = stats.bytes_sent.exchange(0, std::memory_order_relaxed);
+	uint64_t encode_ns = stats.encode_ns.exchange(0, std::memory_order_relaxed);
+	uint64_t sent_frames = frames - unchanged;
+	printf("Tiles: %llu of %llu frames unchanged, %.1f tiles hashed and %.1f sent per frame, %.1f KB per sent frame, "
+		   "%.2f ms per frame\n",
+		   static_cast<unsigned long long>(unchanged), static_cast<unsigned long long>(frames),
+		   frames != 0 ? static_cast<double>(tiles_hashed) / frames : 0.0,
+		   frames != 0 ? static_cast<double>(tiles_sent) / frames : 0.0,
+		   sent_frames != 0 ? bytes_sent / 1024.0 / sent_frames : 0.0,
+		   frames != 0 ? encode_ns / 1e6 / frames : 0.0);
+}
+
+void TileEncoder::Shutdown() {
+	pool.Shutdown();
+	PlatformFree(hashes, TileCount() * sizeof(uint64_t));
+	PlatformFree(row_records, TileCount() * MAX_TILE_RECORD_SIZE);
+	PlatformFree(row_sizes, rows * sizeof(uint32_t));
+	PlatformFree(row_tile_counts, rows * sizeof(uint32_t));
+	PlatformFree(row_tiles_hashed, rows * sizeof(uint32_t));
+	PlatformFree(row_scratch, rows * sizeof(TileScratch));
+	for(uint32_t i = 0; i < NUM_IO_BUFFERS; ++i) {
+		PlatformFree(outputs[i], output_capacity);
+	}
+}
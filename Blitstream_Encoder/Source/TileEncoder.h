@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "Pipeline.h"
+#include "TileCodec.h"
+#include "WorkerPool.h"
+
+// Written by the encoding thread, read by the stats printer
+struct TileStats {
+	std::atomic<uint64_t> frames;
+	// Frames without a single changed tile
+	std::atomic<uint64_t> unchanged;
+	std::atomic<uint64_t> tiles_hashed;
+	std::atomic<uint64_t> tiles_sent;
+	std::atomic<uint64_t> bytes_sent;
+	std::atomic<uint64_t> encode_ns;
+};
+
+// Codes BGRA frames for Codec::Tiles. Every tile that may have changed is
+// hashed and only the ones whose hash differs from the last frame are coded,
+// one row of tiles per job on a WorkerPool
+struct TileEncoder {
+	uint32_t width;
+	uint32_t height;
+	uint32_t columns;
+	uint32_t rows;
+
+	// Of every tile as last sent, meaningless until the first frame was coded whole
+	uint64_t *hashes;
+	bool hashes_valid;
+	WorkerPool pool;
+	// Per tile row, the records of its changed tiles and the scratch to code them
+	uint8_t *row_records;
+	uint32_t *row_sizes;
+	uint32_t *row_tile_counts;
+	uint32_t *row_tiles_hashed;
+	TileScratch *row_scratch;
+	// A TileFrame per output buffer, kept until the output is released
+	uint8_t *outputs[NUM_IO_BUFFERS];
+	uint32_t output_capacity;
+
+	// The frame being encoded, read by the jobs
+	const uint32_t *pixels;
+	uint32_t stride;
+	const int8_t *tile_mask;
+	bool keyframe;
+
+	TileStats stats;
+
+	// thread_total counts the encoding thread too, 0 uses every hardware thread
+	void Initialize(uint32_t frame_width, uint32_t frame_height, uint32_t thread_total);
+	uint32_t TileCount() const;
+
+	// Codes the tiles of the frame that changed into the output buffer, stride
+	// in pixels. tile_mask holds one byte per tile in raster order, tiles
+	// with a zero byte are known to be unchanged and not even hashed. Null
+	// checks every tile. A keyframe, as is the first frame, codes every tile.
+	// Returns no data if no tile changed, which is sent as a duplicate frame
+	EncodedData Encode(const uint32_t *frame_pixels, uint32_t frame_stride, const int8_t *mask, bool force_keyframe,
+					   uint32_t output_index);
+	void EncodeRow(uint32_t row);
+
+	void PrintStats();
+	void Shutdown();
+};
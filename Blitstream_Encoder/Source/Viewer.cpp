@@ -0,0 +1,681 @@
+#include "Viewer.h"
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include "GaloisField.h"
+#include "Platform.h"
+#include "ReedSolomon.h"
+
+static constexpr size_t FEC_SHARDS_SIZE = static_cast<size_t>(MAX_FRAME_PARITY_PACKETS + 2) * MAX_PACKET_PAYLOAD;
+static constexpr size_t RETRANSMIT_SLOTS_SIZE = RETRANSMIT_RING_SIZE * sizeof(RetransmitSlot);
+static constexpr size_t RETRANSMIT_PACKETS_SIZE = static_cast<size_t>(RETRANSMIT_RING_SIZE) * MAX_DATAGRAM_SIZE;
+// A client that has not said hello on the media socket by then is dropped
+static constexpr uint64_t HELLO_TIMEOUT_US = 5000000;
+// The sending thread checks for a lost connection at least this often
+static constexpr int SEND_POLL_TIMEOUT_MS = 100;
+
+static const char *TransportName(Transport transport) {
+	return transport == Transport::Udp ? "UDP" : "TCP";
+}
+
+void Viewer::Start(SocketHandle socket, const char *ip_address, uint32_t width, uint32_t height, uint32_t bitrate,
+				   Codec stream_codec, const ServerOptions &options, KeyframeRequests *requests, CursorState *cursor_state) {
+	accept_timestamp = PlatformTimestamp();
+	client_socket = socket;
+	snprintf(address, sizeof(address), "%s", ip_address);
+	transport = options.transport;
+	codec = stream_codec;
+	media_socket = INVALID_SOCKET_HANDLE;
+	emulator.enabled = false;
+	fec_parity_count = 0;
+	fec_shards = nullptr;
+	retransmit = false;
+	retransmit_slots = nullptr;
+	retransmit_packets = nullptr;
+	adaptive_bitrate = false;
+	target_bitrate.store(bitrate, std::memory_order_relaxed);
+	waiting_for_keyframe = true;
+	keyframe_requests = requests;
+	joined = false;
+	first_keyframe_sent = false;
+	cursor = cursor_state;
+
+	stats.frames_sent.store(0, std::memory_order_relaxed);
+	stats.frames_skipped.store(0, std::memory_order_relaxed);
+	latency_report.Initialize(nullptr);
+	latency_report.Add("send", &stats.send);
+
+	connected.store(true, std::memory_order_relaxed);
+	state.store(ViewerState::Connecting, std::memory_order_release);
+	send_thread = std::thread(&Viewer::SendLoop, this, width, height, bitrate, options);
+}
+
+bool Viewer::Handshake(uint32_t width, uint32_t height, uint32_t bitrate, const ServerOptions &options) {
+	// Bind before the client learns the port so its first hello is not refused
+	uint16_t media_port = 0;
+	if(transport == Transport::Udp) {
+		media_socket = NetBindUdp("0");
+		if(media_socket == INVALID_SOCKET_HANDLE) {
+			printf("Viewer %u: failed to create media socket\n", index);
+			return false;
+		}
+		NetSetSendBufferSize(media_socket, options.send_buffer_size != 0 ? options.send_buffer_size : UDP_SEND_BUFFER_SIZE);
+		media_port = NetLocalPort(media_socket);
+
+		// The control connection is only watched once the hello is in, any
+		// control message before that belongs to the control thread
+		[[maybe_unused]] bool poller_result = poller.Initialize();
+		assert(poller_result && "Failed to create poller");
+		poller.Add(media_socket, NET_POLL_READ);
+	}
+
+	NetSetNoDelay(client_socket, options.tcp_nodelay);
+	if(options.send_buffer_size != 0) {
+		NetSetSendBufferSize(client_socket, options.send_buffer_size);
+	}
+
+	// Send init packet
+	InitMessage init_message {
+		.MAGIC = PROTOCOL_MAGIC,
+		.encoded_width = width,
+		.encoded_height = height,
+		.transport = transport,
+		.media_port = media_port,
+		.codec = codec
+	};
+	if(!NetSendAll(client_socket, &init_message, sizeof(InitMessage))) {
+		return false;
+	}
+
+	if(transport == Transport::Udp) {
+		if(!WaitForHello()) {
+			return false;
+		}
+		poller.Add(client_socket, NET_POLL_READ);
+		emulator.Initialize(media_socket, options.emulator);
+	}
+
+	fec_block_size = options.fec_block_size;
+	if(transport == Transport::Udp && options.fec_percent > 0.0f) {
+		fec_parity_count = static_cast<uint32_t>(fec_block_size * options.fec_percent / 100.0f + 0.999f);
+		fec_parity_count = fec_parity_count > MAX_FEC_PARITY_SHARDS ? MAX_FEC_PARITY_SHARDS : fec_parity_count;
+		fec_shards = static_cast<uint8_t *>(PlatformAllocate(FEC_SHARDS_SIZE));
+		GfInitialize();
+		printf("Viewer %u: FEC %u parity packets per %u packets, %s kernel\n", index, fec_parity_count, fec_block_size,
+			   GfKernelName(GfSelectedKernel()));
+	}
+	parity_packets_sent.store(0, std::memory_order_relaxed);
+	fec_encode_ns.store(0, std::memory_order_relaxed);
+
+	retransmit = transport == Transport::Udp && options.retransmit;
+	if(retransmit) {
+		// Fresh pages are zeroed, so every slot starts out unused
+		retransmit_slots = static_cast<RetransmitSlot *>(PlatformAllocate(RETRANSMIT_SLOTS_SIZE));
+		retransmit_packets = static_cast<uint8_t *>(PlatformAllocate(RETRANSMIT_PACKETS_SIZE));
+	}
+
+	// Never above the encoder profile's bitrate, which sets the quality
+	adaptive_bitrate = options.adaptive_bitrate && bitrate != 0;
+	if(adaptive_bitrate) {
+		bandwidth_estimator.Initialize(options.min_bitrate_kbps * 1000u, bitrate, bitrate);
+	}
+
+	header = DataHeader {
+		.MAGIC = PROTOCOL_MAGIC,
+		.size = 0
+	};
+	sequence = 0;
+	packet_sequence = 0;
+	writer.Initialize(client_socket);
+	control_thread = std::thread(&Viewer::ControlLoop, this);
+	cursor_snapshot.Initialize();
+	cursor_cache.Initialize();
+	cursor_thread = std::thread(&Viewer::CursorLoop, this);
+
+	printf("Viewer %u: streaming to %s over %s\n", index, address, TransportName(transport));
+	return true;
+}
+
+bool Viewer::WaitForHello() {
+	uint64_t start = PlatformTimestamp();
+	while(connected.load(std::memory_order_relaxed) && PlatformTimestamp() - start < HELLO_TIMEOUT_US) {
+		NetPollEvent event;
+		if(poller.Wait(&event, 1, SEND_POLL_TIMEOUT_MS) == 1) {
+			PacketHeader hello;
+			NetAddress hello_address;
+			int64_t result = NetRecvFrom(media_socket, &hello, sizeof(PacketHeader), &hello_address);
+			if(result == sizeof(PacketHeader) && hello.MAGIC == PROTOCOL_MAGIC && hello.type == PacketType::Hello) {
+				[[maybe_unused]] bool connect_result = NetConnectAddress(media_socket, hello_address);
+				assert(connect_result && "Failed to connect media socket");
+				return true;
+			}
+		}
+	}
+	printf("Viewer %u: no hello from %s on the media socket\n", index, address);
+	return false;
+}
+
+void Viewer::SendLoop(uint32_t width, uint32_t height, uint32_t bitrate, ServerOptions options) {
+	if(Handshake(width, height, bitrate, options)) {
+		state.store(ViewerState::Streaming, std::memory_order_release);
+		// Joining right after a keyframe would otherwise mean waiting a whole GOP
+		keyframe_requests->Request();
+		while(connected.load(std::memory_order_relaxed)) {
+			if(!frame_count.try_acquire_for(std::chrono::milliseconds(SEND_POLL_TIMEOUT_MS))) {
+				continue;
+			}
+			SharedFrame *frame;
+			if(!frames.Pop(&frame)) {
+				continue;
+			}
+
+			bool success = SendFrame(*frame);
+			stats.send.Record(PlatformTimestampNs() - frame->queue_timestamp_ns);
+			// The server reuses the frame as soon as the reference is gone
+			bool keyframe = frame->keyframe;
+			frame->references.fetch_sub(1, std::memory_order_acq_rel);
+			if(!success) {
+				break;
+			}
+			stats.frames_sent.fetch_add(1, std::memory_order_relaxed);
+			if(!first_keyframe_sent && keyframe) {
+				first_keyframe_sent = true;
+				printf("Viewer %u: first keyframe sent %.1f ms after connecting\n", index,
+					   (PlatformTimestamp() - accept_timestamp) / 1000.0);
+			}
+		}
+	}
+
+	connected.store(false, std::memory_order_relaxed);
+	state.store(ViewerState::Closed, std::memory_order_release);
+	printf("Viewer %u: %s disconnected\n", index, address);
+}
+
+bool Viewer::Queue(SharedFrame *frame) {
+	// Missing a single frame breaks every later one up to the next keyframe
+	if(waiting_for_keyframe && !frame->keyframe) {
+		stats.frames_skipped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// A frame that does not fit into a UDP packet count is lost like any other
+	if(transport == Transport::Udp && frame->size > MAX_UDP_FRAME_SIZE) {
+		printf("Viewer %u: %u byte frame too large for UDP transport, skipped\n", index, frame->size);
+		Skip(true, frame->keyframe);
+		return false;
+	}
+
+	frame->references.fetch_add(1, std::memory_order_relaxed);
+	if(!frames.Push(frame)) {
+		frame->references.fetch_sub(1, std::memory_order_relaxed);
+		Skip(frame->size != 0, frame->keyframe);
+		return false;
+	}
+	waiting_for_keyframe = false;
+	frame_count.release();
+	return true;
+}
+
+void Viewer::Skip(bool has_data, bool keyframe) {
+	stats.frames_skipped.fetch_add(1, std::memory_order_relaxed);
+	// A repeated frame carries nothing the decoder needs
+	if(!has_data) {
+		return;
+	}
+	// Asked again if the keyframe it was waiting for was skipped as well, a
+	// pending request is served only once
+	if(!waiting_for_keyframe || keyframe) {
+		keyframe_requests->Request();
+	}
+	waiting_for_keyframe = true;
+}
+
+bool Viewer::SendFrame(const SharedFrame &frame) {
+	header.size = frame.size;
+	header.sequence = sequence++;
+	header.flags = (frame.keyframe ? DATA_FLAG_KEYFRAME : 0) | (frame.regions ? DATA_FLAG_REGIONS : 0);
+	header.capture_timestamp = frame.capture_timestamp;
+
+	header.send_timestamp = PlatformTimestamp();
+
+	if(transport == Transport::Udp) {
+		// Nothing tells a UDP sender that the receiver is gone
+		return connected.load(std::memory_order_relaxed) && SendPackets(header, frame.data, frame.size);
+	}
+
+	// Send header and encoded data as one message on the video channel, if no
+	// data is present the header will suffice to tell the client that it
+	// should simply duplicate the current frame
+	NetBuffer buffers[] = {
+		{ .ptr = &header, .size = sizeof(DataHeader) },
+		{ .ptr = frame.data, .size = frame.size }
+	};
+	return writer.Send(Channel::Video, buffers, frame.size != 0 ? 2 : 1);
+}
+
+void Viewer::ControlLoop() {
+	ControlMessage message;
+	for(;;) {
+		// Over UDP NACKs arrive on the media socket in between control messages
+		if(transport == Transport::Udp) {
+			NetPollEvent events[2];
+			int event_count = poller.Wait(events, 2, -1);
+			bool control_readable = event_count < 0;
+			for(int i = 0; i < event_count; ++i) {
+				if(events[i].socket == media_socket) {
+					ReceiveNacks();
+				}
+				else {
+					control_readable = true;
+				}
+			}
+			if(!control_readable) {
+				continue;
+			}
+		}
+
+		if(!NetRecvAll(client_socket, &message, sizeof(ControlMessage))) {
+			break;
+		}
+		uint64_t receive_timestamp = PlatformTimestamp();
+		// Out of step with the client, which must not take the other viewers down
+		if(message.MAGIC != PROTOCOL_MAGIC) {
+			break;
+		}
+
+		if(message.type == ControlType::ClockSync) {
+			// Answered right away, overtaking any frame being sent
+			ClockSyncAnswer answer {
+				.originate_timestamp = message.timestamp,
+				.receive_timestamp = receive_timestamp
+			};
+			ControlMessage reply {
+				.MAGIC = PROTOCOL_MAGIC,
+				.type = ControlType::ClockSync,
+				.timestamp = PlatformTimestamp()
+			};
+			NetBuffer buffers[] = {
+				{ .ptr = &reply, .size = sizeof(ControlMessage) },
+				{ .ptr = &answer, .size = sizeof(ClockSyncAnswer) }
+			};
+			if(!writer.Send(Channel::Control, buffers, 2)) {
+				break;
+			}
+		}
+		else if(message.type == ControlType::Feedback) {
+			if(!ReceiveFeedback(message.timestamp)) {
+				break;
+			}
+		}
+		else if(message.type == ControlType::KeyframeRequest) {
+			keyframe_requests->Request();
+		}
+	}
+	connected.store(false, std::memory_order_relaxed);
+}
+
+void Viewer::CursorLoop() {
+	// The snapshot starts out at version 0, so a viewer that joins gets the
+	// current cursor right away
+	while(connected.load(std::memory_order_relaxed)) {
+		if(cursor->Wait(&cursor_snapshot, SEND_POLL_TIMEOUT_MS) && !SendCursor()) {
+			break;
+		}
+	}
+	connected.store(false, std::memory_order_relaxed);
+}
+
+bool Viewer::SendCursor() {
+	CursorMessage message {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = CursorType::Position,
+		.x = cursor_snapshot.x,
+		.y = cursor_snapshot.y,
+		.flags = cursor_snapshot.visible && cursor_snapshot.shape_hash != 0 ? CURSOR_FLAG_VISIBLE : 0u,
+		.slot = 0
+	};
+	NetBuffer buffers[] = {
+		{ .ptr = &message, .size = sizeof(CursorMessage) },
+		{ .ptr = &cursor_snapshot.shape, .size = sizeof(CursorShape) },
+		{ .ptr = cursor_snapshot.data, .size = cursor_snapshot.shape.data_size }
+	};
+	if(!(message.flags & CURSOR_FLAG_VISIBLE)) {
+		return writer.Send(Channel::Cursor, buffers, 1);
+	}
+
+	message.slot = cursor_cache.Find(cursor_snapshot.shape_hash);
+	if(message.slot != CURSOR_CACHE_MISS) {
+		return writer.Send(Channel::Cursor, buffers, 1);
+	}
+	message.type = CursorType::Shape;
+	message.slot = cursor_cache.Insert(cursor_snapshot.shape_hash);
+	return writer.Send(Channel::Cursor, buffers, 3);
+}
+
+void Viewer::ReceiveNacks() {
+	constexpr uint32_t NACK_HEADER_SIZE = offsetof(NackPacket, sequences);
+
+	// The socket stays blocking for sending, so only the one datagram the
+	// poller reported is read and the next one is left for the next wait
+	NackPacket nack;
+	int64_t size = NetRecv(media_socket, &nack, sizeof(NackPacket));
+	// Hellos keep coming until the client has seen the first frame packet
+	if(size < NACK_HEADER_SIZE || nack.MAGIC != PROTOCOL_MAGIC || nack.type != PacketType::Nack ||
+	   nack.sequence_count > MAX_NACK_SEQUENCES ||
+	   size != static_cast<int64_t>(NACK_HEADER_SIZE + nack.sequence_count * sizeof(uint32_t))) {
+		return;
+	}
+	retransmit_stats.nacks_received.fetch_add(1, std::memory_order_relaxed);
+	if(!retransmit) {
+		return;
+	}
+
+	uint64_t now_ns = PlatformTimestampNs();
+	for(uint32_t i = 0; i < nack.sequence_count; ++i) {
+		Retransmit(nack.sequences[i], nack.round_trip * 1000ull, now_ns);
+	}
+}
+
+bool Viewer::ReceiveFeedback(uint64_t report_timestamp) {
+	FeedbackMessage feedback;
+	if(!NetRecvAll(client_socket, &feedback, sizeof(FeedbackMessage))) {
+		return false;
+	}
+	if(!adaptive_bitrate || feedback.frame_count > MAX_FEEDBACK_FRAMES) {
+		return true;
+	}
+
+	bandwidth_estimator.SetRoundTrip(feedback.round_trip);
+	for(uint32_t i = 0; i < feedback.frame_count; ++i) {
+		const FeedbackFrame &frame = feedback.frames[i];
+		bandwidth_estimator.AddFrame(frame.send_timestamp, frame.arrival_timestamp, frame.size);
+	}
+	bandwidth_estimator.AddLoss(feedback.packets_expected, feedback.packets_lost);
+	// Arrival timestamps are on the receiver's clock, as is the report's
+	uint32_t bitrate = bandwidth_estimator.Update(report_timestamp);
+	target_bitrate.store(bitrate, std::memory_order_relaxed);
+	return true;
+}
+
+void Viewer::Retransmit(uint32_t packet_sequence_number, uint64_t round_trip_ns, uint64_t now_ns) {
+	std::lock_guard<std::mutex> lock(send_mutex);
+
+	uint32_t index = packet_sequence_number % RETRANSMIT_RING_SIZE;
+	RetransmitSlot &slot = retransmit_slots[index];
+	if(slot.size == 0 || slot.sequence != packet_sequence_number ||
+	   now_ns + round_trip_ns / 2 - slot.first_send_timestamp_ns > FRAME_DEADLINE_US * 1000) {
+		retransmit_stats.expired.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	// The NACK was sent before the previous retransmission could have arrived
+	if(slot.last_send_timestamp_ns != slot.first_send_timestamp_ns &&
+	   now_ns - slot.last_send_timestamp_ns < round_trip_ns) {
+		retransmit_stats.suppressed.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	uint8_t *packet = retransmit_packets + static_cast<size_t>(index) * MAX_DATAGRAM_SIZE;
+	PacketHeader header;
+	memcpy(&header, packet, sizeof(PacketHeader));
+	header.flags |= PACKET_FLAG_RETRANSMIT;
+	memcpy(packet, &header, sizeof(PacketHeader));
+
+	NetBuffer buffer {
+		.ptr = packet,
+		.size = slot.size
+	};
+	emulator.Send(&buffer, 1);
+	slot.last_send_timestamp_ns = now_ns;
+	retransmit_stats.retransmits.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Viewer::SendPackets(const DataHeader &header, const void *ptr, uint32_t size) {
+	constexpr uint32_t HEADER_SIZE = sizeof(DataHeader);
+	uint32_t frame_size = HEADER_SIZE + size;
+	uint32_t packet_count = (frame_size + MAX_PACKET_PAYLOAD - 1) / MAX_PACKET_PAYLOAD;
+	// Queue skips larger frames
+	assert(packet_count <= UINT16_MAX && "Frame too large for UDP transport");
+
+	PacketHeader packet {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = PacketType::Frame,
+		.frame_sequence = header.sequence,
+		.frame_size = frame_size,
+		.packet_count = static_cast<uint16_t>(packet_count),
+		.fec_block_size = static_cast<uint8_t>(fec_parity_count != 0 ? fec_block_size : 0),
+		.fec_parity_count = static_cast<uint8_t>(fec_parity_count)
+	};
+	const uint8_t *header_bytes = reinterpret_cast<const uint8_t *>(&header);
+	const uint8_t *data = static_cast<const uint8_t *>(ptr);
+
+	for(uint32_t i = 0; i < packet_count; ++i) {
+		// Byte range of the frame carried by this packet, the first one
+		// starts with the DataHeader
+		uint32_t begin = i * MAX_PACKET_PAYLOAD;
+		uint32_t end = begin + MAX_PACKET_PAYLOAD < frame_size ? begin + MAX_PACKET_PAYLOAD : frame_size;
+
+		NetBuffer buffers[3];
+		uint32_t buffer_count = 0;
+		buffers[buffer_count++] = NetBuffer { .ptr = &packet, .size = sizeof(PacketHeader) };
+		if(begin < HEADER_SIZE) {
+			uint32_t header_end = end < HEADER_SIZE ? end : HEADER_SIZE;
+			buffers[buffer_count++] = NetBuffer { .ptr = header_bytes + begin, .size = header_end - begin };
+		}
+		if(end > HEADER_SIZE) {
+			uint32_t data_begin = (begin > HEADER_SIZE ? begin : HEADER_SIZE) - HEADER_SIZE;
+			buffers[buffer_count++] = NetBuffer { .ptr = data + data_begin, .size = end - HEADER_SIZE - data_begin };
+		}
+
+		packet.sequence = packet_sequence++;
+		packet.packet_index = static_cast<uint16_t>(i);
+		if(!SendPacket(buffers, buffer_count, packet.sequence)) {
+			return false;
+		}
+	}
+
+	return fec_parity_count == 0 || SendParity(packet, header, data);
+}
+
+bool Viewer::SendParity(PacketHeader packet, const DataHeader &header, const uint8_t *data) {
+	constexpr uint32_t HEADER_SIZE = sizeof(DataHeader);
+	uint64_t start_ns = PlatformTimestampNs();
+
+	// Full packets of encoded data are used in place, the one holding the
+	// DataHeader and the last one are gathered and padded
+	uint32_t last_index = packet.packet_count - 1u;
+	uint32_t last_begin = last_index * MAX_PACKET_PAYLOAD;
+	uint8_t *first_shard = fec_shards + MAX_FRAME_PARITY_PACKETS * MAX_PACKET_PAYLOAD;
+	uint8_t *last_shard = first_shard + MAX_PACKET_PAYLOAD;
+	uint32_t first_data_size = packet.frame_size < MAX_PACKET_PAYLOAD ? packet.frame_size - HEADER_SIZE :
+																		MAX_PACKET_PAYLOAD - HEADER_SIZE;
+	memcpy(first_shard, &header, HEADER_SIZE);
+	if(first_data_size != 0) {
+		memcpy(first_shard + HEADER_SIZE, data, first_data_size);
+	}
+	memset(first_shard + HEADER_SIZE + first_data_size, 0, MAX_PACKET_PAYLOAD - HEADER_SIZE - first_data_size);
+	if(last_index != 0) {
+		uint32_t last_size = packet.frame_size - last_begin;
+		memcpy(last_shard, data + (last_begin - HEADER_SIZE), last_size);
+		memset(last_shard + last_size, 0, MAX_PACKET_PAYLOAD - last_size);
+	}
+
+	// Receivers have no room for parity past MAX_FRAME_PARITY_PACKETS, later
+	// blocks of very large frames go without
+	uint32_t block_count = FecBlockCount(packet.packet_count, fec_block_size);
+	uint32_t parity_block_count = (MAX_FRAME_PARITY_PACKETS + fec_parity_count - 1) / fec_parity_count;
+	parity_block_count = parity_block_count < block_count ? parity_block_count : block_count;
+	uint32_t parity_counts[MAX_FRAME_PARITY_PACKETS];
+	for(uint32_t block = 0; block < parity_block_count; ++block) {
+		uint32_t first_parity = block * fec_parity_count;
+		uint32_t data_count = FecBlockDataCount(packet.packet_count, block_count, block);
+		uint32_t parity_count = FecParityCount(data_count, fec_block_size, fec_parity_count);
+		parity_count = first_parity + parity_count > MAX_FRAME_PARITY_PACKETS ? MAX_FRAME_PARITY_PACKETS - first_parity :
+																				parity_count;
+		parity_counts[block] = parity_count;
+
+		const uint8_t *data_shards[MAX_FEC_DATA_SHARDS];
+		for(uint32_t i = 0; i < data_count; ++i) {
+			uint32_t packet_index = block + i * block_count;
+			data_shards[i] = packet_index == 0 ? first_shard :
+							 packet_index == last_index ? last_shard :
+														  data + (packet_index * MAX_PACKET_PAYLOAD - HEADER_SIZE);
+		}
+		uint8_t *parity_shards[MAX_FEC_PARITY_SHARDS];
+		for(uint32_t j = 0; j < parity_count; ++j) {
+			parity_shards[j] = fec_shards + static_cast<size_t>(first_parity + j) * MAX_PACKET_PAYLOAD;
+		}
+		ReedSolomonEncode(data_shards, data_count, parity_shards, parity_count, MAX_PACKET_PAYLOAD);
+	}
+	fec_encode_ns.fetch_add(PlatformTimestampNs() - start_ns, std::memory_order_relaxed);
+
+	// Round robin over the blocks so a burst of losses hits each block once
+	packet.type = PacketType::Parity;
+	uint32_t parity_sent = 0;
+	for(uint32_t j = 0; j < fec_parity_count; ++j) {
+		for(uint32_t block = 0; block < parity_block_count; ++block) {
+			if(j >= parity_counts[block]) {
+				continue;
+			}
+			NetBuffer buffers[] = {
+				{ .ptr = &packet, .size = sizeof(PacketHeader) },
+				{ .ptr = fec_shards + static_cast<size_t>(block * fec_parity_count + j) * MAX_PACKET_PAYLOAD,
+				  .size = MAX_PACKET_PAYLOAD }
+			};
+			packet.sequence = packet_sequence++;
+			packet.packet_index = static_cast<uint16_t>(block);
+			packet.fec_index = static_cast<uint8_t>(j);
+			if(!SendPacket(buffers, 2, packet.sequence)) {
+				return false;
+			}
+			++parity_sent;
+		}
+	}
+	parity_packets_sent.fetch_add(parity_sent, std::memory_order_relaxed);
+	return true;
+}
+
+bool Viewer::SendPacket(const NetBuffer *buffers, uint32_t buffer_count, uint32_t packet_sequence_number) {
+	if(!retransmit) {
+		return emulator.Send(buffers, buffer_count);
+	}
+
+	// The copy is sent instead of the original buffers
+	std::lock_guard<std::mutex> lock(send_mutex);
+	uint32_t index = packet_sequence_number % RETRANSMIT_RING_SIZE;
+	uint8_t *packet = retransmit_packets + static_cast<size_t>(index) * MAX_DATAGRAM_SIZE;
+	uint32_t size = 0;
+	for(uint32_t i = 0; i < buffer_count; ++i) {
+		memcpy(packet + size, buffers[i].ptr, buffers[i].size);
+		size += buffers[i].size;
+	}
+
+	uint64_t now_ns = PlatformTimestampNs();
+	retransmit_slots[index] = RetransmitSlot {
+		.sequence = packet_sequence_number,
+		.size = size,
+		.first_send_timestamp_ns = now_ns,
+		.last_send_timestamp_ns = now_ns
+	};
+	NetBuffer buffer {
+		.ptr = packet,
+		.size = size
+	};
+	return emulator.Send(&buffer, 1);
+}
+
+void Viewer::PrintStats() {
+	LatencySummary send = latency_report.Summarize(0);
+	printf("Viewer %u (%s, %s): sent %llu, skipped %llu, send p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		   index, address, TransportName(transport),
+		   static_cast<unsigned long long>(stats.frames_sent.exchange(0, std::memory_order_relaxed)),
+		   static_cast<unsigned long long>(stats.frames_skipped.exchange(0, std::memory_order_relaxed)),
+		   send.p50_ns / 1000.0, send.p99_ns / 1000.0, send.max_ns / 1000.0);
+
+	ChannelWriterStats &channel_stats = writer.stats;
+	uint64_t messages[CHANNEL_COUNT];
+	uint64_t chunks[CHANNEL_COUNT];
+	for(uint32_t i = 0; i < CHANNEL_COUNT; ++i) {
+		messages[i] = channel_stats.messages[i].exchange(0, std::memory_order_relaxed);
+		chunks[i] = channel_stats.chunks[i].exchange(0, std::memory_order_relaxed);
+	}
+	printf("  Channels: %llu control, %llu cursor and %llu video messages in %llu, %llu and %llu chunks, %llu preemptions\n",
+		   static_cast<unsigned long long>(messages[static_cast<uint32_t>(Channel::Control)]),
+		   static_cast<unsigned long long>(messages[static_cast<uint32_t>(Channel::Cursor)]),
+		   static_cast<unsigned long long>(messages[static_cast<uint32_t>(Channel::Video)]),
+		   static_cast<unsigned long long>(chunks[static_cast<uint32_t>(Channel::Control)]),
+		   static_cast<unsigned long long>(chunks[static_cast<uint32_t>(Channel::Cursor)]),
+		   static_cast<unsigned long long>(chunks[static_cast<uint32_t>(Channel::Video)]),
+		   static_cast<unsigned long long>(channel_stats.preemptions.exchange(0, std::memory_order_relaxed)));
+	if(transport == Transport::Udp && emulator.enabled) {
+		printf("  Link emulator: sent %llu, dropped %llu\n",
+			   static_cast<unsigned long long>(emulator.stats.sent.exchange(0, std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(emulator.stats.dropped.exchange(0, std::memory_order_relaxed)));
+	}
+	if(fec_parity_count != 0) {
+		printf("  FEC: sent %llu parity packets, encoding took %.2f ms\n",
+			   static_cast<unsigned long long>(parity_packets_sent.exchange(0, std::memory_order_relaxed)),
+			   fec_encode_ns.exchange(0, std::memory_order_relaxed) / 1000000.0);
+	}
+	if(adaptive_bitrate) {
+		BandwidthEstimatorStats &estimator_stats = bandwidth_estimator.stats;
+		printf("  Bandwidth: target %u kbps, receiving %u kbps, %llu overuses, %llu delay and %llu loss decreases\n",
+			   target_bitrate.load(std::memory_order_relaxed) / 1000,
+			   estimator_stats.incoming_bitrate.load(std::memory_order_relaxed) / 1000,
+			   static_cast<unsigned long long>(estimator_stats.overuses.exchange(0, std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(estimator_stats.delay_decreases.exchange(0, std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(estimator_stats.loss_decreases.exchange(0, std::memory_order_relaxed)));
+	}
+	if(retransmit) {
+		printf("  Retransmit: %llu NACKs, %llu packets sent again, %llu suppressed, %llu expired\n",
+			   static_cast<unsigned long long>(retransmit_stats.nacks_received.exchange(0, std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(retransmit_stats.retransmits.exchange(0, std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(retransmit_stats.suppressed.exchange(0, std::memory_order_relaxed)),
+			   static_cast<unsigned long long>(retransmit_stats.expired.exchange(0, std::memory_order_relaxed)));
+	}
+}
+
+void Viewer::Shutdown() {
+	// Unblocks the threads if the client is still connected
+	connected.store(false, std::memory_order_relaxed);
+	NetDisconnect(client_socket);
+	if(send_thread.joinable()) {
+		send_thread.join();
+	}
+	if(control_thread.joinable()) {
+		control_thread.join();
+	}
+	if(cursor_thread.joinable()) {
+		cursor_thread.join();
+		cursor_snapshot.Shutdown();
+	}
+	NetClose(client_socket);
+
+	// Frames queued after the sending thread stopped
+	SharedFrame *frame;
+	while(frames.Pop(&frame)) {
+		frame->references.fetch_sub(1, std::memory_order_acq_rel);
+	}
+	while(frame_count.try_acquire());
+
+	if(transport == Transport::Udp) {
+		poller.Shutdown();
+		emulator.Shutdown();
+		if(media_socket != INVALID_SOCKET_HANDLE) {
+			NetClose(media_socket);
+		}
+	}
+	if(retransmit_slots) {
+		PlatformFree(retransmit_slots, RETRANSMIT_SLOTS_SIZE);
+		PlatformFree(retransmit_packets, RETRANSMIT_PACKETS_SIZE);
+		retransmit_slots = nullptr;
+		retransmit_packets = nullptr;
+	}
+	if(fec_shards) {
+		PlatformFree(fec_shards, FEC_SHARDS_SIZE);
+		fec_shards = nullptr;
+	}
+	latency_report.Shutdown();
+	state.store(ViewerState::Free, std::memory_order_release);
+}
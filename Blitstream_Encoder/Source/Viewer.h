@@ -0,0 +1,201 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include "BandwidthEstimator.h"
+#include "ChannelWriter.h"
+#include "CursorShape.h"
+#include "CursorState.h"
+#include "KeyframeRequests.h"
+#include "LatencyHistogram.h"
+#include "LinkEmulator.h"
+#include "Options.h"
+#include "Protocol.h"
+#include "Socket.h"
+#include "SpscQueue.h"
+
+// Send buffer for the UDP socket, a whole frame is written in one burst
+constexpr uint32_t UDP_SEND_BUFFER_SIZE = 4u * 1024u * 1024u;
+// Recently sent packets kept for retransmission, about 100 ms of a 400 Mbit/s stream
+constexpr uint32_t RETRANSMIT_RING_SIZE = 4096;
+// Frames waiting to be sent to a viewer, a viewer that falls further behind
+// skips frames until the next keyframe
+constexpr uint32_t VIEWER_QUEUE_SIZE = 4;
+
+struct RetransmitSlot {
+	uint32_t sequence;
+	// Zero if never used
+	uint32_t size;
+	uint64_t first_send_timestamp_ns;
+	uint64_t last_send_timestamp_ns;
+};
+
+// Written by the control thread, read by the stats printer
+struct RetransmitStats {
+	std::atomic<uint64_t> nacks_received;
+	std::atomic<uint64_t> retransmits;
+	// Already sent again less than a round trip ago
+	std::atomic<uint64_t> suppressed;
+	// No longer in the ring, or could not arrive before the frame deadline
+	std::atomic<uint64_t> expired;
+};
+
+// One encoded frame shared by every viewer it was queued for. The sending
+// thread of each viewer drops its reference once the frame is out, the
+// buffer is reused once none are left
+struct SharedFrame {
+	std::atomic<uint32_t> references;
+	uint32_t size;
+	bool keyframe;
+	// data starts with a FrameRegions
+	bool regions;
+	// PlatformTimestamp reading from before capture
+	uint64_t capture_timestamp;
+	// When the frame was handed to the viewers, for the queuing latency
+	uint64_t queue_timestamp_ns;
+	// capacity bytes, allocated on first use and grown with the frames
+	uint8_t *data;
+	uint32_t capacity;
+};
+
+enum class ViewerState : uint32_t {
+	// Slot unused
+	Free,
+	// Accepted, the handshake has not finished yet
+	Connecting,
+	// Receives frames
+	Streaming,
+	// The connection is gone, the slot is reclaimed on the next accept
+	Closed
+};
+
+// Written by the viewer's threads, read by the stats printer
+struct ViewerStats {
+	std::atomic<uint64_t> frames_sent;
+	// Not queued because the viewer was behind or waiting for a keyframe
+	std::atomic<uint64_t> frames_skipped;
+	// Handed to the viewer until the last byte was written
+	LatencyHistogram send;
+};
+
+// One connected client. Frames are queued by the server's fan-out and sent
+// from the viewer's own thread, so a slow viewer only ever holds up itself.
+// Over UDP each viewer has its own media socket on an ephemeral port, which
+// the client learns from the InitMessage
+struct Viewer {
+	std::atomic<ViewerState> state;
+	uint32_t index;
+	char address[NET_ADDRESS_SIZE];
+	SocketHandle client_socket;
+	Transport transport;
+	Codec codec;
+	// Connected to the client's UDP socket, UDP transport only
+	SocketHandle media_socket;
+	LinkEmulator emulator;
+	// Parity packets for a full block, 0 without FEC
+	uint32_t fec_parity_count;
+	uint32_t fec_block_size;
+	// MAX_FRAME_PARITY_PACKETS parity shards followed by two shards to pad the
+	// first and last packet of a frame in, each MAX_PACKET_PAYLOAD bytes
+	uint8_t *fec_shards;
+	std::atomic<uint64_t> parity_packets_sent;
+	std::atomic<uint64_t> fec_encode_ns;
+
+	// Packet sequence % RETRANSMIT_RING_SIZE indexes the slots and the
+	// MAX_DATAGRAM_SIZE copies of the packets. send_mutex serializes the
+	// sending thread and retransmissions from the control thread
+	bool retransmit;
+	RetransmitSlot *retransmit_slots;
+	uint8_t *retransmit_packets;
+	std::mutex send_mutex;
+	RetransmitStats retransmit_stats;
+	// Sequences are per viewer, frames skipped for it leave no gap
+	uint32_t sequence;
+	uint32_t packet_sequence;
+	DataHeader header;
+
+	// Fed with the client's feedback on the control thread. target_bitrate
+	// stays at the initial bitrate if adaptive bitrate is off
+	bool adaptive_bitrate;
+	BandwidthEstimator bandwidth_estimator;
+	std::atomic<uint32_t> target_bitrate;
+
+	// Fan-out -> sending thread. Only the fan-out touches waiting_for_keyframe
+	SpscQueue<SharedFrame *, VIEWER_QUEUE_SIZE> frames;
+	std::counting_semaphore<VIEWER_QUEUE_SIZE> frame_count { 0 };
+	bool waiting_for_keyframe;
+	// Shared by all viewers, asked for a keyframe on joining, falling behind
+	// and on the client's request
+	KeyframeRequests *keyframe_requests;
+	// PlatformTimestamp reading from when the connection was accepted, set
+	// before the viewer is started
+	uint64_t accept_timestamp;
+	// A frame has been queued, only the fan-out touches it
+	bool joined;
+	// Owned by the sending thread
+	bool first_keyframe_sent;
+
+	// Shared by all viewers, the cursor thread follows it on the cursor
+	// channel. The snapshot and cache are its copy of what the client has
+	CursorState *cursor;
+	CursorSnapshot cursor_snapshot;
+	CursorCache cursor_cache;
+
+	// The sending thread runs the handshake, then sends queued frames
+	std::thread send_thread;
+	// Reads control messages and, over UDP, NACKs from the client while frames
+	// are being sent, clears connected once the client has gone away
+	std::thread control_thread;
+	NetPoller poller;
+	// Sends cursor updates as they come in, no matter how long the frame
+	// being sent takes
+	std::thread cursor_thread;
+	std::atomic<bool> connected;
+	// Frames from the sending thread, cursor updates from the cursor thread
+	// and clock sync answers from the control thread share the TCP
+	// connection, the answers go first and frames last
+	ChannelWriter writer;
+
+	ViewerStats stats;
+	// Reads stats.send, only used by the stats printer
+	LatencyReport latency_report;
+
+	// Takes over an accepted connection and starts the handshake in the
+	// background. bitrate is what the encoder starts out with, 0 if it cannot
+	// be changed
+	void Start(SocketHandle socket, const char *ip_address, uint32_t width, uint32_t height, uint32_t bitrate,
+			   Codec stream_codec, const ServerOptions &options, KeyframeRequests *requests, CursorState *cursor_state);
+	// Takes a reference to the frame and returns true if it is queued, called
+	// from the fan-out only
+	bool Queue(SharedFrame *frame);
+	// Skips a frame that is not queued, one with data makes the viewer wait
+	// for the next keyframe. From the fan-out only
+	void Skip(bool has_data, bool keyframe);
+	void PrintStats();
+	// Disconnects if still connected and waits for its threads
+	void Shutdown();
+
+	void SendLoop(uint32_t width, uint32_t height, uint32_t bitrate, ServerOptions options);
+	// Returns false if the client went away before it was ready for frames
+	bool Handshake(uint32_t width, uint32_t height, uint32_t bitrate, const ServerOptions &options);
+	bool WaitForHello();
+	bool SendFrame(const SharedFrame &frame);
+	// Splits the header and data into datagrams of at most MAX_DATAGRAM_SIZE
+	bool SendPackets(const DataHeader &header, const void *ptr, uint32_t size);
+	// Encodes and sends the parity packets of every block of a frame, packet
+	// is the header of its last frame packet
+	bool SendParity(PacketHeader packet, const DataHeader &header, const uint8_t *data);
+	// Sends one datagram over UDP and keeps a copy for retransmission
+	bool SendPacket(const NetBuffer *buffers, uint32_t buffer_count, uint32_t packet_sequence_number);
+	void ControlLoop();
+	void CursorLoop();
+	// Sends the cursor snapshot, along with its shape unless the client has it cached
+	bool SendCursor();
+	void ReceiveNacks();
+	// Returns false if the connection was closed, report_timestamp is the
+	// client's ControlMessage timestamp
+	bool ReceiveFeedback(uint64_t report_timestamp);
+	void Retransmit(uint32_t packet_sequence_number, uint64_t round_trip_ns, uint64_t now_ns);
+};
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+#include <nvEncodeAPI.h>
+#include "Check.h"
+#include "Pipeline.h"
+
+// Runs the pipeline with asynchronous encoding against a stub function list
+// standing in for the driver, called the way Encoder calls it. Encodes
+// complete in submission order on a thread standing in for the hardware,
+// after a random delay, and signal the output buffer's completion event.
+// Checks that frames are retrieved and sent in the order they were submitted,
+// that an output buffer is never encoded into while it is in flight or
+// locked, and that stopping retrieves and unlocks every frame still in flight
+
+constexpr uint32_t ASYNC_TEST_FPS = 240;
+constexpr uint32_t ASYNC_TEST_RUN_MS = 500;
+// Upper bounds of the random encode and send times, long enough for encodes
+// to overlap and for sends to run out of output buffers now and then
+constexpr uint32_t ASYNC_TEST_MAX_ENCODE_US = 6000;
+constexpr uint32_t ASYNC_TEST_MAX_SEND_US = 8000;
+
+enum class OutputState : uint32_t {
+	Free,
+	Encoding,
+	Done,
+	Locked
+};
+
+struct StubOutput {
+	OutputState state;
+	// Number of the frame encoded into it, written to its bitstream
+	uint32_t frame;
+	uint8_t bitstream[sizeof(uint32_t)];
+};
+
+// Signaled by the hardware thread, stands in for a Windows event
+struct CompletionEvent {
+	std::binary_semaphore signal { 0 };
+};
+
+struct StubDriver {
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool running;
+	// Output buffers submitted and not yet completed, in submission order
+	std::vector<uint32_t> queue;
+	StubOutput outputs[NUM_IO_BUFFERS];
+	CompletionEvent *events[NUM_IO_BUFFERS];
+	uint32_t next_frame;
+	uint32_t in_flight;
+	uint32_t max_in_flight;
+	uint32_t encodes;
+	uint32_t locks;
+	uint32_t unlocks;
+	uint32_t errors;
+	std::vector<uint32_t> submitted;
+	std::mt19937 rng;
+};
+
+static StubDriver driver;
+
+static uint32_t OutputIndex(NV_ENC_OUTPUT_PTR output) {
+	return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(output)) - 1;
+}
+
+static void HardwareLoop() {
+	std::unique_lock<std::mutex> lock(driver.mutex);
+	for(;;) {
+		driver.wake.wait(lock, []() { return !driver.running || !driver.queue.empty(); });
+		if(driver.queue.empty()) {
+			return;
+		}
+		uint32_t encode_us = driver.rng() % ASYNC_TEST_MAX_ENCODE_US;
+		lock.unlock();
+		std::this_thread::sleep_for(std::chrono::microseconds(encode_us));
+		lock.lock();
+
+		uint32_t index = driver.queue.front();
+		driver.queue.erase(driver.queue.begin());
+		StubOutput &output = driver.outputs[index];
+		output.state = OutputState::Done;
+		memcpy(output.bitstream, &output.frame, sizeof(output.frame));
+		--driver.in_flight;
+		driver.events[index]->signal.release();
+	}
+}
+
+static NVENCSTATUS NVENCAPI StubEncodePicture(void *, NV_ENC_PIC_PARAMS *params) {
+	std::lock_guard<std::mutex> lock(driver.mutex);
+	++driver.encodes;
+	uint32_t index = OutputIndex(params->outputBitstream);
+	if(index >= NUM_IO_BUFFERS || driver.outputs[index].state != OutputState::Free || !params->completionEvent) {
+		++driver.errors;
+		return NV_ENC_ERR_INVALID_PARAM;
+	}
+	StubOutput &output = driver.outputs[index];
+	output.state = OutputState::Encoding;
+	output.frame = driver.next_frame++;
+	driver.events[index] = static_cast<CompletionEvent *>(params->completionEvent);
+	driver.submitted.push_back(output.frame);
+	driver.queue.push_back(index);
+	++driver.in_flight;
+	driver.max_in_flight = driver.in_flight > driver.max_in_flight ? driver.in_flight : driver.max_in_flight;
+	driver.wake.notify_one();
+	return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI StubLockBitstream(void *, NV_ENC_LOCK_BITSTREAM *params) {
+	std::lock_guard<std::mutex> lock(driver.mutex);
+	++driver.locks;
+	StubOutput &output = driver.outputs[OutputIndex(params->outputBitstream)];
+	// The completion event was waited for, so the encode has to be done
+	if(output.state != OutputState::Done) {
+		++driver.errors;
+		return NV_ENC_ERR_INVALID_PARAM;
+	}
+	output.state = OutputState::Locked;
+	params->bitstreamBufferPtr = output.bitstream;
+	params->bitstreamSizeInBytes = sizeof(output.bitstream);
+	return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI StubUnlockBitstream(void *, NV_ENC_OUTPUT_PTR bitstream) {
+	std::lock_guard<std::mutex> lock(driver.mutex);
+	++driver.unlocks;
+	StubOutput &output = driver.outputs[OutputIndex(bitstream)];
+	if(output.state != OutputState::Locked) {
+		++driver.errors;
+		return NV_ENC_ERR_INVALID_PARAM;
+	}
+	output.state = OutputState::Free;
+	return NV_ENC_SUCCESS;
+}
+
+// The encoder's side of the calls, as in Encoder::Encode, Retrieve and ReleaseOutput
+struct StubEncoder {
+	NV_ENCODE_API_FUNCTION_LIST api;
+	CompletionEvent completion_events[NUM_IO_BUFFERS];
+	std::vector<uint32_t> retrieved;
+	std::vector<uint32_t> sent;
+	std::mt19937 rng;
+};
+
+static NV_ENC_OUTPUT_PTR OutputBuffer(uint32_t output_index) {
+	return reinterpret_cast<NV_ENC_OUTPUT_PTR>(static_cast<uintptr_t>(output_index) + 1);
+}
+
+static bool CaptureStage(void *, uint32_t) {
+	return true;
+}
+
+static EncodedData EncodeStage(void *user_data, uint32_t, uint32_t output_index) {
+	StubEncoder *encoder = static_cast<StubEncoder *>(user_data);
+	NV_ENC_PIC_PARAMS pic_params {
+		.version = NV_ENC_PIC_PARAMS_VER,
+		.outputBitstream = OutputBuffer(output_index),
+		.completionEvent = &encoder->completion_events[output_index]
+	};
+	encoder->api.nvEncEncodePicture(nullptr, &pic_params);
+	return {};
+}
+
+static EncodedData RetrieveStage(void *user_data, uint32_t, uint32_t output_index) {
+	StubEncoder *encoder = static_cast<StubEncoder *>(user_data);
+	encoder->completion_events[output_index].signal.acquire();
+	NV_ENC_LOCK_BITSTREAM lock_bitstream {
+		.version = NV_ENC_LOCK_BITSTREAM_VER,
+		.outputBitstream = OutputBuffer(output_index)
+	};
+	encoder->api.nvEncLockBitstream(nullptr, &lock_bitstream);
+	uint32_t frame = 0;
+	if(lock_bitstream.bitstreamBufferPtr) {
+		memcpy(&frame, lock_bitstream.bitstreamBufferPtr, sizeof(frame));
+	}
+	encoder->retrieved.push_back(frame);
+	return EncodedData {
+		.ptr = lock_bitstream.bitstreamBufferPtr,
+		.size = lock_bitstream.bitstreamSizeInBytes
+	};
+}
+
+static bool SendStage(void *user_data, const EncodedData &data, uint64_t) {
+	StubEncoder *encoder = static_cast<StubEncoder *>(user_data);
+	uint32_t frame = 0;
+	if(data.ptr) {
+		memcpy(&frame, data.ptr, sizeof(frame));
+	}
+	encoder->sent.push_back(frame);
+	std::this_thread::sleep_for(std::chrono::microseconds(encoder->rng() % ASYNC_TEST_MAX_SEND_US));
+	return true;
+}
+
+static void ReleaseStage(void *user_data, uint32_t output_index) {
+	static_cast<StubEncoder *>(user_data)->api.nvEncUnlockBitstream(nullptr, OutputBuffer(output_index));
+}
+
+int main() {
+	StubEncoder *encoder = new StubEncoder {};
+	encoder->api.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+	encoder->api.nvEncEncodePicture = StubEncodePicture;
+	encoder->api.nvEncLockBitstream = StubLockBitstream;
+	encoder->api.nvEncUnlockBitstream = StubUnlockBitstream;
+	encoder->rng.seed(1);
+	driver.rng.seed(2);
+
+	PipelineStages stages {
+		.user_data = encoder,
+		.capture = CaptureStage,
+		.encode = EncodeStage,
+		.retrieve = RetrieveStage,
+		.send = SendStage,
+		.release = ReleaseStage
+	};
+	Pipeline *pipeline = new Pipeline {};
+
+	// Twice, as for a viewer that leaves and one that joins later
+	for(uint32_t run = 0; run < 2; ++run) {
+		driver.running = true;
+		std::thread hardware_thread(HardwareLoop);
+		pipeline->Start(stages, ASYNC_TEST_FPS);
+		std::this_thread::sleep_for(std::chrono::milliseconds(ASYNC_TEST_RUN_MS));
+		pipeline->Stop();
+		{
+			std::lock_guard<std::mutex> lock(driver.mutex);
+			driver.running = false;
+			driver.wake.notify_one();
+		}
+		hardware_thread.join();
+
+		printf("Run %u: %zu submitted, %zu sent, at most %u in flight\n", run, driver.submitted.size(),
+			   encoder->sent.size(), driver.max_in_flight);
+		// Every submitted frame was retrieved in order, those sent before the
+		// stop were sent in order as well
+		CHECK(encoder->retrieved == driver.submitted);
+		CHECK(encoder->sent.size() <= driver.submitted.size());
+		CHECK(std::equal(encoder->sent.begin(), encoder->sent.end(), driver.submitted.begin()));
+		CHECK(encoder->sent.size() >= ASYNC_TEST_RUN_MS * ASYNC_TEST_FPS / 1000 / 4);
+		CHECK(driver.max_in_flight >= 2);
+		// Nothing in flight or locked is left behind
+		CHECK(driver.encodes == driver.locks && driver.locks == driver.unlocks);
+		for(const StubOutput &output : driver.outputs) {
+			CHECK(output.state == OutputState::Free);
+		}
+		CHECK(driver.errors == 0);
+
+		driver.submitted.clear();
+		encoder->retrieved.clear();
+		encoder->sent.clear();
+		driver.encodes = driver.locks = driver.unlocks = 0;
+		driver.max_in_flight = 0;
+	}
+
+	delete pipeline;
+	delete encoder;
+	return CheckResult();
+}
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+#include "BandwidthEstimator.h"
+#include "Check.h"
+
+// Trace driven simulation of the estimator steering an encoder through a
+// bottleneck whose capacity changes every 20 s. Frame sizes follow a trace
+// of desktop content scaled to the target, the bottleneck is a drop tail
+// queue followed by a fixed propagation delay and the receiver reports its
+// arrivals every 50 ms. Reports utilization and queuing delay per phase and
+// checks that the estimator keeps the queue short without starving the link
+
+constexpr double SIM_FPS = 60.0;
+constexpr uint32_t SIM_PACKET_SIZE = 1176;
+constexpr double SIM_PROPAGATION_MS = 10.0;
+constexpr double SIM_FEEDBACK_INTERVAL_S = 0.05;
+// The receiver's clock is far off the sender's, only differences count
+constexpr uint64_t SIM_CLOCK_OFFSET_US = 7777777;
+// Left out of the per phase numbers while the estimator adapts
+constexpr double SIM_SETTLE_S = 5.0;
+
+struct Phase {
+	double start_s;
+	double capacity_bps;
+};
+
+constexpr Phase SIM_PHASES[] = { { 0, 30e6 }, { 20, 10e6 }, { 40, 20e6 }, { 60, 5e6 }, { 80, 30e6 } };
+constexpr uint32_t SIM_PHASE_COUNT = sizeof(SIM_PHASES) / sizeof(SIM_PHASES[0]);
+constexpr double SIM_DURATION_S = 100.0;
+
+struct PhaseReport {
+	double delivered_bits;
+	double capacity_bits;
+	std::vector<double> queuing_ms;
+	uint32_t last_target;
+};
+
+struct SimulationReport {
+	PhaseReport phases[SIM_PHASE_COUNT];
+	uint64_t packets;
+	uint64_t lost;
+	std::vector<uint32_t> targets;
+};
+
+// Frame sizes relative to the average, mostly small updates with a large
+// frame whenever a window is scrolled or switched. Generated instead of read
+// from a recording so the test needs no data file, with the same shape
+static std::vector<double> DesktopTrace(uint32_t count) {
+	std::vector<double> trace(count);
+	uint32_t state = 12345;
+	double sum = 0.0;
+	for(uint32_t i = 0; i < count; ++i) {
+		state = state * 1664525u + 1013904223u;
+		double noise = (state >> 8) / static_cast<double>(1 << 24);
+		trace[i] = i % 90 == 0 ? 6.0 : 0.4 + noise;
+		sum += trace[i];
+	}
+	for(double &size : trace) {
+		size *= count / sum;
+	}
+	return trace;
+}
+
+static uint32_t PhaseAt(double t) {
+	uint32_t phase = 0;
+	while(phase + 1 < SIM_PHASE_COUNT && SIM_PHASES[phase + 1].start_s <= t) {
+		++phase;
+	}
+	return phase;
+}
+
+static double Percentile(std::vector<double> values, double fraction) {
+	if(values.empty()) {
+		return 0.0;
+	}
+	std::sort(values.begin(), values.end());
+	return values[static_cast<size_t>(fraction * (values.size() - 1))];
+}
+
+struct InFlight {
+	uint64_t send_us;
+	uint64_t arrival_us;
+	uint32_t size;
+	uint32_t packets;
+	uint32_t lost;
+};
+
+static void Simulate(double buffer_ms, SimulationReport *report) {
+	std::vector<double> trace = DesktopTrace(6000);
+	BandwidthEstimator estimator {};
+	estimator.Initialize(1000000, 25000000, 50000000);
+	uint32_t target = estimator.target_bitrate;
+
+	// Arrivals not reported yet and targets on their way back to the sender
+	std::deque<InFlight> arrivals;
+	std::deque<std::pair<double, uint32_t>> targets;
+	double link_free_s = 0.0;
+	double next_feedback_s = SIM_FEEDBACK_INTERVAL_S;
+
+	for(uint32_t frame = 0; frame < SIM_DURATION_S * SIM_FPS; ++frame) {
+		double t = frame / SIM_FPS;
+		while(!targets.empty() && targets.front().first <= t) {
+			target = targets.front().second;
+			targets.pop_front();
+		}
+		uint32_t phase = PhaseAt(t);
+		double capacity = SIM_PHASES[phase].capacity_bps;
+
+		// Packets that do not fit in the bottleneck buffer are dropped
+		double size = target / 8.0 / SIM_FPS * trace[frame % trace.size()];
+		uint32_t packets = static_cast<uint32_t>(ceil(size / SIM_PACKET_SIZE));
+		double start_s = std::max(t, link_free_s);
+		double backlog_ms = (start_s - t) * 1000.0;
+		double room_bytes = std::max(0.0, (buffer_ms - backlog_ms) / 1000.0 * capacity / 8.0);
+		uint32_t kept = std::min(packets, static_cast<uint32_t>(room_bytes / SIM_PACKET_SIZE));
+		double sent_bytes = static_cast<double>(kept) * SIM_PACKET_SIZE;
+		double depart_s = start_s + sent_bytes * 8.0 / capacity;
+		link_free_s = depart_s;
+
+		report->packets += packets;
+		report->lost += packets - kept;
+		PhaseReport &phase_report = report->phases[phase];
+		if(t - SIM_PHASES[phase].start_s >= SIM_SETTLE_S) {
+			phase_report.delivered_bits += sent_bytes * 8.0;
+			phase_report.capacity_bits += capacity / SIM_FPS;
+			phase_report.queuing_ms.push_back(backlog_ms);
+		}
+		arrivals.push_back(InFlight {
+			.send_us = static_cast<uint64_t>(t * 1e6),
+			.arrival_us = static_cast<uint64_t>((depart_s + SIM_PROPAGATION_MS / 1000.0) * 1e6) + SIM_CLOCK_OFFSET_US,
+			.size = static_cast<uint32_t>(size),
+			.packets = packets,
+			.lost = packets - kept
+		});
+
+		while(next_feedback_s <= t) {
+			uint64_t now_us = static_cast<uint64_t>(next_feedback_s * 1e6) + SIM_CLOCK_OFFSET_US;
+			uint32_t expected = 0;
+			uint32_t lost = 0;
+			uint64_t last_arrival_us = 0;
+			estimator.SetRoundTrip(static_cast<uint64_t>(2 * SIM_PROPAGATION_MS * 1000));
+			while(!arrivals.empty() && arrivals.front().arrival_us <= now_us) {
+				const InFlight &arrival = arrivals.front();
+				estimator.AddFrame(arrival.send_us, arrival.arrival_us, arrival.size);
+				expected += arrival.packets;
+				lost += arrival.lost;
+				last_arrival_us = arrival.arrival_us;
+				arrivals.pop_front();
+			}
+			if(last_arrival_us != 0) {
+				estimator.AddLoss(expected, lost);
+				uint32_t new_target = estimator.Update(last_arrival_us);
+				report->targets.push_back(new_target);
+				targets.emplace_back(next_feedback_s + SIM_PROPAGATION_MS / 1000.0, new_target);
+				phase_report.last_target = new_target;
+			}
+			next_feedback_s += SIM_FEEDBACK_INTERVAL_S;
+		}
+	}
+}
+
+static void PrintReport(const char *name, const SimulationReport &report) {
+	printf("%s:\n", name);
+	for(uint32_t i = 0; i < SIM_PHASE_COUNT; ++i) {
+		const PhaseReport &phase = report.phases[i];
+		printf("  %4.1f Mbit/s: utilization %5.1f%%, queuing delay p50 %6.1f ms, p95 %6.1f ms, max %6.1f ms, "
+			   "final target %5.2f Mbit/s\n", SIM_PHASES[i].capacity_bps / 1e6,
+			   100.0 * phase.delivered_bits / phase.capacity_bits, Percentile(phase.queuing_ms, 0.5),
+			   Percentile(phase.queuing_ms, 0.95), Percentile(phase.queuing_ms, 1.0), phase.last_target / 1e6);
+	}
+	printf("  loss %.2f%%\n", 100.0 * report.lost / report.packets);
+}
+
+static void CheckPhases(const SimulationReport &report) {
+	for(uint32_t i = 0; i < SIM_PHASE_COUNT; ++i) {
+		const PhaseReport &phase = report.phases[i];
+		double capacity = SIM_PHASES[i].capacity_bps;
+		// Once settled the queue is usually empty and the target stays
+		// below the capacity
+		CHECK(Percentile(phase.queuing_ms, 0.5) < 20.0);
+		CHECK(phase.last_target < capacity);
+		// The last phase is still probing upwards from the 5 Mbit/s before
+		if(i + 1 < SIM_PHASE_COUNT) {
+			CHECK(phase.delivered_bits > 0.5 * phase.capacity_bits);
+		}
+		else {
+			CHECK(phase.last_target > SIM_PHASES[i - 1].capacity_bps);
+		}
+	}
+}
+
+int main() {
+	// A deep buffer signals congestion through delay, only the sudden drops
+	// in capacity overflow it
+	SimulationReport deep {};
+	Simulate(1000.0, &deep);
+	PrintReport("1000 ms buffer", deep);
+	CheckPhases(deep);
+	CHECK(deep.lost < deep.packets / 100);
+
+	// A shallow one drops packets before the delay grows much
+	SimulationReport shallow {};
+	Simulate(100.0, &shallow);
+	PrintReport("100 ms buffer", shallow);
+	CheckPhases(shallow);
+	CHECK(shallow.lost < shallow.packets / 20);
+
+	// The arrival clock drives all timing, the same trace gives the same targets
+	SimulationReport repeat {};
+	Simulate(1000.0, &repeat);
+	CHECK(repeat.targets == deep.targets);
+
+	for(uint32_t target : deep.targets) {
+		CHECK(target >= 1000000 && target <= 50000000);
+	}
+	return CheckResult();
+}
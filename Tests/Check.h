@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+// Failed checks are counted instead of aborting so one run reports all of
+// them, main returns CheckResult()
+inline uint32_t check_failures = 0;
+
+#define CHECK(condition)                                                                         \
+	do {                                                                                         \
+		if(!(condition)) {                                                                       \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);                 \
+			++check_failures;                                                                    \
+		}                                                                                        \
+	} while(0)
+
+inline int CheckResult() {
+	if(check_failures != 0) {
+		printf("%u checks failed\n", check_failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+#include "Check.h"
+#include "Client.h"
+#include "ClockSync.h"
+#include "Platform.h"
+#include "Server.h"
+
+// First exchanges against a sender clock with a known offset and random,
+// asymmetric delays, where the estimate has to be that of the exchange with
+// the shortest round trip in the window. Then a server and a client in the
+// same process over loopback, which share a clock, so the offset the client
+// settles on is its error and has to stay within 100 us
+
+constexpr uint64_t CLOCK_TEST_TIMEOUT_US = 5000000;
+constexpr uint32_t CLOCK_TEST_FPS = 120;
+constexpr uint32_t CLOCK_TEST_FRAME_SIZE = 16 * 1024;
+constexpr int64_t CLOCK_TEST_MAX_OFFSET_US = 100;
+// Exchanges the loopback run waits for, past the first window
+constexpr uint32_t CLOCK_TEST_EXCHANGES = 2 * CLOCK_SYNC_WINDOW;
+
+static void TestEstimate() {
+	constexpr int64_t SENDER_OFFSET = 123456;
+	constexpr uint32_t EXCHANGES = CLOCK_SYNC_WINDOW * 4;
+	std::mt19937 rng(1);
+	ClockSync sync {};
+	ClockSample exchanges[EXCHANGES];
+	uint64_t now = 1000000000;
+	for(uint32_t i = 0; i < EXCHANGES; ++i) {
+		// The sender holds the request for a while before it answers
+		int64_t outbound = 20 + rng() % 2000;
+		int64_t held = rng() % 500;
+		int64_t inbound = 20 + rng() % 2000;
+		uint64_t receive = now + outbound + SENDER_OFFSET;
+		uint64_t transmit = receive + held;
+		uint64_t arrival = transmit - SENDER_OFFSET + inbound;
+		sync.AddExchange(now, receive, transmit, arrival);
+		now = arrival + 1000;
+		exchanges[i] = ClockSample {
+			.offset = (outbound + SENDER_OFFSET + SENDER_OFFSET - inbound) / 2,
+			.round_trip = outbound + inbound
+		};
+
+		// The estimate is that of an exchange with the shortest round trip
+		// among the last CLOCK_SYNC_WINDOW
+		uint32_t first = i + 1 > CLOCK_SYNC_WINDOW ? i + 1 - CLOCK_SYNC_WINDOW : 0;
+		int64_t shortest = INT64_MAX;
+		for(uint32_t j = first; j <= i; ++j) {
+			shortest = exchanges[j].round_trip < shortest ? exchanges[j].round_trip : shortest;
+		}
+		int64_t offset = sync.offset.load(std::memory_order_relaxed);
+		bool found = false;
+		for(uint32_t j = first; j <= i; ++j) {
+			found |= exchanges[j].round_trip == shortest && exchanges[j].offset == offset;
+		}
+		CHECK(sync.round_trip.load(std::memory_order_relaxed) == shortest);
+		CHECK(found);
+		// Half the round trip bounds the error, give or take the rounding
+		int64_t error = offset - SENDER_OFFSET;
+		CHECK((error < 0 ? -error : error) <= shortest / 2 + 1);
+	}
+	CHECK(sync.synchronized.load(std::memory_order_relaxed));
+	int64_t offset = sync.offset.load(std::memory_order_relaxed);
+	CHECK(sync.ToLocal(5000000 + SENDER_OFFSET) == static_cast<uint64_t>(5000000 + SENDER_OFFSET - offset));
+}
+
+static void TestLoopback() {
+	ServerOptions options {};
+	options.transport = Transport::Tcp;
+	options.adaptive_bitrate = false;
+	options.max_viewers = 1;
+	Server server {};
+	server.Initialize(64, 64, 0, Codec::Hevc, options);
+	Client client {};
+	client.Initialize("127.0.0.1");
+	client.Start(nullptr, nullptr);
+	uint8_t payload[CLOCK_TEST_FRAME_SIZE] = {};
+
+	// The client asks with every frame it receives until the window is full,
+	// then every CLOCK_SYNC_INTERVAL_US, and the answers go out with frames
+	EncodedData frames[FRAME_QUEUE_SIZE];
+	uint64_t start = PlatformTimestamp();
+	while(client.clock_sync.sample_count < CLOCK_TEST_EXCHANGES &&
+		  PlatformTimestamp() - start < CLOCK_TEST_TIMEOUT_US) {
+		server.SendData(payload, CLOCK_TEST_FRAME_SIZE, true, nullptr, 0, PlatformTimestamp());
+		std::this_thread::sleep_for(std::chrono::microseconds(1000000 / CLOCK_TEST_FPS));
+		uint32_t frame_count = client.PollData(frames, FRAME_QUEUE_SIZE);
+		for(uint32_t i = 0; i < frame_count; ++i) {
+			if(frames[i].result != EncodedDataResult::Abort) {
+				client.ReleaseData(frames[i]);
+			}
+		}
+	}
+
+	int64_t offset = client.clock_sync.offset.load(std::memory_order_relaxed);
+	printf("Offset %lld us, round trip %lld us after %u exchanges\n", static_cast<long long>(offset),
+		   static_cast<long long>(client.clock_sync.round_trip.load(std::memory_order_relaxed)),
+		   client.clock_sync.sample_count);
+	CHECK(client.clock_sync.synchronized.load(std::memory_order_acquire));
+	CHECK(client.clock_sync.sample_count >= CLOCK_TEST_EXCHANGES);
+	CHECK(offset <= CLOCK_TEST_MAX_OFFSET_US && offset >= -CLOCK_TEST_MAX_OFFSET_US);
+
+	client.Shutdown();
+	server.Shutdown();
+}
+
+int main() {
+	TestEstimate();
+	TestLoopback();
+	return CheckResult();
+}
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "ColorConvert.h"
+#include "WorkerPool.h"
+
+// Every kernel of both directions against the scalar one byte for byte, at
+// odd and even sizes, every matrix and range, inline and on a pool, the
+// scalar ones against floating point references, and round trips
+
+constexpr ColorKernel COLOR_KERNELS[] = { ColorKernel::Scalar, ColorKernel::Sse41, ColorKernel::Avx2,
+										  ColorKernel::Neon };
+constexpr ColorMatrix COLOR_MATRICES[] = { ColorMatrix::Bt601, ColorMatrix::Bt709 };
+constexpr ColorRange COLOR_RANGES[] = { ColorRange::Limited, ColorRange::Full };
+// Bytes past the end of every destination row, which have to stay untouched
+constexpr uint32_t ROW_PADDING = 5;
+constexpr uint8_t PADDING_BYTE = 0xAA;
+
+struct YuvImage {
+	uint32_t width;
+	uint32_t height;
+	bool nv12;
+	uint32_t y_stride;
+	uint32_t chroma_stride;
+	std::vector<uint8_t> y;
+	// Interleaved UV for NV12
+	std::vector<uint8_t> u;
+	std::vector<uint8_t> v;
+
+	uint8_t U(uint32_t x, uint32_t y_) const {
+		return nv12 ? u[y_ * chroma_stride + x * 2] : u[y_ * chroma_stride + x];
+	}
+	uint8_t V(uint32_t x, uint32_t y_) const {
+		return nv12 ? u[y_ * chroma_stride + x * 2 + 1] : v[y_ * chroma_stride + x];
+	}
+};
+
+static YuvImage Convert(const std::vector<uint32_t> &bgra, uint32_t stride, uint32_t width, uint32_t height,
+						ColorMatrix matrix, ColorRange range, bool nv12, WorkerPool *pool) {
+	uint32_t chroma_width = (width + 1) / 2;
+	uint32_t chroma_height = (height + 1) / 2;
+	YuvImage image {
+		.width = width,
+		.height = height,
+		.nv12 = nv12,
+		.y_stride = width + ROW_PADDING,
+		.chroma_stride = (nv12 ? chroma_width * 2 : chroma_width) + ROW_PADDING
+	};
+	image.y.assign(image.y_stride * height, PADDING_BYTE);
+	image.u.assign(image.chroma_stride * chroma_height, PADDING_BYTE);
+	if(nv12) {
+		ConvertBgraToNv12(bgra.data(), stride, width, height, matrix, range, image.y.data(), image.y_stride,
+						  image.u.data(), image.chroma_stride, pool);
+	}
+	else {
+		image.v.assign(image.chroma_stride * chroma_height, PADDING_BYTE);
+		ConvertBgraToI420(bgra.data(), stride, width, height, matrix, range, image.y.data(), image.y_stride,
+						  image.u.data(), image.chroma_stride, image.v.data(), image.chroma_stride, pool);
+	}
+	return image;
+}
+
+static bool SameImage(const YuvImage &a, const YuvImage &b) {
+	return a.y == b.y && a.u == b.u && a.v == b.v;
+}
+
+// Pixels with random colors, every seventh black or white
+static std::vector<uint32_t> RandomPixels(std::mt19937 *rng, uint32_t count) {
+	std::vector<uint32_t> pixels(count);
+	for(uint32_t i = 0; i < count; ++i) {
+		pixels[i] = i % 7 == 0 ? ((*rng)() & 1 ? 0xFFFFFFFF : 0) : (*rng)();
+	}
+	return pixels;
+}
+
+// Counts the samples more than 1 away from the BT.601 or BT.709 formula in
+// floating point, chroma of the block average with edges repeated
+static uint32_t ReferenceErrors(const std::vector<uint32_t> &bgra, uint32_t stride, ColorMatrix matrix,
+								ColorRange range, const YuvImage &image) {
+	double kr = matrix == ColorMatrix::Bt709 ? 0.2126 : 0.299;
+	double kb = matrix == ColorMatrix::Bt709 ? 0.0722 : 0.114;
+	double y_scale = range == ColorRange::Full ? 1.0 : 219.0 / 255.0;
+	double c_scale = range == ColorRange::Full ? 1.0 : 224.0 / 255.0;
+	double y_offset = range == ColorRange::Full ? 0.0 : 16.0;
+	auto luma = [kr, kb](double b, double g, double r) { return kr * r + (1.0 - kr - kb) * g + kb * b; };
+
+	uint32_t errors = 0;
+	for(uint32_t y = 0; y < image.height; ++y) {
+		for(uint32_t x = 0; x < image.width; ++x) {
+			uint32_t pixel = bgra[y * stride + x];
+			double expected = y_offset + y_scale * luma(pixel & 0xFF, (pixel >> 8) & 0xFF, (pixel >> 16) & 0xFF);
+			errors += std::fabs(expected - image.y[y * image.y_stride + x]) > 1.0 ? 1 : 0;
+		}
+	}
+	for(uint32_t y = 0; y < (image.height + 1) / 2; ++y) {
+		for(uint32_t x = 0; x < (image.width + 1) / 2; ++x) {
+			double b = 0.0, g = 0.0, r = 0.0;
+			for(uint32_t dy = 0; dy < 2; ++dy) {
+				for(uint32_t dx = 0; dx < 2; ++dx) {
+					uint32_t px = 2 * x + dx < image.width ? 2 * x + dx : image.width - 1;
+					uint32_t py = 2 * y + dy < image.height ? 2 * y + dy : image.height - 1;
+					uint32_t pixel = bgra[py * stride + px];
+					b += (pixel & 0xFF) / 4.0;
+					g += ((pixel >> 8) & 0xFF) / 4.0;
+					r += ((pixel >> 16) & 0xFF) / 4.0;
+				}
+			}
+			double average = luma(b, g, r);
+			double u = 128.0 + c_scale * (b - average) / (2.0 - 2.0 * kb);
+			double v = 128.0 + c_scale * (r - average) / (2.0 - 2.0 * kr);
+			errors += std::fabs(u - image.U(x, y)) > 1.0 || std::fabs(v - image.V(x, y)) > 1.0 ? 1 : 0;
+		}
+	}
+	return errors;
+}
+
+static void TestKernels(std::mt19937 *rng, WorkerPool *pool) {
+	constexpr uint32_t SIZES[][2] = { { 1, 1 }, { 2, 2 }, { 3, 5 }, { 7, 3 }, { 15, 9 }, { 16, 16 }, { 17, 17 },
+									  { 31, 2 }, { 33, 7 }, { 64, 64 }, { 100, 37 }, { 129, 130 }, { 1920, 1080 } };
+	for(const uint32_t *size : SIZES) {
+		uint32_t width = size[0];
+		uint32_t height = size[1];
+		uint32_t stride = width + 3;
+		std::vector<uint32_t> bgra = RandomPixels(rng, stride * height);
+		for(ColorMatrix matrix : COLOR_MATRICES) {
+			for(ColorRange range : COLOR_RANGES) {
+				for(bool nv12 : { true, false }) {
+					ColorSelectKernel(ColorKernel::Scalar);
+					YuvImage expected = Convert(bgra, stride, width, height, matrix, range, nv12, nullptr);
+					if(width < 200) {
+						CHECK(ReferenceErrors(bgra, stride, matrix, range, expected) == 0);
+					}
+					uint32_t mismatches = 0;
+					for(ColorKernel kernel : COLOR_KERNELS) {
+						if(!ColorSelectKernel(kernel)) {
+							continue;
+						}
+						mismatches += SameImage(Convert(bgra, stride, width, height, matrix, range, nv12, nullptr),
+												expected) ? 0 : 1;
+						mismatches += SameImage(Convert(bgra, stride, width, height, matrix, range, nv12, pool),
+												expected) ? 0 : 1;
+					}
+					CHECK(mismatches == 0);
+				}
+			}
+		}
+	}
+}
+
+static void TestGray() {
+	// Green takes the rounding, so white and gray have exact luma and no chroma
+	for(ColorMatrix matrix : COLOR_MATRICES) {
+		for(ColorRange range : COLOR_RANGES) {
+			std::vector<uint32_t> bgra = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFF808080, 0xFF808080 };
+			YuvImage image = Convert(bgra, 2, 2, 2, matrix, range, true, nullptr);
+			bool full = range == ColorRange::Full;
+			CHECK(image.y[0] == (full ? 255 : 235));
+			CHECK(image.y[image.y_stride] == (full ? 128 : 126));
+			CHECK(image.U(0, 0) == 128 && image.V(0, 0) == 128);
+		}
+	}
+}
+
+static void TestNv12Kernels(std::mt19937 *rng, WorkerPool *pool) {
+	constexpr uint32_t SIZES[][2] = { { 1, 1 }, { 2, 2 }, { 3, 5 }, { 7, 3 }, { 15, 9 }, { 16, 16 }, { 17, 17 },
+									  { 31, 2 }, { 33, 7 }, { 64, 64 }, { 100, 37 }, { 129, 130 }, { 1920, 1080 } };
+	for(const uint32_t *size : SIZES) {
+		uint32_t width = size[0];
+		uint32_t height = size[1];
+		uint32_t y_stride = width + 3;
+		uint32_t uv_stride = (width + 1) / 2 * 2 + ROW_PADDING;
+		uint32_t stride = width + 2;
+		std::vector<uint8_t> y(y_stride * height), uv(uv_stride * ((height + 1) / 2));
+		// Random samples, many at the ends of their range
+		for(uint32_t i = 0; i < y.size(); ++i) {
+			y[i] = i % 5 == 0 ? ((*rng)() & 1 ? 255 : 0) : static_cast<uint8_t>((*rng)());
+		}
+		for(uint32_t i = 0; i < uv.size(); ++i) {
+			uv[i] = i % 3 == 0 ? ((*rng)() & 1 ? 255 : 0) : static_cast<uint8_t>((*rng)());
+		}
+		for(ColorMatrix matrix : COLOR_MATRICES) {
+			for(ColorRange range : COLOR_RANGES) {
+				// The pixels between the rows are left alone
+				ColorSelectKernel(ColorKernel::Scalar);
+				std::vector<uint32_t> expected(stride * height, 0x12345678);
+				ConvertNv12ToBgra(y.data(), y_stride, uv.data(), uv_stride, width, height, matrix, range,
+								  expected.data(), stride, nullptr);
+				uint32_t mismatches = 0;
+				for(uint32_t row = 0; row < height; ++row) {
+					mismatches += expected[row * stride + width] != 0x12345678 ? 1 : 0;
+				}
+				for(ColorKernel kernel : COLOR_KERNELS) {
+					if(!ColorSelectKernel(kernel)) {
+						continue;
+					}
+					for(WorkerPool *threads : { static_cast<WorkerPool *>(nullptr), pool }) {
+						std::vector<uint32_t> bgra(stride * height, 0x12345678);
+						ConvertNv12ToBgra(y.data(), y_stride, uv.data(), uv_stride, width, height, matrix, range,
+										  bgra.data(), stride, threads);
+						mismatches += bgra != expected ? 1 : 0;
+					}
+				}
+				CHECK(mismatches == 0);
+			}
+		}
+	}
+}
+
+static void TestNv12Exhaustive() {
+	// Every Y, U and V: one image per U, Y is the column and V the row pair
+	constexpr uint32_t WIDTH = 256, HEIGHT = 512;
+	std::vector<uint8_t> y(WIDTH * HEIGHT), uv(WIDTH * HEIGHT / 2);
+	for(uint32_t row = 0; row < HEIGHT; ++row) {
+		for(uint32_t column = 0; column < WIDTH; ++column) {
+			y[row * WIDTH + column] = static_cast<uint8_t>(column);
+		}
+	}
+	std::vector<uint32_t> expected(WIDTH * HEIGHT), bgra(WIDTH * HEIGHT);
+	for(ColorMatrix matrix : COLOR_MATRICES) {
+		for(ColorRange range : COLOR_RANGES) {
+			double kr = matrix == ColorMatrix::Bt709 ? 0.2126 : 0.299;
+			double kb = matrix == ColorMatrix::Bt709 ? 0.0722 : 0.114;
+			double y_scale = range == ColorRange::Full ? 1.0 : 255.0 / 219.0;
+			double c_scale = range == ColorRange::Full ? 1.0 : 255.0 / 224.0;
+			double y_offset = range == ColorRange::Full ? 0.0 : 16.0;
+			int32_t worst = 0;
+			uint32_t mismatches = 0;
+			uint32_t transparent = 0;
+			for(uint32_t u = 0; u < 256; ++u) {
+				for(uint32_t pair = 0; pair < HEIGHT / 2; ++pair) {
+					for(uint32_t column = 0; column < WIDTH / 2; ++column) {
+						uv[pair * WIDTH + column * 2] = static_cast<uint8_t>(u);
+						uv[pair * WIDTH + column * 2 + 1] = static_cast<uint8_t>(pair);
+					}
+				}
+				ColorSelectKernel(ColorKernel::Scalar);
+				ConvertNv12ToBgra(y.data(), WIDTH, uv.data(), WIDTH, WIDTH, HEIGHT, matrix, range, expected.data(),
+								  WIDTH, nullptr);
+				for(uint32_t v = 0; v < 256; ++v) {
+					for(uint32_t luma = 0; luma < 256; ++luma) {
+						uint32_t pixel = expected[v * 2 * WIDTH + luma];
+						double scaled = y_scale * (luma - y_offset);
+						double b = scaled + (2.0 - 2.0 * kb) * c_scale * (u - 128.0);
+						double r = scaled + (2.0 - 2.0 * kr) * c_scale * (v - 128.0);
+						double g = (scaled - kr * r - kb * b) / (1.0 - kr - kb);
+						const double channels[3] = { b, g, r };
+						for(uint32_t channel = 0; channel < 3; ++channel) {
+							double clamped = std::min(255.0, std::max(0.0, std::round(channels[channel])));
+							int32_t error = std::abs(static_cast<int32_t>(clamped) -
+													 static_cast<int32_t>((pixel >> (channel * 8)) & 0xFF));
+							worst = error > worst ? error : worst;
+						}
+						transparent += pixel >> 24 != 0xFF ? 1 : 0;
+					}
+				}
+				for(ColorKernel kernel : COLOR_KERNELS) {
+					if(kernel == ColorKernel::Scalar || !ColorSelectKernel(kernel)) {
+						continue;
+					}
+					ConvertNv12ToBgra(y.data(), WIDTH, uv.data(), WIDTH, WIDTH, HEIGHT, matrix, range, bgra.data(),
+									  WIDTH, nullptr);
+					mismatches += bgra != expected ? 1 : 0;
+				}
+			}
+			CHECK(mismatches == 0);
+			CHECK(transparent == 0);
+			CHECK(worst <= 1);
+		}
+	}
+}
+
+static void TestRoundTrip() {
+	// A smooth image survives BGRA to NV12 and back within 2 per channel
+	constexpr uint32_t SIZE = 256;
+	std::vector<uint32_t> bgra(SIZE * SIZE), result(SIZE * SIZE);
+	for(uint32_t y = 0; y < SIZE; ++y) {
+		for(uint32_t x = 0; x < SIZE; ++x) {
+			bgra[y * SIZE + x] = 0xFF000000 | x << 16 | y << 8 | (x + y) / 2;
+		}
+	}
+	std::vector<uint8_t> luma(SIZE * SIZE), chroma(SIZE * SIZE / 2);
+	ColorSelectKernel(ColorKernel::Scalar);
+	for(ColorMatrix matrix : COLOR_MATRICES) {
+		for(ColorRange range : COLOR_RANGES) {
+			ConvertBgraToNv12(bgra.data(), SIZE, SIZE, SIZE, matrix, range, luma.data(), SIZE, chroma.data(), SIZE,
+							  nullptr);
+			ConvertNv12ToBgra(luma.data(), SIZE, chroma.data(), SIZE, SIZE, SIZE, matrix, range, result.data(), SIZE,
+							  nullptr);
+			int32_t worst = 0;
+			for(uint32_t i = 0; i < SIZE * SIZE; ++i) {
+				for(uint32_t shift = 0; shift < 24; shift += 8) {
+					int32_t error = std::abs(static_cast<int32_t>((bgra[i] >> shift) & 0xFF) -
+											 static_cast<int32_t>((result[i] >> shift) & 0xFF));
+					worst = error > worst ? error : worst;
+				}
+			}
+			CHECK(worst <= 2);
+		}
+	}
+}
+
+int main() {
+	// Converting without ColorInitialize selects a kernel on the way
+	std::mt19937 rng(7);
+	std::vector<uint32_t> bgra = RandomPixels(&rng, 64 * 64);
+	YuvImage first = Convert(bgra, 64, 64, 64, ColorMatrix::Bt709, ColorRange::Limited, true, nullptr);
+	printf("Color conversion with %s\n", ColorKernelName(ColorSelectedKernel()));
+	ColorSelectKernel(ColorKernel::Scalar);
+	CHECK(SameImage(first, Convert(bgra, 64, 64, 64, ColorMatrix::Bt709, ColorRange::Limited, true, nullptr)));
+
+	WorkerPool pool {};
+	pool.Initialize(4);
+	TestKernels(&rng, &pool);
+	TestGray();
+	TestNv12Kernels(&rng, &pool);
+	TestNv12Exhaustive();
+	TestRoundTrip();
+	pool.Shutdown();
+	return CheckResult();
+}
@@ -0,0 +1,263 @@
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "CursorBlend.h"
+#include "CursorOverlay.h"
+#include "CursorShape.h"
+
+// Every blend kernel against a floating point reference, the shape encoding,
+// the sender's shape cache and the receiver's overlay
+
+constexpr BlendKernel BLEND_KERNELS[] = { BlendKernel::Scalar, BlendKernel::Sse2, BlendKernel::Avx2 };
+
+// The formula from CursorBlend.h, evaluated in floating point
+static uint32_t ReferenceBlend(uint32_t src, uint32_t dst) {
+	uint32_t alpha = src >> 24;
+	uint32_t result = dst & 0xFF000000;
+	for(uint32_t shift = 0; shift < 24; shift += 8) {
+		double value = (((src >> shift) & 0xFF) * alpha + ((dst >> shift) & 0xFF) * (255.0 - alpha)) / 255.0;
+		result |= static_cast<uint32_t>(floor(value + 0.5)) << shift;
+	}
+	return result;
+}
+
+static void TestBlendExhaustive() {
+	// Every alpha, source and destination channel value, in rows of an odd
+	// length so each kernel runs its scalar tail as well
+	constexpr uint32_t ROW = 259;
+	uint32_t src[ROW];
+	uint32_t dst[ROW];
+	uint32_t expected[ROW];
+	for(BlendKernel kernel : BLEND_KERNELS) {
+		if(!BlendSelectKernel(kernel)) {
+			printf("Blend %s not supported, skipped\n", BlendKernelName(kernel));
+			continue;
+		}
+		uint64_t mismatches = 0;
+		for(uint32_t alpha = 0; alpha < 256; ++alpha) {
+			for(uint32_t value = 0; value < 256; ++value) {
+				for(uint32_t i = 0; i < ROW; ++i) {
+					uint32_t d = i & 0xFF;
+					src[i] = alpha << 24 | value << 16 | (255 - value) << 8 | value;
+					dst[i] = (i * 37 & 0xFF) << 24 | d << 16 | d << 8 | (255 - d);
+					expected[i] = ReferenceBlend(src[i], dst[i]);
+				}
+				BlendRow(dst, src, ROW);
+				for(uint32_t i = 0; i < ROW; ++i) {
+					mismatches += dst[i] != expected[i] ? 1 : 0;
+				}
+			}
+		}
+		CHECK(mismatches == 0);
+	}
+}
+
+static void TestBlendRowLengths(std::mt19937 *rng) {
+	for(BlendKernel kernel : BLEND_KERNELS) {
+		if(!BlendSelectKernel(kernel)) {
+			continue;
+		}
+		for(uint32_t count = 0; count < 70; ++count) {
+			std::vector<uint32_t> src(count), dst(count), expected(count);
+			for(uint32_t i = 0; i < count; ++i) {
+				src[i] = (*rng)();
+				// Fully transparent pixels take a shortcut in some kernels
+				if((*rng)() % 3 == 0) {
+					src[i] &= 0x00FFFFFF;
+				}
+				dst[i] = (*rng)();
+				expected[i] = ReferenceBlend(src[i], dst[i]);
+			}
+			BlendRow(dst.data(), src.data(), count);
+			CHECK(dst == expected);
+		}
+
+		// Strided images leave the pixels between the rows alone
+		constexpr uint32_t WIDTH = 37, HEIGHT = 5, STRIDE = 41;
+		std::vector<uint32_t> src(STRIDE * HEIGHT), dst(STRIDE * HEIGHT), expected(STRIDE * HEIGHT);
+		for(uint32_t i = 0; i < STRIDE * HEIGHT; ++i) {
+			src[i] = (*rng)();
+			dst[i] = (*rng)();
+			expected[i] = i % STRIDE < WIDTH ? ReferenceBlend(src[i], dst[i]) : dst[i];
+		}
+		BlendImage(dst.data(), STRIDE, src.data(), STRIDE, WIDTH, HEIGHT);
+		CHECK(dst == expected);
+	}
+}
+
+static void TestCompression(std::mt19937 *rng) {
+	constexpr uint32_t COUNT = MAX_CURSOR_DIMENSION * MAX_CURSOR_DIMENSION;
+	std::vector<uint32_t> pixels(COUNT), decoded(COUNT);
+	std::vector<uint8_t> data(MAX_CURSOR_DATA_SIZE);
+
+	// No two neighbours equal, the bound has to hold
+	for(uint32_t i = 0; i < COUNT; ++i) {
+		pixels[i] = i * 2654435761u;
+	}
+	uint32_t size = CursorCompress(pixels.data(), COUNT, data.data());
+	CHECK(size <= MAX_CURSOR_DATA_SIZE);
+	CHECK(CursorDecompress(data.data(), size, decoded.data(), COUNT) && decoded == pixels);
+
+	// Fully transparent, a token and a pixel for every 128
+	std::fill(pixels.begin(), pixels.end(), 0);
+	size = CursorCompress(pixels.data(), COUNT, data.data());
+	CHECK(size == COUNT / 128 * 5);
+	CHECK(CursorDecompress(data.data(), size, decoded.data(), COUNT) && decoded == pixels);
+
+	// Mixes of runs and literals at many lengths
+	for(uint32_t iteration = 0; iteration < 2000; ++iteration) {
+		uint32_t count = (*rng)() % 2000 + 1;
+		std::vector<uint32_t> shape(count), result(count);
+		for(uint32_t i = 0; i < count; ++i) {
+			shape[i] = i != 0 && (*rng)() % 4 != 0 ? shape[i - 1] : (*rng)() % 4;
+		}
+		size = CursorCompress(shape.data(), count, data.data());
+		CHECK(size <= CursorCompressBound(count));
+		CHECK(CursorDecompress(data.data(), size, result.data(), count) && result == shape);
+		// Truncated data or a different pixel count are refused
+		CHECK(!CursorDecompress(data.data(), size - 1, result.data(), count));
+		if(count > 1) {
+			CHECK(!CursorDecompress(data.data(), size, result.data(), count - 1));
+		}
+	}
+	CHECK(!CursorDecompress(data.data(), 0, decoded.data(), 1));
+}
+
+static void TestCache() {
+	CursorCache cache {};
+	cache.Initialize();
+	CHECK(cache.Find(1) == CURSOR_CACHE_MISS);
+
+	uint32_t slots[CURSOR_CACHE_SIZE];
+	for(uint32_t i = 0; i < CURSOR_CACHE_SIZE; ++i) {
+		slots[i] = cache.Insert(100 + i);
+		CHECK(slots[i] < CURSOR_CACHE_SIZE);
+		for(uint32_t j = 0; j < i; ++j) {
+			CHECK(slots[i] != slots[j]);
+		}
+	}
+	for(uint32_t i = 0; i < CURSOR_CACHE_SIZE; ++i) {
+		CHECK(cache.Find(100 + i) == slots[i]);
+	}
+
+	// Shape 100 is used again, 101 is the oldest and makes room
+	CHECK(cache.Find(100) == slots[0]);
+	uint32_t slot = cache.Insert(999);
+	CHECK(slot == slots[1]);
+	CHECK(cache.Find(101) == CURSOR_CACHE_MISS);
+	CHECK(cache.Find(100) == slots[0]);
+	CHECK(cache.Find(999) == slot);
+
+	// The hash covers the pixels, the size and the hot spot
+	uint32_t pixels[4] = { 1, 2, 3, 4 };
+	uint64_t hash = CursorShapeHash(pixels, 2, 2, 0, 0);
+	CHECK(hash != CursorShapeHash(pixels, 4, 1, 0, 0));
+	CHECK(hash != CursorShapeHash(pixels, 2, 2, 1, 0));
+	pixels[3] = 5;
+	CHECK(hash != CursorShapeHash(pixels, 2, 2, 0, 0));
+}
+
+static void TestOverlay() {
+	CursorOverlay overlay {};
+	overlay.Initialize();
+
+	// An opaque 8x4 shape with its hot spot at 2, 1, partly left of the frame
+	uint32_t shape[8 * 4];
+	for(uint32_t i = 0; i < 8 * 4; ++i) {
+		shape[i] = 0xFF000000 | i;
+	}
+	std::vector<uint8_t> message(MAX_CURSOR_MESSAGE_SIZE);
+	CursorMessage header {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = CursorType::Shape,
+		.x = -3,
+		.y = 10,
+		.flags = CURSOR_FLAG_VISIBLE,
+		.slot = 5
+	};
+	CursorShape shape_header { .width = 8, .height = 4, .hot_x = 2, .hot_y = 1 };
+	shape_header.data_size = CursorCompress(shape, 8 * 4, message.data() + sizeof(header) + sizeof(shape_header));
+	memcpy(message.data(), &header, sizeof(header));
+	memcpy(message.data() + sizeof(header), &shape_header, sizeof(shape_header));
+	uint32_t message_size = sizeof(header) + sizeof(shape_header) + shape_header.data_size;
+	CHECK(overlay.Apply(message.data(), message_size));
+	CHECK(overlay.version.load(std::memory_order_relaxed) == 1);
+
+	// A truncated shape hides the cursor until the slot is sent again
+	CursorPlacement placement {
+		.frame_width = 100,
+		.frame_height = 50,
+		.rect_left = 0,
+		.rect_top = 0,
+		.rect_width = 100,
+		.rect_height = 50,
+		.image_width = 100,
+		.image_height = 50
+	};
+	CursorRect rect;
+	CHECK(!overlay.Apply(message.data(), message_size - 1));
+	CHECK(!overlay.Locate(placement, &rect));
+	CHECK(overlay.Apply(message.data(), message_size));
+
+	CHECK(overlay.Locate(placement, &rect));
+	CHECK(rect.x == 0 && rect.y == 10 && rect.width == 5 && rect.height == 4);
+	CHECK(rect.shape_x == 3 && rect.shape_y == 0);
+	std::vector<uint32_t> image(100 * 50, 0xFF808080);
+	overlay.Draw(rect, image.data() + rect.y * 100 + rect.x, 100);
+	CHECK(image[10 * 100 + 0] == (0xFF000000 | 3));
+	CHECK(image[13 * 100 + 4] == (0xFF000000 | (3 * 8 + 7)));
+	CHECK(image[10 * 100 + 5] == 0xFF808080);
+
+	// Letterboxed at half size, the hot spot at -1, 11 lands on 9.5, 10.5
+	CursorPlacement scaled {
+		.frame_width = 100,
+		.frame_height = 50,
+		.rect_left = 10,
+		.rect_top = 5,
+		.rect_width = 50,
+		.rect_height = 25,
+		.image_width = 70,
+		.image_height = 35
+	};
+	CHECK(overlay.Locate(scaled, &rect));
+	CHECK(rect.x == 8 && rect.y == 9 && rect.width == 8 && rect.shape_x == 0);
+
+	// Positions refer to the cached slot, the cursor may be off the image,
+	// hidden or in a slot that was never sent
+	CursorMessage position {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = CursorType::Position,
+		.x = 200,
+		.y = 0,
+		.flags = CURSOR_FLAG_VISIBLE,
+		.slot = 5
+	};
+	CHECK(overlay.Apply(reinterpret_cast<uint8_t *>(&position), sizeof(position)));
+	CHECK(!overlay.Locate(placement, &rect));
+	position.x = 50;
+	position.flags = 0;
+	CHECK(overlay.Apply(reinterpret_cast<uint8_t *>(&position), sizeof(position)));
+	CHECK(!overlay.Locate(placement, &rect));
+	position.flags = CURSOR_FLAG_VISIBLE;
+	position.slot = 6;
+	CHECK(overlay.Apply(reinterpret_cast<uint8_t *>(&position), sizeof(position)));
+	CHECK(!overlay.Locate(placement, &rect));
+	position.slot = CURSOR_CACHE_SIZE;
+	CHECK(!overlay.Apply(reinterpret_cast<uint8_t *>(&position), sizeof(position)));
+
+	overlay.Shutdown();
+}
+
+int main() {
+	BlendInitialize();
+	std::mt19937 rng(1);
+	TestBlendExhaustive();
+	TestBlendRowLengths(&rng);
+	TestCompression(&rng);
+	TestCache();
+	TestOverlay();
+	return CheckResult();
+}
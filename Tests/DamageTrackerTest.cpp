@@ -0,0 +1,212 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "DamageTracker.h"
+
+// Snapping, merging and the capture history of the damage tracker, and that
+// the region and moves it collects always bring a copy of the last collected
+// frame up to date. A small desktop whose size is not a multiple of the
+// block size is painted and scrolled at random while a receiver's copy is
+// only updated from what the tracker reports
+
+constexpr uint32_t FRAME_WIDTH = 1920;
+constexpr uint32_t FRAME_HEIGHT = 1080;
+
+static DamageRect Rect(int32_t left, int32_t top, int32_t right, int32_t bottom) {
+	return DamageRect { .left = left, .top = top, .right = right, .bottom = bottom };
+}
+
+static bool Collect(DamageTracker *tracker, DamageRegion *region) {
+	DamageMoves moves;
+	return tracker->Collect(tracker->Commit(), region, &moves);
+}
+
+static void TestSnapping() {
+	DamageTracker tracker {};
+	tracker.Initialize(FRAME_WIDTH, FRAME_HEIGHT, 16, false);
+	DamageRegion region;
+
+	// The first collect is the whole frame, nothing changed after it
+	CHECK(Collect(&tracker, &region) && region.Covers(FRAME_WIDTH, FRAME_HEIGHT));
+	CHECK(!Collect(&tracker, &region) && region.count == 0);
+
+	// A move onto itself and rects outside the frame change nothing
+	tracker.AddMove(Rect(100, 100, 200, 200), 100, 100);
+	tracker.AddDirty(Rect(-50, -50, -1, -1));
+	tracker.AddDirty(Rect(FRAME_WIDTH + 1, 0, FRAME_WIDTH + 100, 10));
+	CHECK(!Collect(&tracker, &region));
+
+	// Grown to the block grid and clipped to a frame edge that is not on it
+	tracker.AddDirty(Rect(17, 17, 18, 18));
+	CHECK(Collect(&tracker, &region) && region.count == 1);
+	CHECK(region.rects[0].left == 16 && region.rects[0].top == 16);
+	CHECK(region.rects[0].right == 32 && region.rects[0].bottom == 32);
+	tracker.AddDirty(Rect(1910, 1075, 1920, 1080));
+	CHECK(Collect(&tracker, &region) && region.count == 1);
+	CHECK(region.rects[0].top == 1072 && region.rects[0].right == 1920 && region.rects[0].bottom == 1080);
+
+	// One byte per block in raster order
+	tracker.AddDirty(Rect(16, 32, 48, 40));
+	CHECK(Collect(&tracker, &region));
+	CHECK(tracker.BlockCount() == 120 * 68);
+	std::vector<int8_t> map(tracker.BlockCount());
+	tracker.FillBlockMap(region, 5, 0, map.data());
+	uint32_t damaged = 0;
+	for(int8_t value : map) {
+		damaged += value == 5 ? 1 : 0;
+	}
+	CHECK(damaged == 2 && map[2 * 120 + 1] == 5 && map[2 * 120 + 2] == 5);
+}
+
+static void TestHistory() {
+	DamageTracker tracker {};
+	tracker.Initialize(FRAME_WIDTH, FRAME_HEIGHT, 16, false);
+	DamageRegion region;
+	DamageMoves moves;
+	Collect(&tracker, &region);
+
+	// Captures the encoder skipped are merged into the next collect
+	tracker.AddDirty(Rect(0, 0, 10, 10));
+	tracker.Commit();
+	tracker.Commit();
+	tracker.AddDirty(Rect(500, 500, 510, 510));
+	CHECK(tracker.Collect(tracker.Commit(), &region, &moves) && region.count == 2);
+
+	// As many as the history holds are fine, one more is the whole frame
+	uint32_t sequence = 0;
+	for(uint32_t i = 0; i < DAMAGE_HISTORY; ++i) {
+		sequence = tracker.Commit();
+	}
+	CHECK(!tracker.Collect(sequence, &region, &moves));
+	for(uint32_t i = 0; i < DAMAGE_HISTORY + 1; ++i) {
+		sequence = tracker.Commit();
+	}
+	CHECK(tracker.Collect(sequence, &region, &moves) && region.Covers(FRAME_WIDTH, FRAME_HEIGHT));
+	CHECK(tracker.stats.overflows.load(std::memory_order_relaxed) == 1);
+	CHECK(!Collect(&tracker, &region));
+
+	tracker.Invalidate();
+	CHECK(Collect(&tracker, &region) && region.Covers(FRAME_WIDTH, FRAME_HEIGHT));
+
+	// Without keep_moves a move is dirty at its destination
+	tracker.AddMove(Rect(0, 32, 64, 64), 0, 0);
+	CHECK(tracker.Collect(tracker.Commit(), &region, &moves));
+	CHECK(moves.count == 0 && region.count == 1);
+	CHECK(region.rects[0].top == 32 && region.rects[0].bottom == 64);
+}
+
+// A small desktop of 32-bit pixels and what the tracker is told about it
+struct Desktop {
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint32_t> pixels;
+
+	void Fill(const DamageRect &rect, uint32_t value) {
+		for(int32_t y = rect.top; y < rect.bottom; ++y) {
+			for(int32_t x = rect.left; x < rect.right; ++x) {
+				pixels[y * width + x] = value;
+			}
+		}
+	}
+
+	// Source is read completely before anything is written, like a scroll
+	void Move(const DamageRect &destination, int32_t source_x, int32_t source_y) {
+		int32_t move_width = destination.right - destination.left;
+		std::vector<uint32_t> copy(move_width * (destination.bottom - destination.top));
+		for(int32_t y = 0; y < destination.bottom - destination.top; ++y) {
+			memcpy(&copy[y * move_width], &pixels[(source_y + y) * width + source_x], move_width * 4);
+		}
+		for(int32_t y = 0; y < destination.bottom - destination.top; ++y) {
+			memcpy(&pixels[(destination.top + y) * width + destination.left], &copy[y * move_width],
+				   move_width * 4);
+		}
+	}
+};
+
+static DamageRect RandomRect(std::mt19937 *rng, uint32_t width, uint32_t height) {
+	std::uniform_int_distribution<int32_t> x(0, width - 1);
+	std::uniform_int_distribution<int32_t> y(0, height - 1);
+	int32_t left = x(*rng);
+	int32_t top = y(*rng);
+	int32_t right = left + 1 + x(*rng) / 3;
+	int32_t bottom = top + 1 + y(*rng) / 3;
+	return Rect(left, top, right < static_cast<int32_t>(width) ? right : width,
+				bottom < static_cast<int32_t>(height) ? bottom : height);
+}
+
+static void TestReplay(uint32_t block_size, bool keep_moves, std::mt19937 *rng) {
+	constexpr uint32_t WIDTH = 328;
+	constexpr uint32_t HEIGHT = 200;
+	Desktop desktop { .width = WIDTH, .height = HEIGHT, .pixels = std::vector<uint32_t>(WIDTH * HEIGHT) };
+	Desktop receiver = desktop;
+	DamageTracker tracker {};
+	tracker.Initialize(WIDTH, HEIGHT, block_size, keep_moves);
+	DamageRegion region;
+	DamageMoves moves;
+	tracker.Collect(tracker.Commit(), &region, &moves);
+
+	uint32_t value = 1;
+	uint32_t mismatches = 0;
+	for(uint32_t frame = 0; frame < 2000; ++frame) {
+		// Up to three captures per collect, each with some moves and paint
+		uint32_t captures = (*rng)() % 3 + 1;
+		uint32_t sequence = 0;
+		for(uint32_t capture = 0; capture < captures; ++capture) {
+			uint32_t move_count = (*rng)() % 3;
+			for(uint32_t i = 0; i < move_count; ++i) {
+				DamageRect destination = RandomRect(rng, WIDTH, HEIGHT);
+				int32_t source_x = (*rng)() % (WIDTH - (destination.right - destination.left) + 1);
+				int32_t source_y = (*rng)() % (HEIGHT - (destination.bottom - destination.top) + 1);
+				desktop.Move(destination, source_x, source_y);
+				tracker.AddMove(destination, source_x, source_y);
+			}
+			uint32_t dirty_count = (*rng)() % 4;
+			for(uint32_t i = 0; i < dirty_count; ++i) {
+				DamageRect rect = RandomRect(rng, WIDTH, HEIGHT);
+				desktop.Fill(rect, value++);
+				tracker.AddDirty(rect);
+			}
+			sequence = tracker.Commit();
+		}
+
+		bool changed = tracker.Collect(sequence, &region, &moves);
+		CHECK(region.count <= MAX_DAMAGE_RECTS);
+		for(uint32_t i = 0; i < moves.count; ++i) {
+			const DamageMove &move = moves.moves[i];
+			receiver.Move(move.destination, move.source_x, move.source_y);
+		}
+		for(uint32_t i = 0; i < region.count; ++i) {
+			const DamageRect &rect = region.rects[i];
+			CHECK(rect.left >= 0 && rect.top >= 0);
+			CHECK(rect.right <= static_cast<int32_t>(WIDTH) && rect.bottom <= static_cast<int32_t>(HEIGHT));
+			for(int32_t y = rect.top; y < rect.bottom; ++y) {
+				memcpy(&receiver.pixels[y * WIDTH + rect.left], &desktop.pixels[y * WIDTH + rect.left],
+					   (rect.right - rect.left) * 4);
+			}
+		}
+		if(receiver.pixels != desktop.pixels) {
+			++mismatches;
+			receiver.pixels = desktop.pixels;
+		}
+		if(!changed) {
+			CHECK(region.count == 0 && moves.count == 0);
+		}
+	}
+	CHECK(mismatches == 0);
+	if(keep_moves) {
+		CHECK(tracker.stats.moves.load(std::memory_order_relaxed) != 0);
+	}
+}
+
+int main() {
+	std::mt19937 rng(1);
+	TestSnapping();
+	TestHistory();
+	for(uint32_t block_size : { 16u, 32u }) {
+		TestReplay(block_size, false, &rng);
+		TestReplay(block_size, true, &rng);
+	}
+	return CheckResult();
+}
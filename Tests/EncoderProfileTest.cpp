@@ -0,0 +1,151 @@
+#include <cstring>
+
+#include "Check.h"
+#include "EncoderProfile.h"
+
+// Builds the NVENC configuration for every profile from a made up preset
+// configuration and checks what each profile overrides and what it keeps
+
+static bool SameGuid(const GUID &a, const GUID &b) {
+	return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+// Roughly what the P7 preset returns, everything a profile may override set
+// to something it would not choose
+static NV_ENC_CONFIG PresetConfig() {
+	NV_ENC_CONFIG config {};
+	config.gopLength = 250;
+	config.frameIntervalP = 3;
+	config.rcParams.rateControlMode = NV_ENC_PARAMS_RC_VBR;
+	config.rcParams.multiPass = NV_ENC_TWO_PASS_FULL_RESOLUTION;
+	config.rcParams.averageBitRate = 1000000;
+	config.rcParams.enableLookahead = 1;
+	config.rcParams.lookaheadDepth = 16;
+	config.encodeCodecConfig.hevcConfig.idrPeriod = 250;
+	config.encodeCodecConfig.hevcConfig.maxCUSize = NV_ENC_HEVC_CUSIZE_AUTOSELECT;
+	return config;
+}
+
+static EncoderConfigInput Input(const GUID &codec_guid, uint32_t fps) {
+	return EncoderConfigInput {
+		.codec_guid = codec_guid,
+		.profile_guid = NV_ENC_HEVC_PROFILE_MAIN_GUID,
+		.width = 1920,
+		.height = 1080,
+		.fps = fps,
+		.async_encode = true,
+		.qp_map_mode = NV_ENC_QP_MAP_DELTA,
+		.preset_config = PresetConfig()
+	};
+}
+
+static void TestProfileLookup() {
+	for(const EncoderProfile &profile : ENCODER_PROFILES) {
+		CHECK(FindEncoderProfile(profile.name) == &profile);
+	}
+	CHECK(FindEncoderProfile(DEFAULT_ENCODER_PROFILE) != nullptr);
+	CHECK(FindEncoderProfile("no-such-profile") == nullptr);
+}
+
+static void TestUltraLowLatency() {
+	const EncoderProfile &profile = *FindEncoderProfile("ultra-low-latency");
+	EncoderConfigInput input = Input(NV_ENC_CODEC_HEVC_GUID, 60);
+	EncoderConfig output {};
+	BuildEncoderConfig(profile, input, &output);
+
+	const NV_ENC_INITIALIZE_PARAMS &init = output.init_params;
+	CHECK(init.encodeConfig == &output.config);
+	CHECK(SameGuid(init.encodeGUID, NV_ENC_CODEC_HEVC_GUID));
+	CHECK(SameGuid(init.presetGUID, profile.preset_guid));
+	CHECK(init.tuningInfo == NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY);
+	CHECK(init.encodeWidth == 1920 && init.encodeHeight == 1080);
+	CHECK(init.frameRateNum == 60 && init.frameRateDen == 1);
+	CHECK(init.enableEncodeAsync == 1);
+
+	// CBR with a one frame VBV, no lookahead and no reordering
+	const NV_ENC_RC_PARAMS &rc = output.config.rcParams;
+	uint32_t bitrate = static_cast<uint32_t>(1920.0 * 1080 * 60 * profile.bits_per_pixel);
+	CHECK(rc.rateControlMode == NV_ENC_PARAMS_RC_CBR);
+	CHECK(rc.multiPass == NV_ENC_MULTI_PASS_DISABLED);
+	CHECK(rc.averageBitRate == bitrate && rc.maxBitRate == bitrate);
+	CHECK(rc.vbvBufferSize == bitrate / 60);
+	CHECK(rc.vbvInitialDelay == rc.vbvBufferSize);
+	CHECK(rc.enableLookahead == 0 && rc.lookaheadDepth == 0);
+	CHECK(rc.zeroReorderDelay == 1);
+	CHECK(rc.qpMapMode == NV_ENC_QP_MAP_DELTA);
+	CHECK(output.config.frameIntervalP == 1);
+
+	// Infinite GOP, a refresh wave every 2 s spread over 250 ms
+	const NV_ENC_CONFIG_HEVC &hevc = output.config.encodeCodecConfig.hevcConfig;
+	CHECK(output.config.gopLength == NVENC_INFINITE_GOPLENGTH);
+	CHECK(hevc.idrPeriod == NVENC_INFINITE_GOPLENGTH);
+	CHECK(hevc.enableIntraRefresh == 1);
+	CHECK(hevc.intraRefreshPeriod == 120);
+	CHECK(hevc.intraRefreshCnt == 15);
+	// The damage QP map assumes 32x32 CTBs
+	CHECK(hevc.maxCUSize == NV_ENC_HEVC_CUSIZE_32x32);
+}
+
+static void TestH264() {
+	EncoderConfigInput input = Input(NV_ENC_CODEC_H264_GUID, 120);
+	input.preset_config.encodeCodecConfig.h264Config.idrPeriod = 250;
+	EncoderConfig output {};
+	BuildEncoderConfig(*FindEncoderProfile("ultra-low-latency"), input, &output);
+
+	const NV_ENC_CONFIG_H264 &h264 = output.config.encodeCodecConfig.h264Config;
+	CHECK(h264.idrPeriod == NVENC_INFINITE_GOPLENGTH);
+	CHECK(h264.enableIntraRefresh == 1);
+	CHECK(h264.intraRefreshPeriod == 240);
+	CHECK(h264.intraRefreshCnt == 30);
+}
+
+static void TestQualityKeepsPreset() {
+	EncoderConfigInput input = Input(NV_ENC_CODEC_HEVC_GUID, 60);
+	input.qp_map_mode = NV_ENC_QP_MAP_DISABLED;
+	EncoderConfig output {};
+	BuildEncoderConfig(*FindEncoderProfile("quality"), input, &output);
+
+	const NV_ENC_RC_PARAMS &rc = output.config.rcParams;
+	CHECK(rc.rateControlMode == NV_ENC_PARAMS_RC_VBR);
+	CHECK(rc.multiPass == NV_ENC_TWO_PASS_FULL_RESOLUTION);
+	CHECK(rc.averageBitRate == 1000000);
+	CHECK(rc.enableLookahead == 1 && rc.lookaheadDepth == 16);
+	CHECK(rc.qpMapMode == NV_ENC_QP_MAP_DISABLED);
+	CHECK(output.config.gopLength == 250);
+	CHECK(output.config.frameIntervalP == 3);
+
+	const NV_ENC_CONFIG_HEVC &hevc = output.config.encodeCodecConfig.hevcConfig;
+	CHECK(hevc.idrPeriod == 250);
+	CHECK(hevc.enableIntraRefresh == 0);
+	CHECK(hevc.intraRefreshPeriod == 0 && hevc.intraRefreshCnt == 0);
+	// Even a profile that keeps the preset encodes on the CTBs of the QP map
+	CHECK(hevc.maxCUSize == NV_ENC_HEVC_CUSIZE_32x32);
+}
+
+static void TestLowFrameRateRefresh() {
+	// At 1 fps the refresh wave is shorter than a frame, it still needs one
+	// frame and has to end before the next wave starts
+	EncoderConfig output {};
+	BuildEncoderConfig(*FindEncoderProfile("ultra-low-latency"), Input(NV_ENC_CODEC_HEVC_GUID, 1), &output);
+	const NV_ENC_CONFIG_HEVC &hevc = output.config.encodeCodecConfig.hevcConfig;
+	CHECK(hevc.intraRefreshPeriod == 2);
+	CHECK(hevc.intraRefreshCnt == 1);
+
+	for(uint32_t fps = 1; fps <= 240; ++fps) {
+		for(const EncoderProfile &profile : ENCODER_PROFILES) {
+			BuildEncoderConfig(profile, Input(NV_ENC_CODEC_HEVC_GUID, fps), &output);
+			if(hevc.enableIntraRefresh) {
+				CHECK(hevc.intraRefreshCnt >= 1 && hevc.intraRefreshCnt < hevc.intraRefreshPeriod);
+			}
+		}
+	}
+}
+
+int main() {
+	TestProfileLookup();
+	TestUltraLowLatency();
+	TestH264();
+	TestQualityKeepsPreset();
+	TestLowFrameRateRefresh();
+	return CheckResult();
+}
@@ -0,0 +1,352 @@
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "DamageTracker.h"
+#include "FrameRegions.h"
+
+// Parsing and applying frame regions, and scroll sequences replayed through
+// the damage tracker, WriteFrameRegions and the receiver's ApplyFrameRegions.
+// After every encode the receiver's retained frame has to equal the desktop,
+// and the area that had to be encoded is reported with and without copy rects
+
+constexpr uint32_t DESKTOP_WIDTH = 640;
+constexpr uint32_t DESKTOP_HEIGHT = 400;
+constexpr uint32_t DOCUMENT_HEIGHT = 4000;
+constexpr uint32_t REPLAY_FRAMES = 300;
+// Stands in for the parts of a decoded picture outside the dirty rects
+constexpr uint32_t STALE_PIXEL = 0xDEADBEEF;
+
+static void TestCopyRect(std::mt19937 *rng) {
+	// Every overlap direction against a copy through a temporary
+	constexpr uint32_t WIDTH = 97, HEIGHT = 61, STRIDE = 101;
+	uint32_t mismatches = 0;
+	for(uint32_t iteration = 0; iteration < 2000; ++iteration) {
+		std::vector<uint32_t> frame(STRIDE * HEIGHT);
+		for(uint32_t &pixel : frame) {
+			pixel = (*rng)();
+		}
+		CopyRect copy {};
+		copy.width = static_cast<uint16_t>((*rng)() % WIDTH + 1);
+		copy.height = static_cast<uint16_t>((*rng)() % HEIGHT + 1);
+		copy.x = static_cast<uint16_t>((*rng)() % (WIDTH - copy.width + 1));
+		copy.y = static_cast<uint16_t>((*rng)() % (HEIGHT - copy.height + 1));
+		// Often a few pixels away, the overlapping case
+		if(iteration % 2 == 0) {
+			int32_t source_x = copy.x + static_cast<int32_t>((*rng)() % 9) - 4;
+			int32_t source_y = copy.y + static_cast<int32_t>((*rng)() % 9) - 4;
+			bool x_fits = source_x >= 0 && source_x + copy.width <= static_cast<int32_t>(WIDTH);
+			bool y_fits = source_y >= 0 && source_y + copy.height <= static_cast<int32_t>(HEIGHT);
+			copy.source_x = static_cast<uint16_t>(x_fits ? source_x : copy.x);
+			copy.source_y = static_cast<uint16_t>(y_fits ? source_y : copy.y);
+		}
+		else {
+			copy.source_x = static_cast<uint16_t>((*rng)() % (WIDTH - copy.width + 1));
+			copy.source_y = static_cast<uint16_t>((*rng)() % (HEIGHT - copy.height + 1));
+		}
+
+		std::vector<uint32_t> expected = frame;
+		std::vector<uint32_t> moved(copy.width * copy.height);
+		for(uint32_t y = 0; y < copy.height; ++y) {
+			memcpy(&moved[y * copy.width], &frame[(copy.source_y + y) * STRIDE + copy.source_x], copy.width * 4);
+		}
+		for(uint32_t y = 0; y < copy.height; ++y) {
+			memcpy(&expected[(copy.y + y) * STRIDE + copy.x], &moved[y * copy.width], copy.width * 4);
+		}
+		ApplyCopyRect(frame.data(), STRIDE, copy);
+		mismatches += frame != expected ? 1 : 0;
+	}
+	CHECK(mismatches == 0);
+}
+
+static void TestDirtyRect() {
+	// Only the rect is taken, with each image's own stride
+	constexpr uint32_t WIDTH = 20, HEIGHT = 10, STRIDE = 24, DECODED_STRIDE = 32;
+	std::vector<uint32_t> frame(STRIDE * HEIGHT, 1);
+	std::vector<uint32_t> decoded(DECODED_STRIDE * HEIGHT);
+	for(uint32_t i = 0; i < decoded.size(); ++i) {
+		decoded[i] = 100 + i;
+	}
+	DirtyRect rect { .x = 3, .y = 2, .width = 5, .height = 4 };
+	ApplyDirtyRect(frame.data(), STRIDE, decoded.data(), DECODED_STRIDE, rect);
+	uint32_t mismatches = 0;
+	for(uint32_t y = 0; y < HEIGHT; ++y) {
+		for(uint32_t x = 0; x < STRIDE; ++x) {
+			bool inside = x >= 3 && x < 8 && y >= 2 && y < 6 && x < WIDTH;
+			uint32_t expected = inside ? decoded[y * DECODED_STRIDE + x] : 1;
+			mismatches += frame[y * STRIDE + x] != expected ? 1 : 0;
+		}
+	}
+	CHECK(mismatches == 0);
+}
+
+static void TestParse() {
+	uint8_t data[MAX_FRAME_REGIONS_SIZE];
+	DamageRegion region;
+	region.Clear();
+	region.Add(DamageRect { .left = 0, .top = 0, .right = 16, .bottom = 16 });
+	DamageMoves moves;
+	moves.count = 1;
+	moves.moves[0] = DamageMove {
+		.destination = DamageRect { .left = 10, .top = 10, .right = 20, .bottom = 20 },
+		.source_x = 0,
+		.source_y = 0
+	};
+	uint32_t size = WriteFrameRegions(region, moves, data);
+	CHECK(size == sizeof(FrameRegions) + sizeof(CopyRect) + sizeof(DirtyRect));
+	CHECK(ParseFrameRegions(data, size, 640, 480) == size);
+	// The encoded picture follows, more data than the regions is fine
+	CHECK(ParseFrameRegions(data, size + 100, 640, 480) == size);
+
+	// Truncated, a rect outside the frame, or more rects than allowed
+	CHECK(ParseFrameRegions(data, size - 1, 640, 480) == 0);
+	CHECK(ParseFrameRegions(data, 1, 640, 480) == 0);
+	CHECK(ParseFrameRegions(data, size, 15, 480) == 0);
+	CHECK(ParseFrameRegions(data, size, 640, 19) == 0);
+	FrameRegions *header = reinterpret_cast<FrameRegions *>(data);
+	CopyRect *copy = reinterpret_cast<CopyRect *>(header + 1);
+	copy->source_x = 631;
+	CHECK(ParseFrameRegions(data, size, 640, 480) == 0);
+	copy->source_x = 0;
+	copy->width = 0;
+	CHECK(ParseFrameRegions(data, size, 640, 480) == 0);
+	copy->width = 10;
+	DirtyRect *dirty = reinterpret_cast<DirtyRect *>(copy + 1);
+	dirty->height = 0xFFFF;
+	CHECK(ParseFrameRegions(data, size, 640, 480) == 0);
+	dirty->height = 16;
+	CHECK(ParseFrameRegions(data, size, 640, 480) == size);
+	header->copy_count = MAX_COPY_RECTS + 1;
+	CHECK(ParseFrameRegions(data, sizeof(data), 640, 480) == 0);
+	header->copy_count = 0;
+	header->dirty_count = MAX_DIRTY_RECTS + 1;
+	CHECK(ParseFrameRegions(data, sizeof(data), 640, 480) == 0);
+}
+
+// A desktop with a document window and what the tracker is told about it
+struct Desktop {
+	std::vector<uint32_t> pixels;
+	std::vector<uint32_t> document;
+	int32_t view_x;
+	int32_t view_y;
+	int32_t view_width;
+	int32_t view_height;
+	int32_t scroll;
+	std::vector<DamageMove> moves;
+	std::vector<DamageRect> dirty;
+
+	void Initialize(std::mt19937 *rng) {
+		view_x = 100;
+		view_y = 40;
+		view_width = 480;
+		view_height = 320;
+		scroll = 0;
+		pixels.resize(DESKTOP_WIDTH * DESKTOP_HEIGHT);
+		for(uint32_t y = 0; y < DESKTOP_HEIGHT; ++y) {
+			for(uint32_t x = 0; x < DESKTOP_WIDTH; ++x) {
+				pixels[y * DESKTOP_WIDTH + x] = 0xFF3060A0 + ((x / 64 + y / 64) & 1) * 0x101010;
+			}
+		}
+		// Lines of glyphs on white, no two lines alike
+		document.assign(view_width * DOCUMENT_HEIGHT, 0xFFFFFFFF);
+		for(uint32_t line = 0; line + 20 <= DOCUMENT_HEIGHT; line += 20) {
+			uint32_t length = (*rng)() % (view_width - 40);
+			for(uint32_t x = 20; x + 7 < 20 + length; x += 9) {
+				uint32_t pattern = (*rng)();
+				for(uint32_t gy = 3; gy < 16; ++gy) {
+					for(uint32_t gx = 0; gx < 7; ++gx) {
+						if((pattern >> ((gy * 7 + gx) % 32)) & 1) {
+							document[(line + gy) * view_width + x + gx] = 0xFF202020 + (pattern & 0x0F);
+						}
+					}
+				}
+			}
+		}
+		DrawView(0, view_height);
+	}
+
+	void DrawView(int32_t top, int32_t bottom) {
+		for(int32_t y = top; y < bottom; ++y) {
+			memcpy(&pixels[(view_y + y) * DESKTOP_WIDTH + view_x], &document[(scroll + y) * view_width],
+				   view_width * 4);
+		}
+	}
+
+	// Positive distance moves the content up. The screen content moves, then
+	// the strip it uncovered is drawn, as a capture reports it
+	void Scroll(int32_t distance) {
+		int32_t limit = static_cast<int32_t>(DOCUMENT_HEIGHT) - view_height;
+		distance = scroll + distance < 0 ? -scroll : scroll + distance > limit ? limit - scroll : distance;
+		if(distance == 0) {
+			return;
+		}
+		scroll += distance;
+		int32_t amount = distance > 0 ? distance : -distance;
+		if(amount >= view_height) {
+			DrawView(0, view_height);
+			dirty.push_back({ view_x, view_y, view_x + view_width, view_y + view_height });
+			return;
+		}
+		int32_t kept = view_height - amount;
+		int32_t destination_top = distance > 0 ? view_y : view_y + amount;
+		int32_t source_top = distance > 0 ? view_y + amount : view_y;
+		std::vector<uint32_t> moved(view_width * kept);
+		for(int32_t y = 0; y < kept; ++y) {
+			memcpy(&moved[y * view_width], &pixels[(source_top + y) * DESKTOP_WIDTH + view_x], view_width * 4);
+		}
+		for(int32_t y = 0; y < kept; ++y) {
+			memcpy(&pixels[(destination_top + y) * DESKTOP_WIDTH + view_x], &moved[y * view_width], view_width * 4);
+		}
+		moves.push_back({ { view_x, destination_top, view_x + view_width, destination_top + kept }, view_x,
+						  source_top });
+		int32_t strip_top = distance > 0 ? kept : 0;
+		DrawView(strip_top, strip_top + amount);
+		dirty.push_back({ view_x, view_y + strip_top, view_x + view_width, view_y + strip_top + amount });
+	}
+
+	// A caret or clock drawn on the screen only, the next scroll moves it
+	void Blink(std::mt19937 *rng, int32_t x, int32_t y, int32_t width, int32_t height) {
+		uint32_t color = (*rng)() | 0xFF000000;
+		for(int32_t row = y; row < y + height; ++row) {
+			for(int32_t column = x; column < x + width; ++column) {
+				pixels[row * DESKTOP_WIDTH + column] = color;
+			}
+		}
+		dirty.push_back({ x, y, x + width, y + height });
+	}
+
+	uint32_t Commit(DamageTracker *tracker) {
+		for(const DamageMove &move : moves) {
+			tracker->AddMove(move.destination, move.source_x, move.source_y);
+		}
+		for(const DamageRect &rect : dirty) {
+			tracker->AddDirty(rect);
+		}
+		moves.clear();
+		dirty.clear();
+		return tracker->Commit();
+	}
+};
+
+enum class ScrollKind {
+	// Mouse wheel notches
+	Wheel,
+	// Touchpad or smooth scrolling, a few pixels per frame
+	Smooth,
+	// Page down, more than the view holds
+	Page,
+	// All of them with a blinking caret and clock, and an encoder that skips captures
+	Mixed
+};
+
+struct ReplayCost {
+	uint64_t frames;
+	uint64_t encoded_pixels;
+	uint64_t region_bytes;
+};
+
+static ReplayCost Replay(ScrollKind kind, bool keep_moves) {
+	std::mt19937 rng(7 + static_cast<uint32_t>(kind));
+	Desktop desktop {};
+	desktop.Initialize(&rng);
+	DamageTracker tracker {};
+	tracker.Initialize(DESKTOP_WIDTH, DESKTOP_HEIGHT, 16, keep_moves);
+	std::vector<uint32_t> retained(DESKTOP_WIDTH * DESKTOP_HEIGHT);
+	std::vector<uint32_t> decoded(DESKTOP_WIDTH * DESKTOP_HEIGHT);
+	uint8_t data[MAX_FRAME_REGIONS_SIZE];
+	ReplayCost cost {};
+	uint32_t mismatches = 0;
+	int32_t direction = 1;
+	for(uint32_t frame = 0; frame < REPLAY_FRAMES; ++frame) {
+		if(frame != 0) {
+			constexpr int32_t MIXED_STEPS[] = { 8, 16, 48, 96, 350 };
+			int32_t step = kind == ScrollKind::Wheel ? 48 : kind == ScrollKind::Smooth ? 8 :
+						   kind == ScrollKind::Page ? 350 : MIXED_STEPS[rng() % 5];
+			int32_t target = desktop.scroll + step * direction;
+			if(target < 0 || target + desktop.view_height > static_cast<int32_t>(DOCUMENT_HEIGHT)) {
+				direction = -direction;
+			}
+			desktop.Scroll(step * direction);
+			if(kind == ScrollKind::Mixed) {
+				// A second scroll is a capture of its own, its moves follow the first one's paint
+				if(rng() % 16 == 0) {
+					desktop.Commit(&tracker);
+					desktop.Scroll(-step * direction);
+				}
+				if(rng() % 4 == 0) {
+					desktop.Blink(&rng, desktop.view_x + rng() % (desktop.view_width - 2),
+								  desktop.view_y + rng() % (desktop.view_height - 16), 2, 16);
+				}
+				if(rng() % 8 == 0) {
+					desktop.Blink(&rng, 560, 380, 60, 14);
+				}
+			}
+		}
+		uint32_t sequence = desktop.Commit(&tracker);
+		if(kind == ScrollKind::Mixed && frame != REPLAY_FRAMES - 1 && rng() % 3 == 0) {
+			continue;
+		}
+
+		DamageRegion region;
+		DamageMoves moves;
+		if(!tracker.Collect(sequence, &region, &moves)) {
+			continue;
+		}
+		++cost.frames;
+		cost.encoded_pixels += region.Area();
+
+		// The decoded picture is only current inside the dirty rects
+		std::fill(decoded.begin(), decoded.end(), STALE_PIXEL);
+		for(uint32_t i = 0; i < region.count; ++i) {
+			const DamageRect &rect = region.rects[i];
+			for(int32_t y = rect.top; y < rect.bottom; ++y) {
+				memcpy(&decoded[y * DESKTOP_WIDTH + rect.left], &desktop.pixels[y * DESKTOP_WIDTH + rect.left],
+					   (rect.right - rect.left) * 4);
+			}
+		}
+		if(region.Covers(DESKTOP_WIDTH, DESKTOP_HEIGHT)) {
+			// Sent without regions, the picture replaces the retained frame
+			retained = desktop.pixels;
+		}
+		else {
+			uint32_t size = WriteFrameRegions(region, moves, data);
+			cost.region_bytes += size;
+			CHECK(ParseFrameRegions(data, size, DESKTOP_WIDTH, DESKTOP_HEIGHT) == size);
+			ApplyFrameRegions(reinterpret_cast<const FrameRegions *>(data), retained.data(), DESKTOP_WIDTH,
+							  region.count != 0 ? decoded.data() : nullptr, DESKTOP_WIDTH);
+		}
+		if(retained != desktop.pixels) {
+			++mismatches;
+			retained = desktop.pixels;
+		}
+	}
+	CHECK(mismatches == 0);
+	return cost;
+}
+
+int main() {
+	std::mt19937 rng(1);
+	TestCopyRect(&rng);
+	TestDirtyRect();
+	TestParse();
+
+	constexpr ScrollKind KINDS[] = { ScrollKind::Wheel, ScrollKind::Smooth, ScrollKind::Page, ScrollKind::Mixed };
+	constexpr const char *KIND_NAMES[] = { "wheel 48 px", "smooth 8 px", "page 350 px", "mixed" };
+	for(uint32_t i = 0; i < 4; ++i) {
+		ReplayCost dirty = Replay(KINDS[i], false);
+		ReplayCost copies = Replay(KINDS[i], true);
+		double frame_pixels = static_cast<double>(DESKTOP_WIDTH) * DESKTOP_HEIGHT;
+		double dirty_share = dirty.frames ? dirty.encoded_pixels / frame_pixels / dirty.frames : 0.0;
+		double copies_share = copies.frames ? copies.encoded_pixels / frame_pixels / copies.frames : 0.0;
+		printf("%-12s %5.1f%% of the frame encoded, %5.1f%% with copy rects, %5.1f region bytes per frame\n",
+			   KIND_NAMES[i], 100.0 * dirty_share, 100.0 * copies_share,
+			   copies.frames ? static_cast<double>(copies.region_bytes) / copies.frames : 0.0);
+		// Scrolling less than the view keeps part of it
+		if(KINDS[i] != ScrollKind::Page) {
+			CHECK(copies.encoded_pixels < dirty.encoded_pixels);
+		}
+	}
+	return CheckResult();
+}
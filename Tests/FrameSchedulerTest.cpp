@@ -0,0 +1,68 @@
+#include <cstdio>
+
+#include "Check.h"
+#include "FrameScheduler.h"
+#include "Platform.h"
+
+// Paces a loop at the lowest and highest frame rate and checks that deadlines
+// are whole intervals apart, that they keep up with the clock without
+// drifting, that the calibrated spin threshold stays within its bounds and
+// that waiting costs a small share of a core. The CPU bound is loose, only a
+// scheduler that spins for a large part of each interval fails it
+
+constexpr uint32_t SCHEDULER_TEST_RUN_MS = 1000;
+constexpr uint32_t SCHEDULER_TEST_MAX_CPU_PERCENT = 10;
+
+static void TestRate(uint32_t fps) {
+	FrameScheduler scheduler {};
+	scheduler.Initialize(fps);
+	uint64_t frames = static_cast<uint64_t>(SCHEDULER_TEST_RUN_MS) * fps / 1000;
+	uint64_t start_ns = scheduler.Now();
+	uint64_t start_cpu_ns = PlatformThreadCpuTimeNs();
+	uint64_t first_deadline = scheduler.WaitForNextFrame();
+	uint64_t previous_deadline = first_deadline;
+	bool spaced = true;
+	bool bounded = true;
+	for(uint64_t i = 1; i < frames; ++i) {
+		uint64_t deadline = scheduler.WaitForNextFrame();
+		spaced = spaced && deadline > previous_deadline && (deadline - previous_deadline) % scheduler.interval_ns == 0;
+		bounded = bounded && scheduler.spin_threshold_ns >= scheduler.min_spin_threshold_ns &&
+				  scheduler.spin_threshold_ns <= scheduler.max_spin_threshold_ns;
+		previous_deadline = deadline;
+	}
+	uint64_t end_ns = scheduler.Now();
+	uint64_t cpu_ns = PlatformThreadCpuTimeNs() - start_cpu_ns;
+	uint64_t missed = scheduler.stats.missed_deadlines.load(std::memory_order_relaxed);
+
+	printf("%u fps: %.2f%% of a core, spin threshold %llu us, %llu missed deadlines\n", fps,
+		   100.0 * static_cast<double>(cpu_ns) / static_cast<double>(end_ns - start_ns),
+		   static_cast<unsigned long long>(scheduler.spin_threshold_ns / 1000),
+		   static_cast<unsigned long long>(missed));
+	scheduler.PrintStats();
+	CHECK(spaced);
+	CHECK(bounded);
+	// Missed deadlines are skipped, every other one was waited for
+	CHECK(previous_deadline - first_deadline == (frames - 1 + missed) * scheduler.interval_ns);
+	CHECK(end_ns >= previous_deadline);
+	CHECK(cpu_ns * 100 < (end_ns - start_ns) * SCHEDULER_TEST_MAX_CPU_PERCENT);
+	scheduler.Shutdown();
+}
+
+static void TestRateLimits() {
+	FrameScheduler scheduler {};
+	scheduler.Initialize(1);
+	CHECK(scheduler.interval_ns == 1000000000ull / MIN_FRAME_RATE);
+	scheduler.Shutdown();
+	scheduler.Initialize(1000);
+	CHECK(scheduler.interval_ns == 1000000000ull / MAX_FRAME_RATE);
+	CHECK(scheduler.max_spin_threshold_ns >= scheduler.min_spin_threshold_ns);
+	scheduler.Shutdown();
+}
+
+int main() {
+	TestRateLimits();
+	TestRate(MIN_FRAME_RATE);
+	TestRate(60);
+	TestRate(MAX_FRAME_RATE);
+	return CheckResult();
+}
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "LatencyHistogram.h"
+#include "Platform.h"
+
+// Every value has to land in the bucket whose range holds it, with buckets in
+// order and the value a bucket reports at most 1/32 above any value in it.
+// Percentiles of a known distribution have to be the bucket values of the
+// exact ones, and a report covers only what was recorded since the last one.
+// Prints what Record costs next to reading the clock, which it always follows
+
+constexpr uint32_t HISTOGRAM_TEST_RECORDS = 20000000;
+
+// Checks the bucket of value_ns against its neighbours
+static bool Bucketed(uint64_t value_ns) {
+	uint32_t index = LatencyBucketIndex(value_ns);
+	if(index == LATENCY_BUCKET_COUNT - 1) {
+		return value_ns > LatencyBucketValue(index - 1);
+	}
+	bool in_range = value_ns <= LatencyBucketValue(index) && (index == 0 || value_ns > LatencyBucketValue(index - 1));
+	// Reported as the largest value of the bucket
+	bool precise = (LatencyBucketValue(index) - value_ns) * LATENCY_SUB_BUCKET_COUNT <= value_ns;
+	return in_range && precise;
+}
+
+static void TestBuckets() {
+	bool bucketed = true;
+	for(uint64_t value = 0; value < 1u << 16; ++value) {
+		bucketed &= Bucketed(value);
+	}
+	// Both sides of every power of two and random values in between
+	std::mt19937_64 rng(1);
+	for(uint32_t bit = 1; bit < LATENCY_MAX_VALUE_BITS; ++bit) {
+		uint64_t power = 1ull << bit;
+		bucketed &= Bucketed(power - 1) && Bucketed(power) && Bucketed(power + 1);
+		for(uint32_t i = 0; i < 1000; ++i) {
+			bucketed &= Bucketed(power + rng() % power);
+		}
+	}
+	CHECK(bucketed);
+
+	bool ordered = true;
+	for(uint32_t i = 1; i < LATENCY_BUCKET_COUNT; ++i) {
+		ordered &= LatencyBucketValue(i) > LatencyBucketValue(i - 1);
+		ordered &= LatencyBucketIndex(LatencyBucketValue(i)) == i;
+	}
+	CHECK(ordered);
+	CHECK(LatencyBucketValue(LATENCY_BUCKET_COUNT - 1) == (1ull << LATENCY_MAX_VALUE_BITS) - 1);
+	CHECK(LatencyBucketIndex(1ull << LATENCY_MAX_VALUE_BITS) == LATENCY_BUCKET_COUNT - 1);
+	CHECK(LatencyBucketIndex(UINT64_MAX) == LATENCY_BUCKET_COUNT - 1);
+}
+
+static uint64_t Reported(uint64_t value_ns) {
+	return LatencyBucketValue(LatencyBucketIndex(value_ns));
+}
+
+static void TestPercentiles() {
+	LatencyHistogram histogram {};
+	// Recorded before the report starts, never part of it
+	histogram.Record(5000000000ull);
+	LatencyReport report {};
+	report.Initialize(nullptr);
+	report.Add("test", &histogram);
+
+	// 1 to 2000 us in shuffled order
+	std::vector<uint64_t> values;
+	for(uint64_t us = 1; us <= 2000; ++us) {
+		values.push_back(us * 1000);
+	}
+	std::shuffle(values.begin(), values.end(), std::mt19937(1));
+	for(uint64_t value : values) {
+		histogram.Record(value);
+	}
+	LatencySummary summary = report.Summarize(0);
+	CHECK(summary.count == 2000);
+	CHECK(summary.p50_ns == Reported(1000000));
+	CHECK(summary.p99_ns == Reported(1980000));
+	CHECK(summary.p999_ns == Reported(1998000));
+	CHECK(summary.max_ns == Reported(2000000));
+
+	// Nothing new
+	summary = report.Summarize(0);
+	CHECK(summary.count == 0 && summary.p50_ns == 0 && summary.max_ns == 0);
+
+	// One slow sample among a thousand fast ones shows in p99.9 but not in p99
+	for(uint32_t i = 0; i < 999; ++i) {
+		histogram.Record(100000);
+	}
+	histogram.Record(50000000);
+	summary = report.Summarize(0);
+	CHECK(summary.count == 1000);
+	CHECK(summary.p50_ns == Reported(100000) && summary.p99_ns == Reported(100000));
+	CHECK(summary.p999_ns == Reported(100000));
+	CHECK(summary.max_ns == Reported(50000000));
+	histogram.Record(50000000);
+	histogram.Record(100000);
+	summary = report.Summarize(0);
+	CHECK(summary.p50_ns == Reported(100000) && summary.p99_ns == Reported(50000000));
+	report.Shutdown();
+}
+
+static void MeasureOverhead() {
+	LatencyHistogram histogram {};
+	// Durations spread over a few hundred buckets, as real ones are
+	std::mt19937_64 rng(1);
+	std::vector<uint64_t> values(4096);
+	for(uint64_t &value : values) {
+		value = 1000 + rng() % 10000000;
+	}
+
+	uint64_t start_ns = PlatformTimestampNs();
+	for(uint32_t i = 0; i < HISTOGRAM_TEST_RECORDS; ++i) {
+		histogram.Record(values[i % values.size()]);
+	}
+	uint64_t record_ns = PlatformTimestampNs() - start_ns;
+
+	start_ns = PlatformTimestampNs();
+	for(uint32_t i = 0; i < HISTOGRAM_TEST_RECORDS; ++i) {
+		PlatformTimestampNs();
+	}
+	uint64_t clock_ns = PlatformTimestampNs() - start_ns;
+
+	uint64_t count = 0;
+	for(const std::atomic<uint64_t> &bucket : histogram.counts) {
+		count += bucket.load(std::memory_order_relaxed);
+	}
+	CHECK(count == HISTOGRAM_TEST_RECORDS);
+	printf("Record %.2f ns, reading the clock %.2f ns\n", static_cast<double>(record_ns) / HISTOGRAM_TEST_RECORDS,
+		   static_cast<double>(clock_ns) / HISTOGRAM_TEST_RECORDS);
+}
+
+int main() {
+	TestBuckets();
+	TestPercentiles();
+	MeasureOverhead();
+	return CheckResult();
+}
@@ -0,0 +1,108 @@
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "ColorConvert.h"
+#include "Nv12ToBgra.h"
+
+// The CUDA kernel of the decoder against ConvertNv12ToBgra byte for byte, at
+// odd and even sizes and pitches, every matrix and range, and every Y, U and
+// V. Built only where CMake finds a CUDA compiler, skipped without a device
+
+constexpr ColorMatrix COLOR_MATRICES[] = { ColorMatrix::Bt601, ColorMatrix::Bt709 };
+constexpr ColorRange COLOR_RANGES[] = { ColorRange::Limited, ColorRange::Full };
+// Exit code ctest reports as skipped
+constexpr int SKIPPED = 77;
+
+// Converts an NV12 frame laid out like a decoded picture, chroma after height
+// rows of luma, on the GPU and on the CPU, the number of differing pixels
+static uint32_t Compare(const std::vector<uint8_t> &frame, uint32_t pitch, uint32_t width, uint32_t height,
+						ColorMatrix matrix, ColorRange range) {
+	CUdeviceptr device_frame = 0, device_bgra = 0;
+	cuMemAlloc(&device_frame, frame.size());
+	cuMemAlloc(&device_bgra, static_cast<size_t>(width) * height * 4);
+	cuMemcpyHtoD(device_frame, frame.data(), frame.size());
+	ConvertNv12ToBgraDevice(device_frame, pitch, width, height, ColorYuvCoefficients(matrix, range), device_bgra);
+	std::vector<uint32_t> bgra(width * height);
+	CHECK(cuCtxSynchronize() == CUDA_SUCCESS);
+	cuMemcpyDtoH(bgra.data(), device_bgra, bgra.size() * 4);
+	cuMemFree(device_frame);
+	cuMemFree(device_bgra);
+
+	std::vector<uint32_t> expected(width * height);
+	ConvertNv12ToBgra(frame.data(), pitch, frame.data() + pitch * height, pitch, width, height, matrix, range,
+					  expected.data(), width, nullptr);
+	uint32_t mismatches = 0;
+	for(uint32_t i = 0; i < width * height; ++i) {
+		mismatches += bgra[i] != expected[i] ? 1 : 0;
+	}
+	return mismatches;
+}
+
+static void TestRandom(std::mt19937 *rng) {
+	constexpr uint32_t SIZES[][2] = { { 1, 1 }, { 2, 2 }, { 3, 5 }, { 7, 3 }, { 33, 7 }, { 100, 37 }, { 129, 130 },
+									  { 1920, 1080 } };
+	for(const uint32_t *size : SIZES) {
+		uint32_t width = size[0];
+		uint32_t height = size[1];
+		uint32_t pitch = (width + 1) / 2 * 2 + 6;
+		std::vector<uint8_t> frame(pitch * (height + (height + 1) / 2));
+		for(uint32_t i = 0; i < frame.size(); ++i) {
+			frame[i] = i % 5 == 0 ? ((*rng)() & 1 ? 255 : 0) : static_cast<uint8_t>((*rng)());
+		}
+		for(ColorMatrix matrix : COLOR_MATRICES) {
+			for(ColorRange range : COLOR_RANGES) {
+				CHECK(Compare(frame, pitch, width, height, matrix, range) == 0);
+			}
+		}
+	}
+}
+
+static void TestExhaustive() {
+	// One frame per U, Y is the column and V the row pair
+	constexpr uint32_t WIDTH = 256, HEIGHT = 512;
+	std::vector<uint8_t> frame(WIDTH * HEIGHT * 3 / 2);
+	for(uint32_t row = 0; row < HEIGHT; ++row) {
+		for(uint32_t column = 0; column < WIDTH; ++column) {
+			frame[row * WIDTH + column] = static_cast<uint8_t>(column);
+		}
+	}
+	uint8_t *uv = frame.data() + WIDTH * HEIGHT;
+	for(ColorMatrix matrix : COLOR_MATRICES) {
+		for(ColorRange range : COLOR_RANGES) {
+			uint32_t mismatches = 0;
+			for(uint32_t u = 0; u < 256; ++u) {
+				for(uint32_t pair = 0; pair < HEIGHT / 2; ++pair) {
+					for(uint32_t column = 0; column < WIDTH / 2; ++column) {
+						uv[pair * WIDTH + column * 2] = static_cast<uint8_t>(u);
+						uv[pair * WIDTH + column * 2 + 1] = static_cast<uint8_t>(pair);
+					}
+				}
+				mismatches += Compare(frame, WIDTH, WIDTH, HEIGHT, matrix, range);
+			}
+			CHECK(mismatches == 0);
+		}
+	}
+}
+
+int main() {
+	CUdevice device = 0;
+	int device_count = 0;
+	if(cuInit(0) != CUDA_SUCCESS || cuDeviceGetCount(&device_count) != CUDA_SUCCESS || device_count == 0) {
+		printf("No CUDA device, skipped\n");
+		return SKIPPED;
+	}
+	CUcontext context = nullptr;
+	cuDeviceGet(&device, 0);
+	if(cuCtxCreate(&context, 0, device) != CUDA_SUCCESS) {
+		printf("No CUDA context, skipped\n");
+		return SKIPPED;
+	}
+
+	ColorInitialize();
+	std::mt19937 rng(1);
+	TestRandom(&rng);
+	TestExhaustive();
+	cuCtxDestroy(context);
+	return CheckResult();
+}
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "GaloisField.h"
+#include "ReedSolomon.h"
+
+// Field arithmetic against its definition, every region kernel against the
+// scalar one, then round trips through the erasure code: encode, drop shards
+// and reconstruct, with every pattern of losses for small blocks and random
+// ones up to 128 + 128 shards. One loss more than there is parity for has to
+// be refused, and the block layout has to deal out every packet exactly once
+
+constexpr GfKernel GF_KERNELS[] = { GfKernel::Scalar, GfKernel::Ssse3, GfKernel::Avx2 };
+
+// Carry-less multiplication reduced by x^8 + x^4 + x^3 + x^2 + 1
+static uint8_t ReferenceMultiply(uint8_t a, uint8_t b) {
+	uint32_t product = 0;
+	for(uint32_t bit = 0; bit < 8; ++bit) {
+		if(b & (1u << bit)) {
+			product ^= static_cast<uint32_t>(a) << bit;
+		}
+	}
+	for(uint32_t bit = 15; bit >= 8; --bit) {
+		if(product & (1u << bit)) {
+			product ^= 0x11Du << (bit - 8);
+		}
+	}
+	return static_cast<uint8_t>(product);
+}
+
+static void TestField() {
+	bool multiply = true;
+	bool inverse = true;
+	for(uint32_t a = 0; a < 256; ++a) {
+		for(uint32_t b = 0; b < 256; ++b) {
+			multiply &= GfMultiply(static_cast<uint8_t>(a), static_cast<uint8_t>(b)) ==
+						ReferenceMultiply(static_cast<uint8_t>(a), static_cast<uint8_t>(b));
+		}
+		if(a != 0) {
+			inverse &= GfMultiply(static_cast<uint8_t>(a), GfInverse(static_cast<uint8_t>(a))) == 1;
+		}
+	}
+	CHECK(multiply);
+	CHECK(inverse);
+}
+
+static void TestKernels(std::mt19937 *rng) {
+	// Sizes around the 16 and 32 byte steps of the vector kernels
+	constexpr size_t SIZES[] = { 0, 1, 15, 16, 17, 31, 32, 33, 63, 100, 1200, 4097 };
+	GfKernel selected = GfSelectedKernel();
+	for(size_t size : SIZES) {
+		std::vector<uint8_t> source(size), destination(size);
+		for(uint8_t &byte : source) {
+			byte = static_cast<uint8_t>((*rng)());
+		}
+		for(uint8_t &byte : destination) {
+			byte = static_cast<uint8_t>((*rng)());
+		}
+		for(uint32_t c : { 0u, 1u, 2u, 0x53u, 0xFFu }) {
+			std::vector<uint8_t> product(size), sum(destination);
+			for(size_t i = 0; i < size; ++i) {
+				product[i] = ReferenceMultiply(source[i], static_cast<uint8_t>(c));
+				sum[i] ^= product[i];
+			}
+			for(GfKernel kernel : GF_KERNELS) {
+				if(!GfSelectKernel(kernel)) {
+					continue;
+				}
+				std::vector<uint8_t> multiplied(size, 0xCC), added(destination);
+				GfMultiplyRegion(multiplied.data(), source.data(), static_cast<uint8_t>(c), size);
+				GfMultiplyAddRegion(added.data(), source.data(), static_cast<uint8_t>(c), size);
+				CHECK(multiplied == product);
+				CHECK(added == sum);
+			}
+		}
+	}
+	GfSelectKernel(selected);
+}
+
+struct Block {
+	uint32_t data_count;
+	uint32_t parity_count;
+	uint32_t shard_size;
+	// Data shards followed by parity shards
+	std::vector<std::vector<uint8_t>> shards;
+	std::vector<std::vector<uint8_t>> original;
+	std::vector<uint8_t *> pointers;
+};
+
+static Block Encode(uint32_t data_count, uint32_t parity_count, uint32_t shard_size, std::mt19937 *rng) {
+	Block block {
+		.data_count = data_count,
+		.parity_count = parity_count,
+		.shard_size = shard_size
+	};
+	block.shards.assign(data_count + parity_count, std::vector<uint8_t>(shard_size));
+	for(uint32_t i = 0; i < data_count; ++i) {
+		for(uint8_t &byte : block.shards[i]) {
+			byte = static_cast<uint8_t>((*rng)());
+		}
+	}
+	for(std::vector<uint8_t> &shard : block.shards) {
+		block.pointers.push_back(shard.data());
+	}
+	ReedSolomonEncode(block.pointers.data(), data_count, block.pointers.data() + data_count, parity_count,
+					  shard_size);
+	block.original = block.shards;
+	return block;
+}
+
+// Overwrites the shards missing in present, reconstructs and checks the data
+static bool RoundTrip(Block *block, const std::vector<bool> &present) {
+	bool flags[MAX_FEC_DATA_SHARDS + MAX_FEC_PARITY_SHARDS];
+	for(uint32_t i = 0; i < block->data_count + block->parity_count; ++i) {
+		flags[i] = present[i];
+		if(!present[i]) {
+			memset(block->shards[i].data(), 0xEE, block->shard_size);
+		}
+	}
+	bool result = ReedSolomonReconstruct(block->pointers.data(), flags, block->data_count, block->parity_count,
+										 block->shard_size);
+	bool restored = true;
+	for(uint32_t i = 0; i < block->data_count; ++i) {
+		restored &= block->shards[i] == block->original[i];
+	}
+	for(uint32_t i = 0; i < block->data_count + block->parity_count; ++i) {
+		block->shards[i] = block->original[i];
+	}
+	return result && restored;
+}
+
+static void TestEveryLossPattern(std::mt19937 *rng) {
+	// Every subset of up to parity_count losses, and every one of one more
+	constexpr uint32_t BLOCKS[][2] = { { 1, 1 }, { 1, 3 }, { 4, 2 }, { 5, 3 }, { 8, 4 } };
+	for(const uint32_t *counts : BLOCKS) {
+		Block block = Encode(counts[0], counts[1], 37, rng);
+		uint32_t total = counts[0] + counts[1];
+		bool recovered = true;
+		bool refused = true;
+		for(uint32_t mask = 0; mask < (1u << total); ++mask) {
+			std::vector<bool> present(total);
+			uint32_t lost = 0;
+			for(uint32_t i = 0; i < total; ++i) {
+				present[i] = (mask & (1u << i)) == 0;
+				lost += present[i] ? 0 : 1;
+			}
+			if(lost <= counts[1]) {
+				recovered &= RoundTrip(&block, present);
+			}
+			else if(lost == counts[1] + 1) {
+				bool flags[MAX_FEC_DATA_SHARDS + MAX_FEC_PARITY_SHARDS];
+				for(uint32_t i = 0; i < total; ++i) {
+					flags[i] = present[i];
+				}
+				refused &= !ReedSolomonReconstruct(block.pointers.data(), flags, counts[0], counts[1], 37);
+				for(uint32_t i = 0; i < total; ++i) {
+					block.shards[i] = block.original[i];
+				}
+			}
+		}
+		CHECK(recovered);
+		CHECK(refused);
+	}
+}
+
+static void TestRandomLosses(std::mt19937 *rng) {
+	constexpr uint32_t BLOCKS[][3] = { { 32, 4, 1200 }, { 100, 28, 64 }, { 128, 128, 16 }, { 128, 1, 1200 },
+									   { 3, 100, 7 } };
+	GfKernel selected = GfSelectedKernel();
+	for(GfKernel kernel : GF_KERNELS) {
+		if(!GfSelectKernel(kernel)) {
+			continue;
+		}
+		for(const uint32_t *counts : BLOCKS) {
+			Block block = Encode(counts[0], counts[1], counts[2], rng);
+			uint32_t total = counts[0] + counts[1];
+			bool recovered = true;
+			for(uint32_t round = 0; round < 8; ++round) {
+				// Losses of up to parity_count shards, the last round all of them
+				uint32_t lost = round == 7 ? counts[1] : (*rng)() % (counts[1] + 1);
+				std::vector<uint32_t> order(total);
+				for(uint32_t i = 0; i < total; ++i) {
+					order[i] = i;
+				}
+				std::shuffle(order.begin(), order.end(), *rng);
+				std::vector<bool> present(total, true);
+				for(uint32_t i = 0; i < lost; ++i) {
+					present[order[i]] = false;
+				}
+				recovered &= RoundTrip(&block, present);
+			}
+			CHECK(recovered);
+		}
+	}
+	GfSelectKernel(selected);
+}
+
+static void TestBlockLayout() {
+	bool dealt = true;
+	for(uint32_t block_size = 1; block_size <= MAX_FEC_DATA_SHARDS; block_size += 7) {
+		for(uint32_t packet_count = 1; packet_count <= 1000; packet_count += 13) {
+			uint32_t block_count = FecBlockCount(packet_count, block_size);
+			uint32_t total = 0;
+			for(uint32_t block = 0; block < block_count; ++block) {
+				uint32_t data_count = FecBlockDataCount(packet_count, block_count, block);
+				dealt &= data_count >= 1 && data_count <= block_size;
+				dealt &= FecParityCount(data_count, block_size, 4) <= 4;
+				total += data_count;
+			}
+			dealt &= total == packet_count;
+		}
+	}
+	CHECK(dealt);
+	// A full block gets all of the parity, a short one proportionally less but at least one
+	CHECK(FecParityCount(32, 32, 4) == 4);
+	CHECK(FecParityCount(16, 32, 4) == 2);
+	CHECK(FecParityCount(1, 32, 4) == 1);
+}
+
+int main() {
+	GfInitialize();
+	std::mt19937 rng(1);
+	TestField();
+	TestKernels(&rng);
+	TestEveryLossPattern(&rng);
+	TestRandomLosses(&rng);
+	TestBlockLayout();
+	return CheckResult();
+}
@@ -0,0 +1,191 @@
+#include <cstdint>
+
+#include "Check.h"
+#include "RegistrationCache.h"
+
+// Drives the cache through a stub function list standing in for the driver,
+// which hands out handles and counts every call, and checks which calls a
+// sequence of maps and unmaps turns into
+
+struct StubDriver {
+	uint32_t registers;
+	uint32_t unregisters;
+	uint32_t maps;
+	uint32_t unmaps;
+	uintptr_t next_handle;
+	// Registered and mapped handles not yet released, a handle released twice
+	// or never handed out is an error
+	uint32_t live_registrations;
+	uint32_t live_mappings;
+	uint32_t errors;
+};
+
+static StubDriver driver;
+
+static NVENCSTATUS NVENCAPI StubRegister(void *, NV_ENC_REGISTER_RESOURCE *params) {
+	++driver.registers;
+	++driver.live_registrations;
+	params->registeredResource = reinterpret_cast<NV_ENC_REGISTERED_PTR>(++driver.next_handle);
+	return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI StubUnregister(void *, NV_ENC_REGISTERED_PTR registered) {
+	++driver.unregisters;
+	if(!registered || driver.live_registrations == 0) {
+		++driver.errors;
+		return NV_ENC_ERR_INVALID_PARAM;
+	}
+	--driver.live_registrations;
+	return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI StubMap(void *, NV_ENC_MAP_INPUT_RESOURCE *params) {
+	++driver.maps;
+	if(!params->registeredResource) {
+		++driver.errors;
+		return NV_ENC_ERR_INVALID_PARAM;
+	}
+	++driver.live_mappings;
+	params->mappedResource = reinterpret_cast<NV_ENC_INPUT_PTR>(++driver.next_handle);
+	return NV_ENC_SUCCESS;
+}
+
+static NVENCSTATUS NVENCAPI StubUnmap(void *, NV_ENC_INPUT_PTR mapped) {
+	++driver.unmaps;
+	if(!mapped || driver.live_mappings == 0) {
+		++driver.errors;
+		return NV_ENC_ERR_INVALID_PARAM;
+	}
+	--driver.live_mappings;
+	return NV_ENC_SUCCESS;
+}
+
+// Stand-ins for the capture textures, only their addresses are used
+static uint8_t surfaces[MAX_REGISTERED_RESOURCES + 1];
+
+static void MapAndUnmap(RegistrationCache *cache, uint32_t surface, uint32_t width = 1920, uint32_t height = 1080) {
+	cache->Map(&surfaces[surface], NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, width, height, NV_ENC_BUFFER_FORMAT_ARGB);
+	cache->Unmap(&surfaces[surface]);
+}
+
+static void TestHitsAndDeferredUnmaps(NV_ENCODE_API_FUNCTION_LIST *api) {
+	driver = {};
+	RegistrationCache cache {};
+	cache.Initialize(api, nullptr);
+
+	NV_ENC_MAP_INPUT_RESOURCE mapped = cache.Map(&surfaces[0], NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, 1920, 1080,
+												  NV_ENC_BUFFER_FORMAT_ARGB);
+	CHECK(mapped.mappedResource != nullptr);
+	CHECK(driver.registers == 1 && driver.maps == 1);
+
+	// Unmap only queues, the mapping thread unmaps on its next call
+	cache.Unmap(&surfaces[0]);
+	CHECK(driver.unmaps == 0);
+
+	cache.Map(&surfaces[0], NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, 1920, 1080, NV_ENC_BUFFER_FORMAT_ARGB);
+	CHECK(driver.unmaps == 1);
+	CHECK(driver.registers == 1 && driver.maps == 2);
+	CHECK(cache.hits.load(std::memory_order_relaxed) == 1);
+	CHECK(cache.misses.load(std::memory_order_relaxed) == 1);
+
+	// Evicting unmaps what is still mapped before unregistering
+	cache.Evict();
+	CHECK(cache.entry_count == 0);
+	CHECK(driver.live_mappings == 0 && driver.live_registrations == 0);
+	CHECK(driver.errors == 0);
+}
+
+static void TestLeastRecentlyUsedEviction(NV_ENCODE_API_FUNCTION_LIST *api) {
+	driver = {};
+	RegistrationCache cache {};
+	cache.Initialize(api, nullptr);
+
+	for(uint32_t i = 0; i < MAX_REGISTERED_RESOURCES; ++i) {
+		MapAndUnmap(&cache, i);
+	}
+	CHECK(driver.registers == MAX_REGISTERED_RESOURCES && driver.unregisters == 0);
+
+	// Surface 0 is used again, surface 1 becomes the oldest and makes room
+	MapAndUnmap(&cache, 0);
+	MapAndUnmap(&cache, MAX_REGISTERED_RESOURCES);
+	CHECK(driver.unregisters == 1);
+	CHECK(cache.entry_count == MAX_REGISTERED_RESOURCES);
+
+	uint64_t misses = cache.misses.load(std::memory_order_relaxed);
+	MapAndUnmap(&cache, 0);
+	CHECK(cache.misses.load(std::memory_order_relaxed) == misses);
+	MapAndUnmap(&cache, 1);
+	CHECK(cache.misses.load(std::memory_order_relaxed) == misses + 1);
+
+	cache.Shutdown();
+	CHECK(driver.live_mappings == 0 && driver.live_registrations == 0);
+	CHECK(driver.errors == 0);
+}
+
+static void TestReregistrationOnResize(NV_ENCODE_API_FUNCTION_LIST *api) {
+	driver = {};
+	RegistrationCache cache {};
+	cache.Initialize(api, nullptr);
+
+	MapAndUnmap(&cache, 0, 1920, 1080);
+	// Same texture pointer after a mode change, the old registration is stale
+	MapAndUnmap(&cache, 0, 2560, 1440);
+	CHECK(driver.registers == 2 && driver.unregisters == 1);
+	CHECK(cache.entry_count == 1);
+	CHECK(cache.entries[0].width == 2560 && cache.entries[0].height == 1440);
+
+	// A different format counts as a different shape as well
+	cache.Map(&surfaces[0], NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, 2560, 1440, NV_ENC_BUFFER_FORMAT_NV12);
+	CHECK(driver.registers == 3 && driver.unregisters == 2);
+	CHECK(cache.hits.load(std::memory_order_relaxed) == 0);
+
+	// Unmaps still queued when the cache is shut down are not lost
+	cache.Unmap(&surfaces[0]);
+	cache.Shutdown();
+	CHECK(driver.unmaps == driver.maps);
+	CHECK(driver.live_mappings == 0 && driver.live_registrations == 0);
+	CHECK(driver.errors == 0);
+}
+
+static void TestRequestedEviction(NV_ENCODE_API_FUNCTION_LIST *api) {
+	driver = {};
+	RegistrationCache cache {};
+	cache.Initialize(api, nullptr);
+
+	// Surface 0 stays mapped like a frame in flight
+	cache.Map(&surfaces[0], NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, 1920, 1080, NV_ENC_BUFFER_FORMAT_ARGB);
+	MapAndUnmap(&cache, 1);
+	cache.RequestEviction();
+	CHECK(driver.unregisters == 0);
+
+	// The next map evicts surface 1 and registers surface 1 again, surface 0
+	// keeps its mapping until the unmap comes through
+	MapAndUnmap(&cache, 1);
+	CHECK(driver.unregisters == 1 && driver.registers == 3);
+	CHECK(driver.unmaps == 1 && driver.live_mappings == 2);
+	cache.Unmap(&surfaces[0]);
+	MapAndUnmap(&cache, 0);
+	CHECK(driver.unregisters == 2 && driver.registers == 4);
+	CHECK(cache.entry_count == 2);
+	CHECK(cache.hits.load(std::memory_order_relaxed) == 0);
+
+	cache.Shutdown();
+	CHECK(driver.unmaps == driver.maps);
+	CHECK(driver.live_mappings == 0 && driver.live_registrations == 0);
+	CHECK(driver.errors == 0);
+}
+
+int main() {
+	NV_ENCODE_API_FUNCTION_LIST api {};
+	api.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+	api.nvEncRegisterResource = StubRegister;
+	api.nvEncUnregisterResource = StubUnregister;
+	api.nvEncMapInputResource = StubMap;
+	api.nvEncUnmapInputResource = StubUnmap;
+
+	TestHitsAndDeferredUnmaps(&api);
+	TestLeastRecentlyUsedEviction(&api);
+	TestReregistrationOnResize(&api);
+	TestRequestedEviction(&api);
+	return CheckResult();
+}
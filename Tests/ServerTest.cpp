@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "Client.h"
+#include "Platform.h"
+#include "Server.h"
+
+// Streams to a client over loopback while every shared frame is held, as if
+// all viewers were behind, and with a frame too large to allocate. Both have
+// to be dropped rather than dereference a missing buffer, and the viewer has
+// to skip up to the next keyframe, which the drop requests, since the
+// dropped frame breaks the ones after it. A dropped repeat needs no keyframe
+
+constexpr uint64_t SERVER_TEST_TIMEOUT_US = 5000000;
+constexpr uint32_t SERVER_TEST_FRAME_SIZE = 4096;
+
+// Counters of the frames the client received, until one with last or the timeout
+static std::vector<uint64_t> ReceiveUntil(Client *client, uint64_t last) {
+	std::vector<uint64_t> counters;
+	EncodedData frames[FRAME_QUEUE_SIZE];
+	uint64_t start = PlatformTimestamp();
+	while(PlatformTimestamp() - start < SERVER_TEST_TIMEOUT_US) {
+		uint32_t frame_count = client->PollData(frames, FRAME_QUEUE_SIZE);
+		for(uint32_t i = 0; i < frame_count; ++i) {
+			if(frames[i].result == EncodedDataResult::Abort) {
+				return counters;
+			}
+			uint64_t counter = 0;
+			if(frames[i].size >= sizeof(counter)) {
+				memcpy(&counter, frames[i].ptr, sizeof(counter));
+			}
+			counters.push_back(counter);
+			client->ReleaseData(frames[i]);
+		}
+		if(!counters.empty() && counters.back() == last) {
+			return counters;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return counters;
+}
+
+static bool Receives(Client *client, uint64_t last) {
+	std::vector<uint64_t> counters = ReceiveUntil(client, last);
+	return !counters.empty() && counters.back() == last;
+}
+
+static void Send(Server *server, uint8_t *payload, uint64_t counter, bool keyframe) {
+	memcpy(payload, &counter, sizeof(counter));
+	server->SendData(payload, SERVER_TEST_FRAME_SIZE, keyframe, nullptr, 0, PlatformTimestamp());
+}
+
+static void HoldFrames(Server *server, int32_t delta) {
+	for(SharedFrame &frame : server->frames) {
+		frame.references.fetch_add(static_cast<uint32_t>(delta), std::memory_order_relaxed);
+	}
+}
+
+int main() {
+	ServerOptions options {};
+	options.transport = Transport::Tcp;
+	options.adaptive_bitrate = false;
+	options.max_viewers = 1;
+	Server server {};
+	server.Initialize(64, 64, 0, Codec::Hevc, options);
+	Client client {};
+	client.Initialize("127.0.0.1");
+	client.Start(nullptr, nullptr);
+	uint8_t payload[SERVER_TEST_FRAME_SIZE] = {};
+
+	// Joins on a keyframe
+	uint64_t counter = 1;
+	uint64_t start = PlatformTimestamp();
+	while(!server.viewers[0].joined && PlatformTimestamp() - start < SERVER_TEST_TIMEOUT_US) {
+		Send(&server, payload, counter, true);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	CHECK(server.viewers[0].joined);
+	CHECK(Receives(&client, counter));
+
+	// No free shared frame
+	HoldFrames(&server, 1);
+	server.keyframe_requests.Due(PlatformTimestamp());
+	Send(&server, payload, 100, false);
+	HoldFrames(&server, -1);
+	CHECK(server.stats.frames_dropped.load(std::memory_order_relaxed) == 1);
+	CHECK(server.viewers[0].waiting_for_keyframe);
+	CHECK(server.keyframe_requests.pending.load(std::memory_order_relaxed));
+
+	// The frames up to the keyframe are skipped
+	Send(&server, payload, 101, false);
+	Send(&server, payload, 102, true);
+	std::vector<uint64_t> counters = ReceiveUntil(&client, 102);
+	CHECK(counters.size() == 1 && counters[0] == 102);
+	CHECK(!server.viewers[0].waiting_for_keyframe);
+
+	// Too large to allocate, the payload is never read
+	server.SendData(payload, UINT32_MAX, false, nullptr, 0, PlatformTimestamp());
+	CHECK(server.stats.frames_dropped.load(std::memory_order_relaxed) == 2);
+	CHECK(server.viewers[0].waiting_for_keyframe);
+	Send(&server, payload, 103, true);
+	CHECK(Receives(&client, 103));
+
+	// A repeat carries nothing the client needs, the stream goes on
+	HoldFrames(&server, 1);
+	server.SendData(nullptr, 0, false, nullptr, 0, PlatformTimestamp());
+	HoldFrames(&server, -1);
+	CHECK(server.stats.frames_dropped.load(std::memory_order_relaxed) == 3);
+	CHECK(!server.viewers[0].waiting_for_keyframe);
+	Send(&server, payload, 104, false);
+	CHECK(Receives(&client, 104));
+
+	client.Shutdown();
+	server.Shutdown();
+	return CheckResult();
+}
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <thread>
+
+#include "Check.h"
+#include "Platform.h"
+#include "Server.h"
+#include "Session.h"
+#include "SyntheticSource.h"
+
+// Runs a session against a source with a still desktop, which only ever has
+// one new frame, and checks that every viewer that joins still gets a
+// keyframe and that the session goes back to listening once it leaves
+
+// Generous for a loaded machine, the session polls once a second
+constexpr uint64_t SESSION_TEST_TIMEOUT_US = 5000000;
+constexpr uint32_t SESSION_TEST_FPS = 60;
+constexpr uint32_t SESSION_TEST_FRAME_SIZE = 16 * 1024;
+
+struct TestContext {
+	SyntheticSource *source;
+	Server *server;
+};
+
+static bool CaptureStage(void *user_data, uint32_t capture_index) {
+	return static_cast<TestContext *>(user_data)->source->Capture(capture_index);
+}
+
+static bool RepeatStage(void *user_data, uint32_t capture_index) {
+	TestContext *context = static_cast<TestContext *>(user_data);
+	return context->server->keyframe_requests.Pending(PlatformTimestamp()) &&
+		   context->source->RepeatCapture(capture_index);
+}
+
+static EncodedData EncodeStage(void *user_data, uint32_t capture_index, uint32_t output_index) {
+	TestContext *context = static_cast<TestContext *>(user_data);
+	if(context->server->keyframe_requests.Due(PlatformTimestamp())) {
+		context->source->ForceKeyframe();
+	}
+	return context->source->Encode(capture_index, output_index);
+}
+
+static bool SendStage(void *user_data, const EncodedData &data, uint64_t capture_timestamp_ns) {
+	return static_cast<TestContext *>(user_data)->server->SendData(data.ptr, data.size, data.keyframe, data.regions,
+																   data.regions_size, capture_timestamp_ns / 1000);
+}
+
+static void ReleaseStage(void *user_data, uint32_t output_index) {
+	static_cast<TestContext *>(user_data)->source->Release(output_index);
+}
+
+static bool WaitForState(Session *session, SessionState expected) {
+	uint64_t start = PlatformTimestamp();
+	while(session->state.load(std::memory_order_acquire) != expected) {
+		if(PlatformTimestamp() - start > SESSION_TEST_TIMEOUT_US) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return true;
+}
+
+// In SessionTestViewer.cpp, Client.h and Pipeline.h each have their own EncodedData
+uint32_t ReceiveKeyframe(uint64_t timeout_us);
+
+int main() {
+	SyntheticSource source {};
+	source.Initialize(1920, 1080, SESSION_TEST_FRAME_SIZE, 0, 0);
+	source.still = true;
+
+	ServerOptions options {};
+	options.transport = Transport::Tcp;
+	options.adaptive_bitrate = false;
+	options.max_viewers = 1;
+	Server server {};
+	server.Initialize(source.width, source.height, SESSION_TEST_FRAME_SIZE * 8 * SESSION_TEST_FPS, Codec::Hevc,
+					  options);
+
+	TestContext context { .source = &source, .server = &server };
+	PipelineStages stages {
+		.user_data = &context,
+		.capture = CaptureStage,
+		.repeat = RepeatStage,
+		.encode = EncodeStage,
+		.retrieve = nullptr,
+		.send = SendStage,
+		.release = ReleaseStage
+	};
+	Pipeline pipeline {};
+	Session session {};
+	session.Initialize(&pipeline, &server, stages, SESSION_TEST_FPS);
+	std::thread session_thread([&session] { session.Run(); });
+
+	CHECK(WaitForState(&session, SessionState::Listening));
+
+	// The first viewer may get the only new frame there is
+	CHECK(ReceiveKeyframe(SESSION_TEST_TIMEOUT_US) != 0);
+	CHECK(session.stats.streams.load(std::memory_order_relaxed) == 1);
+
+	// Nothing is sent after the keyframe, the session has to notice the
+	// viewer leaving without a failed send
+	CHECK(WaitForState(&session, SessionState::Listening));
+
+	// Nothing new is captured at all for the second viewer, its keyframe
+	// has to come from encoding the last capture again
+	uint64_t repeated = pipeline.stats.repeated.load(std::memory_order_relaxed);
+	CHECK(ReceiveKeyframe(SESSION_TEST_TIMEOUT_US) != 0);
+	CHECK(session.stats.streams.load(std::memory_order_relaxed) == 2);
+	CHECK(pipeline.stats.repeated.load(std::memory_order_relaxed) > repeated);
+	CHECK(WaitForState(&session, SessionState::Listening));
+
+	session.Stop();
+	session_thread.join();
+	CHECK(session.state.load(std::memory_order_acquire) == SessionState::Stopped);
+
+	server.Shutdown();
+	source.Shutdown();
+	return CheckResult();
+}
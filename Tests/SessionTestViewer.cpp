@@ -0,0 +1,30 @@
+#include <chrono>
+#include <thread>
+
+#include "Client.h"
+#include "Platform.h"
+
+// Connects a viewer and counts the keyframes it gets until the first one or
+// the timeout
+uint32_t ReceiveKeyframe(uint64_t timeout_us) {
+	Client client {};
+	client.Initialize("127.0.0.1");
+	client.Start(nullptr, nullptr);
+
+	uint32_t keyframes = 0;
+	EncodedData frames[FRAME_QUEUE_SIZE];
+	uint64_t start = PlatformTimestamp();
+	while(keyframes == 0 && PlatformTimestamp() - start < timeout_us) {
+		uint32_t frame_count = client.PollData(frames, FRAME_QUEUE_SIZE);
+		for(uint32_t i = 0; i < frame_count; ++i) {
+			if(frames[i].result == EncodedDataResult::Abort) {
+				continue;
+			}
+			keyframes += frames[i].keyframe ? 1 : 0;
+			client.ReleaseData(frames[i]);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	client.Shutdown();
+	return keyframes;
+}
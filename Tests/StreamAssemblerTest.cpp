@@ -0,0 +1,262 @@
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Check.h"
+#include "Client.h"
+#include "Platform.h"
+#include "StreamAssembler.h"
+
+// Chunked streams written to a loopback connection: a frame and messages of
+// several chunks interleaved, then malformed streams, each of which has to
+// close the connection without overrunning a buffer and give back the frame
+// it was receiving. The sender stays connected, so Closed comes from the
+// check rather than from the end of the stream. Last the client, which has
+// to drop the connection on malformed control and cursor messages
+
+struct Connection {
+	SocketHandle send_socket;
+	SocketHandle receive_socket;
+};
+
+static Connection Connect() {
+	SocketHandle listen_socket = NetListen("0");
+	char port[8];
+	snprintf(port, sizeof(port), "%u", NetLocalPort(listen_socket));
+	Connection connection {};
+	connection.receive_socket = NetConnect("127.0.0.1", port);
+	char address[NET_ADDRESS_SIZE];
+	connection.send_socket = NetAccept(listen_socket, address, sizeof(address));
+	NetClose(listen_socket);
+	return connection;
+}
+
+static void Disconnect(const Connection &connection) {
+	NetClose(connection.send_socket);
+	NetClose(connection.receive_socket);
+}
+
+// Appends a message as chunks of at most chunk_size bytes
+static void AppendMessage(std::vector<uint8_t> *stream, Channel channel, const void *data, uint32_t size,
+						  uint32_t chunk_size) {
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	uint32_t offset = 0;
+	do {
+		uint32_t count = size - offset < chunk_size ? size - offset : chunk_size;
+		ChunkHeader chunk {
+			.channel = channel,
+			.flags = static_cast<uint8_t>(offset + count == size ? CHUNK_FLAG_END : 0),
+			.size = static_cast<uint16_t>(count)
+		};
+		const uint8_t *header = reinterpret_cast<const uint8_t *>(&chunk);
+		stream->insert(stream->end(), header, header + sizeof(chunk));
+		stream->insert(stream->end(), bytes + offset, bytes + offset + count);
+		offset += count;
+	} while(offset < size);
+}
+
+static std::vector<uint8_t> Frame(uint32_t size, uint32_t magic) {
+	std::vector<uint8_t> frame(sizeof(DataHeader) + size);
+	DataHeader header {
+		.MAGIC = magic,
+		.size = size,
+		.sequence = 7
+	};
+	memcpy(frame.data(), &header, sizeof(header));
+	for(uint32_t i = 0; i < size; ++i) {
+		frame[sizeof(header) + i] = static_cast<uint8_t>(i * 31);
+	}
+	return frame;
+}
+
+static void TestValid() {
+	Connection connection = Connect();
+	FramePool pool {};
+	pool.Initialize();
+	StreamAssembler assembler {};
+	assembler.Initialize();
+
+	// A frame larger than a pool buffer, a control message in between its
+	// chunks and a cursor message split across chunks of its own
+	std::vector<uint8_t> frame = Frame(3 * 1024 * 1024 + 5, PROTOCOL_MAGIC);
+	ControlMessage control {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = ControlType::ClockSync
+	};
+	std::vector<uint8_t> cursor(MAX_CURSOR_MESSAGE_SIZE, 0x5A);
+	std::vector<uint8_t> stream;
+	AppendMessage(&stream, Channel::Video, frame.data(), MAX_CHUNK_PAYLOAD * 3, MAX_CHUNK_PAYLOAD);
+	AppendMessage(&stream, Channel::Control, &control, sizeof(control), 5);
+	AppendMessage(&stream, Channel::Video, frame.data() + MAX_CHUNK_PAYLOAD * 3,
+				  static_cast<uint32_t>(frame.size()) - MAX_CHUNK_PAYLOAD * 3, MAX_CHUNK_PAYLOAD);
+	AppendMessage(&stream, Channel::Cursor, cursor.data(), static_cast<uint32_t>(cursor.size()), 1000);
+	std::thread sender([&]() {
+		NetSendAll(connection.send_socket, stream.data(), static_cast<uint32_t>(stream.size()));
+	});
+
+	AssembledFrame assembled {};
+	CHECK(assembler.Receive(connection.receive_socket, pool, &assembled) == AssembleResult::Message);
+	CHECK(assembler.message_channel == Channel::Control && assembler.message_size == sizeof(control));
+	CHECK(assembler.Receive(connection.receive_socket, pool, &assembled) == AssembleResult::Frame);
+	CHECK(assembled.header.sequence == 7 && assembled.header.size == frame.size() - sizeof(DataHeader));
+	CHECK(memcmp(pool.buffers[assembled.index].ptr, frame.data() + sizeof(DataHeader), assembled.header.size) == 0);
+	pool.Release(assembled.index);
+	CHECK(assembler.Receive(connection.receive_socket, pool, &assembled) == AssembleResult::Message);
+	CHECK(assembler.message_channel == Channel::Cursor && assembler.message_size == cursor.size());
+	CHECK(memcmp(assembler.message, cursor.data(), cursor.size()) == 0);
+	sender.join();
+
+	Disconnect(connection);
+	assembler.Shutdown();
+	pool.Shutdown();
+}
+
+// Sends the stream and expects the assembler to close the connection with
+// every buffer back in the pool but held_mask
+static void ExpectClosed(const std::vector<uint8_t> &stream, uint32_t held_mask = 0) {
+	Connection connection = Connect();
+	FramePool pool {};
+	pool.Initialize();
+	pool.used_mask.store(held_mask, std::memory_order_relaxed);
+	StreamAssembler assembler {};
+	assembler.Initialize();
+	NetSendAll(connection.send_socket, stream.data(), static_cast<uint32_t>(stream.size()));
+
+	AssembledFrame assembled {};
+	CHECK(assembler.Receive(connection.receive_socket, pool, &assembled) == AssembleResult::Closed);
+	CHECK(pool.used_mask.load(std::memory_order_relaxed) == held_mask);
+
+	Disconnect(connection);
+	assembler.Shutdown();
+	pool.used_mask.store(0, std::memory_order_relaxed);
+	pool.Shutdown();
+}
+
+static void TestMalformed() {
+	std::vector<uint8_t> frame = Frame(MAX_CHUNK_PAYLOAD * 4, PROTOCOL_MAGIC);
+	std::vector<uint8_t> message(MAX_CURSOR_MESSAGE_SIZE + 1);
+
+	// A channel that does not exist, also in the middle of a frame
+	std::vector<uint8_t> stream;
+	AppendMessage(&stream, static_cast<Channel>(CHANNEL_COUNT), message.data(), 16, MAX_CHUNK_PAYLOAD);
+	ExpectClosed(stream);
+	stream.clear();
+	AppendMessage(&stream, Channel::Video, frame.data(), MAX_CHUNK_PAYLOAD, MAX_CHUNK_PAYLOAD);
+	AppendMessage(&stream, static_cast<Channel>(0xFF), message.data(), 16, MAX_CHUNK_PAYLOAD);
+	ExpectClosed(stream);
+
+	// Messages larger than their channel's buffer, in one or many chunks
+	stream.clear();
+	AppendMessage(&stream, Channel::Control, message.data(), MAX_CONTROL_MESSAGE_SIZE + 1, MAX_CHUNK_PAYLOAD);
+	ExpectClosed(stream);
+	stream.clear();
+	AppendMessage(&stream, Channel::Cursor, message.data(), MAX_CURSOR_MESSAGE_SIZE + 1, 1000);
+	ExpectClosed(stream);
+
+	// A frame header of another protocol
+	stream.clear();
+	std::vector<uint8_t> foreign = Frame(64, PROTOCOL_MAGIC + 1);
+	AppendMessage(&stream, Channel::Video, foreign.data(), static_cast<uint32_t>(foreign.size()), MAX_CHUNK_PAYLOAD);
+	ExpectClosed(stream);
+
+	// No buffer left for the frame
+	stream.clear();
+	AppendMessage(&stream, Channel::Video, frame.data(), static_cast<uint32_t>(frame.size()), MAX_CHUNK_PAYLOAD);
+	ExpectClosed(stream, (1u << FRAME_POOL_SIZE) - 1);
+}
+
+static void TestPoolGrowth() {
+	// Sizes that do not fit, including those that would wrap when rounded up
+	FramePool pool {};
+	pool.Initialize();
+	uint32_t index = pool.Acquire(0xFFFFFFFF);
+	if(index != INVALID_FRAME_INDEX) {
+		CHECK(pool.buffers[index].capacity >= 0xFFFFFFFF);
+		pool.Release(index);
+	}
+	CHECK(pool.used_mask.load(std::memory_order_relaxed) == 0);
+	index = pool.Acquire(100);
+	CHECK(index != INVALID_FRAME_INDEX && pool.buffers[index].capacity >= 100);
+	pool.Release(index);
+	pool.Shutdown();
+}
+
+// Connects a client on PORT, sends it the stream after the InitMessage and
+// returns what the client makes of each message in it
+static std::vector<EncodedDataResult> ClientResults(const std::vector<uint8_t> &stream, uint32_t message_count) {
+	SocketHandle listen_socket = NetListen(PORT);
+	SocketHandle send_socket = INVALID_SOCKET_HANDLE;
+	std::thread server([&]() {
+		char address[NET_ADDRESS_SIZE];
+		send_socket = NetAccept(listen_socket, address, sizeof(address));
+		InitMessage init_message {
+			.MAGIC = PROTOCOL_MAGIC,
+			.encoded_width = 64,
+			.encoded_height = 64,
+			.transport = Transport::Tcp
+		};
+		NetSendAll(send_socket, &init_message, sizeof(init_message));
+		NetSendAll(send_socket, stream.data(), static_cast<uint32_t>(stream.size()));
+	});
+	Client *client = new Client {};
+	client->Initialize("127.0.0.1");
+	server.join();
+	NetClose(listen_socket);
+
+	std::vector<EncodedDataResult> results;
+	for(uint32_t i = 0; i < message_count; ++i) {
+		results.push_back(client->ReceiveData().result);
+	}
+	NetClose(send_socket);
+	client->Shutdown();
+	delete client;
+	return results;
+}
+
+static void TestClientMessages() {
+	ControlMessage control {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = ControlType::Feedback
+	};
+	ControlMessage foreign_control {
+		.MAGIC = PROTOCOL_MAGIC + 1,
+		.type = ControlType::Feedback
+	};
+	CursorMessage cursor {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = CursorType::Position
+	};
+	CursorMessage bad_slot {
+		.MAGIC = PROTOCOL_MAGIC,
+		.type = CursorType::Position,
+		.slot = CURSOR_CACHE_SIZE
+	};
+
+	std::vector<uint8_t> stream;
+	AppendMessage(&stream, Channel::Control, &control, sizeof(control), MAX_CHUNK_PAYLOAD);
+	AppendMessage(&stream, Channel::Cursor, &cursor, sizeof(cursor), MAX_CHUNK_PAYLOAD);
+	AppendMessage(&stream, Channel::Control, &foreign_control, sizeof(foreign_control), MAX_CHUNK_PAYLOAD);
+	std::vector<EncodedDataResult> results = ClientResults(stream, 3);
+	CHECK(results[0] == EncodedDataResult::Pending && results[1] == EncodedDataResult::Pending);
+	CHECK(results[2] == EncodedDataResult::Abort);
+
+	stream.clear();
+	AppendMessage(&stream, Channel::Control, &control, sizeof(control) - 1, MAX_CHUNK_PAYLOAD);
+	CHECK(ClientResults(stream, 1)[0] == EncodedDataResult::Abort);
+	stream.clear();
+	AppendMessage(&stream, Channel::Cursor, &bad_slot, sizeof(bad_slot), MAX_CHUNK_PAYLOAD);
+	CHECK(ClientResults(stream, 1)[0] == EncodedDataResult::Abort);
+}
+
+int main() {
+	if(!NetStartup()) {
+		printf("Failed to initialize networking\n");
+		return 1;
+	}
+	TestValid();
+	TestMalformed();
+	TestPoolGrowth();
+	TestClientMessages();
+	NetCleanup();
+	return CheckResult();
+}
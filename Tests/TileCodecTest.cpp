@@ -0,0 +1,231 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "TileCodec.h"
+#include "TileDecoder.h"
+#include "TileEncoder.h"
+
+// Every hash kernel against the scalar one, the LZ compressor and tile coding
+// round trips at every tile mode and size, and frames from the tile encoder
+// decoded by the tile decoder, whole, partial and malformed
+
+constexpr TileKernel TILE_KERNELS[] = { TileKernel::Scalar, TileKernel::Sse41, TileKernel::Avx2, TileKernel::Neon };
+constexpr uint32_t FRAME_WIDTH = 500;
+constexpr uint32_t FRAME_HEIGHT = 300;
+
+static void TestHashKernels(std::mt19937 *rng) {
+	// Widths around each kernel's lane count and a stride wider than the block
+	constexpr uint32_t STRIDE = 80;
+	std::vector<uint32_t> pixels(STRIDE * TILE_SIZE);
+	for(uint32_t &pixel : pixels) {
+		pixel = (*rng)();
+	}
+	std::vector<uint64_t> expected;
+	TileSelectKernel(TileKernel::Scalar);
+	for(uint32_t width = 1; width <= TILE_SIZE; ++width) {
+		for(uint32_t height : { 1u, 2u, 7u, 63u, 64u }) {
+			expected.push_back(TileHash(pixels.data(), STRIDE, width, height));
+		}
+	}
+	for(TileKernel kernel : TILE_KERNELS) {
+		if(!TileSelectKernel(kernel)) {
+			printf("Tile %s not supported, skipped\n", TileKernelName(kernel));
+			continue;
+		}
+		uint32_t mismatches = 0;
+		uint32_t i = 0;
+		for(uint32_t width = 1; width <= TILE_SIZE; ++width) {
+			for(uint32_t height : { 1u, 2u, 7u, 63u, 64u }) {
+				mismatches += TileHash(pixels.data(), STRIDE, width, height) != expected[i++] ? 1 : 0;
+			}
+		}
+		CHECK(mismatches == 0);
+
+		// Pixels outside the block do not matter, one changed inside does
+		std::vector<uint32_t> changed = pixels;
+		changed[5 * STRIDE + 70] ^= 1;
+		CHECK(TileHash(changed.data(), STRIDE, TILE_SIZE, TILE_SIZE) == expected.back());
+		changed[5 * STRIDE + 30] ^= 0x100;
+		CHECK(TileHash(changed.data(), STRIDE, TILE_SIZE, TILE_SIZE) != expected.back());
+	}
+	TileInitialize();
+}
+
+static void TestLz(std::mt19937 *rng) {
+	constexpr uint32_t MAX_SIZE = TILE_SIZE * TILE_SIZE * 3;
+	TileScratch *scratch = new TileScratch;
+	std::vector<uint8_t> src(MAX_SIZE), data(TileLzCompressBound(MAX_SIZE)), result(MAX_SIZE);
+	uint32_t failures = 0;
+	for(uint32_t iteration = 0; iteration < 3000; ++iteration) {
+		// Small alphabets with copies of recent bytes, from incompressible to runs
+		uint32_t size = (*rng)() % (MAX_SIZE + 1);
+		uint32_t alphabet = (*rng)() % 256 + 1;
+		for(uint32_t i = 0; i < size; ++i) {
+			src[i] = i > 8 && (*rng)() % 4 == 0 ? src[i - 1 - (*rng)() % 8] : (*rng)() % alphabet;
+		}
+		uint32_t data_size = TileLzCompress(src.data(), size, data.data(), static_cast<uint32_t>(data.size()), scratch);
+		if(data_size == 0 || data_size > TileLzCompressBound(size) ||
+		   !TileLzDecompress(data.data(), data_size, result.data(), size) ||
+		   memcmp(src.data(), result.data(), size) != 0) {
+			++failures;
+			continue;
+		}
+		// One byte short or a different size is refused
+		if(TileLzDecompress(data.data(), data_size - 1, result.data(), size) ||
+		   (size != 0 && TileLzDecompress(data.data(), data_size, result.data(), size - 1))) {
+			++failures;
+		}
+		// Corrupted data may decode to anything but stays within dst
+		for(uint32_t i = 0; i < 4; ++i) {
+			data[(*rng)() % data_size] ^= static_cast<uint8_t>((*rng)() % 255 + 1);
+			TileLzDecompress(data.data(), data_size, result.data(), size);
+		}
+	}
+	CHECK(failures == 0);
+
+	// Too little room is reported rather than overrun
+	std::fill(src.begin(), src.end(), 7);
+	uint32_t data_size = TileLzCompress(src.data(), MAX_SIZE, data.data(), static_cast<uint32_t>(data.size()), scratch);
+	CHECK(data_size != 0 && data_size < MAX_SIZE / 100);
+	CHECK(TileLzCompress(src.data(), MAX_SIZE, data.data(), data_size - 1, scratch) == 0);
+	delete scratch;
+}
+
+// A tile with the given number of colors in short horizontal runs
+static void MakeTile(std::mt19937 *rng, uint32_t colors, uint32_t *pixels, uint32_t stride, uint32_t width,
+					 uint32_t height) {
+	uint32_t palette[256];
+	for(uint32_t i = 0; i < 256; ++i) {
+		palette[i] = (*rng)() | 0xFF000000;
+	}
+	for(uint32_t y = 0; y < height; ++y) {
+		for(uint32_t x = 0; x < width; ++x) {
+			bool repeat = x != 0 && (*rng)() % 4 != 0;
+			pixels[y * stride + x] = repeat ? pixels[y * stride + x - 1] :
+									 colors > 256 ? (*rng)() | 0xFF000000 : palette[(*rng)() % colors];
+		}
+	}
+}
+
+static void TestTileRoundTrip(std::mt19937 *rng) {
+	TileScratch *scratch = new TileScratch;
+	std::vector<uint8_t> data(MAX_TILE_RECORD_SIZE);
+	constexpr uint32_t STRIDE = TILE_SIZE + 3;
+	std::vector<uint32_t> pixels(STRIDE * TILE_SIZE), result(STRIDE * TILE_SIZE);
+	uint32_t failures = 0;
+	uint32_t modes[3] = {};
+	for(uint32_t iteration = 0; iteration < 3000; ++iteration) {
+		// Edge tiles are cut off, so any size up to TILE_SIZE
+		uint32_t width = iteration % 5 == 0 ? TILE_SIZE : (*rng)() % TILE_SIZE + 1;
+		uint32_t height = iteration % 7 == 0 ? TILE_SIZE : (*rng)() % TILE_SIZE + 1;
+		constexpr uint32_t COLORS[] = { 1, 2, 3, 4, 5, 16, 17, 1000 };
+		uint32_t colors = COLORS[iteration % 8];
+		MakeTile(rng, colors, pixels.data(), STRIDE, width, height);
+
+		uint32_t size = TileCompress(pixels.data(), STRIDE, width, height, iteration, data.data(), scratch);
+		TileRecord record;
+		memcpy(&record, data.data(), sizeof(record));
+		if(size > MAX_TILE_RECORD_SIZE || size != sizeof(record) + record.size || record.index != iteration) {
+			++failures;
+			continue;
+		}
+		modes[static_cast<uint32_t>(record.mode)] += 1;
+		std::fill(result.begin(), result.end(), 0);
+		if(!TileDecompress(record, data.data() + sizeof(record), result.data(), STRIDE, width, height, scratch)) {
+			++failures;
+			continue;
+		}
+		for(uint32_t y = 0; y < height; ++y) {
+			// Alpha is not sent, the receiver makes it opaque
+			for(uint32_t x = 0; x < width; ++x) {
+				failures += result[y * STRIDE + x] != (pixels[y * STRIDE + x] | 0xFF000000) ? 1 : 0;
+			}
+		}
+
+		// A truncated payload is refused
+		if(record.size != 0) {
+			record.size -= 1;
+			failures += TileDecompress(record, data.data() + sizeof(record), result.data(), STRIDE, width, height,
+									   scratch) ? 1 : 0;
+		}
+	}
+	CHECK(failures == 0);
+	CHECK(modes[static_cast<uint32_t>(TileMode::Fill)] != 0);
+	CHECK(modes[static_cast<uint32_t>(TileMode::Palette)] != 0);
+	CHECK(modes[static_cast<uint32_t>(TileMode::Raw)] != 0);
+
+	// A palette larger than allowed is refused
+	MakeTile(rng, 4, pixels.data(), STRIDE, TILE_SIZE, TILE_SIZE);
+	TileCompress(pixels.data(), STRIDE, TILE_SIZE, TILE_SIZE, 0, data.data(), scratch);
+	TileRecord record;
+	memcpy(&record, data.data(), sizeof(record));
+	CHECK(record.mode == TileMode::Palette);
+	record.palette_size = MAX_TILE_PALETTE + 1;
+	CHECK(!TileDecompress(record, data.data() + sizeof(record), result.data(), STRIDE, TILE_SIZE, TILE_SIZE, scratch));
+	delete scratch;
+}
+
+static void TestFrames(std::mt19937 *rng) {
+	TileEncoder encoder {};
+	encoder.Initialize(FRAME_WIDTH, FRAME_HEIGHT, 2);
+	TileDecoder decoder {};
+	decoder.Initialize(FRAME_WIDTH, FRAME_HEIGHT, 2);
+	CHECK(encoder.TileCount() == 8 * 5 && decoder.TileCount() == 8 * 5);
+
+	std::vector<uint32_t> frame(FRAME_WIDTH * FRAME_HEIGHT);
+	MakeTile(rng, 1000, frame.data(), FRAME_WIDTH, FRAME_WIDTH, FRAME_HEIGHT);
+	std::vector<int8_t> mask(encoder.TileCount());
+	uint32_t mismatches = 0;
+	for(uint32_t i = 0; i < 40; ++i) {
+		// A few small changes, the first frame is coded whole
+		std::fill(mask.begin(), mask.end(), 0);
+		uint32_t changes = i == 0 ? 0 : (*rng)() % 4;
+		for(uint32_t j = 0; j < changes; ++j) {
+			uint32_t x = (*rng)() % (FRAME_WIDTH - 10);
+			uint32_t y = (*rng)() % (FRAME_HEIGHT - 10);
+			MakeTile(rng, (*rng)() % 3 + 1, frame.data() + y * FRAME_WIDTH + x, FRAME_WIDTH, 10, 10);
+			for(uint32_t ty = y / TILE_SIZE; ty <= (y + 9) / TILE_SIZE; ++ty) {
+				for(uint32_t tx = x / TILE_SIZE; tx <= (x + 9) / TILE_SIZE; ++tx) {
+					mask[ty * encoder.columns + tx] = 1;
+				}
+			}
+		}
+		// Every other frame relies on the hashes alone
+		EncodedData data = encoder.Encode(frame.data(), FRAME_WIDTH, i % 2 ? mask.data() : nullptr, false, i % 2);
+		if(changes == 0 && i != 0) {
+			CHECK(data.size == 0);
+		}
+		if(data.size != 0) {
+			TileFrame header;
+			memcpy(&header, data.ptr, sizeof(header));
+			CHECK(i == 0 ? header.tile_count == encoder.TileCount() : header.tile_count <= changes * 4);
+			CHECK(decoder.Decode(data.ptr, data.size));
+		}
+		mismatches += memcmp(decoder.frame, frame.data(), frame.size() * 4) != 0 ? 1 : 0;
+	}
+	CHECK(mismatches == 0);
+
+	// A keyframe has every tile, malformed frames are refused
+	EncodedData data = encoder.Encode(frame.data(), FRAME_WIDTH, nullptr, true, 0);
+	std::vector<uint8_t> copy(static_cast<const uint8_t *>(data.ptr), static_cast<const uint8_t *>(data.ptr) + data.size);
+	CHECK(decoder.Decode(copy.data(), data.size));
+	CHECK(!decoder.Decode(copy.data(), data.size - 1));
+	CHECK(!decoder.Decode(copy.data(), 2));
+	TileFrame header { .tile_count = decoder.TileCount() + 1 };
+	memcpy(copy.data(), &header, sizeof(header));
+	CHECK(!decoder.Decode(copy.data(), data.size));
+	encoder.Shutdown();
+	decoder.Shutdown();
+}
+
+int main() {
+	TileInitialize();
+	std::mt19937 rng(1);
+	TestHashKernels(&rng);
+	TestLz(&rng);
+	TestTileRoundTrip(&rng);
+	TestFrames(&rng);
+	return CheckResult();
+}